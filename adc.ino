@@ -1,6 +1,7 @@
 // ---------- adc.ino ----------
 // ***THIS IS THE MAIN MEASUREMENT MODULE***
 // First, several classes are defined:
+//   struct ChannelBank (chbank) and its median3Int(), emaInt() kernels
 //   class filter3DBInt
 //   class AnalogChannelBase
 //   class AnalogChannel: public AnalogChannelBase
@@ -17,6 +18,7 @@
 //   char* getChannelName(int channel)
 //   void printChannelsRMS()
 //   int getChannelRMSInt(int channel)
+//   int getChannelInstInt(int channel)
 //   void setTestValue(int index, float value)
 //   void startCollectingWaveforms()
 //   boolean checkCollectingWaveforms()
@@ -73,6 +75,7 @@ const float AVG_ALPHA = 0.0591;         // This alpha is used in the AnalogChann
                                         // ( This alpha is applied in the absence of a do_alpha arg to setInstantaneousValInt() OR
                                         // if the do_alpha arg to setInstantaneousValInt() is true ) AND...
                                         // AVG_ALPHA has not been overriden it using the setAlpha() method - see initADCOffsets()
+                                        // The raw ADC channels (V1 ... IDC) can have their own alpha, median and low-pass stages: parm_adc_filt, see filter.ino
                                         
 const float DIFFCHANNEL_ALPHA = 0.274;  // This alpha is used by the *original* RPM channel (ac_freq1) and applied at 1000 Hz. (cw had this at 0.2)
                                         // In the AnalogDiffChannel class, this alpha filters out high frequency noise in the RPM *calculation*, then...
@@ -84,30 +87,7 @@ const float FREQCHANNEL_ALPHA = 0.036;  // This alpha is used by the *new* RPM c
                                         // the resulting RPM *measurement* is pushed to setInstantaneousValInt() where it is FILTERED AGAIN 
                                         // since do_alpha is explicitly set true. As above, there is a call to ac_freq.setAlpha() in initADCOffsets().
 
-// Attach names to each numbered channel
-const int L1_VOLTAGE = 0;
-const int L2_VOLTAGE = 1;
-const int L3_VOLTAGE = 2;
-const int DC_VOLTAGE = 3;
-const int LINE_VOLTAGE = 4;
-const int L1_CURRENT = 5;
-const int L2_CURRENT = 6;
-const int L3_CURRENT = 7;
-const int DC_CURRENT = 8;
-const int L1L2_VOLTAGE = 9;
-const int L2L3_VOLTAGE = 10;
-const int L3L1_VOLTAGE = 11;
-const int RPM = 12;
-const int WINDSPEED = 13;
-const int DUMP_LOAD_P = 14;
-const int RECT_TEMP = 15;
-const int AMBIENT_TEMP = 16;
-const int CONTROLLER_TEMP = 17;
-const int TAIL_POSITION = 18;
-const int WATT_HOURS = 19;
-const int HVDL_DUTY_CYCLE = 20;
-const int STATE = 21;             // controller state MUST be the last channel
-const int NUM_ADC_CHANNELS = 22;  // total # includes STATE //
+// Channel numbers (L1_VOLTAGE, ..., STATE) and NUM_ADC_CHANNELS are in channels.h, with each channel's name, units and format
 
 // Define voltage scale factors:
 // Vin goes through a 1M/4.7K divider, and we have 4095 counts per 3.3V, so...
@@ -155,6 +135,52 @@ float test_values[20];  // array used in place of real data if we're in test mod
 
 // BEGIN class definitions
 
+// The per-sample state of the 9 raw ADC channels (analog_channels[]) is kept in ONE channel bank, a structure of arrays,
+// instead of in each channel object between its 1 KB waveform[] arrays. readADCs() then touches a few adjacent cache-friendly
+// words per sample, and the kernels below are branchless (median3Int() and emaInt() compile to conditional selects, IT blocks).
+// Bank index = channel number (L1_VOLTAGE ... DC_CURRENT), so getChannelRMSInt() and getChannelInstInt() read it directly.
+#define CHBANK_SIZE 9
+static_assert(L1_VOLTAGE == 0 && DC_CURRENT == CHBANK_SIZE - 1, "adc.ino: the channel bank must hold channels 0 to DC_CURRENT");
+static_assert(FILT_NUM_CHANNELS == CHBANK_SIZE, "adc.ino: each channel bank slot needs a filter chain - see filter.h");
+
+struct ChannelBank {
+  int dc_offset[CHBANK_SIZE];     // added to the raw ADC count, non-zero for current channels - see initADCOffsets()
+  int scale_int[CHBANK_SIZE];     // _SCALE_FACTOR, 1024x actual
+  int alpha_int[CHBANK_SIZE];     // low-pass filter alpha, 1024x actual
+  int med0[CHBANK_SIZE];          // median window: oldest...
+  int med1[CHBANK_SIZE];
+  int med2[CHBANK_SIZE];          // ...newest
+  int inst[CHBANK_SIZE];          // 1024x actual, median-filtered, NOT time-averaged (was instantaneous_val_int)
+  int ema[CHBANK_SIZE];           // 1024x actual, median-filtered and low-pass filtered (was avg_val_int)
+  int raw[CHBANK_SIZE];           // last raw val, offset applied
+  uint8_t pin[CHBANK_SIZE];       // analogRead() channel
+};
+ChannelBank chbank;
+
+// Median of 3, branchless: max(min(a,b), min(max(a,b),c))
+inline int median3Int(int a, int b, int c) {
+  int lo = (a < b) ? a : b;
+  int hi = (a < b) ? b : a;
+  int m = (hi < c) ? hi : c;
+  return( (lo > m) ? lo : m );
+}
+
+// Integer EMA (RC low-pass) step. alpha_int is 1024x actual - see SIGNAL FILTERING NOTES above.
+inline int emaInt(int avg, int val, int alpha_int) {
+  return( ((alpha_int * val) + ((1024 - alpha_int) * avg)) >> 10 );
+}
+
+// Feed val (1024x actual) to bank channel i: shift it into the median window, then filter - see AnalogChannel::read()
+inline void sampleChannelBank(int i, int val, boolean do_median, boolean do_abs, boolean do_alpha) {
+  chbank.med0[i] = chbank.med1[i];
+  chbank.med1[i] = chbank.med2[i];
+  chbank.med2[i] = val;
+  int m = do_median ? median3Int(chbank.med0[i], chbank.med1[i], val) : val;
+  if (do_abs) m = abs(m);
+  chbank.inst[i] = m;
+  chbank.ema[i] = do_alpha ? emaInt(chbank.ema[i], m, chbank.alpha_int[i]) : m;
+}
+
 // This class implements a low-pass filter using integer arithmetic.
 class filter3DBInt {
   protected:
@@ -226,7 +252,7 @@ class AnalogChannelBase {
       if (do_abs) med_val_int = abs(med_val_int);
       
       if (do_alpha) {
-        avg_val_int = ((alpha_int * med_val_int) + ((int)(1024 - alpha_int) * (avg_val_int))) >> 10;  // result is >> 10 because alpha_int has been scaled by 1024x
+        avg_val_int = emaInt(avg_val_int, med_val_int, alpha_int);  // alpha_int has been scaled by 1024x
       } else {
         avg_val_int = med_val_int;
       }
@@ -266,19 +292,11 @@ class AnalogChannelBase {
       alpha_int = (int)(a * 1024.0);
     }
     
-    // This function returns a median val for the channel.
+    // This function returns the median of the channel's last 3 vals, including val_int.
     int getMedianValInt(int val_int) {
       vals_int[valsptr_int++] = val_int;
       if (valsptr_int >= 3) valsptr_int = 0;
-      if ( (vals_int[0] > vals_int[1]) && (vals_int[2] > vals_int[1]) ) {
-        if (vals_int[0] <= vals_int[2] ) {
-          return(vals_int[0]);
-        } else {
-          return(vals_int[2]);
-        }
-      } else {
-        return(vals_int[1]);
-      }
+      return( median3Int(vals_int[0], vals_int[1], vals_int[2]) );
     }
 };  // END class AnalogChannelBase
 
@@ -287,39 +305,72 @@ class AnalogChannelBase {
 // This is a class for 9 raw data analog channels: 3 AC voltages, DC voltage, Line Voltage, 3 AC currents, and DC current.
 // All analog inputs come into a 12-bit A/D converter, giving (theoretically) 12 bits (4096 points) of resolution. 
 // Each analog channel is processed by AnalogChannel class methods.
+// Its state is in chbank[bank], see struct ChannelBank above. The methods below HIDE the AnalogChannelBase methods of the same
+// name, so they must be called through an AnalogChannel (e.g., analog_channels[i]), NOT an AnalogChannelBase* (e.g., acs[]).
+// Use getChannelRMSInt() and getChannelInstInt() for any channel number.
 class AnalogChannel: public AnalogChannelBase {
   private:
-    int channel_num;
-    float scale;
-    int scale_int;
-    int raw_val;
+    int bank;  // chbank index = channel number
 
   public:
-    AnalogChannel(int num, float scale, char* channel_name): 
-                  channel_num(num), scale(scale), AnalogChannelBase(channel_name) {
+    AnalogChannel(int num, float scale, char* channel_name, int bank): 
+                  bank(bank), AnalogChannelBase(channel_name) {
                     
-      scale_int = (int)(scale * 1024);
+      chbank.pin[bank] = num;
+      chbank.scale_int[bank] = (int)(scale * 1024);
+      chbank.alpha_int[bank] = (int)(1024.0 * AVG_ALPHA);
     }
 
     // This function reads an analog channel.
     // analogRead() returns an int to which a DC offset is applied to get the channel raw value.
-    // Then, a 1024x scale factor, a median filter, NO rectification, and a low-pass filter are applied
-    // and the result is saved with setInstantaneousValInt().
+    // Then, a 1024x scale factor, a median filter, NO rectification, and a low-pass filter are applied.
+    // If parm_adc_filt gives the channel a filter chain, the chain replaces the median filter - see filter.ino
     void read() {
-      raw_val = dc_offset + analogRead(channel_num);                    // dc_offset is non-zero for *current* channels - see initADCOffsets() below
-      setInstantaneousValInt( (scale_int*raw_val), true, false, true);  // multiply channel value by scale_int (= 1024*scale), do median, DON'T rectify, do low-pass
-      waveform[waveform_ptr] = getInstantaneousValInt()/1024.;          // save actual val as float in waveform[] - see AnalogChannelBase class
-                                                                        // waveform_ptr increments when startCollectingWaveforms() is called - see below
+      int raw_val = chbank.dc_offset[bank] + analogRead(chbank.pin[bank]);  // dc_offset is non-zero for *current* channels - see initADCOffsets() below
+      chbank.raw[bank] = raw_val;
+      int val = chbank.scale_int[bank] * raw_val;                           // multiply by scale_int (= 1024*scale)
+      uint32_t gen = filt_gen;                                              // read ONCE, loop() may flip it
+      if ( !filt_cfg[gen & 1][bank].active ) {
+        sampleChannelBank(bank, val, true, false, true);                    // do median, DON'T rectify, do low-pass
+      } else if ( filterChainSample(bank, gen, &val) ) {                    // false = decimating, hold the last val
+        sampleChannelBank(bank, val, false, false, true);                   // chain did the median, DON'T rectify, do low-pass
+      }
+      waveform[waveform_ptr] = chbank.inst[bank]/1024.;                     // save actual val as float in waveform[] - see AnalogChannelBase class
+                                                                            // waveform_ptr increments when startCollectingWaveforms() is called - see below
+    }
+
+    void setInstantaneousValInt(int val_int) {
+      sampleChannelBank(bank, val_int, true, true, true);
+    }
+
+    void setInstantaneousValInt(int val_int, boolean do_median, boolean do_abs, boolean do_alpha) {
+      sampleChannelBank(bank, val_int, do_median, do_abs, do_alpha);
+    }
+
+    int getInstantaneousValInt() {
+      return( chbank.inst[bank] );
+    }
+
+    int getAvgValInt() {
+      return( chbank.ema[bank] );
+    }
+
+    void setDCOffset(int offset) {
+      chbank.dc_offset[bank] = offset;
+    }
+
+    void setAlpha(float a) {
+      chbank.alpha_int[bank] = (int)(a * 1024.0);
     }
     
     // This function gets the hardware channel number, used in analogRead().
     int getChannelNum() {
-      return(channel_num);
+      return( chbank.pin[bank] );
     }
 
     // This function returns the raw value.
     int getRawVal() {
-      return(raw_val);
+      return( chbank.raw[bank] );
     }
 };  // END class AnalogChannel
 
@@ -786,16 +837,17 @@ class PLLChannel: public AnalogChannelBase {
 
 // Create instances of the AnalogChannel class for each of 9 raw analog inputs.
 // These channel vals are scaled by the appropriate _SCALE_FACTOR arg *and* multiplied by 1024 when the read() method is called.
-AnalogChannel analog_channels[9] = {
-  AnalogChannel(ADC0, VOLTAGE_SCALE_FACTOR, "V1"), 
-  AnalogChannel(ADC1, VOLTAGE_SCALE_FACTOR, "V2"),
-  AnalogChannel(ADC2, VOLTAGE_SCALE_FACTOR, "V3"),
-  AnalogChannel(ADC3, VOLTAGE_SCALE_FACTOR, "VDC"),
-  AnalogChannel(ADC4, LINE_VOLTAGE_SCALE_FACTOR, "VL"),
-  AnalogChannel(ADC8, CURRENT_SCALE_FACTOR, "I1"),
-  AnalogChannel(ADC9, CURRENT_SCALE_FACTOR, "I2"),
-  AnalogChannel(ADC10, CURRENT_SCALE_FACTOR, "I3"),
-  AnalogChannel(ADC11, CURRENT_SCALE_FACTOR, "IDC")
+// The last arg is the chbank index, which MUST be the channel number - see struct ChannelBank.
+AnalogChannel analog_channels[CHBANK_SIZE] = {
+  AnalogChannel(ADC0, VOLTAGE_SCALE_FACTOR, "V1", L1_VOLTAGE), 
+  AnalogChannel(ADC1, VOLTAGE_SCALE_FACTOR, "V2", L2_VOLTAGE),
+  AnalogChannel(ADC2, VOLTAGE_SCALE_FACTOR, "V3", L3_VOLTAGE),
+  AnalogChannel(ADC3, VOLTAGE_SCALE_FACTOR, "VDC", DC_VOLTAGE),
+  AnalogChannel(ADC4, LINE_VOLTAGE_SCALE_FACTOR, "VL", LINE_VOLTAGE),
+  AnalogChannel(ADC8, CURRENT_SCALE_FACTOR, "I1", L1_CURRENT),
+  AnalogChannel(ADC9, CURRENT_SCALE_FACTOR, "I2", L2_CURRENT),
+  AnalogChannel(ADC10, CURRENT_SCALE_FACTOR, "I3", L3_CURRENT),
+  AnalogChannel(ADC11, CURRENT_SCALE_FACTOR, "IDC", DC_CURRENT)
   };
 
 // Create instances of the AnalogChannelBase class for these channels:
@@ -803,9 +855,9 @@ AnalogChannel analog_channels[9] = {
 // TO ADD A NEW CHANNEL:
 //   1. Create a new channel, ac_name("Name") here.
 //   2. Add the new channel to the acs[] array a bit below this.
-//   3. Assign the new channel a const name and value above, e.g., const int WATT_HOURS = 19
-//   4. Increase the NUM_ADC_CHANNELS const just after the above list of const channel name = val.
-//   5. Edit the web monitor and log file "channels" line to view the new channel.
+//   3. Assign the new channel a const name and value in channels.h, e.g., const int WATT_HOURS = 19
+//   4. Add the channel to ctl_chans[] in channels.h, at the same position as in acs[]. NUM_ADC_CHANNELS is its size.
+//   The SD, UDP and web outputs pick up the new channel from ctl_chans[].
 AnalogChannelBase ac_wind("WS");  // wind speed, 1024x actual
 AnalogChannelBase ac_Tr("Tr");    // rectifier temp, 1024x actual
 AnalogChannelBase ac_Ta("Ta");    // anemometer/ambient temp, 1024x actual
@@ -840,6 +892,7 @@ AnalogChannelBase* acs[] = { &analog_channels[0], &analog_channels[1], &analog_c
                              &analog_channels[6], &analog_channels[7], &analog_channels[8], 
                              &l1l2_diff, &l2l3_diff, &l3l1_diff, &ac_freq, &ac_wind, 
                              &ac_Pd, &ac_Tr, &ac_Ta, &ac_Tc, &ac_TP, &ac_Wh, &ac_DL };
+static_assert(sizeof(acs) / sizeof(acs[0]) == NUM_ADC_CHANNELS - 1, "adc.ino: acs[] must have a channel for every ctl_chans[] entry but STATE");
 
 // END class instantiations
 
@@ -884,30 +937,29 @@ void initADCOffsets() {
 // 8          A11      IDC
 // 9          voltage diff channels, WS channel, temperature channels, TP channel, other stuff...
 void readADCs() {
+  supv_adc_beats++;  // heartbeat, see supervisor.ino
   if (disable_adc) return;
   
   static int call_wind_energy = 0;
-  static int wind_Wh = 0;
   static int call_manage_stepper = 0;
   static int call_furlctl = 0;
   static int call_manage_furl1 = 0;
   static int adc_index = 0;
   float frequency = 0.0;
-  static int post_count = 0;
   boolean even_second = false;
   
   // EXACTLY ONCE PER SECOND... 
   // POST operating variables to server, start web activity, and do config cycles (less often).
-  if ( ++post_count >= SAMPLE_RATE_PER_SEC ) {      // SAMPLE_RATE_PER_SEC = 10000 (defined in wwe.ino)
+  if ( tickTimeSync() ) {                           // at each NTP-disciplined second, ~SAMPLE_RATE_PER_SEC ticks - see timesync.ino
     myunixtime++;                                   // increment myunixtime by 1 second
-    even_second = true;                             // "even" second means EXACTLY 1 second has passed... no stray usec
-    post_count = 0;                                 // rezero counter
+    even_second = true;                             // "even" second means 1 second has passed (to within the 0.5% slew)
     ledOn = !ledOn;                                 // toggle the LED boolean
     digitalWriteDirect(TIMER_LOOP_LED_PIN, ledOn);  // on 1s, off 1s, on 1s, off 1s, ...
     do_post = true;                                 // POST flag, used in wwe.ino if (do_post) {} 
   } else {
     even_second = false;
   }
+  subsecond_ticks = ts_usec / (SAMPLE_PERIOD_MICROS); // used to timestamp journal events - see journal.ino
 
   // NOTE: Unlike the following freq channels, there's no function for the *original* ac_freq1 channel to call below because that channel does not have
   //       a class of its own. Instead, it is managed within the L1L2 diff channel (see class AnalogDiffChannel) by calling l1l2_diff.CalcDiff(true). 
@@ -919,7 +971,8 @@ void readADCs() {
   //ac_pll.doPLL();             // see class PLLChannel ***WORKING***
 
   // Manage dump load at full ADC rate = 10000 Hz.
-  manageDumpLoad();
+  //   Not until Modbus is up: manageDumpLoad() reads and writes the Morningstars. Until then we're in SS1, alternator shorted - see boot.ino
+  if ( modbus_ok ) manageDumpLoad();
 
   // *******************************************************************************************************
   // * Divide the main 10000 Hz ADC timer into 10 time slots (adc_index==0 to 9), each running at 1000 Hz. *
@@ -1047,9 +1100,14 @@ void readADCs() {
     l2l3_diff.CalcDiff(false);
     l3l1_diff.CalcDiff(false);
 
+    // Judge each electrical cycle of the line-to-line waveforms for phase loss or a winding fault - see phasefault.ino
+    checkPhaseFault();
+
     // Process wind speed channel (WS)
-    // We're sending wind speed vals that are updated at only 1 Hz, to be filtered at 1000 Hz.
-    // As such, there will be about 1000 identical vals set before a new val appears, so the filters will have almost no effect on such low freq data.
+    // First assemble and parse any new Etesian data - see wind.ino. A new reading is published as soon as its line is complete.
+    // Wind speed vals are updated at the Etesian's rate (about 1 Hz or a bit faster), to be filtered at 1000 Hz.
+    // As such, there will be hundreds of identical vals set before a new val appears, so the filters will have almost no effect on such low freq data.
+    pollSerialWind();
     ac_wind.setInstantaneousValInt(windspeed_ms, true, true, true);  // m/s 1024x actual; DO median, DO rectify, DO low-pass
     
     // Process temperature channels (Tc, Ta, Tr)
@@ -1059,6 +1117,7 @@ void readADCs() {
     
     // Process tail position (TP) channel
     ac_TP.setInstantaneousValInt(motor.currentPosition(), false, false, false);  // usteps, NOT 1024x actual; DON'T median, DON'T rectify, DON'T low-pass
+    saveCheckpointTP(motor.currentPosition());                                   // TP survives a reset in the backup registers - see checkpoint.ino
 
     // Process dump load duty cycle (HVDL_DUTY_CYCLE) channel
     ac_DL.setInstantaneousValInt(dump_load_duty_cycle, false, false, false);  // integer percentage, NOT 1024x actual; DON'T median, DON'T rectify, DON'T low-pass
@@ -1080,6 +1139,9 @@ void readADCs() {
         collect_waveforms = false;
       }
     }
+
+    // Record the pre-trigger history and check the capture triggers - see capture.ino
+    captureSample();
   }  // END else (adc_index==9)
 
   // Increment adc_index, or reset adc_index to 0 if it reaches 9  
@@ -1104,19 +1166,14 @@ float *getChannelWaveformData(int channel) {
 
 
 char* getChannelName(int channel) {
-  if (channel == STATE) {
-    return("State");
-  } else {
-    return( acs[channel]->getName() );
-  }
+  return( (char*)ctl_chans[channel].name );  // see channels.h
 }
 
 
 void printChannelsRMS() {
   for (int i = 0; i < NUM_ADC_CHANNELS; i++) {
     if (i != STATE) {
-      float val = (float)getChannelRMSInt(i)/1024.0;
-      if (i == TAIL_POSITION) val = round(val * 2.97);  // Special hack to get tail position in deg, for which we stored the raw step count.
+      float val = (float)getChannelRMSInt(i) * ctl_chans[i].scale;  // actual val, e.g., TP in deg - see channels.h
       Serial << getChannelName(i) << "=" << val << " ";
       if (i == RPM) Serial << "(" << (val * ((float)parm_alt_poles.intVal()) / 60.0) << " Hz) ";  // parenthetically show RPM as Hz
     } else {  // executes when i == STATE. Assumes that "State" is the last channel! 
@@ -1144,6 +1201,8 @@ int getChannelRMSInt(int channel) {
 #else
   if (channel == STATE) {                  // if we want the controller state channel
     return( getControllerState() );         //   get controller state bitfield, 32-bit int
+  } else if (channel < CHBANK_SIZE) {       // if it's a raw ADC channel...
+    return( chbank.ema[channel] );          //   get channel val from the channel bank, 1024x actual
   } else {                                  // otherwise...
     return acs[channel]->getAvgValInt();    //   get channel val, 1024x actual
   }
@@ -1151,6 +1210,14 @@ int getChannelRMSInt(int channel) {
 }
 
 
+// This function returns a channel's instantaneous val (1024x actual), i.e., (possibly) median-filtered, (possibly) rectified,
+// but NOT time-averaged. Not for STATE.
+int getChannelInstInt(int channel) {
+  if (channel < CHBANK_SIZE) return( chbank.inst[channel] );  // raw ADC channel, from the channel bank
+  return( acs[channel]->getInstantaneousValInt() );
+}
+
+
 void setTestValue(int index, float value) {
   if (index < 14) {
     dbgPrint(1, "adc setTestValue(");
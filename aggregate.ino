@@ -0,0 +1,143 @@
+// ---------- aggregate.ino ----------
+// ROLLING AGGREGATES
+//
+// Everything used to leave the controller as raw 1-sec samples, so every dashboard query on the Data Server reprocessed
+//   millions of rows. Now the controller also keeps min, max, mean and standard deviation of each controller channel
+//   over 1-minute, 1-hour and 1-day windows, and emits ONE summary record per window when it ends:
+//   - to SD, one JSON line per record, in yyyymmdd.agg (the date the window started, local time)
+//   - via UDP to the Data Server (parm_udp_ip), port udp_remote_port_aggregate (58334)
+//   The windows in progress, and the last completed ones, are at <controllerIP>/agg.json - see aggCmd() in webserver.ino
+//
+// updateAggregates() is called once per second, in if(do_post){}, with the same samples that are posted (getChannelRMSInt()).
+// Memory is fixed: per window, per channel, min, max and Welford accumulators in INTEGER math (no float until a record is
+//   formatted):
+//     delta = x - mean;  mean += delta / n;  M2 += delta * (x - mean)      variance = M2 / (n - 1)
+//   x is the native val (usually 1024x actual). mean is kept with AGG_FRAC more fractional bits, so it doesn't drift
+//   from truncation; M2 is in native units squared, which a day of samples of any channel fits in 64 bits.
+// Windows are aligned to local time (parm_TZ_offset), like the SD file dates. STATE is a bitfield, so it isn't aggregated.
+//
+// Record format, vals in channel units, channels as in ctl_chans[] (see channels.h), e.g.:
+//   {"id":"<mac>","win":"1h","start":1660838400,"n":3600,"channels":["V1",...],"min":[...],"max":[...],"mean":[...],"sd":[...]}
+
+#define AGG_NUM_WINDOWS 3
+#define AGG_NUM_CHANNELS (NUM_ADC_CHANNELS - 1)    // all but STATE, which is the last channel
+#define AGG_FRAC 8                                 // extra fractional bits of the mean
+#define AGG_BUF_SIZE 1400                          // one record; fits in one UDP packet
+
+const uint32_t agg_window_sec[AGG_NUM_WINDOWS] = { 60, 3600, 86400 };
+const char* agg_window_name[AGG_NUM_WINDOWS] = { "1m", "1h", "1d" };
+
+struct AggStats {
+  int32_t min;
+  int32_t max;
+  int64_t mean_q;                                  // mean << AGG_FRAC
+  uint64_t m2;                                     // sum of squared deviations from the mean
+};
+
+struct AggWindow {
+  uint32_t start;                                  // local time the window started
+  uint32_t n;                                      // # samples, the same for every channel
+  AggStats stats[AGG_NUM_CHANNELS];
+};
+
+AggWindow agg_cur[AGG_NUM_WINDOWS];                // windows in progress
+AggWindow agg_last[AGG_NUM_WINDOWS];               // last completed windows, n = 0 if none yet
+char agg_buf[AGG_BUF_SIZE];
+
+
+// Add this second's sample of every channel to every window, closing any window that has ended. Called once per POST - see wwe.ino
+void updateAggregates() {
+  uint32_t now = myunixtime + parm_TZ_offset.intVal() * 3600;  // local time
+  int32_t x[AGG_NUM_CHANNELS];
+  for ( int i = 0; i < AGG_NUM_CHANNELS; i++ ) x[i] = getChannelRMSInt(i);
+
+  for ( int w = 0; w < AGG_NUM_WINDOWS; w++ ) {
+    AggWindow* win = &agg_cur[w];
+    uint32_t start = now - (now % agg_window_sec[w]);
+    if ( win->n > 0 && win->start != start ) {     // window ended (or the clock was set)
+      agg_last[w] = *win;
+      emitAggWindow(w);
+      win->n = 0;
+    }
+    if ( win->n == 0 ) win->start = start;
+
+    uint32_t n = ++win->n;
+    for ( int i = 0; i < AGG_NUM_CHANNELS; i++ ) {
+      AggStats* s = &win->stats[i];
+      int64_t x_q = (int64_t)x[i] << AGG_FRAC;
+      if ( n == 1 ) {
+        s->min = s->max = x[i];
+        s->mean_q = x_q;
+        s->m2 = 0;
+        continue;
+      }
+      if ( x[i] < s->min ) s->min = x[i];
+      if ( x[i] > s->max ) s->max = x[i];
+      int64_t delta = x_q - s->mean_q;
+      s->mean_q += delta / (int64_t)n;
+      s->m2 += (delta >> AGG_FRAC) * ((x_q - s->mean_q) >> AGG_FRAC);  // both deltas have the same sign, so this is >= 0
+    }
+  }
+}
+
+
+// Format window w (agg_last[w] if last, else agg_cur[w]) as a JSON record into agg_buf. Returns its length, 0 if it has no samples.
+int formatAggWindow(int w, boolean last) {
+  AggWindow* win = last ? &agg_last[w] : &agg_cur[w];
+  int len = 0;
+  if ( win->n == 0 ) return(0);
+
+  len += snprintf(agg_buf + len, AGG_BUF_SIZE - len, "{\"id\":\"%s\",\"win\":\"%s\",\"start\":%lu,\"n\":%lu,\"channels\":[",
+                  mac_chars, agg_window_name[w], (unsigned long)win->start, (unsigned long)win->n);
+  for ( int i = 0; i < AGG_NUM_CHANNELS && len < AGG_BUF_SIZE; i++ ) {
+    len += snprintf(agg_buf + len, AGG_BUF_SIZE - len, "%s\"%s\"", i ? "," : "", ctl_chans[i].name);
+  }
+  for ( int k = 0; k < 4 && len < AGG_BUF_SIZE; k++ ) {
+    len += snprintf(agg_buf + len, AGG_BUF_SIZE - len, "],\"%s\":[", k == 0 ? "min" : k == 1 ? "max" : k == 2 ? "mean" : "sd");
+    for ( int i = 0; i < AGG_NUM_CHANNELS && len < AGG_BUF_SIZE; i++ ) {
+      AggStats* s = &win->stats[i];
+      float val;
+      if ( k == 0 ) val = s->min;
+      else if ( k == 1 ) val = s->max;
+      else if ( k == 2 ) val = (float)s->mean_q / (1 << AGG_FRAC);
+      else val = (win->n > 1) ? sqrt((float)s->m2 / (win->n - 1)) : 0.0;
+      len += snprintf(agg_buf + len, AGG_BUF_SIZE - len, "%s%.*f", i ? "," : "", ctl_chans[i].decimals, val * ctl_chans[i].scale);
+    }
+  }
+  if ( len < AGG_BUF_SIZE ) len += snprintf(agg_buf + len, AGG_BUF_SIZE - len, "]}");
+  if ( len >= AGG_BUF_SIZE ) {
+    Serial << "aggregate: Record > " << AGG_BUF_SIZE << " bytes, truncated\n";
+    return(0);
+  }
+  return(len);
+}
+
+
+// Write the record of window w, which just ended, to SD and send it to the Data Server
+void emitAggWindow(int w) {
+  int len = formatAggWindow(w, true);
+  if ( len == 0 ) return;
+
+  if ( SD_ok ) {
+    char fname[] = "yyyymmdd.agg";
+    time_t t = agg_last[w].start;
+    sprintf(fname, "%04d%02d%02d.agg", year(t), month(t), day(t));
+    File sdfile;
+    if ( sdfile = SD.open(fname, O_CREAT | O_APPEND | O_WRITE) ) {
+      sdfile.println(agg_buf);
+      sdfile.close();
+    } else {
+      Serial << "aggregate: Error opening " << fname << "\n";
+    }
+  }
+
+  int a, b, c, d;
+  if ( ethernet_up && sscanf(parm_udp_ip.parmVal(), "%d.%d.%d.%d", &a, &b, &c, &d) == 4 ) {
+    uint8_t ip[4] = { (uint8_t)a, (uint8_t)b, (uint8_t)c, (uint8_t)d };
+    statusudp.beginPacket(ip, udp_remote_port_aggregate);
+    statusudp.write((uint8_t*)agg_buf, len);
+    statusudp.endPacket();
+  }
+  Serial << "aggregate: " << agg_window_name[w] << " window " << agg_last[w].start << " closed, n = " << agg_last[w].n
+         << ", " << len << " bytes\n";
+}
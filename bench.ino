@@ -0,0 +1,145 @@
+// ---------- bench.ino ----------
+// HOT KERNEL MICROBENCHMARKS (on-target, DWT cycle counts)
+//
+// Build with #define ENABLE_BENCH in wwe.ino. setup() then calls runBenchmarks() BEFORE the timers start, so readADCs()
+//   and the stepper interrupt can't preempt a kernel or change its state. The results go to Serial; the controller then
+//   boots as usual. This is a bench build, NOT for a turbine: the kernels run on the live channel and Modbus objects.
+//
+// Each kernel is run BENCH_REPS times per batch, BENCH_BATCHES batches. The best batch is reported, in CPU cycles
+// (84 MHz) per call, from the Cortex-M3 DWT cycle counter. Loop overhead (a few cycles) is included.
+//
+// Regression check: each kernel's result is compared with its baseline in bench_baselines[], below.
+//   - more than BENCH_TOLERANCE_PCT over its baseline --> "REGRESSION", and the run ends with "bench: FAIL"
+//   - baseline 0 = not recorded yet: reported, but not checked. To record one, copy the cycles from a bench run on
+//     the target into the table; from then on that kernel is gated.
+//
+// Kernels:
+//   filter3DBInt::doFilter, AnalogChannelBase::getMedianValInt, setInstantaneousValInt - see adc.ino
+//   sampleChannelBank (median3Int + emaInt on one chbank slot), and a pass over all 9 slots - see adc.ino
+//   filterChainSample with a 7-sample median and 2 biquads ("IDC:M7/B50/B50") - see filter.ino
+//   RPMChannel::sample_and_test (incl. its 2 analogRead's) - see adc.ino
+//   ModbusReg::readReg(true), i.e., cached decode + formatting, for MOD_FLOAT16, MOD_SCALED_V and MOD_SCALED - see modbus.h
+//   printPOSTBody (count only, no send), getValsJSON - see webclient.ino, sdcard.ino
+//   calcWSStats (600 sec of WS), calcRayleighHoldTimes - see furlctl.ino
+
+#ifdef ENABLE_BENCH
+
+#define BENCH_REPS 256
+#define BENCH_BATCHES 8
+#define BENCH_TOLERANCE_PCT 10
+
+struct BenchBaseline {
+  const char* name;
+  uint32_t cycles;                          // cycles per call, 0 = not recorded yet
+};
+
+const BenchBaseline bench_baselines[] = {
+  { "doFilter", 0 },
+  { "getMedianValInt", 0 },
+  { "setInstantaneousValInt", 0 },
+  { "sampleChannelBank", 0 },
+  { "sampleChannelBank x9", 0 },
+  { "filterChainSample M7/B/B", 0 },
+  { "RPM sample_and_test", 0 },
+  { "readReg FLOAT16", 0 },
+  { "readReg SCALED_V", 0 },
+  { "readReg SCALED", 0 },
+  { "printPOSTBody", 0 },
+  { "getValsJSON", 0 },
+  { "calcWSStats", 0 },
+  { "calcRayleighHoldTimes", 0 },
+};
+
+volatile int bench_sink = 0;                // kernel results go here, so the compiler can't drop the calls
+int bench_regressions = 0;
+int bench_unchecked = 0;                    // kernels with no baseline
+
+// Time stmt: best of BENCH_BATCHES batches of reps calls, in cycles per call
+#define BENCH(name, reps, stmt) {                                    \
+  uint32_t best = 0xFFFFFFFF;                                        \
+  for ( int b = 0; b < BENCH_BATCHES; b++ ) {                        \
+    uint32_t t0 = DWT->CYCCNT;                                       \
+    for ( int i = 0; i < (reps); i++ ) { stmt; }                     \
+    uint32_t c = (DWT->CYCCNT - t0) / (reps);                        \
+    if ( c < best ) best = c;                                        \
+  }                                                                  \
+  reportBench(name, best);                                           \
+}
+
+
+void reportBench(const char* name, uint32_t cycles) {
+  uint32_t base = 0;
+  for ( unsigned int i = 0; i < sizeof(bench_baselines) / sizeof(bench_baselines[0]); i++ ) {
+    if ( strcmp(bench_baselines[i].name, name) == 0 ) base = bench_baselines[i].cycles;
+  }
+  Serial << "bench: " << name << " = " << cycles << " cycles";
+  if ( !base ) {                            // not recorded yet: skip the check
+    Serial << " (no baseline)\n";
+    bench_unchecked++;
+    return;
+  }
+  int pct = ((int)cycles - (int)base) * 100 / (int)base;
+  Serial << " (baseline " << base << ", " << (pct >= 0 ? "+" : "") << pct << "%)";
+  if ( pct > BENCH_TOLERANCE_PCT ) {
+    Serial << " REGRESSION";
+    bench_regressions++;
+  }
+  Serial << "\n";
+}
+
+
+void runBenchmarks() {
+  static int in[256];                       // pseudo-random samples, +/-2048 x 1024
+  static int ws[600];                       // 10 min of WS, 1-sec vals, m/s 1024x actual
+  static float rayleigh[41], rayleigh_sum[41];
+  static int hold[41];
+  uint32_t r = 12345;
+  int avg, maxval, mad;
+
+  for ( int i = 0; i < 256; i++ ) {
+    r = r * 1103515245 + 12345;
+    in[i] = ((int)(r >> 20) - 2048) << 10;
+  }
+  for ( int i = 0; i < 600; i++ ) ws[i] = (8 * 1024) + (in[i & 255] >> 8);  // 8 m/s +/- 8
+
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;  // enable the DWT cycle counter
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  Serial << "bench: Running " << BENCH_BATCHES << " x " << BENCH_REPS << " calls per kernel, "
+         << SystemCoreClock / 1000000 << " MHz...\n";
+
+  filter3DBInt filt((int)(AVG_ALPHA * 1024.0), true);
+  BENCH("doFilter", BENCH_REPS, bench_sink += filt.doFilter(in[i & 255]));
+  BENCH("getMedianValInt", BENCH_REPS, bench_sink += ac_Ta.getMedianValInt(in[i & 255]));
+  BENCH("setInstantaneousValInt", BENCH_REPS, ac_Ta.setInstantaneousValInt(in[i & 255]));
+  BENCH("sampleChannelBank", BENCH_REPS, sampleChannelBank(LINE_VOLTAGE, in[i & 255], true, false, true));
+  BENCH("sampleChannelBank x9", 16, for ( int c = 0; c < CHBANK_SIZE; c++ ) sampleChannelBank(c, in[(i + c) & 255], true, false, true));
+  BENCH("RPM sample_and_test", BENCH_REPS, ac_freq.sample_and_test());
+
+  uint32_t gen = filt_gen + 1;              // parse into the table the ISR isn't using (the timers aren't running yet anyway)
+  int v;
+  parseFilterChains("IDC:M7/B50/B50", gen & 1);
+  BENCH("filterChainSample M7/B/B", BENCH_REPS, v = in[i & 255]; filterChainSample(DC_CURRENT, gen, &v); bench_sink += v);
+  filt_state[DC_CURRENT].gen = filt_gen;    // the real table flip will re-prime it
+
+  mppt600.cachedDataOK(true);               // readReg(true) decodes from the response buffer, no Modbus traffic
+  mppt30.cachedDataOK(true);
+  nuvation.cachedDataOK(true);
+  BENCH("readReg FLOAT16", BENCH_REPS, bench_sink += mppt600_adc_vb_f_med.readReg(true));
+  BENCH("readReg SCALED_V", BENCH_REPS, bench_sink += mppt30_adc_vb_f_med.readReg(true));
+  BENCH("readReg SCALED", BENCH_REPS, bench_sink += nuvation_Vol.readReg(true));
+  mppt600.cachedDataOK(false);
+  mppt30.cachedDataOK(false);
+  nuvation.cachedDataOK(false);
+
+  BENCH("printPOSTBody", 16, bench_sink += printPOSTBody(false, true, CH_GROUP_CONTROLLER, TELEM_ALL_CHANNELS));
+  BENCH("getValsJSON", 16, bench_sink += getValsJSON(CH_GROUP_CONTROLLER).length());
+
+  BENCH("calcWSStats", 16, bench_sink += calcWSStats(ws, 600, &avg, &maxval, &mad));
+  BENCH("calcRayleighHoldTimes", 16, calcRayleighHoldTimes(avg + (i << 6), rayleigh, rayleigh_sum, hold));
+
+  Serial << "bench: " << (bench_regressions ? "FAIL" : "PASS") << ", " << bench_regressions << " regression(s) > "
+         << BENCH_TOLERANCE_PCT << "%, " << bench_unchecked << " kernel(s) with no baseline\n";
+}
+
+#endif
@@ -0,0 +1,35 @@
+// ---------- boot.h ----------
+// Boot stages, timeline and subsystem-ready flags - see boot.ino
+// This is a .h file (#include'd in wwe.ino) so that wwe.ino, adc.ino and webclient.ino can see it.
+
+#ifndef BOOT_DEFINED
+#define BOOT_DEFINED
+
+// Boot stages, in the order they normally complete. Stages up to BOOT_CONTROL run in setup();
+//   the rest are run by runBootStages() from loop(), AFTER the timer interrupts are protecting the machine.
+#define BOOT_RESET 0                        // setup() entered
+#define BOOT_PARMS 1                        // parms loaded from the flash parm store (or defaults)
+#define BOOT_CONTROL 2                      // timer interrupts started: readADCs(), SC logic, furlctl1(), stepper
+#define BOOT_MODBUS 3                       // Modbus/RTU up, Morningstar charge states read: manageDumpLoad() may run
+#define BOOT_MODBUS_ID 4                    // Morningstar identity, scale factor and 'slow' register reads done
+#define BOOT_WIND 5                         // Etesian anemometer initialized
+#define BOOT_SD 6                           // SD card initialized (or given up on, if parms came from flash)
+#define BOOT_ETHERNET 7                     // Ethernet, NTP and webserver up
+#define BOOT_NUVATION 8                     // Nuvation Modbus/TCP scale factors read
+#define BOOT_WEATHER 9                      // first NWS alert check done
+#define BOOT_DONE 10                        // all stages complete
+#define NUM_BOOT_STAGES 11
+
+#define BOOT_RETRY_MSEC 15000               // wait between Ethernet or SD retries
+
+uint32_t boot_msec[NUM_BOOT_STAGES];        // millis() when each stage completed
+uint16_t boot_tries[NUM_BOOT_STAGES];       // # attempts, for stages that can fail
+uint32_t boot_done_mask = 0;                // bit n set when stage n has completed
+boolean boot_done = false;                  // all stages complete, runBootStages() has nothing left to do
+
+// Subsystem-ready flags. Code that uses a subsystem checks its flag, so it is safe to run before the boot completes.
+volatile boolean modbus_ok = false;         // Serial3/ModbusMaster ready and charge states read - used by readADCs() in adc.ino
+volatile boolean wind_ok = false;           // Serial2/Etesian ready - used by pollSerialWind() in the timer interrupt, see wind.ino
+boolean ethernet_up = false;                // W5500 initialized - used by ethernetOK() in webclient.ino
+
+#endif
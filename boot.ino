@@ -0,0 +1,207 @@
+// ---------- boot.ino ----------
+// STAGED BOOT
+//
+// setup() used to block for many seconds before the main timer was started, i.e., before readADCs() and the shorting
+//   contactor logic were protecting the machine: Ethernet/DHCP/NTP, SD retries, ~30 Modbus identity reads with delay(5)'s,
+//   3 sec of Etesian delays and a synchronous HTTPS weather check. Now setup() does only what control needs:
+//   pins, ADC, SC, RTC time, parms from flash, shutdown state - then starts the timer interrupts (BOOT_CONTROL).
+// Everything else is brought up by runBootStages(), called from the top of loop() until it's done:
+//   - Etesian: timed steps, never blocks - see initWind() in wind.ino
+//   - Modbus: initModbus() first, then ONE identity read group per call - see modbus.ino
+//     manageDumpLoad() is not called by readADCs() until modbus_ok is set (it writes to the Morningstars). Until then the
+//     alternator is held shorted by shutdown state 1, which the boot always starts in - see initShutdownState() below.
+//   - Ethernet: initWeb(), retried every BOOT_RETRY_MSEC instead of a blocking while()
+//   - SD: after the first Ethernet attempt (same SPI bus order as before). If there were no parms in flash, retried until
+//     the SD parm file is read, then the boot parm changes are applied and committed - see applyBootParms()
+//   - Nuvation scale factors and the first weather check, once Ethernet is up (the UDP telemetry and Modbus/TCP server
+//     sockets are opened as soon as it is)
+// At most ONE blocking step is done per call, so if(do_post) in loop() keeps running (late, not stalled) during the boot.
+// Code in loop() that uses a subsystem checks its ready flag (modbus_ok, wind_ok, ethernet_up, SD_ok) - see boot.h
+//
+// Each stage records when it completed (msec since reset) and how many tries it took. The timeline is printed when the
+//   boot is done, and is available at <controllerIP>/boot.json - see bootCmd() in webserver.ino
+
+// Stage numbers, timeline and ready flags are in boot.h
+
+
+char* getBootStageName(int stage) {
+  switch (stage) {
+    case BOOT_RESET:     return ("RESET");
+    case BOOT_PARMS:     return ("PARMS");
+    case BOOT_CONTROL:   return ("CONTROL");
+    case BOOT_MODBUS:    return ("MODBUS");
+    case BOOT_MODBUS_ID: return ("MODBUS_ID");
+    case BOOT_WIND:      return ("WIND");
+    case BOOT_SD:        return ("SD");
+    case BOOT_ETHERNET:  return ("ETHERNET");
+    case BOOT_NUVATION:  return ("NUVATION");
+    case BOOT_WEATHER:   return ("WEATHER");
+    case BOOT_DONE:      return ("DONE");
+    default:             return ("UNKNOWN");
+  }
+}
+
+
+boolean bootStageDone(int stage) {
+  return( (boot_done_mask & (1UL << stage)) != 0 );
+}
+
+
+// Record that a stage has completed
+void markBootStage(int stage) {
+  boot_msec[stage] = millis();
+  boot_done_mask |= (1UL << stage);
+  if ( boot_tries[stage] == 0 ) boot_tries[stage] = 1;
+  Serial << "boot: " << getBootStageName(stage) << " at " << boot_msec[stage] << " msec\n";
+}
+
+
+// Initialize Shutdown State.
+// Unless we're in SS=2, we initialize into SS=1.
+// This forces the system operator to deal with SS=2 situations, but it also means that
+// setting SS=0 is required to start the turbine. And doing THAT requires that the controller
+// web server (Ethernet!) be functional to provide a Controller Operating Parameters web page.
+void initShutdownState() {
+  if ( parm_shutdown_state.intVal() != 2 ) {
+    parm_shutdown_state.setParmVal("1");
+    shutdown_state = 1;
+  } else {
+    shutdown_state = 2;
+  }
+}
+
+
+// Called ONCE, when the parms are final (from flash in setup(), otherwise after the SD parm file is read):
+//   re-apply the shutdown state rule, increment the restart count and save the parms to flash and SD.
+void applyBootParms() {
+  initShutdownState();
+
+  // Increment controller Restart Count parm.
+  int num_resets = 1 + parm_num_resets.intVal();
+  parm_num_resets.setParmVal(num_resets);
+  Serial << "boot: Controller restarts = " << num_resets << "\n";
+
+  // Save updated parms to flash and SD.
+  // We've possibly changed parm_shutdown_state and DEFINITELY changed parm_num_resets.
+  writeParms2Flash();
+  if ( SD_ok ) writeParms2SD(PARMFILENAME);
+  printParms();  // see parms.ino
+}
+
+
+// Bring up the rest of the system, one step at a time. Called at the top of loop() until boot_done.
+void runBootStages() {
+  static int modbus_id_step = 0;                // next readModbusIdentity() step
+  static unsigned long eth_try_time = 0;        // millis() of the last Ethernet attempt
+  static unsigned long sd_try_time = 0;         // millis() of the last SD attempt
+
+  if ( boot_done ) return;
+
+  // Etesian: cheap timed steps, so it's done alongside whatever else is going on
+  if ( !wind_ok && initWind() ) {
+    wind_ok = true;
+    markBootStage(BOOT_WIND);
+  }
+
+  // Modbus/RTU first: manageDumpLoad() is waiting for it
+  if ( !modbus_ok ) {
+#ifdef DOMODBUS
+    initModbus();
+#endif
+    modbus_ok = true;                           // manageDumpLoad() may now run - see readADCs() in adc.ino
+    markBootStage(BOOT_MODBUS);
+    return;
+  }
+
+  // Ethernet - see web.ino
+  if ( !ethernet_up && (boot_tries[BOOT_ETHERNET] == 0 || (millis() - eth_try_time) >= BOOT_RETRY_MSEC) ) {
+    boot_tries[BOOT_ETHERNET]++;
+    eth_try_time = millis();
+    if ( initWeb() ) {
+      ethernet_up = true;
+      initTelemetry();                          // see telemetry.ino
+      initModbusServer();                       // see modbusserver.ino
+      initTimeSync();                           // see timesync.ino
+      markBootStage(BOOT_ETHERNET);
+    } else {
+      Serial << "boot: ETHERNET DOWN! Retrying in " << BOOT_RETRY_MSEC / 1000 << " sec\n";
+    }
+    return;
+  }
+
+  // SD card - see sdcard.ino
+  //   With the original Ethernet shield, the SD card would NOT initialize following a code update.
+  //   A workaround was to retry here, ejecting then reinserting the SD card. This problem does NOT occur with the Ethernet 2 shield.
+  //   If parms were loaded from flash, we don't NEED the SD card to run, so we only try once.
+  if ( !bootStageDone(BOOT_SD) && (boot_tries[BOOT_SD] == 0 || (millis() - sd_try_time) >= BOOT_RETRY_MSEC) ) {
+    boot_tries[BOOT_SD]++;
+    sd_try_time = millis();
+    SD_ok = initializeSDCard();
+    if ( parmstore_ok ) {
+      if ( SD_ok ) writeParms2SD(PARMFILENAME);   // refresh the readable copy of the parms
+      markBootStage(BOOT_SD);
+    } else if ( SD_ok ) {
+      // There was no valid parm image in flash (e.g., first boot of this firmware), so use the SD parm file.
+      // If the SD parm file doesn't exist, create it and write current parms to it - see parms.ino
+      if ( !readSD2Parms(PARMFILENAME) ) writeParms2SD(PARMFILENAME);
+      applyBootParms();
+      markBootStage(BOOT_SD);
+    } else {
+      Serial << "boot: Eject and reinsert SD card.\n";
+    }
+    return;
+  }
+
+  // Morningstar identity reads, one group per call - see modbus.ino
+  if ( !bootStageDone(BOOT_MODBUS_ID) ) {
+#ifdef DOMODBUS
+    if ( readModbusIdentity(modbus_id_step++) ) markBootStage(BOOT_MODBUS_ID);
+#else
+    markBootStage(BOOT_MODBUS_ID);
+#endif
+    return;
+  }
+
+  if ( !ethernet_up ) return;                   // the rest needs Ethernet
+
+  // Nuvation Modbus/TCP scale factors - see modbus.ino
+  if ( !bootStageDone(BOOT_NUVATION) ) {
+    boot_tries[BOOT_NUVATION]++;
+    if ( readNuvationScaleFactors() ) markBootStage(BOOT_NUVATION);
+    return;
+  }
+
+  // Check weather data as we start up, then at intervals in loop()
+  if ( !bootStageDone(BOOT_WEATHER) ) {
+    getWeatherData();  // in weather.ino --> calls weather API(s) in webclient.ino
+    Serial << "boot: weather_furl = " << weather_furl << "\n";
+    markBootStage(BOOT_WEATHER);
+    return;
+  }
+
+  // Wait for the Etesian, if need be
+  if ( !wind_ok ) return;
+
+  markBootStage(BOOT_DONE);
+  boot_done = true;
+  printBootTimeline();
+}
+
+
+void printBootTimeline() {
+  Serial << "boot: ---------- BOOT TIMELINE ----------\n";
+  for ( int i = 0; i < NUM_BOOT_STAGES; i++ ) {
+    if ( bootStageDone(i) ) {
+      Serial << "boot: " << getBootStageName(i) << " = " << boot_msec[i] << " msec, tries = " << boot_tries[i] << "\n";
+    } else {
+      Serial << "boot: " << getBootStageName(i) << " = pending, tries = " << boot_tries[i] << "\n";
+    }
+  }
+}
+
+
+// Format one stage as a JSON object, e.g.: {"stage":"CONTROL","msec":112,"tries":1}   (msec = -1 if not done yet)
+void formatBootStage(char* buf, int stage) {
+  sprintf(buf, "{\"stage\":\"%s\",\"msec\":%ld,\"tries\":%u}", getBootStageName(stage),
+          bootStageDone(stage) ? (long)boot_msec[stage] : -1L, boot_tries[stage]);
+}
@@ -0,0 +1,345 @@
+// ---------- capture.ino ----------
+// TRIGGERED WAVEFORM CAPTURE (fault recorder)
+//
+// wave.json (startCollectingWaveforms() in adc.ino) records whatever 256 msec FOLLOWS a web request. By the time anyone
+//   asks, the transient that furled or braked the turbine is long gone. So the ISR now records continuously, and a trigger
+//   freezes the samples around it:
+//   - captureSample() is called by readADCs() at 1000 Hz (adc_index==9, like the waveforms). It writes the instantaneous
+//     val of each channel in cap_chans[] into the ACTIVE capture slot, a circular buffer of CAP_SAMPLES samples.
+//   - When a trigger fires, recording continues for CAP_POST_SAMPLES (the trigger sample is the first of them), then the
+//     slot is frozen with up to CAP_PRE_SAMPLES of pre-trigger history, and the ISR switches to the other slot.
+//     Two slots, so a second event can be captured while the first is being saved. If both are frozen, triggers are
+//     dropped (and counted) until loop() frees one.
+//   - serviceCaptures(), called every loop() iteration, saves a frozen slot to SD a few lines per call, then frees it.
+//
+// Triggers are set by parm_cap_trig, a comma-separated list of (case doesn't matter):
+//   FURL, SC, SHUTDOWN, REED, MANUAL   control events, as they're logged to the journal - see logJournalEvent() in journal.ino
+//                                      (FURL = start or end of a full furl, SC = shorted or unshorted, MANUAL = Manual Mode on or off)
+//   <chan>><val>, <chan><<val>         the instantaneous val of a controller channel crosses val (channel units), e.g., VDC>400
+//   DRPM><val>                         RPM changes by more than val rpm/sec (measured over CAP_DRPM_SAMPLES msec)
+//   e.g., "FURL,SC,VDC>400,IDC>60,DRPM>100". An empty parm = event triggers off. A capture can also be triggered from
+//   the web: <controllerIP>/cap.json?trigger
+// The ISR reads the trigger table through an index, and a parm change is parsed into the OTHER table, then the index
+//   is flipped, so the ISR never sees a half-written table.
+//
+// Files: CAP/yyyymmdd/hhmmsscc.CSV (local time of the trigger, cc = 1/100 sec), one header line, one line of column
+//   names, then one line per msec, time relative to the trigger, vals in channel units:
+//     # id=<mac>,time=1660838400.125,trigger=EVENT,detail=1,rate=1000,pre=128
+//     msec,V1,V2,V3,VDC,I1,I2,I3,IDC,RPM
+//     -128,12.50,...
+// <controllerIP>/cap.json lists the most recent captures and the trigger state; a file is downloaded from
+//   <controllerIP>/cap.csv?yyyymmdd/hhmmsscc - see capCmd() and capFileCmd() in webserver.ino
+
+#define CAP_NUM_CHANNELS 9
+#define CAP_PRE_SAMPLES 128                    // msec of history before the trigger
+#define CAP_POST_SAMPLES 256                   // msec from the trigger on
+#define CAP_SAMPLES (CAP_PRE_SAMPLES + CAP_POST_SAMPLES)
+#define CAP_SHIFT 6                            // samples are stored as 16-bit native val >> CAP_SHIFT, i.e., 16x actual: +/-2047 V, A, rpm
+#define CAP_MAX_LEVEL_TRIGS 4
+#define CAP_DRPM_SAMPLES 100                   // DRPM is checked every 100 msec
+#define CAP_LINES_PER_CALL 32                  // lines written to SD per serviceCaptures() call
+#define CAP_INDEX_SIZE 16                      // # saved captures listed in cap.json
+
+// Slot states. A slot is written by the ISR while ARMED or POST, and by loop() ONLY while READY.
+#define CAP_FREE 0                             // saved, or never used
+#define CAP_ARMED 1                            // recording history, waiting for a trigger
+#define CAP_POST 2                             // triggered, recording post-trigger samples
+#define CAP_READY 3                            // frozen, waiting to be saved
+
+// Trigger sources
+#define CAP_SRC_EVENT 1                        // detail = journal event type (JRNL_*)
+#define CAP_SRC_LEVEL 2                        // detail = channel
+#define CAP_SRC_DRPM 3                         // detail = rpm/sec
+#define CAP_SRC_MANUAL 4                       // web request
+
+const int cap_chans[CAP_NUM_CHANNELS] = { L1_VOLTAGE, L2_VOLTAGE, L3_VOLTAGE, DC_VOLTAGE,
+                                          L1_CURRENT, L2_CURRENT, L3_CURRENT, DC_CURRENT, RPM };
+
+struct CaptureTrigs {
+  uint32_t event_mask;                         // bit (1 << JRNL_*) set = trigger on that journal event
+  int num_levels;
+  int8_t level_chan[CAP_MAX_LEVEL_TRIGS];
+  boolean level_above[CAP_MAX_LEVEL_TRIGS];    // true = trigger when val goes above level, false = below
+  int32_t level[CAP_MAX_LEVEL_TRIGS];          // native units
+  int32_t drpm;                                // RPM change per CAP_DRPM_SAMPLES, 1024x actual, 0 = off
+};
+
+struct CaptureSlot {
+  volatile uint8_t state;                      // CAP_FREE, ...
+  uint8_t src;                                 // CAP_SRC_*
+  uint16_t head;                               // next sample to write
+  uint16_t count;                              // # samples written, up to CAP_SAMPLES
+  uint16_t post_left;                          // post-trigger samples still to record
+  int32_t detail;
+  uint32_t time;                               // myunixtime of the trigger
+  uint16_t msec;
+  int16_t data[CAP_SAMPLES][CAP_NUM_CHANNELS];
+};
+
+struct CaptureRecord {
+  char fname[28];                              // "CAP/yyyymmdd/hhmmsscc.CSV"
+  uint32_t time;
+  uint16_t msec;
+  uint8_t src;
+  int32_t detail;
+};
+
+CaptureTrigs cap_trigs[2];
+volatile int cap_trigs_active = 0;             // the table the ISR uses; the other one is parsed into
+CaptureSlot cap_slots[2];
+volatile int cap_active = 0;                   // the slot the ISR writes
+volatile uint8_t cap_pending_src = 0;          // trigger waiting for the ISR, 0 = none
+volatile int32_t cap_pending_detail = 0;
+boolean cap_level_was[CAP_MAX_LEVEL_TRIGS];    // level condition on the last sample, so we trigger on the crossing
+int cap_drpm_count = 0;
+int cap_last_rpm = 0;
+uint32_t cap_count = 0;                        // # captures taken
+uint32_t cap_dropped = 0;                      // # triggers lost because both slots were waiting to be saved
+CaptureRecord cap_index[CAP_INDEX_SIZE];       // most recent saved captures
+uint32_t cap_index_n = 0;                      // # saved since reset; the latest is cap_index[(cap_index_n - 1) % CAP_INDEX_SIZE]
+
+
+char* getCaptureSourceName(int src) {
+  switch (src) {
+    case CAP_SRC_EVENT:  return ("EVENT");
+    case CAP_SRC_LEVEL:  return ("LEVEL");
+    case CAP_SRC_DRPM:   return ("DRPM");
+    case CAP_SRC_MANUAL: return ("MANUAL");
+    default:             return ("UNKNOWN");
+  }
+}
+
+
+// Request a capture. The first trigger wins until the ISR takes it. Called from the ISR, or from loop() for CAP_SRC_MANUAL.
+void triggerCapture(int src, int detail) {
+  if ( cap_pending_src ) return;
+  cap_pending_detail = detail;
+  cap_pending_src = src;                       // publish AFTER the detail
+}
+
+
+// Trigger on a control event if it's selected by parm_cap_trig. Called by logJournalEvent() - see journal.ino
+void triggerCaptureOnEvent(int type) {
+  if ( cap_trigs[cap_trigs_active].event_mask & (1UL << type) ) triggerCapture(CAP_SRC_EVENT, type);
+}
+
+
+// Check the level and DRPM triggers. Called from captureSample() ONLY.
+void checkCaptureTriggers() {
+  CaptureTrigs* t = &cap_trigs[cap_trigs_active];
+  for ( int i = 0; i < t->num_levels; i++ ) {
+    int val = getChannelInstInt(t->level_chan[i]);
+    boolean over = t->level_above[i] ? (val > t->level[i]) : (val < t->level[i]);
+    if ( over && !cap_level_was[i] ) triggerCapture(CAP_SRC_LEVEL, t->level_chan[i]);
+    cap_level_was[i] = over;
+  }
+  if ( ++cap_drpm_count >= CAP_DRPM_SAMPLES ) {
+    cap_drpm_count = 0;
+    int rpm = getChannelInstInt(RPM);
+    int drpm = abs(rpm - cap_last_rpm);
+    cap_last_rpm = rpm;
+    if ( t->drpm > 0 && drpm > t->drpm ) triggerCapture(CAP_SRC_DRPM, (drpm * (1000 / CAP_DRPM_SAMPLES)) >> 10);
+  }
+}
+
+
+// Record one sample of every capture channel, and handle triggers. Called from readADCs() at 1000 Hz ONLY!
+void captureSample() {
+  CaptureSlot* s = &cap_slots[cap_active];
+  if ( s->state == CAP_READY ) {                    // frozen, so switch to the other slot...
+    CaptureSlot* other = &cap_slots[cap_active ^ 1];
+    if ( other->state != CAP_FREE ) {               //   unless loop() hasn't saved that one yet either
+      if ( cap_pending_src ) {
+        cap_dropped++;
+        cap_pending_src = 0;
+      }
+      return;
+    }
+    cap_active ^= 1;
+    s = other;
+  }
+  if ( s->state == CAP_FREE ) {
+    s->head = 0;
+    s->count = 0;
+    s->state = CAP_ARMED;
+  }
+
+  int16_t* row = s->data[s->head];
+  for ( int i = 0; i < CAP_NUM_CHANNELS; i++ ) row[i] = getChannelInstInt(cap_chans[i]) >> CAP_SHIFT;
+  if ( ++s->head >= CAP_SAMPLES ) s->head = 0;
+  if ( s->count < CAP_SAMPLES ) s->count++;
+
+  checkCaptureTriggers();
+  if ( s->state == CAP_POST ) {
+    cap_pending_src = 0;                            // this capture already covers it
+    if ( --s->post_left == 0 ) {
+      s->state = CAP_READY;                         // loop() may now read it - see serviceCaptures()
+      cap_count++;
+    }
+  } else if ( cap_pending_src ) {                   // ARMED, and triggered
+    s->src = cap_pending_src;
+    s->detail = cap_pending_detail;
+    s->time = myunixtime;
+    s->msec = subsecond_ticks / (SAMPLE_RATE_PER_SEC / 1000);
+    s->post_left = CAP_POST_SAMPLES - 1;            // this sample is the first post-trigger sample
+    s->state = CAP_POST;
+    cap_pending_src = 0;
+  }
+}
+
+
+// Parse parm_cap_trig into cap_trigs[which]. Returns the # triggers, or -1 if there's a bad one (which is skipped).
+int parseCaptureTriggers(char* str, int which) {
+  CaptureTrigs* t = &cap_trigs[which];
+  char buf[48];
+  int n = 0;
+  boolean ok = true;
+
+  memset(t, 0, sizeof(CaptureTrigs));
+  strncpy(buf, str, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  for ( char* tok = strtok(buf, ", "); tok != NULL; tok = strtok(NULL, ", ") ) {
+    char* op = strpbrk(tok, "<>");
+    boolean above = (op != NULL && *op == '>');
+    if ( op ) *op++ = 0;
+    if ( !op && !strcasecmp(tok, "FURL") ) t->event_mask |= (1UL << JRNL_FURL) | (1UL << JRNL_UNFURL);
+    else if ( !op && !strcasecmp(tok, "SC") ) t->event_mask |= (1UL << JRNL_SC_SHORT) | (1UL << JRNL_SC_UNSHORT);
+    else if ( !op && !strcasecmp(tok, "SHUTDOWN") ) t->event_mask |= (1UL << JRNL_SHUTDOWN);
+    else if ( !op && !strcasecmp(tok, "REED") ) t->event_mask |= (1UL << JRNL_REED_SWITCH);
+    else if ( !op && !strcasecmp(tok, "MANUAL") ) t->event_mask |= (1UL << JRNL_MANUAL_ON) | (1UL << JRNL_MANUAL_OFF);
+    else if ( op && above && !strcasecmp(tok, "DRPM") ) {
+      t->drpm = (int32_t)(atof(op) * 1024.0 * CAP_DRPM_SAMPLES / 1000.0);
+    } else if ( op ) {
+      int ch;
+      for ( ch = 0; ch < STATE; ch++ ) if ( !strcasecmp(tok, ctl_chans[ch].name) ) break;
+      if ( ch == STATE || t->num_levels == CAP_MAX_LEVEL_TRIGS ) {
+        ok = false;
+        continue;
+      }
+      t->level_chan[t->num_levels] = ch;
+      t->level_above[t->num_levels] = above;
+      t->level[t->num_levels] = (int32_t)(atof(op) / ctl_chans[ch].scale);
+      t->num_levels++;
+    } else {
+      ok = false;
+      continue;
+    }
+    n++;
+  }
+  return( ok ? n : -1 );
+}
+
+
+// Re-parse the triggers if any parm has changed, then flip the ISR to the new table
+void updateCaptureTriggers() {
+  static unsigned long last_parms_version = 0xFFFFFFFF;
+  if ( parms_version == last_parms_version ) return;
+  last_parms_version = parms_version;
+
+  int which = cap_trigs_active ^ 1;
+  int n = parseCaptureTriggers(parm_cap_trig.parmVal(), which);
+  if ( n < 0 ) Serial << "capture: Bad trigger in \"" << parm_cap_trig.parmVal() << "\", skipped\n";
+  cap_trigs_active = which;
+  Serial << "capture: " << max(n, 0) << " triggers from \"" << parm_cap_trig.parmVal() << "\"\n";
+}
+
+
+// Make the SD file name of a capture from its trigger time (local time): CAP/yyyymmdd/hhmmsscc.CSV
+void makeCaptureFileName(char* fname, uint32_t time, int msec) {
+  time_t t = time + parm_TZ_offset.intVal() * 3600;
+  sprintf(fname, "CAP/%04d%02d%02d/%02d%02d%02d%02d.CSV", year(t), month(t), day(t), hour(t), minute(t), second(t), msec / 10);
+}
+
+
+// Make an SD file name from a cap.csv request tail, "yyyymmdd/hhmmsscc". Returns false if it's not one.
+boolean getCaptureFileName(char* fname, char* tail) {
+  if ( strlen(tail) != 17 || tail[8] != '/' ) return(false);
+  for ( int i = 0; i < 17; i++ ) if ( i != 8 && !isdigit(tail[i]) ) return(false);
+  sprintf(fname, "CAP/%s.CSV", tail);
+  return(true);
+}
+
+
+// Save a frozen capture slot to SD, CAP_LINES_PER_CALL lines at a time, then free it. Re-parse the triggers if parms changed.
+// Called every loop() iteration, so a capture never holds up if(do_post).
+void serviceCaptures() {
+  static int saving = -1;                           // slot being saved
+  static int line = 0;                              // next sample to write, -1 = header
+  static char fname[28];
+
+  updateCaptureTriggers();
+
+  if ( saving < 0 ) {
+    saving = cap_active ^ 1;                        // if both are frozen, the inactive one is older
+    if ( cap_slots[saving].state != CAP_READY ) saving = cap_active;
+    if ( cap_slots[saving].state != CAP_READY ) {
+      saving = -1;
+      return;
+    }
+    line = -1;
+    makeCaptureFileName(fname, cap_slots[saving].time, cap_slots[saving].msec);
+    if ( !SD_ok ) {
+      Serial << "capture: No SD card, " << getCaptureSourceName(cap_slots[saving].src) << " capture discarded\n";
+      cap_slots[saving].state = CAP_FREE;
+      saving = -1;
+      return;
+    }
+    char dir[13];
+    strncpy(dir, fname, 12);                        // "CAP/yyyymmdd"
+    dir[12] = 0;
+    SD.mkdir(dir);
+  }
+
+  CaptureSlot* s = &cap_slots[saving];
+  int pre = s->count - CAP_POST_SAMPLES;            // pre-trigger samples, CAP_PRE_SAMPLES unless we were armed only briefly
+  File sdfile;
+  if ( !(sdfile = SD.open(fname, O_CREAT | O_APPEND | O_WRITE)) ) {
+    Serial << "capture: Error opening " << fname << ", capture discarded\n";
+    s->state = CAP_FREE;
+    saving = -1;
+    return;
+  }
+  char buf[128];
+  int len;
+  if ( line < 0 ) {
+    sprintf(buf, "# id=%s,time=%lu.%03u,trigger=%s,detail=%ld,rate=1000,pre=%d", mac_chars, (unsigned long)s->time, s->msec,
+            getCaptureSourceName(s->src), (long)s->detail, pre);
+    sdfile.println(buf);
+    len = sprintf(buf, "msec");
+    for ( int i = 0; i < CAP_NUM_CHANNELS; i++ ) len += sprintf(buf + len, ",%s", ctl_chans[cap_chans[i]].name);
+    sdfile.println(buf);
+    line = 0;
+  }
+  for ( int n = 0; n < CAP_LINES_PER_CALL && line < s->count; n++, line++ ) {
+    int16_t* row = s->data[(s->head + CAP_SAMPLES - s->count + line) % CAP_SAMPLES];
+    len = sprintf(buf, "%d", line - pre);
+    for ( int i = 0; i < CAP_NUM_CHANNELS; i++ ) {
+      len += sprintf(buf + len, ",%.2f", (float)(row[i] << CAP_SHIFT) * ctl_chans[cap_chans[i]].scale);
+    }
+    sdfile.println(buf);
+  }
+  sdfile.close();
+  if ( line < s->count ) return;                    // more next time
+
+  CaptureRecord* rec = &cap_index[cap_index_n++ % CAP_INDEX_SIZE];
+  strcpy(rec->fname, fname);
+  rec->time = s->time;
+  rec->msec = s->msec;
+  rec->src = s->src;
+  rec->detail = s->detail;
+  Serial << "capture: " << getCaptureSourceName(s->src) << " capture saved to " << fname << "\n";
+  s->state = CAP_FREE;                              // the ISR may use the slot again
+  saving = -1;
+}
+
+
+// Format a saved capture as a JSON object, e.g.: {"file":"20220818/12000012","time":1660838400.125,"trigger":"EVENT","detail":1}
+//   file is the cap.csv request tail
+void formatCaptureRecord(char* buf, int i) {
+  CaptureRecord* rec = &cap_index[i % CAP_INDEX_SIZE];
+  char tail[18];
+  strncpy(tail, rec->fname + 4, 17);                // skip "CAP/", drop ".CSV"
+  tail[17] = 0;
+  sprintf(buf, "{\"file\":\"%s\",\"time\":%lu.%03u,\"trigger\":\"%s\",\"detail\":%ld}", tail, (unsigned long)rec->time,
+          rec->msec, getCaptureSourceName(rec->src), (long)rec->detail);
+}
@@ -0,0 +1,120 @@
+// ---------- channels.h ----------
+// CHANNEL DESCRIPTORS: what each data channel is called, its units and how its value is formatted
+//
+// Channel metadata used to be spread around: the channel numbers and NUM_ADC_CHANNELS in adc.ino, the TP and DL multipliers
+//   repeated in printPOSTBody() and getValsJSON(), hand-maintained NUM_MOD_*_CHANNELS counts in modbus.h, and the TS-60 alarm
+//   words merged by comparing channel names to "ABloD60", "ABhiD60", etc. for every channel every second.
+// Now each group of channels is ONE constexpr table, and the counts are the table sizes, so they can't drift apart:
+//   - controller channels: ctl_chans[] below
+//   - Modbus channels: mod_fast_chans[], mod_slow_chans[], mod_nuv_chans[] in modbus.h
+// The SD (sdcard.ino), UDP/HTTP (webclient.ino) and web page (webserver.ino) outputs all get channel names and formatted
+//   values through getChanName() and formatChanVal() in webclient.ino, which just look up these tables.
+// The tables are checked by static_assert's, so a channel number that doesn't match its table position, or a merged
+//   word without its partner, is a compile error.
+// This is a .h file (#include'd in wwe.ino) so that every sketch tab can see it.
+
+#ifndef CHANNELS_DEFINED
+#define CHANNELS_DEFINED
+
+// Channel groups. Same numbers as the do_modbus arg used by the SD, UDP and HTTP output functions.
+#define CH_GROUP_CONTROLLER 0
+#define CH_GROUP_MOD_FAST 1                        // Morningstar Modbus/RTU 'fast' regs
+#define CH_GROUP_MOD_SLOW 2                        // Morningstar Modbus/RTU 'slow' regs
+#define CH_GROUP_NUVATION 3                        // Nuvation Modbus/TCP regs
+
+// Controller channel decimals
+#define CH_INT -1                                  // print the native value as an integer (bitfield)
+
+// Modbus channel flags
+#define CH_MERGE_LO 1                              // low word of a 32-bit val: not output by itself, see CH_MERGE_HI
+#define CH_MERGE_HI 2                              // high word: output as ONE channel, (HI << 16) + LO, with the LO channel
+                                                   //   immediately before it in the table, and named merged_name
+#define CH_NOT_CACHED 4                            // EEPROM reg in the 'fast' table that's NOT in a long read cache, so it's
+                                                   //   read with the 'slow' regs, not from the cache every second
+
+struct ChannelDesc {
+  int id;                                          // channel number, MUST equal the table position
+  const char* name;                                // label in the SD, UDP and HTTP channel lists
+  const char* units;
+  float scale;                                     // val in units = native val (getChannelRMSInt()) * scale
+  int8_t decimals;                                 // decimal places, or CH_INT
+};
+
+class ModbusReg;                                   // see modbus.h
+
+struct ModChannel {
+  ModbusReg* reg;                                  // name, units and val come from the reg
+  uint8_t flags;                                   // CH_MERGE_LO, CH_MERGE_HI, CH_NOT_CACHED
+  const char* merged_name;                         // CH_MERGE_HI only
+};
+
+
+// Controller channel numbers. These index acs[] in adc.ino, and are used as channel numbers everywhere else.
+const int L1_VOLTAGE = 0;
+const int L2_VOLTAGE = 1;
+const int L3_VOLTAGE = 2;
+const int DC_VOLTAGE = 3;
+const int LINE_VOLTAGE = 4;
+const int L1_CURRENT = 5;
+const int L2_CURRENT = 6;
+const int L3_CURRENT = 7;
+const int DC_CURRENT = 8;
+const int L1L2_VOLTAGE = 9;
+const int L2L3_VOLTAGE = 10;
+const int L3L1_VOLTAGE = 11;
+const int RPM = 12;
+const int WINDSPEED = 13;
+const int DUMP_LOAD_P = 14;
+const int RECT_TEMP = 15;
+const int AMBIENT_TEMP = 16;
+const int CONTROLLER_TEMP = 17;
+const int TAIL_POSITION = 18;
+const int WATT_HOURS = 19;
+const int HVDL_DUTY_CYCLE = 20;
+const int STATE = 21;                              // controller state MUST be the last channel
+
+#define CH_1024X (1.0 / 1024.0)                    // most channel vals are 1024x actual
+#define CH_TP_DEG_PER_USTEP (360.0 / (2000 * 62))  // TP is in usteps: 2000 usteps/rev, 62:1 gear --> 0.002903226 deg/ustep
+
+constexpr ChannelDesc ctl_chans[] = {
+  { L1_VOLTAGE,      "V1",    "V",   CH_1024X, 2 },
+  { L2_VOLTAGE,      "V2",    "V",   CH_1024X, 2 },
+  { L3_VOLTAGE,      "V3",    "V",   CH_1024X, 2 },
+  { DC_VOLTAGE,      "VDC",   "V",   CH_1024X, 2 },
+  { LINE_VOLTAGE,    "VL",    "V",   CH_1024X, 2 },
+  { L1_CURRENT,      "I1",    "A",   CH_1024X, 2 },
+  { L2_CURRENT,      "I2",    "A",   CH_1024X, 2 },
+  { L3_CURRENT,      "I3",    "A",   CH_1024X, 2 },
+  { DC_CURRENT,      "IDC",   "A",   CH_1024X, 2 },
+  { L1L2_VOLTAGE,    "V12",   "V",   CH_1024X, 2 },
+  { L2L3_VOLTAGE,    "V23",   "V",   CH_1024X, 2 },
+  { L3L1_VOLTAGE,    "V31",   "V",   CH_1024X, 2 },
+  { RPM,             "RPM",   "rpm", CH_1024X, 2 },
+  { WINDSPEED,       "WS",    "m/s", CH_1024X, 2 },
+  { DUMP_LOAD_P,     "Pd",    "",    CH_1024X, 2 },  // used for various vals, see ac_Pd in adc.ino
+  { RECT_TEMP,       "Tr",    "C",   CH_1024X, 2 },
+  { AMBIENT_TEMP,    "Ta",    "F",   CH_1024X, 2 },
+  { CONTROLLER_TEMP, "Tc",    "C",   CH_1024X, 2 },
+  { TAIL_POSITION,   "TP",    "deg", CH_TP_DEG_PER_USTEP, 2 },
+  { WATT_HOURS,      "Wh",    "Wh",  CH_1024X, 2 },
+  { HVDL_DUTY_CYCLE, "DL",    "",    0.01, 2 },      // native val is an integer %, output as a fraction
+  { STATE,           "State", "",    1.0, CH_INT },
+};
+
+const int NUM_ADC_CHANNELS = sizeof(ctl_chans) / sizeof(ctl_chans[0]);  // total # includes STATE
+
+// Compile-time checks of the tables. constexpr functions must be a single return statement (C++11), hence the recursion.
+constexpr bool ctlChannelsOK(int i) {
+  return( i >= NUM_ADC_CHANNELS || (ctl_chans[i].id == i && ctlChannelsOK(i + 1)) );
+}
+
+constexpr bool modChannelsOK(const ModChannel* chans, int n, int i) {
+  return( i >= n || ((!(chans[i].flags & CH_MERGE_HI) || (i > 0 && (chans[i-1].flags & CH_MERGE_LO) && chans[i].merged_name))
+                     && (!(chans[i].flags & CH_MERGE_LO) || (i + 1 < n && (chans[i+1].flags & CH_MERGE_HI)))
+                     && modChannelsOK(chans, n, i + 1)) );
+}
+
+static_assert(ctlChannelsOK(0), "channels.h: ctl_chans[] is not in channel number order");
+static_assert(STATE == NUM_ADC_CHANNELS - 1, "channels.h: STATE must be the last channel");
+
+#endif
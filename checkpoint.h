@@ -0,0 +1,36 @@
+// ---------- checkpoint.h ----------
+// Runtime state checkpoint layout - see checkpoint.ino
+// This is a .h file (#include'd in wwe.ino) so that wwe.ino can see it.
+
+#ifndef CHECKPOINT_DEFINED
+#define CHECKPOINT_DEFINED
+
+// Flash ring: the 4 KB just below the parm store (see parmstore.h), well above the updatefw.bin bootloader at 0xC0000
+#define CKPT_ADDR 0xF7000                  // ABSOLUTE flash address - see note re DueFlashStorage.h in wwe.ino
+#define CKPT_NUM_PAGES 16
+#define CKPT_PAGE_SIZE 256                 // IFLASH1_PAGE_SIZE
+#define CKPT_RECS_PER_PAGE (CKPT_PAGE_SIZE / sizeof(CkptRecord))
+#define CKPT_NUM_RECS (CKPT_NUM_PAGES * CKPT_RECS_PER_PAGE)
+#define CKPT_MAGIC 0x54504B43              // "CKPT"
+#define CKPT_INTERVAL_SEC 300              // scheduled checkpoint interval; 128 records per ring --> each page is erased every 10.7 hours
+
+// SAM3X backup registers 6 and 7 (0-5 are the supervisor's - see supervisor.h): the tail position, written every msec
+#define CKPT_GPBR_TP 6                     // motor.currentPosition(), usteps
+#define CKPT_GPBR_TP_CHECK 7               // ~TP ^ CKPT_MAGIC, so a power-up's random contents aren't taken for a position
+
+struct CkptRecord {
+  uint32_t magic;
+  uint32_t seq;                            // checkpoint sequence #, highest valid one wins; record i of the ring holds seq % CKPT_NUM_RECS == i
+  uint32_t time;                           // myunixtime
+  int32_t wind_Wh;                         // daily energy, Wh 1024x actual - see readADCs() in adc.ino
+  int32_t total_tail_motion;               // usteps of tail motion since the last full furl - see furlctl1() in furlctl.ino
+  int32_t quiet_time;                      // furlctl1() iterations since the last furl condition
+  int32_t tail_pos;                        // motor.currentPosition(), usteps
+  uint32_t crc;                            // CRC32 of the 28 bytes above - see crc32Update() in parmstore.ino
+};
+
+static_assert(sizeof(CkptRecord) == 32 && (CKPT_PAGE_SIZE % sizeof(CkptRecord)) == 0, "checkpoint.h: a flash page must hold a whole number of records");
+
+uint32_t ckpt_seq = 0;                     // seq of the newest checkpoint in flash, 0 = none
+
+#endif
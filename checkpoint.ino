@@ -0,0 +1,123 @@
+// ---------- checkpoint.ino ----------
+// RUNTIME STATE CHECKPOINTS
+//
+// A watchdog reset, a firmware update or a power cut used to lose all runtime state: the day's wind energy (wind_Wh),
+//   the tail slippage counter (total_tail_motion), the tail exercise timer (quiet_time) and the tail position. Only parms
+//   survive (flash and SD). Now a small CRC-protected record of that state is checkpointed, and restored in setup():
+//   - Flash ring: a 32-byte CkptRecord, written every CKPT_INTERVAL_SEC (in if(do_post){}), and before an orderly reboot
+//     (doFWUpdate() in wwe.ino). Records are appended in a 4 KB ring of 16 pages x 8 records. A page is erased only when
+//     the ring wraps onto it; the other 7 records are programmed into the erased page WITHOUT an erase, so each page sees
+//     one erase per 128 checkpoints. Writes to flash bank 1 don't stall the timer interrupts - see parmstore.ino
+//   - Backup registers: the tail position changes too fast for a 5-minute checkpoint, so readADCs() also writes it to
+//     GPBR 6 every msec, with a check word in GPBR 7. They survive any reset but a power cycle.
+// restoreCheckpoint() finds the valid record with the highest seq (a 128-record scan of memory-mapped flash and one CRC,
+//   i.e., microseconds, no SD), and:
+//   - myunixtime: if the RTC didn't give us a later time
+//   - wind_Wh: if the checkpoint is from the same UTC day (wind_Wh is zeroed at 00:00 UTC - see readADCs())
+//   - quiet_time: as checkpointed, so a reset doesn't postpone the daily tail exercise
+//   - total_tail_motion: reported only. Initializing TP at boot re-zeros it, as before - see furlctl1()
+//   - tail position: from GPBR 6, if its check word is good, i.e., this wasn't a power-up. The tail isn't re-homed any
+//     less: furlctl1() still initializes TP with the reed switch, but it starts from where the tail really is.
+//
+// Layout, ring geometry and GPBR registers are in checkpoint.h
+
+
+uint32_t getCkptRecordAddr(int i) {
+  return( CKPT_ADDR + (i / CKPT_RECS_PER_PAGE) * CKPT_PAGE_SIZE + (i % CKPT_RECS_PER_PAGE) * sizeof(CkptRecord) );
+}
+
+
+// Copy ring record i into rec. Returns true if it is complete and uncorrupted.
+boolean readCkptRecord(int i, CkptRecord* rec) {
+  memcpy(rec, dueflashstorage.readAddress(getCkptRecordAddr(i)), sizeof(CkptRecord));
+  if ( rec->magic != CKPT_MAGIC || (rec->seq % CKPT_NUM_RECS) != (uint32_t)i ) return(false);
+  return( crc32Update(0, (byte*)rec, sizeof(CkptRecord) - 4) == rec->crc );
+}
+
+
+// Save the tail position in the backup registers. Called from readADCs() ONLY, every msec.
+void saveCheckpointTP(int pos) {
+  GPBR->SYS_GPBR[CKPT_GPBR_TP] = pos;
+  GPBR->SYS_GPBR[CKPT_GPBR_TP_CHECK] = ~(uint32_t)pos ^ CKPT_MAGIC;   // a reset between these 2 writes just fails the check
+}
+
+
+// Restore runtime state from the newest checkpoint. Call ONCE in setup(), after the RTC time is read and BEFORE the timers start.
+// Returns true if a checkpoint was found.
+boolean restoreCheckpoint() {
+  CkptRecord rec;
+  CkptRecord newest;
+  boolean found = false;
+
+  // Tail position, from the backup registers
+  uint32_t tp = GPBR->SYS_GPBR[CKPT_GPBR_TP];
+  if ( GPBR->SYS_GPBR[CKPT_GPBR_TP_CHECK] == (~tp ^ CKPT_MAGIC) ) {
+    motor.currentPosition((int)tp);
+    motor.desiredPosition((int)tp);    // hold it here, don't drive the tail to 0
+    Serial << "checkpoint: Restored TP = " << (int)tp << " usteps\n";
+  }
+
+  for ( int i = 0; i < CKPT_NUM_RECS; i++ ) {
+    if ( readCkptRecord(i, &rec) && (!found || (int32_t)(rec.seq - newest.seq) > 0) ) {
+      newest = rec;
+      found = true;
+    }
+  }
+  if ( !found ) {
+    Serial << "checkpoint: No checkpoint in flash\n";
+    return(false);
+  }
+  ckpt_seq = newest.seq;
+
+  if ( myunixtime < newest.time ) myunixtime = newest.time;    // RTC failed or is behind
+  if ( (newest.time / 86400) == (myunixtime / 86400) ) wind_Wh = newest.wind_Wh;
+  quiet_time = newest.quiet_time;
+  Serial << "checkpoint: Restored seq " << newest.seq << " from " << myunixtime - newest.time << " sec ago: Wh = "
+         << (wind_Wh >> 10) << ", tail motion was " << newest.total_tail_motion << ", quiet time = " << quiet_time
+         << ", TP was " << newest.tail_pos << "\n";
+  return(true);
+}
+
+
+// Write a checkpoint of the current runtime state to the next ring record. Returns true if it verifies.
+// Called every CKPT_INTERVAL_SEC in if(do_post){}, and before an orderly reboot - see wwe.ino
+boolean writeCheckpoint() {
+  CkptRecord rec;
+  rec.magic = CKPT_MAGIC;
+  rec.seq = ckpt_seq + 1;
+  rec.time = myunixtime;
+  rec.wind_Wh = wind_Wh;
+  rec.total_tail_motion = total_tail_motion;
+  rec.quiet_time = quiet_time;
+  rec.tail_pos = motor.currentPosition();
+  rec.crc = crc32Update(0, (byte*)&rec, sizeof(rec) - 4);
+
+  int i = rec.seq % CKPT_NUM_RECS;
+  uint32_t addr = getCkptRecordAddr(i);
+  byte* slot = dueflashstorage.readAddress(addr);
+  boolean blank = true;
+  for ( int n = 0; n < (int)sizeof(rec); n++ ) if ( slot[n] != 0xFF ) blank = false;
+
+  if ( (i % CKPT_RECS_PER_PAGE) == 0 ) {
+    // First record of a page: erase it, dropping the records from the last time around the ring
+    byte page[CKPT_PAGE_SIZE];
+    memset(page, 0xFF, CKPT_PAGE_SIZE);
+    memcpy(page, &rec, sizeof(rec));
+    dueflashstorage.write(addr, page, CKPT_PAGE_SIZE);
+  } else if ( blank ) {
+    // Program the erased record in place, no erase
+    flash_unlock(addr, addr + sizeof(rec) - 1, 0, 0);
+    flash_write(addr, &rec, sizeof(rec), 0);
+    flash_lock(addr, addr + sizeof(rec) - 1, 0, 0);  // re-lock, as DueFlashStorage::write() does
+  } else {
+    // Not erased (e.g., a write cut short by a reset): rewrite the page, keeping its other records
+    dueflashstorage.write(addr, (byte*)&rec, sizeof(rec));
+  }
+
+  if ( !readCkptRecord(i, &rec) || rec.seq != ckpt_seq + 1 ) {
+    Serial << "checkpoint: Verify FAILED for record " << i << "\n";
+    return(false);
+  }
+  ckpt_seq = rec.seq;
+  return(true);
+}
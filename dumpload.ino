@@ -0,0 +1,140 @@
+// ---------- dumpload.ino ----------
+// DUMP LOAD (HVDL) DRIVE AND REGULATION
+//
+// manageDumpLoad() in furlctl.ino decides WHEN to dump (Morningstar not OK, TS-MPPT-600V disconnected, or unloaded).
+//   This module decides HOW MUCH, and drives the IGBT.
+//
+// Duty cycle, in 0.1% units (dump_load_duty_pm, 0-1000), is updated at 100 Hz, in one of 2 modes (parm_hvdl_mode):
+//   0 = RAMP: the original open-loop load curve. Duty rises linearly from Vstart to Vstart+Vspan, then falls to hold
+//       power at Pmax, so P(V) matches the curve programmed into the TS-MPPT-600V.
+//   1 = PI:   closed-loop regulation of DC voltage at parm_hvdl_Vreg. Fixed-point PI with anti-windup: the integral is
+//       clamped to the output range, and it stops integrating while the output is saturated in the direction of the error.
+//       Gains: parm_hvdl_Kp (0.1% per V), parm_hvdl_Ki (0.1% per V-sec).
+//   In both modes, duty is limited so that dump load power never exceeds Pmax (duty <= R*Pmax/V^2).
+//
+// Drive:
+//   - DUMP_PWM_HW defined (see pindefs.h): a SAM3X PWM channel on DUMP_IGBT_PWM_PIN drives the IGBT in hardware,
+//     at parm_hvdl_pwm_hz with 16-bit period resolution (always better than 0.1%). The ISR only writes the duty cycle,
+//     at 100 Hz, double-buffered by the PWM so it takes effect at the end of a period. ***DUMP_IGBT_DRV_PIN (28) has no
+//     PWM function, so the IGBT driver input must be wired to DUMP_IGBT_PWM_PIN***
+//   - otherwise: software PWM on DUMP_IGBT_DRV_PIN, as before: 100 Hz, 1% resolution, the pin toggled by the 10 kHz ISR.
+//     parm_hvdl_pwm_hz is ignored.
+
+#define DUMP_DUTY_MAX 1000                     // 100.0%
+#define DUMP_UPDATE_HZ 100                     // computeDumpLoadDuty() rate
+#define DUMP_PWM_MIN_HZ 50
+#define DUMP_PWM_MAX_HZ 20000
+
+int dump_load_duty_pm = 0;                     // duty cycle, 0.1% units; dump_load_duty_cycle (%) is kept for the DL channel
+int32_t dump_pi_integral = 0;                  // PI integral term, 0.1% units, 1024x
+int dump_pwm_hz = 0;                           // carrier frequency the PWM channel is set to, 0 = not set
+
+
+// Set up the dump load drive, load OFF. Called in setup(), BEFORE the timers start.
+void initDumpLoad() {
+#ifdef DUMP_PWM_HW
+  pinMode(DUMP_IGBT_DRV_PIN, INPUT);           // not connected to the IGBT driver any more, don't drive it
+  pmc_enable_periph_clk(ID_PWM);
+  configureDumpLoadPWM(parm_hvdl_pwm_hz.intVal());
+  const PinDescription* pin = &g_APinDescription[DUMP_IGBT_PWM_PIN];
+  PIO_Configure(pin->pPort, pin->ulPinType, pin->ulPin, pin->ulPinConfiguration);  // hand the pin to the PWM
+  Serial << "dumpload: Hardware PWM on pin " << DUMP_IGBT_PWM_PIN << ", " << dump_pwm_hz << " Hz\n";
+#else
+  digitalWriteDirect(DUMP_IGBT_DRV_PIN, DUMP_LOAD_OFF);
+  Serial << "dumpload: Software PWM on pin " << DUMP_IGBT_DRV_PIN << ", 100 Hz\n";
+#endif
+  digitalWriteDirect(DUMP_LOAD_ACTIVE_LED_PIN, HIGH);
+}
+
+
+#ifdef DUMP_PWM_HW
+// (Re)configure the PWM channel for a carrier of hz, duty 0. Safe to call from the ISR.
+void configureDumpLoadPWM(int hz) {
+  uint32_t ch = g_APinDescription[DUMP_IGBT_PWM_PIN].ulPWMChannel;
+  hz = constrain(hz, DUMP_PWM_MIN_HZ, DUMP_PWM_MAX_HZ);
+  uint32_t pre = 0;                            // MCK / 2^pre, the fastest clock whose period fits in 16 bits
+  while ( (VARIANT_MCK >> pre) / hz > 65535 ) pre++;
+  uint32_t period = (VARIANT_MCK >> pre) / hz;
+  // PWML output: with CPOL = 0 it is HIGH for the duty cycle, so invert it for an active-LOW drive - see pindefs.h
+  PWMC_DisableChannel(PWM, ch);
+  PWMC_ConfigureChannel(PWM, ch, pre, 0, (DUMP_LOAD_ON == HIGH) ? 0 : PWM_CMR_CPOL);
+  PWMC_SetPeriod(PWM, ch, period);
+  PWMC_SetDutyCycle(PWM, ch, 0);
+  PWMC_EnableChannel(PWM, ch);
+  dump_pwm_hz = hz;
+}
+#endif
+
+
+// Drive the IGBT at duty (0.1% units). Called from manageDumpLoad() ONLY, i.e., from the ISR.
+//   Hardware PWM: called at 100 Hz. Software PWM: called every tick (10 kHz), with tick = 0-99 within the 10 msec period.
+void driveDumpLoad(int duty, int tick) {
+#ifdef DUMP_PWM_HW
+  if ( parm_hvdl_pwm_hz.intVal() != dump_pwm_hz ) configureDumpLoadPWM(parm_hvdl_pwm_hz.intVal());  // parm changed
+  uint32_t ch = g_APinDescription[DUMP_IGBT_PWM_PIN].ulPWMChannel;
+  PWMC_SetDutyCycle(PWM, ch, (PWM->PWM_CH_NUM[ch].PWM_CPRD * duty) / DUMP_DUTY_MAX);
+  digitalWriteDirect(DUMP_LOAD_ACTIVE_LED_PIN, duty > 0 ? LOW : HIGH);
+#else
+  // ON for duty/10 ticks (1 tick = 0.1 msec) out of every 100 ticks = 10 msec
+  boolean on = tick < (duty / 10);
+  digitalWriteDirect(DUMP_IGBT_DRV_PIN, on ? DUMP_LOAD_ON : DUMP_LOAD_OFF);
+  digitalWriteDirect(DUMP_LOAD_ACTIVE_LED_PIN, on ? LOW : HIGH);
+#endif
+}
+
+
+// Dump load OFF and the regulator reset. Called when manageDumpLoad() stops dumping.
+void stopDumpLoad() {
+  dump_pi_integral = 0;
+  dump_load_duty_pm = 0;
+  dump_load_duty_cycle = 0;
+  driveDumpLoad(0, 0);
+}
+
+
+// Returns the duty cycle (0.1% units) for DC voltage dc_voltage (1024x actual). Called at 100 Hz while dumping.
+// We use integer math throughout, no floating point!
+int computeDumpLoadDuty(int dc_voltage) {
+  int dump_load_resistance = parm_hvdl_R.intVal() << 10;      // ohms, 1024x actual
+  int dump_load_max_power = parm_hvdl_Pmax.intVal() << 10;    // W, 1024x actual
+  int v_start = parm_hvdl_Vstart.intVal() << 10;              // V, 1024x actual
+  int v_span = parm_hvdl_Vspan.intVal() << 10;                // V, 1024x actual
+  int v_full = v_start + v_span;
+  int duty;
+
+  // Duty cycle at which the dump load draws Pmax at voltage v: R*Pmax/V^2. In 64 bits, so it doesn't overflow at 0.1%
+  //   resolution: e.g., (18*1024) * 1000 * (2200*1024) / (230*1024)^2 = 748.6 --> 74.9%
+  int64_t pmax_num = (int64_t)dump_load_resistance * DUMP_DUTY_MAX * dump_load_max_power;
+  int max_duty = (v_full > 0) ? pmax_num / ((int64_t)v_full * v_full) : 0;
+  int limit = (dc_voltage > (1 << 10)) ? min((int64_t)DUMP_DUTY_MAX, pmax_num / ((int64_t)dc_voltage * dc_voltage)) : DUMP_DUTY_MAX;
+
+  if ( parm_hvdl_mode.intVal() == 1 ) {
+    // PI: error in V (1024x), gains in 0.1% per V and 0.1% per V-sec, so terms are 0.1% units, 1024x
+    int err = dc_voltage - (parm_hvdl_Vreg.intVal() << 10);
+    int p_term = parm_hvdl_Kp.intVal() * err;
+    int out = (p_term + dump_pi_integral) >> 10;
+    // Anti-windup: don't integrate further into saturation
+    if ( !((out >= limit && err > 0) || (out <= 0 && err < 0)) ) {
+      dump_pi_integral += (parm_hvdl_Ki.intVal() * err) / DUMP_UPDATE_HZ;
+      dump_pi_integral = constrain(dump_pi_integral, 0, limit << 10);
+    }
+    duty = (p_term + dump_pi_integral) >> 10;
+  } else {
+    // RAMP: if vstart + v_span > 120+110 = 230V, we want MAX and CONSTANT power = 2200W = max_duty * (V^2/R).
+    if ( dc_voltage >= v_start ) {              // if dc_voltage is ABOVE v_start (both are 1024x actual)...
+      if ( dc_voltage > v_full ) {              //   if dc_voltage has exceeded (vstart + v_span)...
+        // Above 230V, duty cycle DECREASES as voltage rises to MAINTAIN power at dump_load_max_power = 2200W
+        duty = limit;
+      } else {                                  //   otherwise, dc_voltage is BETWEEN v_start and (vstart + v_span)...
+        // CREATE A SMOOTH LOAD CURVE:
+        // Duty cycle increases linearly with V as power increases with V^2, so P(V) = duty(V) * (V^2)/R
+        // ***This works amazingly well. So much so that this equation is used to calculate the P(V) load curve programmed into the TS-MPPT-600V.***
+        //    Because the load curves are identical, switching between the TS-MPPT-600V and the HVDL should be seamless.
+        duty = ((int64_t)max_duty * (dc_voltage - v_start)) / v_span;
+      }
+    } else {                                    // otherwise, dc_voltage is BELOW v_start...
+      duty = 0;                                 //   so no load yet
+    }
+  }
+  return( constrain(duty, 0, limit) );
+}
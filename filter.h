@@ -0,0 +1,43 @@
+// ---------- filter.h ----------
+// Per-channel ADC filter chains - see filter.ino
+// This is a .h file (#include'd in wwe.ino) so that adc.ino, which comes before filter.ino, can see it.
+
+#ifndef FILTER_DEFINED
+#define FILTER_DEFINED
+
+#define FILT_NUM_CHANNELS 9                 // the raw ADC channels, L1_VOLTAGE ... DC_CURRENT - same as CHBANK_SIZE in adc.ino
+#define FILT_FS_HZ 1000                     // each raw channel is read every 10th readADCs() tick
+#define FILT_MAX_MEDIAN 7                   // median window, odd, 1 = off
+#define FILT_MAX_DECIM 16                   // averaging decimation factor
+#define FILT_MAX_BIQUADS 2                  // biquad stages per channel
+#define FILT_COEF_SHIFT 28                  // biquad coefficients are Q4.28: |a1| < 2 and enough bits for fc down to ~1 Hz
+#define FILT_STATE_FRAC 10                  // biquad outputs are kept with 10 more fraction bits than 1024x, so |val| < 2048 actual
+#define FILT_MIN_FC_DIV 200                 // fc >= fs/200, where the rounding dead-band is < 1/2 LSB (1024x) - see parseFilterChains()
+
+// One channel's chain, computed by loop() - see updateFilterChains()
+struct FiltChainCfg {
+  boolean active;                           // false = the default: median-of-3 + EMA, as before
+  uint8_t median_len;
+  uint8_t decim;
+  uint8_t num_biquads;
+  int alpha_int;                            // EMA alpha, 1024x actual, applied last - see sampleChannelBank() in adc.ino
+  int32_t b0[FILT_MAX_BIQUADS], b1[FILT_MAX_BIQUADS], b2[FILT_MAX_BIQUADS];  // Q4.28
+  int32_t a1[FILT_MAX_BIQUADS], a2[FILT_MAX_BIQUADS];                          // Q4.28, a0 = 1
+};
+
+// One channel's chain state, ISR only
+struct FiltChainState {
+  uint32_t gen;                             // filt_gen this state was primed for; a mismatch re-primes it
+  uint8_t med_ptr;
+  uint8_t decim_count;
+  int32_t decim_sum;
+  int med[FILT_MAX_MEDIAN];
+  int x1[FILT_MAX_BIQUADS], x2[FILT_MAX_BIQUADS];  // biquad history, Direct Form I, 1024x actual
+  int y1[FILT_MAX_BIQUADS], y2[FILT_MAX_BIQUADS];  // 1024x actual << FILT_STATE_FRAC
+};
+
+FiltChainCfg filt_cfg[2][FILT_NUM_CHANNELS];  // the ISR uses filt_cfg[filt_gen & 1]; loop() fills the other one, then bumps filt_gen
+volatile uint32_t filt_gen = 0;
+FiltChainState filt_state[FILT_NUM_CHANNELS];
+
+#endif
@@ -0,0 +1,203 @@
+// ---------- filter.ino ----------
+// PER-CHANNEL ADC FILTER CHAINS
+//
+// By default each raw ADC channel (V1 ... IDC, see analog_channels[] in adc.ino) gets a median-of-3 and an EMA with
+//   AVG_ALPHA, both hard-wired. parm_adc_filt replaces that, per channel, with a chain of fixed-point stages, so noise
+//   can be traded against latency at a site without a firmware release. It's a comma-separated list of (case doesn't matter):
+//     <chan>:<stage>/<stage>/...        chan = V1, V2, V3, VDC, I1, I2, I3 or IDC (not VL: it isn't read)
+//                                       V1, V2 and V3 may only have an A stage - see phasefault.ino
+//   Stages, run in THIS order whatever order they're listed in:
+//     M<n>       median of the last n samples, n = 1 (off), 3, 5 or 7; default 3
+//     D<n>       average n samples, output every nth (CIC order 1), n = 1 ... FILT_MAX_DECIM; default 1
+//                The channel's instantaneous val is held between outputs.
+//     B<fc>      2nd-order Butterworth low-pass at fc Hz, at the decimated rate, fs/FILT_MIN_FC_DIV <= fc <= 0.45 fs;
+//                up to FILT_MAX_BIQUADS
+//     A<alpha>   EMA alpha of the channel's average (RMS) val, per 1000 Hz sample, 1/1024 <= alpha <= 1; default AVG_ALPHA
+//                The EMA only sees the decimated outputs, so with D<n> it's applied as 1 - (1 - alpha)^n: the same time
+//                constant, in seconds, as without decimation.
+//   e.g., "IDC:M5/B50,VDC:D4/B10/A0.2". Channels not listed are filtered as before. An empty parm = all as before.
+//
+// Coefficients are computed in loop() by updateFilterChains() when a parm changes, into the table the ISR is NOT using,
+//   then filt_gen is bumped, which flips the ISR to the new table in one word write. A channel's chain state is
+//   re-primed from its next sample when the table flips, so a changed chain doesn't start from stale history.
+//   A parm change that leaves the chains as they were doesn't flip the table.
+// Biquad outputs are fed back with FILT_STATE_FRAC extra fraction bits, and b1 absorbs the coefficient rounding so the
+//   DC gain is exactly 1. Rounding at 1024x alone left a dead-band of many volts at a low fc (a 100 V step settled at
+//   112 V with B1); at fc >= fs/FILT_MIN_FC_DIV the dead-band is now < 1/2 LSB.
+// Chain sample rate is FILT_FS_HZ (each raw channel is read every 10th readADCs() tick). A 7-sample median and two
+//   biquads cost a few hundred cycles per sample, i.e., a few percent of the 100 usec tick - see bench.ino
+
+
+// Median of the n (odd) vals in v, n <= FILT_MAX_MEDIAN
+int medianInt(int* v, int n) {
+  if ( n == 3 ) return( median3Int(v[0], v[1], v[2]) );
+  int s[FILT_MAX_MEDIAN];
+  for ( int i = 0; i < n; i++ ) {
+    int j = i;
+    for ( ; j > 0 && s[j-1] > v[i]; j-- ) s[j] = s[j-1];   // insertion sort
+    s[j] = v[i];
+  }
+  return( s[n / 2] );
+}
+
+
+// Run val (1024x actual) through raw channel ch's chain in filt_cfg[gen & 1]. Called from readADCs() ONLY - see AnalogChannel::read()
+// Returns true, with the filtered val in *val, if there's an output this sample (always, unless decimating).
+boolean filterChainSample(int ch, uint32_t gen, int* val) {
+  FiltChainCfg* c = &filt_cfg[gen & 1][ch];
+  FiltChainState* s = &filt_state[ch];
+  int x = *val;
+
+  if ( s->gen != gen ) {                   // new table: start from a steady state at this sample
+    s->gen = gen;
+    s->med_ptr = 0;
+    s->decim_count = 0;
+    s->decim_sum = 0;
+    for ( int i = 0; i < FILT_MAX_MEDIAN; i++ ) s->med[i] = x;
+    for ( int k = 0; k < FILT_MAX_BIQUADS; k++ ) {
+      s->x1[k] = s->x2[k] = x;
+      s->y1[k] = s->y2[k] = x * (1 << FILT_STATE_FRAC);
+    }
+  }
+
+  if ( c->median_len > 1 ) {
+    s->med[s->med_ptr] = x;
+    if ( ++s->med_ptr >= c->median_len ) s->med_ptr = 0;
+    x = medianInt(s->med, c->median_len);
+  }
+
+  if ( c->decim > 1 ) {
+    s->decim_sum += x;
+    if ( ++s->decim_count < c->decim ) return(false);
+    x = s->decim_sum / c->decim;
+    s->decim_sum = 0;
+    s->decim_count = 0;
+  }
+
+  for ( int k = 0; k < c->num_biquads; k++ ) {   // Direct Form I, 64-bit accumulator (SMULL/SMLAL)
+    int64_t acc = ((int64_t)c->b0[k] * x + (int64_t)c->b1[k] * s->x1[k] + (int64_t)c->b2[k] * s->x2[k]) * (1 << FILT_STATE_FRAC)
+                - (int64_t)c->a1[k] * s->y1[k] - (int64_t)c->a2[k] * s->y2[k];
+    int y = (int)((acc + (1LL << (FILT_COEF_SHIFT - 1))) >> FILT_COEF_SHIFT);  // 1024x actual << FILT_STATE_FRAC
+    s->x2[k] = s->x1[k];
+    s->x1[k] = x;
+    s->y2[k] = s->y1[k];
+    s->y1[k] = y;
+    x = (y + (1 << (FILT_STATE_FRAC - 1))) >> FILT_STATE_FRAC;
+  }
+
+  *val = x;
+  return(true);
+}
+
+
+// Set biquad stage k of c to a 2nd-order Butterworth low-pass at fc Hz, sample rate fs Hz (RBJ cookbook, Q = 1/sqrt(2))
+void calcLowPassBiquad(FiltChainCfg* c, int k, float fc, float fs) {
+  double w0 = 2.0 * PI * fc / fs;
+  double cw = cos(w0);
+  double alpha = sin(w0) / (2.0 * 0.70710678);
+  double scale = (double)(1L << FILT_COEF_SHIFT) / (1.0 + alpha);   // normalize to a0 = 1
+  c->b0[k] = (int32_t)lround((1.0 - cw) / 2.0 * scale);
+  c->b2[k] = c->b0[k];
+  c->a1[k] = (int32_t)lround(-2.0 * cw * scale);
+  c->a2[k] = (int32_t)lround((1.0 - alpha) * scale);
+  c->b1[k] = (1L << FILT_COEF_SHIFT) + c->a1[k] + c->a2[k] - 2 * c->b0[k];  // = (1 - cw) * scale, rounded so b0 + b1 + b2 = 1 + a1 + a2
+}
+
+
+// Parse parm_adc_filt into filt_cfg[which]. Returns the # channel chains, or -1 if there's a bad one (which is skipped,
+// i.e., that channel is filtered as before).
+int parseFilterChains(char* str, int which) {
+  FiltChainCfg* cfg = filt_cfg[which];
+  char buf[PARM_VAL_LEN];
+  int n = 0;
+  boolean ok = true;
+
+  memset(cfg, 0, sizeof(filt_cfg[0]));
+  for ( int ch = 0; ch < FILT_NUM_CHANNELS; ch++ ) cfg[ch].alpha_int = (int)(1024.0 * AVG_ALPHA);
+  strncpy(buf, str, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  for ( char* tok = strtok(buf, ", "); tok != NULL; tok = strtok(NULL, ", ") ) {
+    char* stage = strchr(tok, ':');
+    int ch = FILT_NUM_CHANNELS;
+    if ( stage ) {
+      *stage++ = 0;
+      for ( ch = 0; ch < FILT_NUM_CHANNELS; ch++ ) if ( !strcasecmp(tok, ctl_chans[ch].name) ) break;
+    }
+    if ( ch == LINE_VOLTAGE ) ch = FILT_NUM_CHANNELS;   // VL isn't read - see readADCs() in adc.ino
+    if ( ch == FILT_NUM_CHANNELS ) {
+      ok = false;
+      continue;
+    }
+
+    FiltChainCfg c;
+    float fc[FILT_MAX_BIQUADS];
+    float alpha = AVG_ALPHA;
+    boolean good = true;
+    memset(&c, 0, sizeof(c));                // memset, not = {}, so memcmp() in updateFilterChains() sees zeroed padding
+    c.active = true;
+    c.median_len = 3;
+    c.decim = 1;
+    c.alpha_int = (int)(1024.0 * AVG_ALPHA);
+    while ( stage && *stage ) {
+      char* next = strchr(stage, '/');
+      if ( next ) *next++ = 0;
+      float v = atof(stage + 1);
+      int iv = (int)v;
+      switch ( toupper(*stage) ) {
+        case 'M':
+          if ( iv < 1 || iv > FILT_MAX_MEDIAN || !(iv & 1) ) good = false;
+          else c.median_len = iv;
+          break;
+        case 'D':
+          if ( iv < 1 || iv > FILT_MAX_DECIM ) good = false;
+          else c.decim = iv;
+          break;
+        case 'B':
+          if ( v <= 0.0 || c.num_biquads == FILT_MAX_BIQUADS ) good = false;
+          else fc[c.num_biquads++] = v;
+          break;
+        case 'A':
+          if ( v < 1.0 / 1024 || v > 1.0 ) good = false;
+          else alpha = v;
+          break;
+        default:
+          good = false;
+      }
+      stage = next;
+    }
+
+    // V1-V3 feed CalcDiff() and the phase-fault detector, which need the three in step: only their A may change
+    if ( ch <= L3_VOLTAGE && (c.median_len != 3 || c.decim != 1 || c.num_biquads) ) good = false;   // see phasefault.ino
+
+    float fs = (float)FILT_FS_HZ / c.decim;
+    for ( int k = 0; k < c.num_biquads; k++ ) {
+      if ( fc[k] < fs / FILT_MIN_FC_DIV || fc[k] > 0.45 * fs ) good = false;   // below fs/FILT_MIN_FC_DIV, the dead-band grows ~1/fc^2
+      else calcLowPassBiquad(&c, k, fc[k], fs);
+    }
+    c.alpha_int = (int)(1024.0 * (1.0 - pow(1.0 - alpha, c.decim)));   // the EMA runs once per decimated output
+    if ( !good ) {
+      ok = false;
+      continue;
+    }
+    memcpy(&cfg[ch], &c, sizeof(c));
+    n++;
+  }
+  return( ok ? n : -1 );
+}
+
+
+// Re-parse the filter chains if any parm has changed, then flip the ISR to the new table if they're different
+void updateFilterChains() {
+  static unsigned long last_parms_version = 0xFFFFFFFF;
+  if ( parms_version == last_parms_version ) return;
+  last_parms_version = parms_version;
+
+  uint32_t gen = filt_gen + 1;
+  int n = parseFilterChains(parm_adc_filt.parmVal(), gen & 1);
+  if ( n < 0 ) Serial << "filter: Bad chain in \"" << parm_adc_filt.parmVal() << "\", skipped\n";
+  if ( memcmp(filt_cfg[gen & 1], filt_cfg[filt_gen & 1], sizeof(filt_cfg[0])) == 0 ) return;
+
+  filt_gen = gen;                            // the ISR now uses the new table
+  for ( int ch = 0; ch < FILT_NUM_CHANNELS; ch++ ) chbank.alpha_int[ch] = filt_cfg[gen & 1][ch].alpha_int;
+  Serial << "filter: " << max(n, 0) << " filter chains from \"" << parm_adc_filt.parmVal() << "\"\n";
+}
@@ -82,40 +82,81 @@ const int FURLlimit = ((62*2000*110)/360) + 1;  // usteps, integer math --> add
 // CONTROLLER_TEMP = 17;
 // TAIL_POSITION = 18;
 // STATE = 19;
+//
+// THRESHOLD RULE ENGINE
+// Each checker is a "rule" that is COMPILED and then EVALUATED:
+//   compile() - converts the threshold parm into the channel's native units (1024x actual, or usteps for TAIL_POSITION).
+//               This is done only when a parm has changed (parms_version, see parms.h), not on every check.
+//   eval()    - compares the channel val with the compiled threshold. Called ONCE per furlctl()/furlctl1() iteration
+//               for ALL rules by evalThresholdRules(), which also builds the furl and SC reason bits in the same pass.
+//   check()   - returns the result of the last eval(). This is what checkFurlConditions(), etc. use.
+// Each rule can have:
+//   hysteresis - once tripped, the rule stays tripped until val falls back past the threshold by hyst_pct % of the threshold.
+//                This keeps a furl reason from chattering on and off when a val hovers right at its threshold.
+//   dwell      - # consecutive evaluations the threshold must be exceeded before the rule trips (0 = trip immediately).
+// If record_violations is true, we count trips and save the time (myunixtime) of the last one - see printThresholdStats().
 
 class thresholdChecker {
   public:
-    thresholdChecker(char* checker_name, int channel_num, Parm* threshold_parmptr, boolean gteq, boolean record_violations): 
+    thresholdChecker(char* checker_name, int channel_num, Parm* threshold_parmptr, boolean gteq, boolean record_violations, 
+                     int hyst_pct = 0, int dwell = 0): 
                      checker_name(checker_name), channel_num(channel_num), parmptr(threshold_parmptr), gteq(gteq), record_violations(record_violations),
-      result(false) {}
+                     hyst_pct(hyst_pct), dwell(dwell), result(false), threshold(0), hyst(0), val(0), dwell_count(0), violations(0), last_trip(0) {}
+
+    // Convert the threshold parm to native channel units.
+    void compile() {
+      int t = parmptr->floatValInt();  // floatValInt() returns floatval_int = (int)(1024.0 * floatval) --> result is 1024x actual!
+                                       // NOTE: floatval_int is set ONLY for FLOAT parms!
 
-    boolean check(boolean verbose) {
-      // First, get the threshold against which we compare the measured val
-      int threshold = parmptr->floatValInt();  // floatValInt() returns floatval_int = (int)(1024.0 * floatval) --> result is 1024x actual!
-                                               // NOTE: floatval_int is set ONLY for FLOAT parms!
-      
       // val is 1024x actual ONLY for the 9 physical analog data channels: 3 AC voltages, DC voltage, Line Voltage, 3 AC currents, and DC current.
-      // This 1024x scale factor is applied by the AnalogChannel class read() method.
-      // getChannelRMSInt(TAIL_POSITION) returns val as motor.currentPosition() in usteps and is NOT 1024x actual.
-      int val = getChannelRMSInt(channel_num);                 
-
-      // Special handling for TP threshold and val
-      if (channel_num == TAIL_POSITION) {
-        threshold = ((threshold*2000)/360)*62;  // deg --> usteps (1024x actual because of floatValInt conversion above)
-        val = abs(val) << 10;                   // abs() because TP val may be (-), then multiply by 1024x to compare with threshold
-      }
+      // getChannelRMSInt(TAIL_POSITION) returns val as motor.currentPosition() in usteps and is NOT 1024x actual, so...
+      // convert the TP threshold deg --> usteps here, once, and round UP so (val >= threshold) is the same as the old (val<<10 >= threshold<<10).
+      if (channel_num == TAIL_POSITION) t = ((((t*2000)/360)*62) + 1023) >> 10;
+      threshold = t;
+      hyst = (abs(t) * hyst_pct) / 100;
+    }
 
-      if (verbose) Serial << "furlctl: checker_name = " << checker_name << ", threshold = " << threshold << ", val = " << val << "\n";
+    // Compare the channel val with the compiled threshold, applying hysteresis and dwell. Returns the (possibly latched) result.
+    boolean eval() {
+      val = getChannelRMSInt(channel_num);
+      if (channel_num == TAIL_POSITION) val = abs(val);  // abs() because TP val may be (-)
 
-      // Compare val with threshold and set result = true or false
-      gteq ? result = (val >= threshold) : result = (val <= threshold);
+      boolean over;
+      if (gteq) {
+        over = result ? (val >= threshold - hyst) : (val >= threshold);  // once tripped, must drop below threshold-hyst to clear
+      } else {
+        over = result ? (val <= threshold + hyst) : (val <= threshold);  // once tripped, must rise above threshold+hyst to clear
+      }
 
-      if (result && record_violations) {
-        // use this to save a breadcrumb?
+      if (!over) {                         // if we're within limits...
+        result = false;                    //   clear the rule
+        dwell_count = 0;                   //   and restart the dwell timer
+      } else if (!result) {                // otherwise, if we're over the threshold but not yet tripped...
+        if (dwell_count >= dwell) {        //   if we've been over for long enough...
+          result = true;                   //     TRIP!
+          dwell_count = 0;
+          if (record_violations) {         //     record the violation
+            violations++;
+            last_trip = myunixtime;
+          }
+        } else {
+          dwell_count++;
+        }
       }
       return (result);
     }
 
+    boolean check(boolean verbose) {
+      if (verbose) Serial << "furlctl: checker_name = " << checker_name << ", threshold = " << threshold << ", val = " << val << "\n";
+      return (result);
+    }
+
+    char* checkerName() { return (checker_name); }
+    int thresholdVal() { return (threshold); }
+    int lastVal() { return (val); }
+    unsigned long violationCount() { return (violations); }
+    unsigned long lastTrip() { return (last_trip); }
+
   private:
     boolean result;
     char* checker_name;
@@ -123,6 +164,14 @@ class thresholdChecker {
     Parm* parmptr;
     boolean gteq;
     boolean record_violations;
+    int hyst_pct;                // hysteresis, % of threshold
+    int dwell;                   // # evaluations over threshold before tripping
+    int threshold;               // compiled threshold, native channel units
+    int hyst;                    // compiled hysteresis, native channel units
+    int val;                     // val at last eval()
+    int dwell_count;
+    unsigned long violations;    // # of trips
+    unsigned long last_trip;     // myunixtime of last trip
 };
 
 // Define threshold names corresponding to elements of the threshold_checkers[] array (defined below).
@@ -139,6 +188,7 @@ class thresholdChecker {
 #define SC_HIGH_RPM 9
 #define SC_HIGH_WS 10
 #define SC_HIGH_TP 11
+#define NUM_THRESHOLD_CHECKERS 12
 const boolean GTEQ = true;   // used by threshold_checkers[]
 const boolean LTEQ = false;  // used by threshold_checkers[]
 
@@ -146,17 +196,18 @@ const boolean LTEQ = false;  // used by threshold_checkers[]
 // Call them individually as threshold_checkers[FURL_INIT_V], etc.
 // This makes it easy to call them elsewhere - see checkFurlConditions(), checkSCSafeConditions(), checkSCNowConditions()
 // We can do various things here, including checking and recording breadcrumbs.
+// Hysteresis is used ONLY on the furl and SC exercise rules. Failsafe rules trip immediately and clear immediately, as before.
 thresholdChecker threshold_checkers[] = {
-  // tail motor FURL thresholds. True if > threshold.
-  thresholdChecker("", DC_VOLTAGE, &parm_furl_init_v, GTEQ, true),   // 0'th array element = FURL_INIT_V checker
-  thresholdChecker("", DC_CURRENT, &parm_furl_init_i, GTEQ, true),   // 1 = FURL_INIT_I
-  thresholdChecker("", RPM, &parm_furl_init_rpm, GTEQ, true),        // 2 = FURL_INIT_RPM
-  thresholdChecker("", WINDSPEED, &parm_furl_init_ws, GTEQ, true),   // 3 = FURL_INIT_WS
+  // tail motor FURL thresholds. True if > threshold. 2% hysteresis.
+  thresholdChecker("FURL_INIT_V", DC_VOLTAGE, &parm_furl_init_v, GTEQ, true, 2, 0),    // 0'th array element = FURL_INIT_V checker
+  thresholdChecker("FURL_INIT_I", DC_CURRENT, &parm_furl_init_i, GTEQ, true, 2, 0),    // 1 = FURL_INIT_I
+  thresholdChecker("FURL_INIT_RPM", RPM, &parm_furl_init_rpm, GTEQ, true, 2, 0),       // 2 = FURL_INIT_RPM
+  thresholdChecker("FURL_INIT_WS", WINDSPEED, &parm_furl_init_ws, GTEQ, true, 2, 0),   // 3 = FURL_INIT_WS
 
-  // shorting contactor EXERCISE thresholds. True if <= threshold.
-  thresholdChecker("", DC_VOLTAGE, &parm_sc_exer_v, LTEQ, true),     // 4 = SC_LOW_V
-  thresholdChecker("", DC_CURRENT, &parm_sc_exer_i, LTEQ, true),     // 5 = SC_LOW_I
-  thresholdChecker("", RPM, &parm_sc_exer_rpm, LTEQ, true),          // 6 = SC_LOW_RPM
+  // shorting contactor EXERCISE thresholds. True if <= threshold. 2% hysteresis.
+  thresholdChecker("SC_LOW_V", DC_VOLTAGE, &parm_sc_exer_v, LTEQ, true, 2, 0),         // 4 = SC_LOW_V
+  thresholdChecker("SC_LOW_I", DC_CURRENT, &parm_sc_exer_i, LTEQ, true, 2, 0),         // 5 = SC_LOW_I
+  thresholdChecker("SC_LOW_RPM", RPM, &parm_sc_exer_rpm, LTEQ, true, 2, 0),            // 6 = SC_LOW_RPM
 
   // shorting contactor FAILSAFE thresholds. True if > threshold.
   thresholdChecker("SC_HIGH_V", DC_VOLTAGE, &parm_sc_furled_failsafe_v, GTEQ, true),  // 7 = SC_HIGH_V
@@ -166,6 +217,47 @@ thresholdChecker threshold_checkers[] = {
   thresholdChecker("SC_HIGH_TP", TAIL_POSITION, &parm_sc_failsafe_tp, GTEQ, true)     // 11 = SC_HIGH_TP
 };
 
+// Results of the last evalThresholdRules() pass
+int threshold_rule_bits = 0;                  // bit n set if threshold_checkers[n] is tripped
+int threshold_furl_reason = 0;                // furl_reason bits 0-3 and 8 (VOLT, CURR, RPM, WIND, XWIND)
+int threshold_sc_reason = 0;                  // sc_reason bits 0-3 and 8 (VOLT, CURR, RPM, TAIL, XWIND)
+unsigned long threshold_parms_version = ~0;   // parms_version the rules were last compiled at, ~0 forces a compile on first use
+#define SC_SAFE_RULES ((1 << SC_LOW_V) | (1 << SC_LOW_I) | (1 << SC_LOW_RPM))
+
+// Evaluate ALL threshold rules in one pass. Called once at the top of furlctl() and furlctl1().
+// Rules are recompiled first if any parm has changed since the last pass.
+void evalThresholdRules() {
+  if (threshold_parms_version != parms_version) {
+    threshold_parms_version = parms_version;
+    for (int i = 0; i < NUM_THRESHOLD_CHECKERS; i++) threshold_checkers[i].compile();
+  }
+
+  int bits = 0;
+  for (int i = 0; i < NUM_THRESHOLD_CHECKERS; i++) {
+    if (threshold_checkers[i].eval()) bits |= (1 << i);
+  }
+  threshold_rule_bits = bits;
+
+  // Map rule bits directly into furl and SC reason bits.
+  int xwind = ((bits >> SC_HIGH_WS) & 1) << 8;                                    // eXtreme WIND --> bit 8 of both
+  threshold_furl_reason = (bits & 0xF) | xwind;                                   // FURL_INIT_V..WS (rules 0-3) --> bits 0-3
+  threshold_sc_reason = ((bits >> SC_HIGH_V) & 0x7)                               // SC_HIGH_V..RPM (rules 7-9) --> bits 0-2
+                      | (((bits >> SC_HIGH_TP) & 1) << 3) | xwind;                // SC_HIGH_TP (rule 11) --> bit 3
+}
+
+// Print violation counts and last trip times. ONLY CALL OUTSIDE OF TIMER LOOP!
+void printThresholdStats(int msglvl) {
+  if (msglvl >= MSGLVL) {
+    for (int i = 0; i < NUM_THRESHOLD_CHECKERS; i++) {
+      Serial << "furlctl: " << threshold_checkers[i].checkerName() 
+             << " threshold = " << threshold_checkers[i].thresholdVal()
+             << " val = " << threshold_checkers[i].lastVal()
+             << " trips = " << threshold_checkers[i].violationCount()
+             << " last = " << threshold_checkers[i].lastTrip() << "\n";
+    }
+  }
+}
+
 // This function shorts the shorting contactor.
 // The shorting contactor is normally closed (N.C.) = shorted. Voltage must be applied to it to open it (unshorted).
 // HIGH means send voltage to the shorting contactor, unshorting it. LOW releases the contactor, shorting it.
@@ -197,6 +289,7 @@ void initSC() {
 // FURL_STATE_2 LED will be OFF when furled or unfurled
 
 void furlctl(boolean even_second) {
+  evalThresholdRules();  // evaluate all threshold rules ONCE for this iteration
                                                                    // if the motor is ON..., i.e.,
   if (--furl_motor_on > 0) {                                       // if furl_motor_counter > 0, // "--" prefix syntax decrements the counter BEFORE evaluation
                                                                    //   furl_state can be either 0 (UNFURL) or 2 (FURL), nothing else!
@@ -351,6 +444,9 @@ void furlctl1() {
   static boolean last_manual_unfurl_state = manual_unfurl_state;
   static boolean reed_switch_state = !debounced_rs_state;         // 0=open, 1=closed
   static boolean last_reed_switch_state = reed_switch_state;
+  static boolean last_manual_mode = false;                        // saved checkManualMode(), for the event journal
+  static int last_sc_shorted = sc_shorted;                        // saved sc_shorted, for the event journal
+  static int last_shutdown_state = shutdown_state;                // saved shutdown_state, for the event journal
 
   static boolean motor_zero_flag = 0;   // = 1 when motor position == 0 == straight back, unfurled
   static int furlDir = 1;               // flag toggles between +1 and -1 
@@ -404,12 +500,14 @@ void furlctl1() {
 
   int current_motor_position = 0;      // not static
   static int last_motor_position = 0;  // saved current_motor_position. Static!
-  static int total_tail_motion = 0;    // cumulative angular motion of tail. Static!
 
   // end LOCAL VARS
 
 
 
+  // Evaluate all threshold rules ONCE for this iteration. checkFurlConditions(), etc. below use the results.
+  evalThresholdRules();
+
   // Stepper motor acceleration. This should NOT need to be changed below this.
   motor.Acceleration(5);  // 5 usteps/s/(machine state eval)*(1000 evals/s) = 5000 usteps/s/s
 
@@ -446,9 +544,11 @@ void furlctl1() {
 
   if ( (reed_switch_state == 1) && (last_reed_switch_state == 0) ) {  // if RS has JUST CLOSED...
     if ( motor.currentPosition() >= 0 ) {                             //   if current TP is (+)
+      logJournalEvent(JRNL_REED_SWITCH, RSlimit, TAIL_POSITION);      //     journal TP *before* the reset, so we can see any drift
       motor.currentPosition(RSlimit);                                 //     reset motor position to (+)LIMIT
       motor.desiredPosition( motor.currentPosition() );               //     STOP MOTOR - because we've reached a limit!
     } else {                                                          //   otherwise, TP is (-)
+      logJournalEvent(JRNL_REED_SWITCH, -RSlimit, TAIL_POSITION);     //     journal TP *before* the reset
       motor.currentPosition(-RSlimit);                                //     reset motor position to (-)LIMIT
       motor.desiredPosition( motor.currentPosition() );               //     STOP MOTOR - because we've reached a limit!
     }
@@ -463,8 +563,8 @@ void furlctl1() {
 
   sc_failsafe_reason = checkSCNowConditions();  //   check failsafe conditions (VOLT, CURR, RPM, TAIL, TPINIT), global var
   if ( sc_failsafe_reason ) {                   //   if we find ANY failsafe conditions...
+    if ( shutdown_state != 2 ) parm_shutdown_state.setParmVal("2");  //     write state to flash/SD ONCE so it PERSISTS ACROSS RESETS
     shutdown_state = 2;                         //     set hard shutdown_state
-    parm_shutdown_state.setParmVal("2");        //     write state to SD so it PERSISTS ACROSS RESETS
                                                 //     The only way to exit SS2 is by setting SS1 or SS0 on the parms page!
                                                 //     If SS2 is caused by tp_init_fail, it can only be cleared by entering Manual Mode, 
                                                 //     and then setting SS1 or SS0 on the parms page.
@@ -472,6 +572,12 @@ void furlctl1() {
   }
   // ********** end CHECK FAILSAFES **********
 
+  // Journal any change of shutdown_state, whether made just above, in TP initialization, or from the parms page / config server in loop().
+  if ( shutdown_state != last_shutdown_state ) {
+    logJournalEvent(JRNL_SHUTDOWN, shutdown_state, STATE);
+    last_shutdown_state = shutdown_state;
+  }
+
 
   // ********** MANAGE SHORTING CONTACTOR **********
   // NOTE: engage_sc is set when furl_reason is evaluated in the switch() statement below.
@@ -494,6 +600,10 @@ void furlctl1() {
   // writing ZERO to SC_CTL_PIN turns SSR off, which SHORTS the SC.
   digitalWriteDirect(SC_CTL_PIN, !sc_shorted);         // SC_CTL_PIN = 0 = shorted
   digitalWriteDirect(SC_ACTIVE_LED_PIN, !sc_shorted);  // SC_ACTIVE_LED_PIN = 0 = LED on
+  if ( sc_shorted != last_sc_shorted ) {
+    logJournalEvent(sc_shorted ? JRNL_SC_SHORT : JRNL_SC_UNSHORT, sc_reason, RPM);
+    last_sc_shorted = sc_shorted;
+  }
   // ********** end MANAGE SHORTING CONTACTOR **********
 
   // ********** MANUAL MODE **********
@@ -503,6 +613,11 @@ void furlctl1() {
   // As such, there are no checks to enter Manual Mode other than the physical switch!
   //
 
+  if ( checkManualMode() != last_manual_mode ) {
+    last_manual_mode = checkManualMode();
+    logJournalEvent(last_manual_mode ? JRNL_MANUAL_ON : JRNL_MANUAL_OFF, 0, TAIL_POSITION);
+  }
+
   if ( checkManualMode() ) {
     last_manual_furl_state = manual_furl_state;     // save last manual furl (+) state
     manual_furl_state = checkManualFurl();          // get new manual furl (+) state
@@ -754,18 +869,8 @@ void furlctl1() {
       for (int i = 1; i < ws_arrsize; i++) ws_arr[i-1] = ws_arr[i];  //     shift WS array elements, 0<--1, 1<--2 ... 598<--599
     }
     ws_arr[ws_arrsize-1] = getChannelRMSInt(WINDSPEED);              //   put latest WS into last array element (m/s/, 1024x actual)
-    ws_arrsum = 0;                                                   //   rezero WS array sum
-    for (int i = 0; i < ws_arrsize; i++) ws_arrsum += ws_arr[i];     //   compute sum of array vals
     last_ws_avg = ws_avg;                                            //   save old ave WS (m/s, 1024x actual)
-    ws_avg = ws_arrsum / ws_arrsize;                                 //   compute new ave WS (m/s, 1024x actual)
-    ws_max = 0;                                                      //   rezero ws_max
-    for (int i = 0; i < ws_arrsize; i++) {
-      if ( ws_arr[i] > ws_max ) ws_max = ws_arr[i];                  //   find the max array val (m/s, 1024x actual)
-    }
-      
-    ws_mad = 0;                                                            // rezero MAD
-    for (int i=0; i < ws_arrsize; i++) ws_mad += abs(ws_arr[i] - ws_avg);  // compute MAD sum, 1024x actual
-    ws_mad = ws_mad / ws_arrsize;                                          // compute MAD, 1024x actual
+    ws_arrsum = calcWSStats(ws_arr, ws_arrsize, &ws_avg, &ws_max, &ws_mad);  // new ave, max and MAD of WS (m/s, 1024x actual) - see below
 
     // Use ac_Pd as a TEMPORARY parm for monitoring |WS|
     //ac_Pd.setInstantaneousValInt( ws_avg, false, false, false );     // m/s, 1024x actual; DON'T median, DON'T rectify, DON'T filter
@@ -783,40 +888,8 @@ void furlctl1() {
       if ( ws_arr[ws_arrsize-1] >= (ws*MPH2MS*1024) ) latest_WSgte[ws] = myunixtime;
     }
 
-    // Compute the Rayleigh probability distribution from the average WS.
-    // The Rayleigh distribution equation used below is taken from _Wind Power_ (Paul Gipe, 2004), p37.
-    // We need the *entire* distribution to get cumulative probabilities in rayleigh_sum[].
-    // The latter is used below to compute TP hold times. 
-    // ***This should probably be converted to INTEGER math to minimize processing time. Arghhh!***
-    float ws_avg_mph = ws_avg*MS2MPH/1024.;  // FLOATING POINT! convert (1024*m/s) to mph
-    if (ws_avg_mph > 1) {                    // if() avoids divide by zero
-      for (int ws = 0; ws < 41; ws++) {      // compute *entire* distribution ws = 0 to 40 mph
-        rayleigh[ws] = HALF_PI * ws/sq(ws_avg_mph) * exp( -(PI/4)*sq(ws/ws_avg_mph) );  // floating point math! int/float = float
-        if (ws == 0) rayleigh_sum[0] = 1;
-        if (ws > 0) rayleigh_sum[ws] = rayleigh_sum[ws-1] - rayleigh[ws];  // rayleigh_sum[ws] = probability of all wind speeds >= ws
-      }
-    }
-
-    // Now, using the cumulative WS probabilities, we compute TP hold times for ws >= 22 mph.
-    // We do this based on two assumptions:
-    //   1. We ASSUME (based on observation) that for ws < 22 mph, NO furl is required, and conversely, that furling IS required for ws >= 22 mph.
-    //      Note that this threshold may change with, for example, a new blade set with different performance!
-    //      The hold time (in seconds) for ws==22 mph is MUCH GREATER THAN hold times calculated in the following loop.
-    //      This is intended to compensate for a too-slow tail slewing response from TP=0 in turbulent wind conditions.
-    //      Specifically, holding TP at ~30 deg saves a critical 1.5 seconds of furling time (@20 deg/s) while
-    //      sacrificing only 1-cos(30) = 0.13 = 13% of power. Theoretically.
-    //   2. We ASSUME that cumulative Rayleigh probabilities are related to TP hold times using the ratio:
-    //      Prob(WS >= ws) / Prob(WS >= 22), where ws >= 22 mph, is a factor by which TP hold times can be reduced as WS increases.
-    //      This assumption is entirely empirical! ...but it seems to work.
-    //      Note that the Rayleigh ratios vary significantly as the average WS changes... because the Rayleigh distribution changes, i.e.,
-    //      higher average WS --> longer hold times at each WS threshold. This is what we want.
-    //      Also, for wind speeds > 22 mph, TP hold times are scaled to 300 seconds, not 1200 seconds (ws==22 mph is a special case).
-    //
-    //      Loop over only those wind speeds that are needed for the TP calculation below --> *** ws+=2 ***
-    hold_WSgte[22] = 1200;
-    for (int ws = 24; ws < 41; ws+=2) {
-      if (rayleigh_sum[22] > 0) hold_WSgte[ws] = max( (int)(300 * rayleigh_sum[ws]/rayleigh_sum[22]), 30 );  // if() avoids divide by zero, enforce 30-sec minimum
-    }
+    // Compute the Rayleigh probability distribution from the average WS, and from it, TP hold times for ws >= 22 mph - see below
+    calcRayleighHoldTimes(ws_avg, rayleigh, rayleigh_sum, hold_WSgte);
 
     // TAIL POSITIONING:
     // Caculate the WSgte[ws] flags which are used below (along with predicted RPM) to dynamically set the TP.
@@ -1149,13 +1222,18 @@ void furlctl1() {
           engage_sc = true;                                                  //   engage shorting contactor
           break;
         case 512 ... 1023:                                                   // WX (weather) NWS Alert/Warning/Advisory furl (bit 9)
-          full_furl_time = max(1*FURLCTL1_PER_SEC, furl_time_remaining);     //   1-sec furl, weather_furl flag is reset when alert expires by getNWSAPIData in webclient.ino
+          full_furl_time = max(1*FURLCTL1_PER_SEC, furl_time_remaining);     //   1-sec furl, weather_furl flag is reset when alert expires by updateWeatherFurl in weather.ino
+          engage_sc = true;                                                  //   engage shorting contactor
+          break;
+        case 1024 ... 2047:                                                  // PHASE loss or winding fault (bit 10), phase_fault is reset by checkPhaseFault()
+          full_furl_time = max(3600*FURLCTL1_PER_SEC, furl_time_remaining);  //   60-min furl, then the alternator is judged again as it spins up
           engage_sc = true;                                                  //   engage shorting contactor
           break;
         default:                                                             // shouldn't happen, but if does...
           full_furl_time = max(3600*FURLCTL1_PER_SEC, furl_time_remaining);  //   60-min furl
           engage_sc = true;                                                  //   engage shorting contactor
       }
+      if ( !stepper_furl_timer ) logJournalEvent(JRNL_FURL, furl_reason, getFurlReasonChannel(furl_reason));  // journal a NEW full furl
       stepper_furl_timer = 1;  // re/start furl timer. If we're already fully furled, another triggering event will reset full_furl_time.
     }  // END if ( furl_reason > 0 )
 
@@ -1164,6 +1242,7 @@ void furlctl1() {
       stepper_furl_timer++;                         //   increment furl timer here (not further below due to exit outer if() condition below)
       
       if ( stepper_furl_timer > full_furl_time ) {  //   if we've exceeded full_furl_time...
+        logJournalEvent(JRNL_UNFURL, furl_reason_saved, WINDSPEED);
         stepper_furl_timer = 0;                     //     exit the outer if() on the next iteration
         full_furl_time = 0;                         //     necessary because of the max() comparisons above
         furl_reason_saved = 0;                      //     reset saved furl reason, used by getControllerState()
@@ -1193,6 +1272,63 @@ void furlctl1() {
 // ********** end STEPPER MOTOR CONTROL - furlctl1() **********
 
 
+// Wind statistics for furlctl1(), called once per second. These are separate functions so that bench.ino can time them.
+// Compute the average, max and mean absolute deviation (MAD) of n WS vals (m/s, 1024x actual). Returns their sum.
+int calcWSStats(int* arr, int n, int* avg, int* maxval, int* mad) {
+  int sum = 0;
+  for (int i = 0; i < n; i++) sum += arr[i];                   // compute sum of array vals
+  *avg = sum / n;                                              // compute ave WS (m/s, 1024x actual)
+  *maxval = 0;
+  for (int i = 0; i < n; i++) {
+    if ( arr[i] > *maxval ) *maxval = arr[i];                        // find the max array val (m/s, 1024x actual)
+  }
+  *mad = 0;
+  for (int i = 0; i < n; i++) *mad += abs(arr[i] - *avg);      // compute MAD sum, 1024x actual
+  *mad = *mad / n;                                             // compute MAD, 1024x actual
+  return(sum);
+}
+
+
+// Compute the Rayleigh distribution rayleigh[0-40 mph] from ws_avg (m/s, 1024x actual), its cumulative probabilities
+//   rayleigh_sum[], and from those, the TP hold times hold_WSgte[] (sec).
+void calcRayleighHoldTimes(int ws_avg, float* rayleigh, float* rayleigh_sum, int* hold_WSgte) {
+  // Compute the Rayleigh probability distribution from the average WS.
+  // The Rayleigh distribution equation used below is taken from _Wind Power_ (Paul Gipe, 2004), p37.
+  // We need the *entire* distribution to get cumulative probabilities in rayleigh_sum[].
+  // The latter is used below to compute TP hold times. 
+  // ***This should probably be converted to INTEGER math to minimize processing time. Arghhh!***
+  float ws_avg_mph = ws_avg*MS2MPH/1024.;  // FLOATING POINT! convert (1024*m/s) to mph
+  if (ws_avg_mph > 1) {                    // if() avoids divide by zero
+    for (int ws = 0; ws < 41; ws++) {      // compute *entire* distribution ws = 0 to 40 mph
+      rayleigh[ws] = HALF_PI * ws/sq(ws_avg_mph) * exp( -(PI/4)*sq(ws/ws_avg_mph) );  // floating point math! int/float = float
+      if (ws == 0) rayleigh_sum[0] = 1;
+      if (ws > 0) rayleigh_sum[ws] = rayleigh_sum[ws-1] - rayleigh[ws];  // rayleigh_sum[ws] = probability of all wind speeds >= ws
+    }
+  }
+
+  // Now, using the cumulative WS probabilities, we compute TP hold times for ws >= 22 mph.
+  // We do this based on two assumptions:
+  //   1. We ASSUME (based on observation) that for ws < 22 mph, NO furl is required, and conversely, that furling IS required for ws >= 22 mph.
+  //      Note that this threshold may change with, for example, a new blade set with different performance!
+  //      The hold time (in seconds) for ws==22 mph is MUCH GREATER THAN hold times calculated in the following loop.
+  //      This is intended to compensate for a too-slow tail slewing response from TP=0 in turbulent wind conditions.
+  //      Specifically, holding TP at ~30 deg saves a critical 1.5 seconds of furling time (@20 deg/s) while
+  //      sacrificing only 1-cos(30) = 0.13 = 13% of power. Theoretically.
+  //   2. We ASSUME that cumulative Rayleigh probabilities are related to TP hold times using the ratio:
+  //      Prob(WS >= ws) / Prob(WS >= 22), where ws >= 22 mph, is a factor by which TP hold times can be reduced as WS increases.
+  //      This assumption is entirely empirical! ...but it seems to work.
+  //      Note that the Rayleigh ratios vary significantly as the average WS changes... because the Rayleigh distribution changes, i.e.,
+  //      higher average WS --> longer hold times at each WS threshold. This is what we want.
+  //      Also, for wind speeds > 22 mph, TP hold times are scaled to 300 seconds, not 1200 seconds (ws==22 mph is a special case).
+  //
+  //      Loop over only those wind speeds that are needed for the TP calculation in furlctl1() --> *** ws+=2 ***
+  hold_WSgte[22] = 1200;
+  for (int ws = 24; ws < 41; ws+=2) {
+    if (rayleigh_sum[22] > 0) hold_WSgte[ws] = max( (int)(300 * rayleigh_sum[ws]/rayleigh_sum[22]), 30 );  // if() avoids divide by zero, enforce 30-sec minimum
+  }
+}
+
+
 
 
 // Check for Morningstar mppt600 and div60 controller faults. 
@@ -1240,16 +1376,11 @@ int checkMorningstarState() {
 //   Its only use is to set state sc_reason bits that get put into the bitfield returned by getControllerState().
 //   It is NOT used to activate the contactor. For that, see 
 int checkSCConditions() {
-  int reason = 0;                                                    // local scope!
-  if (threshold_checkers[SC_HIGH_V].check(false)) reason |= 1;       // if over-voltage (VOLT), set bit 0
-  if (threshold_checkers[SC_HIGH_I].check(false)) reason |= 2;       // if over-current (CURR), set bit 1
-  if (threshold_checkers[SC_HIGH_RPM].check(false)) reason |= 4;     // if over-speed (RPM), set bit 2
-  if (threshold_checkers[SC_HIGH_TP].check(false)) reason |= 8;      // if over-furled (TAIL), set bit 3
+  int reason = threshold_sc_reason;                                  // bits 0-3 (VOLT, CURR, RPM, TAIL) and 8 (XWIND) - see evalThresholdRules()
   if ( tp_init_fail ) reason |= 16;                                  // if TP initialization fails (TPINIT), set bit 4
   if ( exercise_furl ) reason |= 32;                                 // if EXERcise tail flag, set bit 5
   if ( anemometer_furl ) reason |= 64;                               // if ANEMometer frozen flag, set bit 6
   if ( morningstar_furl ) reason |= 128;                             // if MORNingstar fault or wrong state flag, set bit 7
-  if ( threshold_checkers[SC_HIGH_WS].check(false) ) reason |= 256;  // if eXtreme WIND flag, set bit 8
   if ( weather_furl && !parm_wx_override.intVal() ) reason |= 512;   // if WX (weather) flag and "WX Override?" == 0, set bit 9
   return(reason);                                                    // return 10 bits --> 2^10 --> possible values are 0-1023
 }
@@ -1258,18 +1389,16 @@ int checkSCConditions() {
 // This function checks for full furl conditions.
 // It returns a bitfield coding one or more furl reasons.
 int checkFurlConditions() {
-  int reason = 0;                                                     // local scope!
-  if ( threshold_checkers[FURL_INIT_V].check(false) ) reason |= 1;    // if VOLTage threshold exceeded, set bit 0
-  if ( threshold_checkers[FURL_INIT_I].check(false) ) reason |= 2;    // if CURRent threshold exceeded, set bit 1
-  if ( threshold_checkers[FURL_INIT_RPM].check(false) ) reason |= 4;  // if RPM threshold exceeded, set bit 2
-  if ( threshold_checkers[FURL_INIT_WS].check(false) ) reason |= 8;   // if WIND speed threshold exceeded, set bit 3
+  int reason = threshold_furl_reason;                                 // bits 0-3 (VOLT, CURR, RPM, WIND) and 8 (XWIND) - see evalThresholdRules()
   if ( exercise_furl ) reason |= 16;                                  // if EXERcise tail flag, set bit 4
   if ( anemometer_furl ) reason |= 32;                                // if ANEMometer frozen flag, set bit 5
   if ( slippage_furl ) reason |= 64;                                  // if SLIPpage tail motor flag, set bit 6
   if ( morningstar_furl ) reason |= 128;                              // if MORNingstar fault or wrong state flag, set bit 7
-  if ( threshold_checkers[SC_HIGH_WS].check(false) ) reason |= 256;   // if eXtreme WIND threshold exceeded, set bit 8
   if ( weather_furl && !parm_wx_override.intVal() ) reason |= 512;    // if WX (weather) flag and "WX Override?" == 0, set bit 9
-  return(reason);                                                     // return 10 bits --> 2^10 --> possible values are 0-1023
+  static unsigned long phase_trips_seen = 0;
+  if ( phase_fault || phase_fault_trips != phase_trips_seen ) reason |= 1024;  // if PHASE loss or winding fault flag, or a trip since the last call, set bit 10 - see phasefault.ino
+  phase_trips_seen = phase_fault_trips;
+  return(reason);                                                     // return 11 bits --> 2^11 --> possible values are 0-2047
 }
 
 int checkManualMode(){
@@ -1319,6 +1448,11 @@ void printFurlStatus(int msglvl){
     } else {
       Serial << "furlctl: SC energized (OPEN)\n";
     }
+
+    if (phase_fault) {
+      Serial << "furlctl: PHASE fault on " << getChannelName(phase_fault_chan) << ", why = " << phase_fault_why
+             << ", trips = " << phase_fault_trips << "\n";
+    }
     
     if (dump_load_duty_cycle > 0) {
       Serial << "furlctl: Dump load ON = " << dump_load_duty_cycle << "\n";
@@ -1331,22 +1465,15 @@ void printFurlStatus(int msglvl){
 
 // Check for conditions which guarantee a safe exercise of the shorting contactor.
 boolean checkSCSafeConditions() {
-  boolean rc = false;                                    // return code, local scope!
-  rc = ( threshold_checkers[SC_LOW_V].check(false)       // true if V < low threshold V
-      && threshold_checkers[SC_LOW_I].check(false)       // true if I < low threshold I
-      && threshold_checkers[SC_LOW_RPM].check(false) );  // true if RPM < low threshold RPM
-  return rc;
+  // true if V, I AND RPM are all < their low thresholds - see evalThresholdRules()
+  return ( (threshold_rule_bits & SC_SAFE_RULES) == SC_SAFE_RULES );
 }
 
 
 // Check for conditions which require an IMMEDIATE short.
 // SC at high voltage, current or RPM carries some risk of alternator demagnetization, but may prevent even more severe damage.
 int checkSCNowConditions() {
-  int reason = 0;                                                 // local scope!
-  if (threshold_checkers[SC_HIGH_V].check(false)) reason |= 1;    // if over-voltage (VOLT), set bit 0
-  if (threshold_checkers[SC_HIGH_I].check(false)) reason |= 2;    // if over-current (CURR), set bit 1
-  if (threshold_checkers[SC_HIGH_RPM].check(false)) reason |= 4;  // if over-speed (RPM), set bit 2
-  if (threshold_checkers[SC_HIGH_TP].check(false)) reason |= 8;   // if over-furled (TAIL), set bit 3
+  int reason = threshold_sc_reason & 0xF;                         // bits 0-3 (VOLT, CURR, RPM, TAIL) - see evalThresholdRules()
   if (tp_init_fail) reason |= 16;                                 // if TP initialization fails (TPINIT), set bit 4
   return(reason);                                                 // return 5 bits, possible values are 0-31
 }
@@ -1363,7 +1490,7 @@ boolean checkManualSCShort() {
 //   Discontinuities are the result of adding reasons for furl and SC as the system and code evolved.
 //   NOTE: bitwise and shift operate on 32-bit ints
 // Bits 0-2: sc_reason_saved, bits 7-9 --> MORN, XWIND, WX
-// Bits 3-12: furl_reason_saved, bits 0-9 --> VOLT, CURR, RPM, WIND, EXER, ANEM, SLIP, MORN, XW, WX
+// Bits 3-13: furl_reason_saved, bits 0-10 --> VOLT, CURR, RPM, WIND, EXER, ANEM, SLIP, MORN, XW, WX, PHASE
 // Bit 14: shorting contactor state: 0==unshorted, 1==shorted
 // Bits 15-21: sc_reason_saved, bits 0-6 --> VOLT, CURR, RPM, TAIL, TPINIT, EXER, ANEM
 // Bit 22: shutdown_state, bit 0: 0 --> SS==0, 1 --> SS==1
@@ -1376,8 +1503,7 @@ boolean checkManualSCShort() {
 
 int getControllerState() {
   return( ((sc_reason_saved & 0x380) >> 7)    // select bits 7-9 (0011 1000 0000) of sc_reason_saved, shift *RIGHT* into return bits 0-2
-        + ((furl_reason_saved & 0x3FF) << 3)  // select bits 0-9 (0011 1111 1111) of furl_reason_saved, shift LEFT into return bits 3-12
-                                              // return bit 13 is UNUSED (save for one more furl reason?)
+        + ((furl_reason_saved & 0x7FF) << 3)  // select bits 0-10 (0111 1111 1111) of furl_reason_saved, shift LEFT into return bits 3-13
         + (sc_shorted << 14)                  // shift 1 bit LEFT into return bit 14
         + ((sc_reason_saved & 0x7F) << 15)    // select bits 0-6 (0111 1111) of sc_reason_saved, shift LEFT into return bits 15-21
         + ((shutdown_state & 1) << 22)        // select bit 0 of shutdown_state, shift LEFT into return bit 22
@@ -1401,6 +1527,7 @@ int getControllerState() {
 //           as dump load switches on/off, we get Vdc spikes much > (Kb*RPM = Voc) and alternator makes horrible noise!
 int manageDumpLoad() {
   static int dump_cyclenum = 0;                // dump cycle counter, must be static!
+  static boolean dumping = false;              // dump load was active on the last call
   static int Morningstar_timer = 0;            // function call iteration counter, must be static!
   static boolean MorningstarOK = false;        // controller ok flag
   static boolean unloaded = false;             // if true, this flag LATCHES dump load ON if obs'd vdc_drop is too low
@@ -1409,22 +1536,7 @@ int manageDumpLoad() {
   int vdc_drop = 0;                            // voltage drop, 1024x actual
   const int Kb = 1053;                         // alternator motor constant, 1024x actual: 1.0285 * 1024 = 1053
 
-  // HVDL control parms
-  //const int dump_load_resistance = 18 << 10;   // ohms, 1024x actual. This is FIXED (for now) even though it is a controller operating parm
-  int dump_load_resistance = parm_hvdl_R.intVal() << 10;
-  
-  //const int dump_load_max_power = 2200 << 10;  // dump load maximum power (W), 1024x actual; rev0 blades 2200W
-  //const int dump_load_max_power = 2200 << 10;  // dump load maximum power (W), 1024x actual; rev1 blades 2200W
-  int dump_load_max_power = parm_hvdl_Pmax.intVal() << 10;
-
-  //const int v_start = 120 << 10;               // dump start voltage, 1024x actual; rev0 and rev1 blades 120V
-  int v_start = parm_hvdl_Vstart.intVal() << 10;
-  
-  //const int v_span = 110 << 10;                // dump span voltage, 1024x actual; rev0 blades 110V
-  //const int v_span = 180 << 10;                // dump span voltage, 1024x actual; rev1 blades 180V
-  int v_span = parm_hvdl_Vspan.intVal() << 10;
-
-  const int max_duty = (dump_load_resistance * ((100*dump_load_max_power) / (v_start + v_span))) / (v_start + v_span);  // max dump load duty cycle
+  // HVDL control parms (R, Pmax, Vstart, Vspan, mode, ...) are used by computeDumpLoadDuty() - see dumpload.ino
   
   // We need to know whether the TS-MPPT-600V is DISC'ed when manageDumpLoad() is first called by readADCs().
   // These initializations depend on mppt600_mb_charge_state having been read during Modbus initialization - see modbus.ino.
@@ -1550,42 +1662,30 @@ int manageDumpLoad() {
   //   an unloaded condition has been detected
   if ( !MorningstarOK || mppt600_disconnected || unloaded ) {
   
+    dumping = true;
+
     // Update dump_load_duty_cycle every 100th function iteration.
     if ( dump_cyclenum >= 100 ) {  // dump load runs at 10,000 Hz / 100 = 100 Hz
       dump_cyclenum = 0;
-          
-      // If vstart + v_span > 120+110 = 230V, we want MAX and CONSTANT power = 2200W = max_duty * (V^2/R).
-      //   --> max_duty = 100*2200*18/(230^2) = 75%, initialized above.
-      // BE CAREFUL with integer math to avoid overflow at 2^31 - 1:
-      //   --> max_duty = {(18*1024)*[(100*2200*1024)/(230*1024)]}/(230*1024) = 74.9%
-      
-      if ( dc_voltage >= v_start ) {              // if dc_voltage is ABOVE v_start (both are 1024x actual)...
-        if ( dc_voltage > (v_start + v_span) ) {  //   if dc_voltage has exceeded (vstart + v_span)...
-          // Above 230V, duty cycle DECREASES as voltage rises to MAINTAIN power at dump_load_max_power = 2200W
-          dump_load_duty_cycle = (dump_load_resistance * ((100*dump_load_max_power) / dc_voltage)) / dc_voltage;  // GLOBAL var
-        } else {                                  //   otherwise, dc_voltage is BETWEEN v_start and (vstart + v_span)... 
-          // CREATE A SMOOTH LOAD CURVE:
-          // Duty cycle increases linearly with V as power increases with V^2, so P(V) = duty(V) * (V^2)/R
-          // ***This works amazingly well. So much so that this equation is used to calculate the P(V) load curve programmed into the TS-MPPT-600V.***
-          //    Because the load curves are identical, switching between the TS-MPPT-600V and the HVDL should be seamless.
-          dump_load_duty_cycle = (max_duty * (dc_voltage - v_start)) / v_span;
-        }
-      } else {                                    // otherwise, dc_voltage is BELOW v_start...
-        dump_load_duty_cycle = 0;                 //   so no load yet
-      }
+      dump_load_duty_pm = computeDumpLoadDuty(dc_voltage);  // 0.1% units, ramp or PI - see dumpload.ino
+      dump_load_duty_cycle = dump_load_duty_pm / 10;        // GLOBAL var, integer %, for the DL channel
+#ifdef DUMP_PWM_HW
+      driveDumpLoad(dump_load_duty_pm, 0);                  // hardware PWM: just update the duty cycle
+#endif
     }  // END update dump_load_duty_cycle
 
+#ifndef DUMP_PWM_HW
     // Turn dump load ON for dump_load_duty_cycle iterations (where 1 iteration = 0.1 msec) out of every 10 msec
-    if ( dump_cyclenum < dump_load_duty_cycle ) {
-      digitalWriteDirect(DUMP_IGBT_DRV_PIN, DUMP_LOAD_ON);
-      digitalWriteDirect(DUMP_LOAD_ACTIVE_LED_PIN, LOW);
-    } else {
-      digitalWriteDirect(DUMP_IGBT_DRV_PIN, DUMP_LOAD_OFF);
-      digitalWriteDirect(DUMP_LOAD_ACTIVE_LED_PIN, HIGH);
-    }
+    driveDumpLoad(dump_load_duty_pm, dump_cyclenum);
+#endif
   
     dump_cyclenum++;
     
-  }  // END activate dump load if()
+  } else if ( dumping ) {  // END activate dump load if()
+    // Stopped dumping: make sure the IGBT is left OFF, wherever in the PWM period we were, and reset the regulator
+    dumping = false;
+    dump_cyclenum = 0;
+    stopDumpLoad();
+  }
   
 }  // end manageDumpLoad()
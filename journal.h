@@ -0,0 +1,36 @@
+// ---------- journal.h ----------
+// Control event journal types and ring buffer - see journal.ino
+// This is a .h file (#include'd in wwe.ino) so that furlctl.ino and adc.ino, which come before journal.ino, can see it.
+
+#ifndef JOURNAL_DEFINED
+#define JOURNAL_DEFINED
+
+#define JOURNAL_SIZE 64                     // # records, MUST be a power of 2
+#define JOURNAL_MASK (JOURNAL_SIZE - 1)
+
+// Event types
+#define JRNL_FURL 1                         // full furl started, detail = furl_reason
+#define JRNL_UNFURL 2                       // full furl ended, detail = furl_reason_saved
+#define JRNL_SC_SHORT 3                     // SC shorted, detail = sc_reason
+#define JRNL_SC_UNSHORT 4                   // SC unshorted, detail = sc_reason
+#define JRNL_SHUTDOWN 5                     // shutdown_state changed, detail = new shutdown_state
+#define JRNL_REED_SWITCH 6                  // reed switch closed, detail = TP limit we reset to
+#define JRNL_MANUAL_ON 7                    // Manual Mode entered
+#define JRNL_MANUAL_OFF 8                   // Manual Mode exited
+#define JRNL_RESET 9                        // controller reset, detail = reset cause | (last stall flags << 8) - see supervisor.ino
+
+struct JournalRecord {
+  uint32_t time;                            // myunixtime, sec
+  uint16_t msec;                            // msec within that second
+  uint8_t type;                             // JRNL_* event type
+  uint8_t channel;                          // channel (see adc.ino) that val was read from
+  int32_t detail;                           // event-specific, see above
+  int32_t val;                              // channel val at the time of the event, native units (usually 1024x actual)
+};
+
+JournalRecord journal[JOURNAL_SIZE];
+volatile uint32_t journal_head = 0;         // next record to write, written ONLY by logJournalEvent()
+volatile uint32_t journal_tail = 0;         // next record to flush, written ONLY by flushJournal2SD()
+uint32_t journal_dropped = 0;               // records overwritten before they were flushed
+
+#endif
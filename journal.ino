@@ -0,0 +1,100 @@
+// ---------- journal.ino ----------
+// CONTROL EVENT JOURNAL
+//
+// The STATE bitfield (see getControllerState() in furlctl.ino) is only sampled once per second, so a short event
+//   between posts, e.g., an SC failsafe that trips and clears, or a reed switch hit, can be missed entirely.
+// So, furlctl1() logs control events *as they happen* into a small RAM ring buffer:
+//   FURL / UNFURL (start and end of a full furl), SC SHORT / UNSHORT, shutdown_state change, reed switch closure,
+//   and Manual Mode entry/exit.
+// Each record is a fixed 16 bytes with a 1-msec timestamp (myunixtime + 10 kHz tick count - see readADCs() in adc.ino),
+//   a detail code (e.g., furl_reason) and the value of the channel that triggered it.
+//
+// The ring is lock-free, single producer, single consumer:
+//   - ONLY the timer interrupt (furlctl1) calls logJournalEvent(). It writes the record, THEN advances journal_head.
+//   - ONLY loop() calls flushJournal2SD(). It reads records up to journal_head, THEN advances journal_tail.
+//   (Exception: checkResetCause() in supervisor.ino, called from setup() BEFORE the timers start.)
+//   If loop() falls behind by more than JOURNAL_SIZE events, the oldest are overwritten and counted in journal_dropped.
+// Flushed records stay in RAM until overwritten, so the most recent JOURNAL_SIZE events are also available
+//   at <controllerIP>/events.json - see eventsCmd() in webserver.ino
+// Record layout, event types and the ring buffer itself are in journal.h
+
+// Append an event to the journal. Called from the timer interrupt ONLY!
+void logJournalEvent(int type, int detail, int channel) {
+  JournalRecord* rec = &journal[journal_head & JOURNAL_MASK];
+  rec->time = myunixtime;
+  rec->msec = subsecond_ticks / (SAMPLE_RATE_PER_SEC / 1000);
+  rec->type = type;
+  rec->channel = channel;
+  rec->detail = detail;
+  rec->val = getChannelRMSInt(channel);
+  journal_head++;                           // publish the record AFTER it is complete
+  triggerCaptureOnEvent(type);              // freeze a waveform capture, if parm_cap_trig asks for this event - see capture.ino
+}
+
+
+// Pick the channel most relevant to a furl_reason bitfield: the lowest set threshold bit (VOLT, CURR, RPM), then the
+// faulted line-to-line channel (PHASE), otherwise wind speed.
+int getFurlReasonChannel(int reason) {
+  if (reason & 1) return(DC_VOLTAGE);
+  if (reason & 2) return(DC_CURRENT);
+  if (reason & 4) return(RPM);
+  if (reason & 1024) return(phase_fault_chan);
+  return(WINDSPEED);
+}
+
+
+char* getJournalEventName(int type) {
+  switch (type) {
+    case JRNL_FURL:        return ("FURL");
+    case JRNL_UNFURL:      return ("UNFURL");
+    case JRNL_SC_SHORT:    return ("SC_SHORT");
+    case JRNL_SC_UNSHORT:  return ("SC_UNSHORT");
+    case JRNL_SHUTDOWN:    return ("SHUTDOWN");
+    case JRNL_REED_SWITCH: return ("REED_SWITCH");
+    case JRNL_MANUAL_ON:   return ("MANUAL_ON");
+    case JRNL_MANUAL_OFF:  return ("MANUAL_OFF");
+    case JRNL_RESET:       return ("RESET");
+    default:               return ("UNKNOWN");
+  }
+}
+
+
+// Format one record as a JSON object, e.g.: {"time":1660838400.125,"event":"FURL","detail":8,"chan":"WS","val":15360}
+void formatJournalRecord(char* buf, JournalRecord* rec) {
+  sprintf(buf, "{\"time\":%lu.%03u,\"event\":\"%s\",\"detail\":%ld,\"chan\":\"%s\",\"val\":%ld}",
+          (unsigned long)rec->time, rec->msec, getJournalEventName(rec->type), (long)rec->detail,
+          getChannelName(rec->channel), (long)rec->val);
+}
+
+
+// Write any new journal records to SD, one JSON object per line. Called from loop() ONLY!
+// Returns # records written, or -1 on SD error (in which case the records stay queued for next time).
+int flushJournal2SD(char* fname) {
+  File sdfile;
+  char line[128];
+  int count = 0;
+
+  uint32_t head = journal_head;             // snapshot; the ISR may add more while we work, we'll get them next time
+  if ( journal_tail == head ) return(0);    // nothing to do
+
+  if ( (head - journal_tail) > JOURNAL_SIZE ) {            // if we fell behind and the ISR lapped us...
+    journal_dropped += (head - journal_tail) - JOURNAL_SIZE;
+    journal_tail = head - JOURNAL_SIZE;                    //   skip ahead to the oldest record still in RAM
+    Serial << "journal: " << journal_dropped << " events dropped (total)\n";
+  }
+
+  if ( !SD_ok ) return(-1);
+  if ( !(sdfile = SD.open(fname, O_CREAT | O_APPEND | O_WRITE)) ) {
+    Serial << "journal: Error opening " << fname << "\n";
+    return(-1);
+  }
+  while ( journal_tail != head ) {
+    formatJournalRecord(line, &journal[journal_tail & JOURNAL_MASK]);
+    sdfile.println(line);
+    Serial << "journal: " << line << "\n";
+    journal_tail++;
+    count++;
+  }
+  sdfile.close();
+  return(count);
+}
@@ -404,6 +404,26 @@ class ModbusReg {
     float valFloat(){
       return val_float;
     }
+
+    // The last value read, as a float whatever the datatype, e.g., for the Modbus/TCP server - see modbusserver.ino
+    //   NaN if the last read failed, or if there's no number (string, long read)
+    float valAsFloat(){
+      if (modbus_result != 0 || datatype == MOD_STRING || datatype == MOD_LONG_READ) return NAN;
+      float f;
+      switch (datatype) {
+        case MOD_HALFWORD:
+        case MOD_FULLWORD:
+          return (float)(uint32_t)val_int;
+        case MOD_HALFWORD_SIGNED:
+          return (float)val_int;
+        case MOD_FLOAT16:  // val_int holds the bits of the 32-bit float, see readReg()
+        case MOD_FLOAT32:
+          memcpy(&f, &val_int, 4);
+          return f;
+        default:           // scaled types
+          return val_float;
+      }
+    }
     
     char* valStrg(){
       return(strbuf);
@@ -504,7 +524,7 @@ class ModbusReg {
 //
 // *** TO ADD A CHANNEL ***
 //   1. Create an instance of the desired channel in one of the lists of ModbusReg class objects below
-//   2. Add the new channel to mod_nuv_regs[] or mod_fast_regs[] or mod_slow_regs[] - found after the ModbusReg class lists
+//   2. Add the new channel to mod_nuv_chans[] or mod_fast_chans[] or mod_slow_chans[] - found after the ModbusReg class lists
 //   3. If the channel is to be included in a long read cache, change the <device>_cache.setNumRegs(#) in modbus.ino
 //-------------------------------------------------------------------------
 // Nuvation low-voltage BMS (16-bit registers)
@@ -703,170 +723,161 @@ ModbusReg div2_d_filt = ModbusReg(&div2, MOD_HOLDING_REG, 0x001C, "TS60 PWM duty
 ModbusReg div2_Alarm_HI = ModbusReg(&div2, MOD_HOLDING_REG, 0x001D, "TS60 alarm, HI", "ABhiD2", "", MOD_HALFWORD);                    // bitfield
 
 
-// Populate the arrays below with Modbus register names.
-// These arrays specify which channels are to be read every second and sent out in UDP packets.
+// Populate the tables below with Modbus registers - see channels.h
+// These tables specify which channels are to be read every second and sent out in UDP packets.
 // Do not include scale factors, as they are read once only (during Modbus init).
-
-const int NUM_MOD_NUV_CHANNELS = 8;  // MOD_NUM_NUV_REGS must = # channels in the array below
-ModbusReg* mod_nuv_regs[] = {
-  &nuvation_Vol,
-  &nuvation_MaxBatACha,
-  &nuvation_MaxBatADischa,
-  &nuvation_BMaxCellVol,
-  &nuvation_BMinCellVol,
-  &nuvation_BMaxModTemp,
-  &nuvation_BMinModTemp,
-  &nuvation_BTotDCCurr,
+// The channel counts are the table sizes. A table can't have more than 64 channels (telemetry masks are 64 bits).
+
+constexpr ModChannel mod_nuv_chans[] = {
+  { &nuvation_Vol },
+  { &nuvation_MaxBatACha },
+  { &nuvation_MaxBatADischa },
+  { &nuvation_BMaxCellVol },
+  { &nuvation_BMinCellVol },
+  { &nuvation_BMaxModTemp },
+  { &nuvation_BMinModTemp },
+  { &nuvation_BTotDCCurr },
 };
-
-
-const int NUM_MOD_FAST_CHANNELS = 58;  // NUM_MOD_FAST_CHANNELS must = # channels in the array below
-ModbusReg* mod_fast_regs[] = {
-  &mppt600_vb_ref,
-  &mppt600_adc_vb_f_med,
-  &mppt600_adc_va_f_shadow,
-  &mppt600_adc_ib_f_shadow,
-  &mppt600_adc_ia_f_shadow,
-  &mppt600_T_hs,
-  &mppt600_mb_charge_state,
-  &mppt600_fault_i,
-  &mppt600_alarm_i,
-  //&mppt600_Ahc_r,
-  //&mppt600_kwhc_r,
-  &mppt600_Whc_daily,
-
-  &mppt60_vb_ref,
-  &mppt60_adc_vb_f_med,
-  &mppt60_adc_va,
-  &mppt60_adc_ib_f_shadow,
-  &mppt60_adc_ia_f_shadow,
-  &mppt60_T_hs,
-  &mppt60_charge_state,
-  &mppt60_fault,
-  &mppt60_alarm,
-  //&mppt60_Ahc_r,
-  &mppt60_whc_daily,
-  &mppt60_EV_hvd,  // from EEPROM
-  &mppt60_EV_hvr,  // from EEPROM
-
-  &div60_V_ref,
-  &div60_adc_vb_f,
-  &div60_adc_vx_f,
-  &div60_adc_ipv_f,
-  &div60_adc_iload_f,
-  &div60_T_hs,
-  &div60_control_state,
-  &div60_d_filt,
-  &div60_fault,
-  &div60_Alarm_LO,
-  &div60_Alarm_HI,
-  &div60_Ah_r,
+const int NUM_MOD_NUV_CHANNELS = sizeof(mod_nuv_chans) / sizeof(mod_nuv_chans[0]);
+
+
+// The TS-60 alarm is 32 bits in 2 regs, LO and HI. They're output as ONE channel, ABD60 or ABD2 (CH_MERGE_LO, CH_MERGE_HI).
+// The EV_hvd and EV_hvr regs of the PV controllers are NOT in the long read caches, so they're flagged CH_NOT_CACHED.
+constexpr ModChannel mod_fast_chans[] = {
+  { &mppt600_vb_ref },
+  { &mppt600_adc_vb_f_med },
+  { &mppt600_adc_va_f_shadow },
+  { &mppt600_adc_ib_f_shadow },
+  { &mppt600_adc_ia_f_shadow },
+  { &mppt600_T_hs },
+  { &mppt600_mb_charge_state },
+  { &mppt600_fault_i },
+  { &mppt600_alarm_i },
+  //{ &mppt600_Ahc_r },
+  //{ &mppt600_kwhc_r },
+  { &mppt600_Whc_daily },
+
+  { &mppt60_vb_ref },
+  { &mppt60_adc_vb_f_med },
+  { &mppt60_adc_va },
+  { &mppt60_adc_ib_f_shadow },
+  { &mppt60_adc_ia_f_shadow },
+  { &mppt60_T_hs },
+  { &mppt60_charge_state },
+  { &mppt60_fault },
+  { &mppt60_alarm },
+  //{ &mppt60_Ahc_r },
+  { &mppt60_whc_daily },
+  { &mppt60_EV_hvd, CH_NOT_CACHED },  // from EEPROM
+  { &mppt60_EV_hvr, CH_NOT_CACHED },  // from EEPROM
+
+  { &div60_V_ref },
+  { &div60_adc_vb_f },
+  { &div60_adc_vx_f },
+  { &div60_adc_ipv_f },
+  { &div60_adc_iload_f },
+  { &div60_T_hs },
+  { &div60_control_state },
+  { &div60_d_filt },
+  { &div60_fault },
+  { &div60_Alarm_LO, CH_MERGE_LO },
+  { &div60_Alarm_HI, CH_MERGE_HI, "ABD60" },
+  { &div60_Ah_r },
   
-  &mppt30_vb_ref,
-  &mppt30_adc_vb_f_med,
-  &mppt30_adc_va,
-  &mppt30_adc_ib_f_shadow,
-  &mppt30_adc_ia_f_shadow,
-  &mppt30_T_hs,
-  &mppt30_charge_state,
-  &mppt30_fault,
-  &mppt30_alarm,
-  //&mppt30_Ahc_r,
-  &mppt30_whc_daily,
-  &mppt30_EV_hvd,  // from EEPROM
-  &mppt30_EV_hvr,  // from EEPROM
-
-  &div2_V_ref,
-  &div2_adc_vb_f,
-  &div2_adc_vx_f,
-  &div2_adc_ipv_f,
-  &div2_adc_iload_f,
-  &div2_T_hs,
-  &div2_control_state,
-  &div2_d_filt,
-  &div2_fault,
-  &div2_Alarm_LO,
-  &div2_Alarm_HI,
-  &div2_Ah_r,
+  { &mppt30_vb_ref },
+  { &mppt30_adc_vb_f_med },
+  { &mppt30_adc_va },
+  { &mppt30_adc_ib_f_shadow },
+  { &mppt30_adc_ia_f_shadow },
+  { &mppt30_T_hs },
+  { &mppt30_charge_state },
+  { &mppt30_fault },
+  { &mppt30_alarm },
+  //{ &mppt30_Ahc_r },
+  { &mppt30_whc_daily },
+  { &mppt30_EV_hvd, CH_NOT_CACHED },  // from EEPROM
+  { &mppt30_EV_hvr, CH_NOT_CACHED },  // from EEPROM
+
+  { &div2_V_ref },
+  { &div2_adc_vb_f },
+  { &div2_adc_vx_f },
+  { &div2_adc_ipv_f },
+  { &div2_adc_iload_f },
+  { &div2_T_hs },
+  { &div2_control_state },
+  { &div2_d_filt },
+  { &div2_fault },
+  { &div2_Alarm_LO, CH_MERGE_LO },
+  { &div2_Alarm_HI, CH_MERGE_HI, "ABD2" },
+  { &div2_Ah_r },
 };
+const int NUM_MOD_FAST_CHANNELS = sizeof(mod_fast_chans) / sizeof(mod_fast_chans[0]);
 
 
 // Finally, expand the list below with the slow read (typ. EEPROM) channels...
-// Array specifying which channels are to be read infrequently and sent out in UDP packets
-const int NUM_MOD_SLOW_CHANNELS = 36;  // NUM_MOD_SLOW_CHANNELS value must match # channels in the array below
-ModbusReg* mod_slow_regs[] = {
-  &mppt60_EV_hvd,
-  &mppt60_EV_hvr,
-  &mppt30_EV_hvd,
-  &mppt30_EV_hvr,
+// Table specifying which channels are to be read infrequently and sent out in UDP packets
+constexpr ModChannel mod_slow_chans[] = {
+  { &mppt60_EV_hvd },
+  { &mppt60_EV_hvr },
+  { &mppt30_EV_hvd },
+  { &mppt30_EV_hvr },
   //
-  &mppt600_PV_P_0,
-  &mppt600_PV_P_1,
-  &mppt600_PV_P_2,
-  &mppt600_PV_P_3,
-  &mppt600_PV_P_4,
-  &mppt600_PV_P_5,
-  &mppt600_PV_P_6,
-  &mppt600_PV_P_7,
-  &mppt600_PV_P_8,
-  &mppt600_PV_P_9,
-  &mppt600_PV_P_10,
-  &mppt600_PV_P_11,
-  &mppt600_PV_P_12,
-  &mppt600_PV_P_13,
-  &mppt600_PV_P_14,
-  &mppt600_PV_P_15,
-  &mppt600_PV_V_0,
-  &mppt600_PV_V_1,
-  &mppt600_PV_V_2,
-  &mppt600_PV_V_3,
-  &mppt600_PV_V_4,
-  &mppt600_PV_V_5,
-  &mppt600_PV_V_6,
-  &mppt600_PV_V_7,
-  &mppt600_PV_V_8,
-  &mppt600_PV_V_9,
-  &mppt600_PV_V_10,
-  &mppt600_PV_V_11,
-  &mppt600_PV_V_12,
-  &mppt600_PV_V_13,
-  &mppt600_PV_V_14,
-  &mppt600_PV_V_15,
+  { &mppt600_PV_P_0 },
+  { &mppt600_PV_P_1 },
+  { &mppt600_PV_P_2 },
+  { &mppt600_PV_P_3 },
+  { &mppt600_PV_P_4 },
+  { &mppt600_PV_P_5 },
+  { &mppt600_PV_P_6 },
+  { &mppt600_PV_P_7 },
+  { &mppt600_PV_P_8 },
+  { &mppt600_PV_P_9 },
+  { &mppt600_PV_P_10 },
+  { &mppt600_PV_P_11 },
+  { &mppt600_PV_P_12 },
+  { &mppt600_PV_P_13 },
+  { &mppt600_PV_P_14 },
+  { &mppt600_PV_P_15 },
+  { &mppt600_PV_V_0 },
+  { &mppt600_PV_V_1 },
+  { &mppt600_PV_V_2 },
+  { &mppt600_PV_V_3 },
+  { &mppt600_PV_V_4 },
+  { &mppt600_PV_V_5 },
+  { &mppt600_PV_V_6 },
+  { &mppt600_PV_V_7 },
+  { &mppt600_PV_V_8 },
+  { &mppt600_PV_V_9 },
+  { &mppt600_PV_V_10 },
+  { &mppt600_PV_V_11 },
+  { &mppt600_PV_V_12 },
+  { &mppt600_PV_V_13 },
+  { &mppt600_PV_V_14 },
+  { &mppt600_PV_V_15 },
 };
-
-
-// This function is called by getChanName(), which is called by printPOSTBody(), both in webclient.ino,
-// and is used to select which subset of data channels gets put into UDP packets.
-char* getModchannelName(int modbus_type, int i) {
-  switch (modbus_type) {
-    case 1:
-      return(mod_fast_regs[i]->getChanLabel());
-      break;
-    case 2:
-      return(mod_slow_regs[i]->getChanLabel());
-      break;
-    case 3:
-      return(mod_nuv_regs[i]->getChanLabel());
-      break;
-    default:
-      break;
-  }
-}
-
-// This function is called by printPOSTBody() in webclient.ino
-char* getModchannelValue(int modbus_type, int i) {
-  switch (modbus_type) {
-    case 1:
-      return(mod_fast_regs[i]->valStrg());
-      break;
-    case 2:
-      return(mod_slow_regs[i]->valStrg());
-      break;
-    case 3:
-      return(mod_nuv_regs[i]->valStrg());
-      break;
+const int NUM_MOD_SLOW_CHANNELS = sizeof(mod_slow_chans) / sizeof(mod_slow_chans[0]);
+
+static_assert(modChannelsOK(mod_nuv_chans, NUM_MOD_NUV_CHANNELS, 0), "modbus.h: bad CH_MERGE_* in mod_nuv_chans[]");
+static_assert(modChannelsOK(mod_fast_chans, NUM_MOD_FAST_CHANNELS, 0), "modbus.h: bad CH_MERGE_* in mod_fast_chans[]");
+static_assert(modChannelsOK(mod_slow_chans, NUM_MOD_SLOW_CHANNELS, 0), "modbus.h: bad CH_MERGE_* in mod_slow_chans[]");
+static_assert(NUM_MOD_FAST_CHANNELS <= 64 && NUM_MOD_SLOW_CHANNELS <= 64, "modbus.h: too many channels for a telemetry mask");
+
+
+// Returns the channel table for a Modbus group (CH_GROUP_MOD_FAST, CH_GROUP_MOD_SLOW, CH_GROUP_NUVATION), and its size in n
+const ModChannel* getModChannels(int group, int* n) {
+  switch (group) {
+    case CH_GROUP_MOD_FAST:
+      *n = NUM_MOD_FAST_CHANNELS;
+      return(mod_fast_chans);
+    case CH_GROUP_MOD_SLOW:
+      *n = NUM_MOD_SLOW_CHANNELS;
+      return(mod_slow_chans);
+    case CH_GROUP_NUVATION:
+      *n = NUM_MOD_NUV_CHANNELS;
+      return(mod_nuv_chans);
     default:
-      break;
+      *n = 0;
+      return(NULL);
   }
 }
 
@@ -0,0 +1,194 @@
+// ---------- modbusserver.ino ----------
+// MODBUS/TCP SERVER (slave)
+//
+// SCADA used to get controller data by scraping HTML pages or by listening for the JSON UDP packets. Now standard Modbus/TCP
+//   tooling can poll the controller directly, on port 502, with function 03 (Read Holding Registers) or 04 (Read Input
+//   Registers) - both read the same map. Writes are NOT supported (exception 01), and the Morningstars are never polled on
+//   a client's behalf: every read is served from the once-per-second snapshot, so third-party pollers can't load the RS-485 bus.
+//
+// The snapshot is taken by updateModbusServerSnapshot() in if(do_post){}, after the data reads - see wwe.ino. It is stored
+//   in Modbus (big-endian) byte order, so a request is answered with a header and a memcpy(): no per-request formatting.
+//
+// REGISTER MAP. 32-bit vals take 2 registers, HIGH word first. A request must lie within one block (otherwise exception 02).
+//      0 -   43  controller channels 0-21 (see channels.h), int32, native units, i.e., as getChannelRMSInt():
+//                  1024x actual, except TP (usteps), DL duty cycle (%) and STATE (bitfield)
+//    100 -  105  status: 100 = STATE bitfield (uint32), 102 = snapshot time (myunixtime, uint32), 104 = shutdown_state (int32)
+//   1000 - 1115  Morningstar 'fast' regs, mod_fast_chans[0-57] (see modbus.h), float32
+//   2000 - 2071  Morningstar 'slow' regs, mod_slow_chans[0-35], float32
+//   3000 - 3015  Nuvation regs, mod_nuv_chans[0-7], float32
+//   Modbus device vals are NaN if the last read of that reg failed - see valAsFloat() in modbus.h
+//
+// Only MBS_MAX_CLIENTS (1) client may be connected at once: a further connection is closed as soon as it's accepted,
+//   and a client that sends nothing for MBS_IDLE_MSEC is dropped to free its socket. The W5500 has 8 sockets:
+//     always open   statusudp (telemetry, summaries)                               1
+//                   webserver listener (port 49153)                                1
+//                   this listener (port 502)                                       1
+//     while busy    webserver client (a page being served)                         1
+//                   Nuvation Modbus/TCP client (once per second)                   1
+//                   webclient HTTP posts or HTTPS weather (one at a time)          1
+//                   configudp (while a config reply is pending), ntpudp (while
+//                     a request is outstanding), DNS/DHCP lookups                 1-3
+//                   this server's client                                           1
+//   That's 8 with one UDP transient; a second Modbus client would take the socket a config or NTP request needs.
+
+#define MBS_PORT 502
+#define MBS_MAX_CLIENTS 1                 // + 1 socket for the listener - see the socket budget above
+#define MBS_IDLE_MSEC 30000
+#define MBS_MAX_FRAME 260                 // 7-byte MBAP header + 253-byte PDU
+#define MBS_MAX_READ 125                  // max # registers in one read, per the Modbus spec
+
+#define MBS_CTL_BASE 0
+#define MBS_STATUS_BASE 100
+#define MBS_FAST_BASE 1000
+#define MBS_SLOW_BASE 2000
+#define MBS_NUV_BASE 3000
+#define MBS_NUM_STATUS_REGS 6
+
+EthernetServer mbs_server(MBS_PORT);
+EthernetClient mbs_clients[MBS_MAX_CLIENTS];
+uint8_t mbs_rxbuf[MBS_MAX_CLIENTS][MBS_MAX_FRAME];
+int mbs_rxlen[MBS_MAX_CLIENTS];
+unsigned long mbs_last_rx[MBS_MAX_CLIENTS];
+uint32_t mbs_requests = 0;                // # requests answered (including exceptions)
+
+// The snapshot, 2 bytes per register, big-endian
+uint8_t mbs_ctl[NUM_ADC_CHANNELS * 4];
+uint8_t mbs_status[MBS_NUM_STATUS_REGS * 2];
+uint8_t mbs_fast[NUM_MOD_FAST_CHANNELS * 4];
+uint8_t mbs_slow[NUM_MOD_SLOW_CHANNELS * 4];
+uint8_t mbs_nuv[NUM_MOD_NUV_CHANNELS * 4];
+
+
+// Start listening. Called once Ethernet is up - see runBootStages() in boot.ino
+void initModbusServer() {
+  mbs_server.begin();
+  Serial << "modbusserver: Listening on port " << MBS_PORT << "\n";
+}
+
+
+void putMBSLong(uint8_t* p, uint32_t val) {
+  p[0] = val >> 24;
+  p[1] = val >> 16;
+  p[2] = val >> 8;
+  p[3] = val;
+}
+
+
+void putMBSFloat(uint8_t* p, float val) {
+  uint32_t bits;
+  memcpy(&bits, &val, 4);
+  putMBSLong(p, bits);
+}
+
+
+// Copy this second's vals into the snapshot. Called once per second, in if(do_post){}, after the data reads - see wwe.ino
+void updateModbusServerSnapshot() {
+  for ( int i = 0; i < NUM_ADC_CHANNELS; i++ ) putMBSLong(&mbs_ctl[i*4], getChannelRMSInt(i));
+  putMBSLong(&mbs_status[0], getChannelRMSInt(STATE));
+  putMBSLong(&mbs_status[4], myunixtime);
+  putMBSLong(&mbs_status[8], shutdown_state);
+  for ( int i = 0; i < NUM_MOD_FAST_CHANNELS; i++ ) putMBSFloat(&mbs_fast[i*4], mod_fast_chans[i].reg->valAsFloat());
+  for ( int i = 0; i < NUM_MOD_SLOW_CHANNELS; i++ ) putMBSFloat(&mbs_slow[i*4], mod_slow_chans[i].reg->valAsFloat());
+  for ( int i = 0; i < NUM_MOD_NUV_CHANNELS; i++ ) putMBSFloat(&mbs_nuv[i*4], mod_nuv_chans[i].reg->valAsFloat());
+}
+
+
+// Find the snapshot bytes for registers addr to addr+count-1. Returns NULL if they're not all in one block.
+uint8_t* getMBSRegs(int addr, int count) {
+  if ( addr >= MBS_CTL_BASE && addr + count <= MBS_CTL_BASE + NUM_ADC_CHANNELS*2 ) return( &mbs_ctl[(addr - MBS_CTL_BASE)*2] );
+  if ( addr >= MBS_STATUS_BASE && addr + count <= MBS_STATUS_BASE + MBS_NUM_STATUS_REGS ) return( &mbs_status[(addr - MBS_STATUS_BASE)*2] );
+  if ( addr >= MBS_FAST_BASE && addr + count <= MBS_FAST_BASE + NUM_MOD_FAST_CHANNELS*2 ) return( &mbs_fast[(addr - MBS_FAST_BASE)*2] );
+  if ( addr >= MBS_SLOW_BASE && addr + count <= MBS_SLOW_BASE + NUM_MOD_SLOW_CHANNELS*2 ) return( &mbs_slow[(addr - MBS_SLOW_BASE)*2] );
+  if ( addr >= MBS_NUV_BASE && addr + count <= MBS_NUV_BASE + NUM_MOD_NUV_CHANNELS*2 ) return( &mbs_nuv[(addr - MBS_NUV_BASE)*2] );
+  return(NULL);
+}
+
+
+// Answer one complete request frame from client c. Returns the # bytes of the frame.
+int handleMBSFrame(int c, uint8_t* frame) {
+  uint8_t reply[MBS_MAX_FRAME];
+  int frame_len = 6 + ((frame[4] << 8) | frame[5]);  // MBAP length field counts the unit id + PDU
+  uint8_t fc = frame[7];
+  int pdu_len;
+
+  memcpy(reply, frame, 7);                            // transaction id, protocol id, (length), unit id
+  reply[7] = fc;
+  if ( fc != 3 && fc != 4 ) {
+    reply[7] = fc | 0x80;
+    reply[8] = 1;                                     // ILLEGAL FUNCTION
+    pdu_len = 2;
+  } else {
+    int addr = (frame[8] << 8) | frame[9];
+    int count = (frame[10] << 8) | frame[11];
+    uint8_t* regs = getMBSRegs(addr, count);
+    if ( frame_len < 12 || count < 1 || count > MBS_MAX_READ ) {
+      reply[7] = fc | 0x80;
+      reply[8] = 3;                                   // ILLEGAL DATA VALUE
+      pdu_len = 2;
+    } else if ( regs == NULL ) {
+      reply[7] = fc | 0x80;
+      reply[8] = 2;                                   // ILLEGAL DATA ADDRESS
+      pdu_len = 2;
+    } else {
+      reply[8] = count * 2;                           // byte count
+      memcpy(&reply[9], regs, count * 2);
+      pdu_len = 2 + count * 2;
+    }
+  }
+  reply[4] = (pdu_len + 1) >> 8;
+  reply[5] = (pdu_len + 1) & 0xff;
+  mbs_clients[c].write(reply, 7 + pdu_len);
+  mbs_requests++;
+  return(frame_len);
+}
+
+
+// Accept new clients, answer any complete requests, and drop idle clients. Called every loop() iteration, never waits.
+void pollModbusServer() {
+  EthernetClient newclient = mbs_server.accept();
+  if ( newclient ) {
+    int c;
+    for ( c = 0; c < MBS_MAX_CLIENTS; c++ ) if ( !mbs_clients[c] ) break;
+    if ( c < MBS_MAX_CLIENTS ) {
+      mbs_clients[c] = newclient;
+      mbs_rxlen[c] = 0;
+      mbs_last_rx[c] = millis();
+      Serial << "modbusserver: Client " << c << " connected from " << newclient.remoteIP() << "\n";
+    } else {
+      Serial << "modbusserver: Too many clients, closing connection from " << newclient.remoteIP() << "\n";
+      newclient.stop();
+    }
+  }
+
+  for ( int c = 0; c < MBS_MAX_CLIENTS; c++ ) {
+    if ( !mbs_clients[c] ) continue;
+    if ( !mbs_clients[c].connected() || (millis() - mbs_last_rx[c]) > MBS_IDLE_MSEC ) {
+      Serial << "modbusserver: Client " << c << " disconnected\n";
+      mbs_clients[c].stop();
+      continue;
+    }
+    int n = mbs_clients[c].available();
+    if ( n <= 0 ) continue;
+    n = mbs_clients[c].read(&mbs_rxbuf[c][mbs_rxlen[c]], min(n, MBS_MAX_FRAME - mbs_rxlen[c]));
+    if ( n <= 0 ) continue;
+    mbs_rxlen[c] += n;
+    mbs_last_rx[c] = millis();
+
+    // Answer every complete frame in the buffer (a client may pipeline several requests)
+    int pos = 0;
+    while ( mbs_rxlen[c] - pos >= 8 ) {
+      uint8_t* frame = &mbs_rxbuf[c][pos];
+      int frame_len = 6 + ((frame[4] << 8) | frame[5]);
+      if ( frame[2] != 0 || frame[3] != 0 || frame_len < 8 || frame_len > MBS_MAX_FRAME ) {  // not Modbus/TCP
+        Serial << "modbusserver: Bad frame from client " << c << ", closing connection\n";
+        mbs_clients[c].stop();
+        pos = mbs_rxlen[c];
+        break;
+      }
+      if ( mbs_rxlen[c] - pos < frame_len ) break;    // the rest hasn't arrived yet
+      pos += handleMBSFrame(c, frame);
+    }
+    mbs_rxlen[c] -= pos;
+    if ( mbs_rxlen[c] > 0 && pos > 0 ) memmove(mbs_rxbuf[c], &mbs_rxbuf[c][pos], mbs_rxlen[c]);
+  }
+}
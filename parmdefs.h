@@ -1,6 +1,6 @@
 // ---------- parmdefs.h ----------
 // This module defines ALL Controller Operating Parameters
-// MAX_PARMS 40 (see parms.h) current count = 37
+// MAX_PARMS 48 (see parms.h) current count = 47
 // All parms are saved to SD and the Config Server and persist across controller resets.
 //
 // Any parms which should NOT be checked against those on the Config Server should be added to the udp-config.py script
@@ -9,7 +9,7 @@
 // Parms MUST be listed below in the order they should appear on the Controller Operating Parameters webpage - see webserver.ino
 
 
-// ***TURBINE PARMS (14)***
+// ***TURBINE PARMS (15)***
 // Shutdown State
 // 0 = Normal Operation, 1 = Shutdown (routine), 2 = Shutdown (emergency)
 Parm parm_shutdown_state = Parm("shutdown_state", "Shutdown State", "0/1/2", 0);  // this is the most frequently changed parm
@@ -38,9 +38,12 @@ Parm parm_sc_exer_rpm = Parm("sc_exer_rpm", "Brake@ RPM <", "rpm", (float)180.0)
 // Number of alternator pole pairs (used in calculating RPM)
 Parm parm_alt_poles = Parm("alt_poles", "Alternator Poles", "", 6);  // Alxion alternator
 
+// Phase fault sensitivity: line-to-line amplitude imbalance (or +/- peak asymmetry) that furls, 0 = off - see phasefault.ino
+Parm parm_phase_imbal = Parm("phase_imbal", "Phase Fault@ Imbal >", "%", 40);
 
 
-// ***NETWORK AND SERVER PARMS (10)***
+
+// ***NETWORK AND SERVER PARMS (15)***
 // Dis/allow the controller to override parm vals if they differ from those saved on the Config Server
 Parm parm_ovrd = Parm("ovrd", "Override Updates?", "0/1", 0);  // default = 0 = don't override
 
@@ -49,7 +52,7 @@ Parm parm_cfg_minutes = Parm("cfg_minutes", "Update Interval", "mins", 5);
 
 // Update Server IP address. This server handles FIRMWARE updates - see doFWUpdate() in wwe.ino
 char pbuf20[20] = "192.168.1.4";
-Parm parm_cfg_ip = Parm("cfg_ip", "Update Server", pbuf20);
+Parm parm_cfg_ip = Parm("cfg_ip", "Update Server", pbuf20, sizeof(pbuf20));
 
 // Update Server port which handles FIRMWARE updates - see doFWUpdate() in wwe.ino
 Parm parm_cfg_port = Parm("cfg_port", "Update Port", "", 49152);
@@ -57,11 +60,30 @@ Parm parm_cfg_port = Parm("cfg_port", "Update Port", "", 49152);
 // Name of the firmware binary file currently being executed.
 // NOTE: Binary file name need to be in 8.3 format for saving to SD. Filenames could be coded by date, e.g., 20210627.bin
 char pbuf21[50] = "wwe.bin";
-Parm parm_binfile = Parm("binary_filename", "Update File", pbuf21);
+Parm parm_binfile = Parm("binary_filename", "Update File", pbuf21, sizeof(pbuf21));
 
 // Data Server IP address. This server handles UDP data and config requests from the controller.
 char pbuf19[20] = "192.168.1.4";
-Parm parm_udp_ip = Parm("udp_ip", "Data Server", pbuf19);
+Parm parm_udp_ip = Parm("udp_ip", "Data Server", pbuf19, sizeof(pbuf19));
+
+// Telemetry subscribers, in addition to the Data Server: "<ip>:<port>,<group>,<decimation>,<mask>", "" = none - see telemetry.ino
+// e.g., "192.168.1.50:58328,1,60,FFFFFFFFFFFFFFFF" is 44 chars, so these hold PARM_VAL_LEN - see parms.h
+char pbuf27[PARM_VAL_LEN] = "";
+Parm parm_telem_sub1 = Parm("telem_sub1", "Telemetry Sub 1", pbuf27, sizeof(pbuf27));
+char pbuf28[PARM_VAL_LEN] = "";
+Parm parm_telem_sub2 = Parm("telem_sub2", "Telemetry Sub 2", pbuf28, sizeof(pbuf28));
+
+// Shared key a SUB/UNSUB message to the telemetry port must carry, "" = UDP subscriptions refused - see telemetry.ino
+char pbuf31[20] = "";
+Parm parm_telem_key = Parm("telem_key", "Telemetry Key", pbuf31, sizeof(pbuf31));
+
+// Waveform capture triggers, e.g., "FURL,SC,VDC>400,IDC>60,DRPM>100", "" = none - see capture.ino
+char pbuf29[40] = "FURL,SC,SHUTDOWN";
+Parm parm_cap_trig = Parm("cap_trig", "Capture Triggers", pbuf29, sizeof(pbuf29));
+
+// ADC filter chains, e.g., "IDC:M5/B50,VDC:D4/B10/A0.2", "" = the default median-of-3 + EMA on all channels - see filter.ino
+char pbuf30[PARM_VAL_LEN] = "";
+Parm parm_adc_filt = Parm("adc_filt", "ADC Filter Chains", pbuf30, sizeof(pbuf30));
 
 // Controller LAN IP address (if static) or DHCP
 char pbuf23[20] = "192.168.1.40";
@@ -69,10 +91,10 @@ Parm parm_controller_ip = Parm("controller_ip", "Controller IP", "DHCP");  // "D
 
 // LAN Gateway
 char pbuf24[20] = "192.168.1.1";
-Parm parm_gateway_ip = Parm("gateway_ip", "Gateway IP", pbuf24);
+Parm parm_gateway_ip = Parm("gateway_ip", "Gateway IP", pbuf24, sizeof(pbuf24));
 
  // LAN DNS
-Parm parm_dns1_ip = Parm("dns1_ip", "DNS1 IP", pbuf24);
+Parm parm_dns1_ip = Parm("dns1_ip", "DNS1 IP", pbuf24, sizeof(pbuf24));
 
 // Nuvation BMS IP address (via Modbus/TCP)
 char pbuf22[20] = "192.168.1.21";
@@ -81,13 +103,18 @@ Parm parm_nuvation_ip = Parm("nuvation_ip", "Nuvation IP", IPAddress(192,168,1,2
 
 
 
-// ***HVDL PARMS (5)***
-// These parms are used by manageDumpLoad() - see furlctl.ino
+// ***HVDL PARMS (10)***
+// These parms are used by manageDumpLoad() - see furlctl.ino - and computeDumpLoadDuty() - see dumpload.ino
 Parm parm_hvdl_active = Parm("hvdl_active", "HVDL Active", "0/1", 0);
 Parm parm_hvdl_R = Parm("hvdl_R", "HVDL Resistance", "Ohms", 18);
 Parm parm_hvdl_Vstart = Parm("hvdl_Vstart", "HVDL Vstart", "V", 120);
 Parm parm_hvdl_Vspan = Parm("hvdl_Vspan", "HVDL Vspan", "V", 180);
 Parm parm_hvdl_Pmax = Parm("hvdl_Pmax", "HVDL Pmax", "W", 2200);
+Parm parm_hvdl_mode = Parm("hvdl_mode", "HVDL Mode (0=ramp, 1=PI)", "0/1", 0);
+Parm parm_hvdl_pwm_hz = Parm("hvdl_pwm_hz", "HVDL PWM Frequency", "Hz", 100);  // hardware PWM only - see DUMP_PWM_HW in pindefs.h
+Parm parm_hvdl_Vreg = Parm("hvdl_Vreg", "HVDL PI Vreg", "V", 250);
+Parm parm_hvdl_Kp = Parm("hvdl_Kp", "HVDL PI Kp", "0.1%/V", 20);
+Parm parm_hvdl_Ki = Parm("hvdl_Ki", "HVDL PI Ki", "0.1%/V-s", 50);
 
 
 
@@ -6,17 +6,20 @@
 #define TYPE_INT 1
 #define TYPE_FLOAT 2
 #define TYPE_IP 3
-#define MAX_PARMS 40
+#define MAX_PARMS 48
+#define PARM_VAL_LEN 64  // max string val length + 1, e.g., a telem_sub parm: the web form field, the flash parm store record - see parmstore.h
 
 class Parm;
 int num_parms = 0;
 boolean addParm(Parm*);
 boolean parms_dirty = false;
+unsigned long parms_version = 0;  // incremented on EVERY parm change (not on setting the same val), so consumers can tell when to recompute - see evalThresholdRules() in furlctl.ino
 void digitalWriteDirect(int, boolean);
 
 void setParmsDirty() {
   //digitalWriteDirect(39, HIGH);
   parms_dirty = true;
+  parms_version++;
   //digitalWriteDirect(39, LOW);
 }
 
@@ -27,14 +30,24 @@ class Parm {
     // STRING parameter:
     // SPACE FOR THE STRING MUST BE PREALLOCATED AND GIVEN TO THIS CONSTRUCTOR!
     // Although Parm has its own string buffer, forcing use of an external one allows use of strings longer than the fixed length of the internal buffer.
+    // Without a len, the buffer must hold PARM_VAL_LEN chars.
     Parm(char* parmname, char* engname, char* val):
-         parmname(parmname), strval(val), parm_eng_name(engname), parm_units("") {  // arg initializers
+         parmname(parmname), strval(val), strval_len(PARM_VAL_LEN), parm_eng_name(engname), parm_units("") {  // arg initializers
       parmtype = TYPE_STR;  // set parm type
       addParm(this);        // add to the parameter list
       newparm = true;       // set flag
       setParmsDirty();      //
     }
 
+    // STRING parameter with its buffer size, e.g., Parm("name", "Eng Name", pbuf, sizeof(pbuf)). A longer val is truncated.
+    Parm(char* parmname, char* engname, char* val, size_t len):
+         parmname(parmname), strval(val), strval_len(len), parm_eng_name(engname), parm_units("") {  // arg initializers
+      parmtype = TYPE_STR;
+      addParm(this);
+      newparm = true;
+      setParmsDirty();
+    }
+
     // INTEGER parameter:
     Parm(char* parmname, char* engname, char* units, int val): 
          parmname(parmname), intval(val), parm_eng_name(engname), parm_units(units) {  // arg initializers
@@ -86,23 +99,27 @@ class Parm {
 
     // Set value of STRING parm; return true if successful, false if not.
     // If parm type is string, just copy it to the Parm's buffer, otherwise, convert it.
+    // Copies are bounded by the buffer size: a val too long for it is truncated, not written past its end.
+    // An unchanged val isn't a change: it doesn't bump parms_version, which would recommit the flash parm store - see wwe.ino
     boolean setParmVal(char* val) {
+      if ( strncmp(parmVal(), val, (parmtype == TYPE_STR ? strval_len : PARM_VAL_LEN) - 1) == 0 ) return(true);
       if (parmtype == TYPE_STR) {
        //strcpy(strbuf, val);                       // string representation; why commented out?
-       strcpy(strval, val);                       // ???
+       strncpy(strval, val, strval_len - 1);      // bounded by strval_len, see the constructors
+       strval[strval_len - 1] = 0;
       }
       if (parmtype == TYPE_INT) {
-        strcpy(strbuf, val);                      // string representation
+        copyStrBuf(val);                          // string representation
         intval = atoi(val);                       // int representation
       }
       if (parmtype == TYPE_FLOAT) {
-        strcpy(strbuf, val);                      // string representation
+        copyStrBuf(val);                          // string representation
         floatval = atof(val);                     // float representation
         floatval_int = (int)(1024.0 * floatval);  // int representation
       }
       
       if (parmtype == TYPE_IP) {
-        strcpy(strbuf, val);                                                        // string representation
+        copyStrBuf(val);                                                            // string representation
         sscanf(strbuf, "%d.%d.%d.%d", &ipval[0], &ipval[1], &ipval[2], &ipval[3]);  // array representation
       }
       
@@ -113,6 +130,7 @@ class Parm {
     // Set value of INTEGER parm; return true if successful, false if not.
     boolean setParmVal(int val) {
       //Serial << "parms.h: set INTEGER parm to " << val << "\n";
+      if ( val == intval ) return(true);           // unchanged, see setParmVal(char*)
       sprintf(strbuf, "%d", val);
       intval = val;
       newparm = true;
@@ -122,6 +140,7 @@ class Parm {
     // Set value of FLOAT parm; return true if successful, false if not.
     boolean setParmVal(float val) {
       //Serial << "parms.h: set FLOAT parm to " << val << "\n";
+      if ( val == floatval ) return(true);         // unchanged, see setParmVal(char*)
       sprintf(strbuf, "%.2f", val);
       floatval = val;
       floatval_int = (int)(1024.0 * floatval);
@@ -192,15 +211,21 @@ class Parm {
     }
     
   private:
+    void copyStrBuf(char* val) {
+      strncpy(strbuf, val, PARM_VAL_LEN - 1);
+      strbuf[PARM_VAL_LEN - 1] = 0;
+    }
+
     int int_range_max;
     int int_range_min;
     float float_range_max;
     float float_range_min;
     boolean newparm;
-    char strbuf[40];
+    char strbuf[PARM_VAL_LEN];
     int parmtype;
     char* parmname;
     char* strval;
+    size_t strval_len;                    // size of the strval buffer
     char* parm_eng_name;
     char* parm_units;
     int intval;
@@ -214,33 +239,41 @@ class Parm {
 // A pointer to each parm is added to this array as they are created. This gives us a way to read and write all of them.
 Parm* parmary[MAX_PARMS];
 
-int findParmIndex(char* pn){
-  //Serial.print("findParmIndex(): ");
-  //Serial.println(pn);
-  for(int i = 0; i < num_parms; i++){
-    Parm* parmptr = parmary[i];
-    char* parmname = parmptr->parmName();
-    //Serial.println(parmname);
-    if(strcmp(parmname, pn) == 0){
-      //Serial.println("found");
+// Name index: parm names are hashed (32-bit FNV-1a) into an open-addressed table of parmary[] indices, so a lookup is 
+//   one hash plus (almost always) one strcmp instead of a strcmp against every parm. 
+//   The same hash identifies each parm in the flash parm store - see parmstore.ino
+#define PARM_HASH_SIZE 64                  // power of 2, comfortably > MAX_PARMS
+#define PARM_HASH_MASK (PARM_HASH_SIZE - 1)
+uint32_t parm_hashes[MAX_PARMS];           // name hash of each parm, same index as parmary[]
+uint8_t parm_hash_index[PARM_HASH_SIZE];   // parmary[] index + 1; 0 = empty slot (so the table is valid before any constructor runs)
+
+uint32_t parmHash(char* pn){
+  uint32_t h = 2166136261UL;
+  while(*pn){
+    h ^= (uint8_t)*pn++;
+    h *= 16777619UL;
+  }
+  return(h);
+}
+
+// Return the parmary[] index of the parm with name hash h, or -1. If pn is NULL, match on the hash alone.
+int findParmIndexHash(uint32_t h, char* pn){
+  for(int slot = h & PARM_HASH_MASK; parm_hash_index[slot]; slot = (slot + 1) & PARM_HASH_MASK){
+    int i = parm_hash_index[slot] - 1;
+    if(parm_hashes[i] == h && (pn == NULL || strcmp(parmary[i]->parmName(), pn) == 0)){
       return(i);
     }
-  }    
-  //Serial.println("not found");
+  }
   return(-1);
 }
 
+int findParmIndex(char* pn){
+  return(findParmIndexHash(parmHash(pn), pn));
+}
+
 Parm* findParm(char* pn){
-  for(int i = 0; i < num_parms; i++){
-    Parm* parmptr = parmary[i];
-    char* parmname = parmptr->parmName();
-    //Serial.println(parmname);
-    if(strcmp(parmname, pn) == 0){
-      return(parmptr);
-    }
-  }    
-  //Serial.println("not found");
-  return(NULL);
+  int i = findParmIndex(pn);
+  return(i >= 0 ? parmary[i] : NULL);
 }
 
 // This version always returns the string version of the parm.
@@ -274,7 +307,12 @@ boolean setParmVal(char* pn, char* val){
 
 boolean addParm(Parm* newparmptr){
   if(num_parms < MAX_PARMS){
+    uint32_t h = parmHash(newparmptr->parmName());
+    int slot = h & PARM_HASH_MASK;
+    while(parm_hash_index[slot]) slot = (slot + 1) & PARM_HASH_MASK;
+    parm_hashes[num_parms] = h;
     parmary[num_parms++] = newparmptr;
+    parm_hash_index[slot] = num_parms;  // index + 1
     return(true);
   }else{
     return(false);
@@ -2,11 +2,11 @@
 // Parms are operating parameters that need to be saved in nonvolatile memory.
 // This module contains functions to move them around and print them:
 // 
-// boolean writeParms2SD(char* filename)      : current parms --> buffer --> SD, used in wwe.ino and by parmCmd() in webserver.ino
+// boolean writeParms2SD(char* filename)      : current parms --> buffer --> SD, used in wwe.ino
 // void writeParms2Buff(boolean include_mac)  : current parms --> buffer, used by writeParms2SD(), and in wwe.ino
 
 // boolean readSD2Parms(char* filename)       : SD --> buffer --> current parms, used in wwe.ino
-// int writeBuff2Parms()                      : buffer --> current parms, used by readSD2Parms(), and by sendConfigUDP() in web.ino
+// int writeBuff2Parms()                      : buffer --> current parms, used by readSD2Parms(), and by checkConfigUDP() in web.ino
 
 // void printParms()                          : current parms --> Serial
 // void printJSONBuf()                        : buffer --> Serial
@@ -136,9 +136,11 @@ int writeBuff2Parms() {
       //Serial << "parms: writeBuff2Parms() " << i.key() << " = " << (char*)i.value() << "\n";
       strcpy(tmpkey, i.key());                                         //   copy key into tmpkey
       if ( strcmp(tmpkey, "status") != 0 ) {                           //   if tmpkey != "status"...
-        setParmVal(tmpkey, i.value());                                 //     ***update parm val to that found in jsonbuf***
-        rc |= 1;                                                       //     set return code bit 0 --> parm update has occurred
-        Serial << "parms: writeBuff2Parms() Updated parm " << tmpkey << " = " << (char*)i.value() << "\n";
+        if ( strcmp(parmVal(tmpkey), i.value()) != 0 ) {               //     if the value differs (see parms.h)...
+          setParmVal(tmpkey, i.value());                               //       ***update parm val to that found in jsonbuf***
+          rc |= 1;                                                     //       set return code bit 0 --> parm update has occurred
+          Serial << "parms: writeBuff2Parms() Updated parm " << tmpkey << " = " << (char*)i.value() << "\n";
+        }
         if (strcmp(tmpkey, "binary_filename") == 0) {                  //     if key == "binary_filename"
           rc |= 2;                                                     //       set return code bit 1 --> firmware update is available
           Serial << "parms: writeBuff2Parms() Firmware update " << (char*)i.value() << " is available!\n";
@@ -0,0 +1,57 @@
+// ---------- parmstore.h ----------
+// Flash parm store layout and state - see parmstore.ino
+// This is a .h file (#include'd in wwe.ino) so that wwe.ino and webclient.ino can see it.
+
+#ifndef PARMSTORE_DEFINED
+#define PARMSTORE_DEFINED
+
+#define PARMSTORE_ADDR 0xF8000             // ABSOLUTE flash address - see note re DueFlashStorage.h in wwe.ino
+#define PARMSTORE_SLOT_SIZE 4096           // 16 flash pages, = sizeof(rcvbuf) - see writeParms2Flash()
+#define PARMSTORE_NUM_SLOTS 8              // 8 * 4096 = 32 KB, to the end of flash
+#define PARMSTORE_PAGE_SIZE 256            // IFLASH1_PAGE_SIZE
+#define PARMSTORE_MAGIC 0x534D5250         // "PRMS"
+#define PARMSTORE_FORMAT 3                 // change if the header/record layout or slot size changes, and add the old one to
+                                           //   parmstore_formats[] (1: 2 KB slots, 2: 4 KB slots, 3: 64-char vals)
+#define PARMSTORE_VAL_LEN PARM_VAL_LEN     // same as Parm strbuf[] - see parms.h
+#define PARMSTORE_RETRY_SEC 10             // first retry after a failed commit; doubles with each failure, up to 64x
+
+DueFlashStorage dueflashstorage;           // instantiate a DUE flash storage object - used here, in checkpoint.ino, web.ino, webclient.ino
+
+struct ParmStoreHeader {
+  uint32_t magic;
+  uint16_t format;
+  uint16_t count;                          // # records that follow
+  uint32_t seq;                            // commit sequence #, highest valid one wins
+  uint32_t crc;                            // CRC32 of the 12 header bytes above + count records
+};
+
+struct ParmStoreRecord {
+  uint32_t name_hash;
+  char val[PARMSTORE_VAL_LEN];             // null-terminated string representation, as in the SD parm file
+};
+
+#if (16 + MAX_PARMS * (4 + PARMSTORE_VAL_LEN)) > PARMSTORE_SLOT_SIZE
+#error "PARMSTORE_SLOT_SIZE too small for MAX_PARMS"
+#endif
+
+// Formats readFlash2Parms() can load: the current one first, then older ones, which are migrated - see parmstore.ino
+struct ParmStoreFormat {
+  uint16_t format;
+  uint16_t slot_size;                      // slots are at PARMSTORE_ADDR + n * slot_size
+  uint16_t val_len;                        // a record is a name hash + val_len chars
+};
+const ParmStoreFormat parmstore_formats[] = {
+  { PARMSTORE_FORMAT, PARMSTORE_SLOT_SIZE, PARMSTORE_VAL_LEN },
+  { 2, 4096, 40 },
+  { 1, 2048, 40 },
+};
+#define PARMSTORE_NUM_FORMATS (int)(sizeof(parmstore_formats) / sizeof(parmstore_formats[0]))
+
+boolean parmstore_ok = false;              // true once a valid image has been read or written
+int parmstore_slot = -1;                   // slot holding the current image
+uint32_t parmstore_seq = 0;                // its sequence #
+unsigned long parmstore_version = 0;       // parms_version when last committed - see parms.h
+int parmstore_failures = 0;                // failed commits in a row
+unsigned long parmstore_retry_time = 0;    // myunixtime after which loop() may retry a failed commit - see wwe.ino
+
+#endif
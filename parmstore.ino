@@ -0,0 +1,176 @@
+// ---------- parmstore.ino ----------
+// FLASH PARM STORE
+//
+// Parms are kept as a binary image in the top 32 KB of flash bank 1 (0xF8000-0xFFFFF), above the updatefw.bin bootloader
+//   which doFWUpdate() loads at 0xC0000 - see webclient.ino. Unlike the SD parm file (see parms.ino), the image is available
+//   before (and without) the SD card, and committing a change is a few page writes instead of an SD delete + rewrite.
+//
+// The region is divided into PARMSTORE_NUM_SLOTS slots. Each commit goes to the slot AFTER the current one, so the
+//   previous image stays intact until the new one is written and verified, and writes are spread over all slots.
+// Slot layout:
+//   header  : magic, format, parm count, sequence #, CRC32 (of the rest of the header and all the records)
+//   records : { name hash, value string } for each parm - see parmHash() in parms.h
+// Parms are matched by name hash, so an image written by older firmware still loads after parms are added or removed.
+// At boot, readFlash2Parms() loads the valid slot with the highest sequence #. If there's no image in the current
+//   format, it looks for one in an older format (see parmstore_formats[] in parmstore.h), loads it, and the next commit
+//   rewrites it in the current format, in a slot that doesn't overlap it.
+//
+// Commit order: a slot's records are written first and its header page LAST. If power fails part way through,
+//   that slot's CRC does not match and the previous slot is used.
+// A commit that doesn't verify (e.g., a worn page) is retried in the NEXT slot, never the current one, and loop()
+//   backs off PARMSTORE_RETRY_SEC, doubling, between retries instead of rewriting flash every pass.
+//
+// Writes to bank 1 do not stall code executing from bank 0, so the timer interrupts keep running during a commit.
+//
+// boolean writeParms2Flash()  : current parms --> rcvbuf[] --> flash, used in wwe.ino and by parmCmd() in webserver.ino
+// boolean readFlash2Parms()   : flash --> current parms, used in wwe.ino
+// uint32_t crc32Update()      : standard (zlib) CRC32
+
+// Layout, slot geometry and state are in parmstore.h
+
+
+// Nibble-table CRC32 (poly 0xEDB88320). Start with crc = 0; pass the previous result to continue over more data.
+uint32_t crc32Update(uint32_t crc, const byte* buf, int len) {
+  static const uint32_t crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  crc = ~crc;
+  while ( len-- > 0 ) {
+    crc ^= *buf++;
+    crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+    crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+  }
+  return(~crc);
+}
+
+
+uint32_t getParmStoreSlotAddr(int slot) {
+  return(PARMSTORE_ADDR + slot * PARMSTORE_SLOT_SIZE);
+}
+
+
+// CRC of a slot image, wherever it is (flash or rcvbuf[]); rec_size = 4 + the format's val_len
+uint32_t getParmStoreCRC(byte* image, int count, int rec_size) {
+  uint32_t crc = crc32Update(0, image, 12);
+  return(crc32Update(crc, image + sizeof(ParmStoreHeader), count * rec_size));
+}
+
+
+// Return true if flash at addr holds a complete, uncorrupted image in format f; copy its header into hdr.
+boolean checkParmStoreImage(uint32_t addr, const ParmStoreFormat* f, ParmStoreHeader* hdr) {
+  byte* image = dueflashstorage.readAddress(addr);
+  int rec_size = 4 + f->val_len;
+  memcpy(hdr, image, sizeof(ParmStoreHeader));
+  if ( hdr->magic != PARMSTORE_MAGIC || hdr->format != f->format || hdr->count > MAX_PARMS ) return(false);
+  if ( sizeof(ParmStoreHeader) + hdr->count * rec_size > f->slot_size ) return(false);
+  return(getParmStoreCRC(image, hdr->count, rec_size) == hdr->crc);
+}
+
+
+// Return true if the slot holds a complete, uncorrupted image in the current format; copy its header into hdr.
+boolean checkParmStoreSlot(int slot, ParmStoreHeader* hdr) {
+  return(checkParmStoreImage(getParmStoreSlotAddr(slot), &parmstore_formats[0], hdr));
+}
+
+
+// Find the newest valid image, in the newest format there is one in, and load it into the current parms. Returns true if successful.
+boolean readFlash2Parms() {
+  ParmStoreHeader hdr;
+  ParmStoreRecord rec;
+  const ParmStoreFormat* f = NULL;
+  uint32_t addr = 0;
+  int loaded = 0;
+
+  parmstore_slot = -1;
+  for ( int k = 0; k < PARMSTORE_NUM_FORMATS && f == NULL; k++ ) {
+    const ParmStoreFormat* fk = &parmstore_formats[k];
+    int num_slots = PARMSTORE_NUM_SLOTS * PARMSTORE_SLOT_SIZE / fk->slot_size;
+    for ( int slot = 0; slot < num_slots; slot++ ) {
+      uint32_t a = PARMSTORE_ADDR + slot * fk->slot_size;
+      if ( checkParmStoreImage(a, fk, &hdr) && (f == NULL || (int32_t)(hdr.seq - parmstore_seq) > 0) ) {
+        f = fk;
+        addr = a;
+        parmstore_seq = hdr.seq;
+      }
+    }
+  }
+  if ( f == NULL ) {
+    Serial << "parmstore: readFlash2Parms(): No valid parm image in flash\n";
+    return(false);
+  }
+  parmstore_slot = (addr - PARMSTORE_ADDR) / PARMSTORE_SLOT_SIZE;  // for an older format, the current slot it lies in
+
+  int rec_size = 4 + f->val_len;
+  byte* image = dueflashstorage.readAddress(addr);
+  memcpy(&hdr, image, sizeof(ParmStoreHeader));
+  for ( int n = 0; n < hdr.count; n++ ) {
+    byte* r = image + sizeof(ParmStoreHeader) + n * rec_size;
+    memset(&rec, 0, sizeof(rec));
+    memcpy(&rec.name_hash, r, 4);
+    memcpy(rec.val, r + 4, min((int)f->val_len, PARMSTORE_VAL_LEN));
+    rec.val[PARMSTORE_VAL_LEN - 1] = 0;
+    int i = findParmIndexHash(rec.name_hash, NULL);  // see parms.h
+    if ( i >= 0 ) {                                  // skip parms this firmware doesn't have
+      parmary[i]->setParmVal(rec.val);
+      loaded++;
+    }
+  }
+  if ( f->format == PARMSTORE_FORMAT ) {
+    parmstore_version = parms_version;
+  } else {                                 // leave parmstore_version stale, so the next commit migrates it
+    Serial << "parmstore: readFlash2Parms(): Format " << f->format << " image at 0x" << _HEX(addr) << ", will be rewritten as format " << PARMSTORE_FORMAT << "\n";
+  }
+  parmstore_ok = true;
+  Serial << "parmstore: readFlash2Parms(): Loaded " << loaded << " of " << hdr.count << " parms from slot " << parmstore_slot << ", seq " << parmstore_seq << "\n";
+  return(true);
+}
+
+
+// Commit the current parms to the next slot (skipping slots that failed to verify). Returns true if the new image verifies.
+// Uses rcvbuf[] as the image buffer. A string val longer than PARMSTORE_VAL_LEN - 1 is truncated, and logged.
+boolean writeParms2Flash() {
+  ParmStoreHeader hdr;
+  ParmStoreRecord rec;
+  unsigned long version = parms_version;  // snapshot; if a parm changes while we work, the next commit picks it up
+  int slot = (parmstore_slot + 1 + parmstore_failures % (PARMSTORE_NUM_SLOTS - 1)) % PARMSTORE_NUM_SLOTS;
+  uint32_t addr = getParmStoreSlotAddr(slot);
+
+  memset(rcvbuf, 0xFF, PARMSTORE_SLOT_SIZE);
+  for ( int i = 0; i < num_parms; i++ ) {
+    memset(&rec, 0, sizeof(rec));
+    rec.name_hash = parm_hashes[i];
+    strncpy(rec.val, parmary[i]->parmVal(), PARMSTORE_VAL_LEN - 1);
+    if ( strlen(parmary[i]->parmVal()) >= PARMSTORE_VAL_LEN ) {
+      Serial << "parmstore: writeParms2Flash(): " << parmary[i]->parmName() << " truncated to " << (PARMSTORE_VAL_LEN - 1) << " chars\n";
+    }
+    memcpy(rcvbuf + sizeof(ParmStoreHeader) + i * sizeof(ParmStoreRecord), &rec, sizeof(rec));
+  }
+  hdr.magic = PARMSTORE_MAGIC;
+  hdr.format = PARMSTORE_FORMAT;
+  hdr.count = num_parms;
+  hdr.seq = parmstore_seq + 1;
+  memcpy(rcvbuf, &hdr, sizeof(hdr));
+  hdr.crc = getParmStoreCRC(rcvbuf, num_parms, sizeof(ParmStoreRecord));
+  memcpy(rcvbuf, &hdr, sizeof(hdr));
+
+  int len = sizeof(ParmStoreHeader) + num_parms * sizeof(ParmStoreRecord);
+  if ( len > PARMSTORE_PAGE_SIZE ) {  // records first...
+    dueflashstorage.write(addr + PARMSTORE_PAGE_SIZE, rcvbuf + PARMSTORE_PAGE_SIZE, len - PARMSTORE_PAGE_SIZE);
+  }
+  dueflashstorage.write(addr, rcvbuf, min(len, PARMSTORE_PAGE_SIZE));  // ...then the header page
+
+  if ( !checkParmStoreSlot(slot, &hdr) || hdr.seq != parmstore_seq + 1 ) {
+    parmstore_failures++;
+    parmstore_retry_time = myunixtime + (PARMSTORE_RETRY_SEC << min(parmstore_failures - 1, 6));
+    Serial << "parmstore: writeParms2Flash(): Verify FAILED for slot " << slot << ", failure #" << parmstore_failures << "\n";
+    return(false);
+  }
+  parmstore_failures = 0;
+  parmstore_slot = slot;
+  parmstore_seq = hdr.seq;
+  parmstore_version = version;
+  parmstore_ok = true;
+  Serial << "parmstore: writeParms2Flash(): Wrote " << num_parms << " parms to slot " << slot << ", seq " << parmstore_seq << "\n";
+  return(true);
+}
@@ -0,0 +1,31 @@
+// ---------- phasefault.h ----------
+// Fast phase-loss and winding-fault detection - see phasefault.ino
+// This is a .h file (#include'd in wwe.ino) so that furlctl.ino and journal.ino, which come before phasefault.ino, can see it.
+
+#ifndef PHASEFAULT_DEFINED
+#define PHASEFAULT_DEFINED
+
+#define PF_MIN_AMP_INT (50 << 10)           // cycles with a mean line-to-line peak below 50 V aren't judged, 1024x actual
+#define PF_HYST_INT (5 << 10)               // zero crossing hysteresis, 1024x actual
+#define PF_MIN_CYCLE_MSEC 12                // 83 Hz, the max alternator frequency - see AnalogDiffChannel::CalcDiff() in adc.ino
+#define PF_MAX_CYCLE_MSEC 500               // 2 Hz = 40 rpm (6 poles); no V12 crossing for this long ends the cycle anyway
+#define PF_TIMEOUT_CYCLES 2                 // ...or for this many of the last good cycle's length, e.g., a shorted L1-L2
+#define PF_PHASE_TOL_PCT 15                 // a line-to-line crossing must be 1/3 or 2/3 of a cycle after V12's, +/- this % of a cycle
+#define PF_TRIP_CYCLES 2                    // consecutive bad cycles to set phase_fault
+#define PF_CLEAR_CYCLES 10                  // consecutive good cycles to clear it
+
+// Why a cycle was bad (phase_fault_why)
+#define PF_IMBAL 1                          // line-to-line amplitudes differ by more than parm_phase_imbal %
+#define PF_ASYM 2                           // a line-to-line waveform's + and - peaks differ by more than parm_phase_imbal % (rectifier leg)
+#define PF_ORDER 4                          // a line-to-line waveform didn't cross zero once, 120 deg from the others, in the usual order
+
+// judgePhaseCycle() returns these if it can't judge a cycle
+#define PF_STOPPED -1                       // stopped (below PF_MIN_AMP_INT) or disabled (parm_phase_imbal = 0): clears phase_fault
+#define PF_NOT_JUDGED -2                    // too short (a noise crossing), or started mid-cycle: ignored
+
+volatile boolean phase_fault = false;       // furl_reason bit 10 (PHASE) - see checkFurlConditions() in furlctl.ino
+volatile int phase_fault_chan = L1L2_VOLTAGE;  // the line-to-line channel with the lowest (or most asymmetric) amplitude in the tripping cycle
+volatile int phase_fault_why = 0;           // PF_* bits of the tripping cycle
+volatile unsigned long phase_fault_trips = 0;  // # times phase_fault has been set; furlctl1() furls on a new trip even if it has already cleared
+
+#endif
@@ -0,0 +1,131 @@
+// ---------- phasefault.ino ----------
+// FAST PHASE-LOSS AND WINDING-FAULT DETECTION
+//
+// An open phase, a failed rectifier leg or a phase-to-phase short used to show up only in the 1 sec EMA of VDC, IDC
+//   and RPM, i.e., after seconds, and only if it pushed one of them over a furl threshold. checkPhaseFault() instead
+//   judges every electrical cycle of the line-to-line waveforms (V12, V23, V31), as sampled by CalcDiff() in readADCs()
+//   at 1000 Hz: median-filtered, NOT time-averaged. parseFilterChains() keeps V1-V3 on the default median-of-3, so the
+//   three stay in step whatever parm_adc_filt says - see filter.ino. A cycle runs from one positive V12 zero crossing
+//   to the next, or times out after PF_TIMEOUT_CYCLES x the last good cycle (PF_MAX_CYCLE_MSEC before there is one),
+//   so a collapsed V12, e.g., L1 shorted to L2, is still judged every couple of cycles. At the end of each cycle, it's bad if:
+//   - PF_IMBAL: the largest and smallest line-to-line peak amplitudes differ by more than parm_phase_imbal % of their mean
+//   - PF_ASYM:  a waveform's + and - peaks differ by more than parm_phase_imbal % of its amplitude
+//   - PF_ORDER: V23 and V31 don't each cross zero once, 1/3 and 2/3 of a cycle after V12 (+/- PF_PHASE_TOL_PCT),
+//               in the order learned from the first good cycle after a reset
+// Cycles are only judged while the mean amplitude is above PF_MIN_AMP_INT and the cycle is a possible alternator
+//   frequency. PF_TRIP_CYCLES bad cycles in a row set phase_fault, which is furl_reason bit 10 (PHASE, STATE bit 13),
+//   i.e., a 60-min furl with the shorting contactor engaged - see furlctl1(). PF_CLEAR_CYCLES good cycles, a stopped
+//   (below PF_MIN_AMP_INT) alternator or parm_phase_imbal = 0 clear it; a cycle that can't be judged (noise) doesn't.
+//   furlctl1() runs every 100 msec, so it also furls on any trip since its last call (phase_fault_trips), even if
+//   phase_fault has cleared in between. At 470 rpm (23.5 Hz) a fault is seen in ~85 msec (~170 msec for a shorted
+//   L1-L2, which times out), plus up to 100 msec until the next furlctl1() call.
+//
+// Thresholds and flags are in phasefault.h
+
+int pf_max[3], pf_min[3];                   // peaks of V12, V23, V31 in this cycle, 1024x actual
+int pf_cross[3];                            // msec into the cycle of each waveform's last positive zero crossing
+int pf_ncross[3];                           // # positive zero crossings in this cycle
+boolean pf_armed[3];                        // waveform has been below -PF_HYST_INT since its last positive crossing
+int pf_msec = 0;                            // msec into this cycle
+int pf_period = 0;                          // msec, the last good cycle ended by a V12 crossing, 0 = none since stopping
+boolean pf_synced = false;                  // a cycle started at a V12 crossing, so it can be judged
+int pf_order = 0;                           // +1 = V23 crosses 1/3 cycle after V12, -1 = V31 does, 0 = not learned yet
+int pf_bad = 0;                             // consecutive bad cycles
+int pf_good = 0;                            // consecutive good cycles
+
+
+// Judge the cycle that just ended, n msec long. timed_out = no V12 crossing ended it, so there's no phase to check.
+// Returns its PF_* bits (0 = good), or PF_STOPPED or PF_NOT_JUDGED. Sets *chan to the worst line-to-line waveform.
+int judgePhaseCycle(int n, boolean timed_out, int* chan) {
+  int amp[3], asym[3];
+  int sum = 0, lo = 0, hi = 0, why = 0;
+  int pct = parm_phase_imbal.intVal();
+
+  for ( int i = 0; i < 3; i++ ) {
+    amp[i] = (pf_max[i] - pf_min[i]) / 2;
+    asym[i] = abs(pf_max[i] + pf_min[i]) / 2;
+    sum += amp[i];
+    if ( amp[i] < amp[lo] ) lo = i;
+    if ( amp[i] > amp[hi] ) hi = i;
+  }
+  int mean = sum / 3;
+  if ( pct <= 0 || mean < PF_MIN_AMP_INT ) return(PF_STOPPED);
+  if ( !timed_out && n < PF_MIN_CYCLE_MSEC ) return(PF_NOT_JUDGED);
+
+  *chan = lo;
+  if ( (amp[hi] - amp[lo]) * 100 > pct * mean ) why |= PF_IMBAL;   // < 2^31: amplitudes are < 1000 V * 1024
+  for ( int i = 0; i < 3; i++ ) {
+    if ( asym[i] * 100 > pct * amp[i] ) {
+      why |= PF_ASYM;
+      *chan = i;
+    }
+  }
+
+  if ( !timed_out ) {
+    int tol = max(n * PF_PHASE_TOL_PCT / 100, 2);      // at least +/-2 msec of sampling jitter
+    int order = 0;
+    if ( pf_ncross[1] == 1 && pf_ncross[2] == 1 ) {
+      if ( abs(pf_cross[1] - n / 3) <= tol && abs(pf_cross[2] - 2 * n / 3) <= tol ) order = 1;
+      if ( abs(pf_cross[2] - n / 3) <= tol && abs(pf_cross[1] - 2 * n / 3) <= tol ) order = -1;
+    }
+    if ( !order || (pf_order && order != pf_order) ) why |= PF_ORDER;
+    else if ( !why ) pf_order = order;      // learn the rotation from a good cycle
+  }
+  return(why);
+}
+
+
+// Track the line-to-line waveforms and set/clear phase_fault. Called from readADCs() ONLY, at 1000 Hz, after CalcDiff().
+void checkPhaseFault() {
+  int v[3] = { l1l2_diff.getInstantaneousValInt(), l2l3_diff.getInstantaneousValInt(), l3l1_diff.getInstantaneousValInt() };
+  boolean new_cycle = false;
+
+  pf_msec++;
+  for ( int i = 0; i < 3; i++ ) {
+    if ( v[i] > pf_max[i] ) pf_max[i] = v[i];
+    if ( v[i] < pf_min[i] ) pf_min[i] = v[i];
+    if ( v[i] < -PF_HYST_INT ) {
+      pf_armed[i] = true;
+    } else if ( pf_armed[i] && v[i] >= 0 ) {   // positive zero crossing
+      pf_armed[i] = false;
+      pf_ncross[i]++;
+      pf_cross[i] = pf_msec;
+      if ( i == 0 ) new_cycle = true;
+    }
+  }
+  int timeout = pf_period ? min(PF_TIMEOUT_CYCLES * pf_period, PF_MAX_CYCLE_MSEC) : PF_MAX_CYCLE_MSEC;
+  if ( !new_cycle && pf_msec < timeout ) return;
+
+  // A cycle ended by the FIRST V12 crossing (e.g., after a time-out) started mid-cycle, so it's skipped.
+  // A timed-out cycle is always judged, for amplitude only: a shorted L1-L2 never crosses zero.
+  int chan = 0;
+  int why = PF_NOT_JUDGED;
+  if ( pf_synced || !new_cycle ) why = judgePhaseCycle(pf_msec, !new_cycle, &chan);
+  if ( why == PF_STOPPED ) {                // stopped or disabled: start over
+    pf_bad = 0;
+    pf_good = 0;
+    pf_period = 0;
+    phase_fault = false;
+  } else if ( why > 0 ) {
+    pf_good = 0;
+    if ( ++pf_bad >= PF_TRIP_CYCLES && !phase_fault ) {
+      phase_fault_why = why;
+      phase_fault_chan = L1L2_VOLTAGE + chan;
+      phase_fault_trips++;
+      phase_fault = true;
+    }
+  } else if ( why == 0 ) {
+    pf_bad = 0;
+    if ( new_cycle ) pf_period = pf_msec;
+    if ( pf_good < PF_CLEAR_CYCLES ) pf_good++;
+    if ( pf_good >= PF_CLEAR_CYCLES ) phase_fault = false;
+  }
+
+  // Start the next cycle with this sample
+  pf_synced = new_cycle;
+  pf_msec = 0;
+  for ( int i = 0; i < 3; i++ ) {
+    pf_max[i] = pf_min[i] = v[i];
+    pf_ncross[i] = 0;
+  }
+}
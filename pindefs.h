@@ -33,6 +33,9 @@
 #define DUMP_LOAD_ON HIGH        // if processor output connected directly to optoisolator anode
 #define DUMP_LOAD_OFF LOW
 #endif
+//#define DUMP_PWM_HW              // if defined, drive the dump load from a hardware PWM channel on DUMP_IGBT_PWM_PIN - see dumpload.ino
+                                 //   ***pin 28 has no PWM function, so this REQUIRES the IGBT driver to be rewired to DUMP_IGBT_PWM_PIN***
+#define DUMP_IGBT_PWM_PIN 9      // PC21 = PWML4
 
 // Furl/Unfurl control pins for a linear actuator motor - used by furlctl(), see furlctl.ino
 // Not used with stepper motor
@@ -96,7 +99,7 @@ void initPins() {
   //pinMode(SPI_SS_PIN, OUTPUT);                 // SD card
 
   // Control pins
-  pinMode(DUMP_IGBT_DRV_PIN, OUTPUT);          // dump load
+  pinMode(DUMP_IGBT_DRV_PIN, OUTPUT);          // dump load - see initDumpLoad() in dumpload.ino
   pinMode(FURL_CTL_PIN, OUTPUT);               // FURL 
   pinMode(UNFURL_CTL_PIN, OUTPUT);             // UNFURL
   pinMode(SC_CTL_PIN, OUTPUT);                 // shorting contactor
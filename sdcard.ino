@@ -81,56 +81,48 @@ boolean writeDataToSD(char *fname, int do_modbus) {
 
 
 // Generate a JSON string containing Controller or Modbus channels.
+// Channel names come from the channel tables - see getChanName() in webclient.ino
 String getChannelsJSON(int do_modbus) {
   String channels_strg = "";
-  int num_channels;
-
-  if (do_modbus == 0) num_channels = NUM_ADC_CHANNELS;   // 0 == Controller data, NUM_ADC_CHANNELS is defined in adc.ino
-  if (do_modbus == 1) num_channels = NUM_MOD_FAST_CHANNELS;  // 1 == Morningstar Modbus/RTU 'fast' regs, NUM_MOD_FAST_CHANNELS is defined in modbus.h
-  if (do_modbus == 2) num_channels = NUM_MOD_SLOW_CHANNELS;  // 2 == Morningstar Modbus/RTU 'slow' regs, NUM_MOD_SLOW_CHANNELS is defined in modbus.h
-  if (do_modbus == 3) num_channels = NUM_MOD_NUV_CHANNELS;   // 3 == Nuvation Modbus/TCP regs, NUM_MOD_NUV_CHANNELS is defined in modbus.h
+  int num_channels = getNumChans(do_modbus);
+  boolean first = true;
+  char* name;
 
   channels_strg = "{\"channels\":[\"";  //   start a channels JSON string
 
-  for (int i = 0; i < num_channels-1; i++) {                       // for each channnel (except the last)...
-    channels_strg.concat( getChanName(i, do_modbus) );             //   get channel name - see webclient.ino
-    channels_strg.concat( "\",\"" );                               //   continue string
+  for (int i = 0; i < num_channels; i++) {                         // for each channnel...
+    if ((name = getChanName(i, do_modbus)) == NULL) continue;      //   merged into the next channel, skip it
+    if (!first) channels_strg.concat( "\",\"" );                    //   continue string
+    first = false;
+    channels_strg.concat( name );                                  //   get channel name - see webclient.ino
   }
-  channels_strg.concat( getChanName(num_channels-1, do_modbus) );  // get last channel
   channels_strg.concat ( "\"]}" );                                 // end string
   return (channels_strg);                                          // return a String object
 }
 
 
 // Generate a JSON string containing Controller or Modbus vals.
+// Vals are formatted exactly as in UDP and HTTP posts - see formatChanVal() in webclient.ino
 String getValsJSON(int do_modbus) {
   String vals_strg = "";
-  int num_channels;
-
-  if (do_modbus == 0) num_channels = NUM_ADC_CHANNELS;   // 0 == Controller data, NUM_ADC_CHANNELS is defined in adc.ino
-  if (do_modbus == 1) num_channels = NUM_MOD_FAST_CHANNELS;  // 1 == Morningstar Modbus/RTU 'fast' regs, NUM_MOD_FAST_CHANNELS is defined in modbus.h
-  if (do_modbus == 2) num_channels = NUM_MOD_SLOW_CHANNELS;  // 2 == Morningstar Modbus/RTU 'slow' regs, NUM_MOD_SLOW_CHANNELS is defined in modbus.h
-  if (do_modbus == 3) num_channels = NUM_MOD_NUV_CHANNELS;   // 3 == Nuvation Modbus/TCP regs, NUM_MOD_NUV_CHANNELS is defined in modbus.h
+  int num_channels = getNumChans(do_modbus);
+  boolean first = true;
+  char buf[40];
 
   vals_strg = "{\"vals\":[";  // start a vals JSON string
 
-  for (int i = 0; i < num_channels-1; i++) {                                      // for each channel (except the last)...
-    if ( do_modbus > 0 ) {                                                        //   if this is modbus data...
-      vals_strg.concat( String( getModchannelValue(do_modbus, i) ) );             //     get the val, returned as char*
-    } else {                                                                      //   otherwise, it's controller data...
-      float multiplier = 0.0009765625;                                            //     channel values are 1024x actual, so multiply by 1/1024 = 0.0009765625, except for...
-      if (i == TAIL_POSITION) multiplier = 0.002903226;                           //     tail position, in usteps, with 360/(2000*62) deg/ustep, so multiplier = 0.002903226
-      vals_strg.concat( String( ((float)getChannelRMSInt(i)*multiplier), 2) );    //     show 2 decimal places
-      vals_strg.concat( "," );                                                    //     continue string
-    }
-  }
-  if ( do_modbus > 0 ) {                                                          // if this is modbus data...
-    vals_strg.concat( String( getModchannelValue(do_modbus, num_channels-1) ) );  //   get last val, returned as char*
-  } else {                                                                        // otherwise, it's controller data...
-    vals_strg.concat( String( getChannelRMSInt(num_channels-1) ) );               //   last val is State (no multiplier), returned as int
+  for (int i = 0; i < num_channels; i++) {                                        // for each channel...
+    if (getChanName(i, do_modbus) == NULL) continue;                              //   merged into the next channel, skip it
+    if (!first) vals_strg.concat( "," );                                          //   continue string
+    first = false;
+    formatChanVal(buf, i, do_modbus);                                             //   get the val
+    vals_strg.concat( buf );
   }
   vals_strg.concat( "], \"time\":" );                                             // end vals array
   vals_strg.concat( String(myunixtime) );                                         // add timestamp
+  vals_strg.concat( ", \"ms\":" );                                                // add msec timestamp - see timesync.ino
+  formatTimeMs(buf, getTimeMs());
+  vals_strg.concat( buf );
   vals_strg.concat( "}" );                                                        // end string
   return (vals_strg);                                                             // return a String object
 }
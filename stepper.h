@@ -18,6 +18,28 @@ inline int min(int a,int b) {return ((a)<(b)?(a):(b)); }
 #define MOTOR_DIR_LEFT LOW
 #define STEPPERCTL_PER_SEC 1000  // 1000 is max allowable - see readADCs() in adc.ino
 
+// MOTION PLANNER
+// If defined, velocity is ramped on every motor step from a precomputed table of step intervals (see planProfile() below)
+//   rather than being incremented once per msec in updateState(). Comment out to restore the legacy per-msec velocity control.
+#define STEPPER_RAMP_TABLE
+#define RAMP_TABLE_SIZE 256      // number of table segments; each segment spans (1 << ramp_shift) motor steps
+
+// HARDWARE STEP PULSES
+// If defined, the motor timer generates the STEP pulse itself on its TIOA output, and we take ONE interrupt per step 
+//   (to count position and set the next interval) instead of two interrupts per step that toggle MOTOR_STEP_PIN in software.
+//   STEP pulse timing is then exact, regardless of TC0 preempting the motor interrupt.
+// MOTOR_STEP_PIN (Due pin 5 = PC25) is TIOA6, so in this mode the motor runs on TC2 channel 0 (TC6_Handler) rather than 
+//   TC2 channel 2 (TC8_Handler, whose TIOA8 is Due pin 11). Requires STEPPER_RAMP_TABLE.
+//#define STEPPER_HW_STEP
+#ifdef STEPPER_HW_STEP
+#ifndef STEPPER_RAMP_TABLE
+#error "STEPPER_HW_STEP requires STEPPER_RAMP_TABLE"
+#endif
+#define MOTOR_TIMER_CH 0         // TC2 channel 0, aka TC6
+#else
+#define MOTOR_TIMER_CH 2         // TC2 channel 2, aka TC8
+#endif
+
 class StepperMotor{
   public:
     // constructor
@@ -28,15 +50,30 @@ class StepperMotor{
             acceleration(acceleration), min_velocity(min_vel), 
             max_velocity(max_vel), current_position(0), desired_position(0), 
             current_velocity(min_vel), motor_dir(LOW), motor_enbl(MOTOR_DISABLED){
+#ifdef STEPPER_RAMP_TABLE
+      planProfile();
+#endif
     }
     void Acceleration(int a){
+#ifdef STEPPER_RAMP_TABLE
+      if(a == acceleration) return;  // furlctl1() sets this on every call, so only re-plan on an actual change
+      acceleration = a;
+      planProfile();
+#else
       acceleration = a;
+#endif
     }
     int Acceleration(){
       return(acceleration);
     }
     void maxVelocity(int v){
+#ifdef STEPPER_RAMP_TABLE
+      if(v == max_velocity) return;
+      max_velocity = v;
+      ramp_max = rampSteps(v);  // cruise at this step of the ramp
+#else
       max_velocity = v;
+#endif
     }
     int maxVelocity(){
       return(max_velocity);
@@ -77,7 +114,84 @@ class StepperMotor{
       return(decel_x);
     }
 
+#ifdef STEPPER_RAMP_TABLE
+    // Build the acceleration ramp. This is the AVR446 approach (see Atmel app note AVR446, "Linear speed control 
+    // of stepper motor"): at constant acceleration a, velocity after n steps is  v(n) = sqrt(v0^2 + 2*a*n),  so
+    // the interval for step n is fixed by n alone and can be computed ahead of time. Deceleration is the same 
+    // ramp run backwards, which means ramp_n is also the number of steps it takes to stop. 
+    //
+    // The table only depends on acceleration and min_velocity, so it is built once at startup (and again only if
+    // Acceleration() is changed). A move to any desired_position is then planned step-by-step in handleMotorInterrupt():
+    //   accelerate while there's room to stop, cruise at ramp_max (max_velocity), decelerate when steps to go <= ramp_n.
+    // Short moves naturally become triangular profiles.
+    //
+    // The full ramp is 4740 steps at 5000 usteps/s/s, so we keep every (1 << ramp_shift)'th step and interpolate.
+    // Entries are 1/4 of the step period in 42 MHz timer counts (RA), so they fit in 16 bits: 42E6/172/4 = 61046.
+    void planProfile(){
+      int32_t a = max(acceleration, 1) * STEPPERCTL_PER_SEC;                   // usteps/s/s
+      int32_t v0 = min_velocity;
+      ramp_len = ((MAX_VELOCITY_INIT * MAX_VELOCITY_INIT) - (v0 * v0)) / (2 * a);  // steps from min to max velocity
+      ramp_shift = 0;
+      while((ramp_len >> ramp_shift) >= RAMP_TABLE_SIZE) ramp_shift++;
+      for(int i = 0; i <= RAMP_TABLE_SIZE; i++){
+        int32_t n = min(i << ramp_shift, ramp_len);
+        float v = sqrt( (float)v0 * v0 + 2.0 * a * n );                             // v(n) = sqrt(v0^2 + 2an)
+        ramp_v[i] = (uint16_t)v;                                                    // usteps/s, for reporting
+        ramp_q[i] = (uint16_t)(10500000.0 / v);                                     // 42E6/4 counts per quarter step period
+      }
+      ramp_max = rampSteps(max_velocity);
+      if(ramp_n > ramp_len) ramp_n = ramp_len;
+    }
+
+    // Ramp step at which velocity v is reached, n = (v^2 - v0^2) / 2a. Only called when a setter changes.
+    int32_t rampSteps(int32_t v){
+      int32_t a = max(acceleration, 1) * STEPPERCTL_PER_SEC;
+      v = max(min(v, MAX_VELOCITY_INIT), min_velocity);
+      return(min(((v * v) - (min_velocity * min_velocity)) / (2 * a), ramp_len));
+    }
+
+    // Called from the motor interrupt each time a step goes out. Tracks position, moves one step up or down the ramp, 
+    // and stops the motor at the end of the move. Returns the 1/4 step period for the next step.
+    uint32_t rampStep(){
+      // Keep track of current position.
+      if(motor_dir == MOTOR_DIR_RIGHT){
+        current_position++;
+      }else{
+        current_position--;
+      }
+      // Steps left to go in the direction we're moving. Negative if we're headed the wrong way.
+      int32_t togo = (motor_dir == MOTOR_DIR_RIGHT) ? (desired_position - current_position) : (current_position - desired_position);
+      if((togo <= ramp_n) || (ramp_n > ramp_max)){
+        // Time to slow down, headed the wrong way, or max_velocity was lowered: step back down the ramp.
+        if(ramp_n > 0) ramp_n--;
+      }else if(ramp_n < ramp_max){
+        // Room to stop ahead of us, so step up the ramp.
+        ramp_n++;
+      }
+      // Stop when we've run off the bottom of the ramp at (or past) the target, or hit the target slowly enough.
+      // If we're not at desired_position, updateState() will start us again in the right direction.
+      if(((ramp_n == 0) && (togo <= 0))
+            || ((togo == 0) && (ramp_v[ramp_n >> ramp_shift] < (10 * min_velocity)))){
+        motor_enbl = MOTOR_DISABLED;
+        ramp_n = 0;
+        current_velocity = min_velocity;
+      }
+      return(rampQuarterPeriod(ramp_n));
+    }
+
+    // Quarter step period for ramp step n, linearly interpolated between table entries. No divide.
+    uint32_t rampQuarterPeriod(int32_t n){
+      int i = n >> ramp_shift;
+      int f = n - (i << ramp_shift);
+      return(ramp_q[i] - (((ramp_q[i] - ramp_q[i+1]) * f) >> ramp_shift));
+    }
+#endif
+
     void updateDecelX(){
+#ifdef STEPPER_RAMP_TABLE
+      // The deceleration ramp mirrors the acceleration ramp, so the number of steps it takes to stop is just ramp_n.
+      decel_x = ramp_n;
+#else
       // If we are going at a particular velocity, seeking a particular position, we need to know 
       // at what displacement we need to start decelerating. This calculates how many steps it should
       // take, at the specified acceleration, it will take to decelerate to zero velocity.
@@ -94,10 +208,35 @@ class StepperMotor{
       // 6888^2 = 47,444,544 < (2^31 - 1) = 2,147,483,647
       //decel_x = (current_velocity/acceleration) * current_velocity / STEPPERCTL_PER_SEC / 4;  // cw's original calculation
       decel_x = (current_velocity * current_velocity) / (2 * acceleration) / STEPPERCTL_PER_SEC;  // aw revision
+#endif
     }
     
     // Following will be called at regular intervals, timer driven:
     void updateState(){
+#ifdef STEPPER_RAMP_TABLE
+      // With the motion planner, acceleration happens per step in handleMotorInterrupt(). All we do here is
+      // start a stopped motor in the right direction. It always starts at the bottom of the ramp.
+      if((motor_enbl == MOTOR_DISABLED) && (current_position != desired_position)){
+        ramp_n = 0;
+        motor_dir = (current_position < desired_position) ? MOTOR_DIR_RIGHT : MOTOR_DIR_LEFT;
+        motor_enbl = MOTOR_ENABLED;
+#ifdef STEPPER_HW_STEP
+        // No trailing-edge interrupt to set DIR and ENBL, so do it here. Restart the counter at the bottom-of-ramp 
+        // period so DIR has a full step period of setup time before the first pulse, then let the pulses out.
+        digitalWriteDirect(MOTOR_DIR_PIN, motor_dir);
+        digitalWriteDirect(MOTOR_ENBL_PIN, motor_enbl);
+        uint32_t q = rampQuarterPeriod(0);
+        TC_SetRC(motor_timer_id, motor_timer_num, q << 2);
+        TC_SetRA(motor_timer_id, motor_timer_num, q << 1);
+        motor_timer_id->TC_CHANNEL[motor_timer_num].TC_CCR = TC_CCR_SWTRG;
+        setStepOutput(true);
+#endif
+      }
+#ifdef SHOW_MOTOR_STATUS
+      writeStatus2(motor_enbl == MOTOR_ENABLED ? 1 : 0);
+#endif
+      current_velocity = ramp_v[ramp_n >> ramp_shift];  // for currentVelocity() only
+#else
       // Left of where we want to be
       if(current_position < desired_position){
         if(motor_enbl == MOTOR_DISABLED){
@@ -157,12 +296,50 @@ class StepperMotor{
       // This runs the timer/counter at twice the required rate, and the timer interrupt 
       // routine toggles the "step" output.
       current_rc = 42000000 / min(current_velocity, MAX_VELOCITY_INIT);
+#endif
+    }
+
+#ifdef STEPPER_HW_STEP
+    // Hand MOTOR_STEP_PIN over to the timer's TIOA output and set up the waveform: TIOA is SET at RC compare 
+    // (start of each step period) and CLEARED at RA compare, so RA is the pulse width. Call once, after startTimer().
+    void startHWStep(){
+      PIO_Configure(g_APinDescription[step_pin].pPort, PIO_PERIPH_B, g_APinDescription[step_pin].ulPin, PIO_DEFAULT);
+      setStepOutput(false);
+    }
+
+    // Gate STEP pulses on/off. With ACPC = CLEAR, RC compare leaves TIOA low and no pulse goes out.
+    // The motor interrupt reads this back to decide whether a step was actually made - see handleMotorInterrupt().
+    void setStepOutput(boolean on){
+      uint32_t cmr = motor_timer_id->TC_CHANNEL[motor_timer_num].TC_CMR & ~(TC_CMR_ACPA_Msk | TC_CMR_ACPC_Msk);
+      motor_timer_id->TC_CHANNEL[motor_timer_num].TC_CMR = cmr | TC_CMR_ACPA_CLEAR | (on ? TC_CMR_ACPC_SET : TC_CMR_ACPC_CLEAR);
     }
 
+    // Following is called from the motor timer interrupt at RC compare, i.e., right as the hardware starts a STEP pulse.
+    // One interrupt per step. Position is counted only if the output was enabled at that compare, so current_position 
+    // always matches the pulses the driver actually saw. The output can only be switched on in updateState(), which 
+    // this interrupt preempts, and is switched off only here.
+    void handleMotorInterrupt(){
+      supv_motor_beats++;  // heartbeat, see supervisor.ino
+      // This is for diagnostic purposes.
+      digitalWriteDirect(STEPPER_MOTOR_INT_PIN, HIGH);
+      if((motor_timer_id->TC_CHANNEL[motor_timer_num].TC_CMR & TC_CMR_ACPC_Msk) == TC_CMR_ACPC_SET){
+        uint32_t q = rampStep();
+        if(motor_enbl == MOTOR_DISABLED){
+          setStepOutput(false);
+          digitalWriteDirect(MOTOR_ENBL_PIN, motor_enbl);
+        }
+        // Timer runs at the step rate in this mode: RC is the full step period, RA (pulse width) is half of it.
+        TC_SetRC(motor_timer_id, motor_timer_num, q << 2);
+        TC_SetRA(motor_timer_id, motor_timer_num, q << 1);
+      }
+      digitalWriteDirect(STEPPER_MOTOR_INT_PIN, LOW);
+    }
+#else
     // Following is called from the motor timer interrupt. It generates the actual "step" signal that is sent
     // to the motor controller.
     
     void handleMotorInterrupt(){
+      supv_motor_beats++;  // heartbeat, see supervisor.ino
       // This is for diagnostic purposes.
       digitalWriteDirect(STEPPER_MOTOR_INT_PIN, HIGH);
       static int lastRC = 0;
@@ -170,6 +347,12 @@ class StepperMotor{
       if(outstate == HIGH){
         if(motor_enbl == MOTOR_ENABLED){
           digitalWriteDirect(MOTOR_STEP_PIN, HIGH);
+#ifdef STEPPER_RAMP_TABLE
+          // Interval for the next step. The timer runs at twice the step rate, so RC is 1/2 and RA is 1/4 of the step period.
+          uint32_t q = rampStep();
+          TC_SetRC(motor_timer_id, motor_timer_num, q << 1);
+          TC_SetRA(motor_timer_id, motor_timer_num, q);
+#else
           // leading edge of step pulse
           // If We have a new value for RC, then update the register value.
           //if(lastRC != current_rc){
@@ -192,6 +375,7 @@ class StepperMotor{
             motor_enbl = MOTOR_DISABLED;
             current_velocity = min_velocity;
           }
+#endif
         }
       }else{
         // Make trailing edge of clock
@@ -204,6 +388,7 @@ class StepperMotor{
       outstate = ~outstate  & 1;
       digitalWriteDirect(STEPPER_MOTOR_INT_PIN, LOW);
     }
+#endif
   protected:
     int decel_x = 0;
     int cycle_num = 0;
@@ -225,6 +410,15 @@ class StepperMotor{
     int dir_pin;
     int enbl_pin;
     int outstate;
+#ifdef STEPPER_RAMP_TABLE
+    // Motion planner - see planProfile()
+    uint16_t ramp_q[RAMP_TABLE_SIZE + 1];  // 1/4 step period (42 MHz counts) at the start of each ramp segment
+    uint16_t ramp_v[RAMP_TABLE_SIZE + 1];  // velocity (usteps/s) at the start of each ramp segment
+    int32_t ramp_n = 0;                    // current step along the ramp == steps needed to stop
+    int32_t ramp_max = 0;                  // ramp step at which max_velocity is reached
+    int32_t ramp_len = 0;                  // ramp steps from min_velocity to MAX_VELOCITY_INIT
+    int ramp_shift = 0;                    // log2(steps per table segment)
+#endif
 };
 
 
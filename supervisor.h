@@ -0,0 +1,33 @@
+// ---------- supervisor.h ----------
+// ISR heartbeat counters and backup register layout - see supervisor.ino
+// This is a .h file (#include'd in wwe.ino) so that adc.ino and stepper.h can see it.
+
+#ifndef SUPERVISOR_DEFINED
+#define SUPERVISOR_DEFINED
+
+#define SUPV_CHECK_MSEC 250                        // how often loop() checks the heartbeats
+#define SUPV_ADC_MIN_RATE (SAMPLE_RATE_PER_SEC / 2)  // beats/sec; readADCs() runs at SAMPLE_RATE_PER_SEC
+#define SUPV_MOTOR_MIN_RATE (MIN_VELOCITY_INIT / 2)  // beats/sec; the motor timer never runs slower than MIN_VELOCITY_INIT steps/sec
+
+// Stall flags
+#define SUPV_ADC_STALL 1                           // readADCs() (TC0) heartbeat too slow
+#define SUPV_MOTOR_STALL 2                         // handleMotorInterrupt() (TC6/TC8) heartbeat too slow
+
+// SAM3X general purpose backup registers, GPBR->SYS_GPBR[0..7]. They survive any reset (but not a power cycle).
+#define SUPV_GPBR_MAGIC 0                          // SUPV_MAGIC if the record below is valid
+#define SUPV_GPBR_TIME 1                           // myunixtime at the last check
+#define SUPV_GPBR_UPTIME 2                         // millis() at the last check
+#define SUPV_GPBR_ADC 3                            // supv_adc_beats at the last check
+#define SUPV_GPBR_MOTOR 4                          // supv_motor_beats at the last check
+#define SUPV_GPBR_STATUS 5                         // stall flags at the last check
+                                                   // 6, 7 are the tail position - see checkpoint.h
+#define SUPV_MAGIC 0x53555056                      // "SUPV"
+
+// Heartbeats: ONE increment per interrupt, a few cycles. Only the interrupts write them.
+volatile uint32_t supv_adc_beats = 0;             // bumped by readADCs() in adc.ino
+volatile uint32_t supv_motor_beats = 0;           // bumped by handleMotorInterrupt() in stepper.h
+
+uint32_t supv_stall = 0;                           // stall flags from the last check
+int reset_cause = -1;                              // RSTC_SR.RSTTYP at boot, see getResetCauseName() in supervisor.ino
+
+#endif
@@ -0,0 +1,94 @@
+// ---------- supervisor.ino ----------
+// ISR LIVENESS SUPERVISOR
+//
+// The watchdog only sees loop(). If the TC0 interrupt (readADCs(): sampling, SC, furling, dump load) or the motor
+//   interrupt stopped, loop() would keep running and keep resetting the watchdog while the turbine went unprotected.
+// So each interrupt bumps a heartbeat counter (see supervisor.h), and superviseISRs(), called at the top of loop(),
+//   checks every SUPV_CHECK_MSEC that each counter has advanced at no less than half its expected rate.
+//   The watchdog is reset ONLY when all heartbeats are OK, so a stalled interrupt leads to a watchdog reset.
+//   (***watchdogSetup() must be UNCOMMENTED in wwe.ino for the watchdog to work***)
+//
+// Each check also saves a small record (time, uptime, heartbeats, stall flags) in the SAM3X backup registers (GPBR).
+//   They survive the reset, so at the next boot checkResetCause() can report WHY the controller reset (RSTC_SR) and
+//   what the supervisor saw last. The report goes to Serial and into the control event journal - see journal.ino
+
+// Heartbeats, stall flags and the GPBR layout are in supervisor.h
+
+
+char* getResetCauseName(int cause) {
+  switch (cause) {
+    case 0:  return ("POWER_UP");    // general reset: VDDCORE rising
+    case 1:  return ("BACKUP");      // wake up from backup mode
+    case 2:  return ("WATCHDOG");
+    case 3:  return ("SOFTWARE");    // RSTC_CR, e.g., after a firmware update - see doFWUpdate() in wwe.ino
+    case 4:  return ("USER");        // NRST pin, i.e., the reset button
+    default: return ("UNKNOWN");
+  }
+}
+
+
+// Report the reset cause and the supervisor's last record from before the reset. Call ONCE in setup(), BEFORE the timers start
+//   (it writes to the journal, which is otherwise only written by the timer interrupt).
+void checkResetCause() {
+  reset_cause = (RSTC->RSTC_SR & RSTC_SR_RSTTYP_Msk) >> RSTC_SR_RSTTYP_Pos;
+  Serial << "supervisor: Reset cause = " << getResetCauseName(reset_cause) << "\n";
+
+  uint32_t last_status = 0;
+  if ( GPBR->SYS_GPBR[SUPV_GPBR_MAGIC] == SUPV_MAGIC ) {
+    last_status = GPBR->SYS_GPBR[SUPV_GPBR_STATUS];
+    Serial << "supervisor: Last check at " << GPBR->SYS_GPBR[SUPV_GPBR_TIME]
+           << ", uptime " << GPBR->SYS_GPBR[SUPV_GPBR_UPTIME] << " msec"
+           << ", ADC beats " << GPBR->SYS_GPBR[SUPV_GPBR_ADC]
+           << ", motor beats " << GPBR->SYS_GPBR[SUPV_GPBR_MOTOR]
+           << ", stall flags " << last_status << "\n";
+  } else {
+    Serial << "supervisor: No record from before the reset (e.g., power cycle)\n";
+  }
+  // detail = reset cause in bits 0-7, last stall flags in bits 8-15
+  logJournalEvent(JRNL_RESET, reset_cause | (last_status << 8), WINDSPEED);
+
+  GPBR->SYS_GPBR[SUPV_GPBR_STATUS] = 0;
+  GPBR->SYS_GPBR[SUPV_GPBR_MAGIC] = SUPV_MAGIC;
+}
+
+
+// Check the interrupt heartbeats and reset the watchdog only if they're all OK. Called at the top of every loop().
+void superviseISRs() {
+  static unsigned long last_check = 0;
+  static uint32_t last_adc_beats = 0;
+  static uint32_t last_motor_beats = 0;
+
+  unsigned long now = millis();
+  unsigned long dt = now - last_check;
+  if ( dt < SUPV_CHECK_MSEC ) {
+    if ( supv_stall == 0 ) watchdogReset();
+    return;
+  }
+
+  uint32_t adc_beats = supv_adc_beats;        // snapshot
+  uint32_t motor_beats = supv_motor_beats;
+  uint32_t stall = 0;
+  if ( last_check ) {                          // skip the first call, there's nothing to compare with yet
+    if ( (uint64_t)(adc_beats - last_adc_beats) * 1000 < (uint64_t)SUPV_ADC_MIN_RATE * dt ) stall |= SUPV_ADC_STALL;
+#ifdef ENABLE_STEPPER
+    if ( (uint64_t)(motor_beats - last_motor_beats) * 1000 < (uint64_t)SUPV_MOTOR_MIN_RATE * dt ) stall |= SUPV_MOTOR_STALL;
+#endif
+  }
+  if ( stall != supv_stall ) {
+    Serial << "supervisor: Stall flags " << supv_stall << " --> " << stall << " (ADC beats " << (adc_beats - last_adc_beats)
+           << ", motor beats " << (motor_beats - last_motor_beats) << " in " << dt << " msec)"
+           << (stall ? ", NOT resetting watchdog\n" : "\n");
+  }
+  supv_stall = stall;
+  last_check = now;
+  last_adc_beats = adc_beats;
+  last_motor_beats = motor_beats;
+
+  GPBR->SYS_GPBR[SUPV_GPBR_TIME] = myunixtime;
+  GPBR->SYS_GPBR[SUPV_GPBR_UPTIME] = now;
+  GPBR->SYS_GPBR[SUPV_GPBR_ADC] = adc_beats;
+  GPBR->SYS_GPBR[SUPV_GPBR_MOTOR] = motor_beats;
+  GPBR->SYS_GPBR[SUPV_GPBR_STATUS] = stall;
+
+  if ( stall == 0 ) watchdogReset();
+}
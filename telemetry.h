@@ -0,0 +1,41 @@
+// ---------- telemetry.h ----------
+// Telemetry subscriber registry and packet buffer - see telemetry.ino
+// This is a .h file (#include'd in wwe.ino) so that webclient.ino, which comes before telemetry.ino, can see it.
+// statusudp is here, not in web.ino, so that aggregate.ino and telemetry.ino, which come before web.ino, can see it.
+
+#ifndef TELEMETRY_DEFINED
+#define TELEMETRY_DEFINED
+
+#define TELEM_MAX_SUBS 10                   // max # subscribers, from all sources
+#define TELEM_MAX_UDP_SUBS 4                // max # TELEM_SRC_UDP leases, so the other 6 are always free for the Data Server (4) and parms (2)
+#define TELEM_NUM_GROUPS 4                  // data groups, same as printPOSTBody() do_modbus: 0=controller, 1=Modbus fast, 2=Modbus slow, 3=Nuvation
+#define TELEM_BUF_SIZE 2048                 // one encoded packet; the W5500 socket TX buffer is 2 KB
+#define TELEM_LEASE_SEC 300                 // a UDP subscription lasts this long unless renewed
+#define TELEM_ALL_CHANNELS 0xFFFFFFFFFFFFFFFFULL
+
+// Where a subscription came from
+#define TELEM_SRC_DATASERVER 1              // parm_udp_ip, all 4 groups at the original rates
+#define TELEM_SRC_PARM 2                    // parm_telem_sub1, parm_telem_sub2
+#define TELEM_SRC_UDP 3                     // SUB message on udp_local_port_telemetry
+
+struct TelemSub {
+  uint8_t ip[4];
+  uint16_t port;
+  uint8_t group;                            // data group, 0-3 (see above)
+  uint8_t source;                           // TELEM_SRC_*
+  uint32_t decimation;                      // send when myunixtime % decimation == 0, e.g., 1 = every sec, 3600 = on the hour
+  uint64_t mask;                            // bit i set = send channel i of the group
+  uint32_t expires;                         // myunixtime when a TELEM_SRC_UDP subscription lapses
+  uint32_t sent;                            // # packets sent
+};
+
+EthernetUDP statusudp;                      // the telemetry socket, open on udp_local_port_telemetry - see initTelemetry()
+
+TelemSub telem_subs[TELEM_MAX_SUBS];
+int num_telem_subs = 0;
+
+char telem_buf[TELEM_BUF_SIZE];             // a packet is encoded here ONCE, then sent to every subscriber that wants it
+int telem_len = 0;
+boolean telem_overflow = false;             // packet didn't fit, don't send it
+
+#endif
@@ -0,0 +1,202 @@
+// ---------- telemetry.ino ----------
+// TELEMETRY SUBSCRIPTIONS
+//
+// The controller used to send its UDP data to exactly one host, the Data Server (parm_udp_ip), opening and closing the
+//   statusudp socket for every packet and encoding every packet as it went out.
+// Now any number of consumers (up to TELEM_MAX_SUBS), e.g., the Data Server, a local HMI and a historian, can subscribe to
+//   any data group, each with its own rate (decimation) and its own channel subset (mask):
+//   - the Data Server: parm_udp_ip gets all 4 groups, as before: controller, Modbus fast and Nuvation every second, Modbus slow on the hour
+//   - parms: parm_telem_sub1 and parm_telem_sub2, each "<ip>:<port>,<group>,<decimation>,<mask>", e.g.,
+//       "192.168.1.50:58328,0,5,*"  --> all controller channels every 5 sec
+//       "192.168.1.60:58329,1,1,3F"  --> Modbus fast channels 0-5 every sec
+//     <mask> is hex (channel i = bit i, up to 64 channels) or * for all. An empty parm = no subscriber.
+//   - UDP: a message to the controller on udp_local_port_telemetry (58333),
+//       SUB <key> <port> <group> <decimation> <mask>    (the subscriber's IP is the message's source IP)
+//       UNSUB <key> <port> <group>
+//     <key> must match parm_telem_key; if it doesn't, or the parm is empty, the message is dropped without a reply, so
+//     a spoofed source IP can't be made a target for telemetry or replies. At most TELEM_MAX_UDP_SUBS leases are held,
+//     which keeps registry slots free for the Data Server and the parms, and a SUB can't take over one of their entries.
+//     The reply is "OK <lease sec>" or "ERR". A UDP subscription lapses after TELEM_LEASE_SEC unless it's renewed.
+// Each second, for each group, a packet is encoded ONCE per distinct channel mask into telem_buf, then sent to every
+//   subscriber that is due and has that mask. More subscribers cost socket writes, not more formatting.
+// statusudp stays open on udp_local_port_telemetry: it sends the packets and receives the SUB/UNSUB messages.
+//
+// Registry and packet buffer are in telemetry.h. The packet itself is encoded by printPOSTBody() in webclient.ino
+
+
+// Start the telemetry socket. Called once Ethernet is up - see runBootStages() in boot.ino
+void initTelemetry() {
+  statusudp.begin(udp_local_port_telemetry);
+  Serial << "telemetry: Listening for subscriptions on port " << udp_local_port_telemetry << "\n";
+}
+
+
+// Add a subscriber, or update it if there's one with the same IP, port and group. Returns its index, or -1 if the registry
+// (or, for TELEM_SRC_UDP, the lease quota) is full, or a UDP subscription would replace a Data Server or parm one.
+int addTelemetrySub(uint8_t* ip, int port, int group, uint32_t decimation, uint64_t mask, int source, uint32_t expires) {
+  if ( group < 0 || group >= TELEM_NUM_GROUPS || port <= 0 || port > 65535 ) return(-1);
+  int i, num_udp = 0;
+  for ( i = 0; i < num_telem_subs; i++ ) {
+    if ( !memcmp(telem_subs[i].ip, ip, 4) && telem_subs[i].port == port && telem_subs[i].group == group ) break;
+    if ( telem_subs[i].source == TELEM_SRC_UDP ) num_udp++;
+  }
+  if ( i < num_telem_subs && source == TELEM_SRC_UDP && telem_subs[i].source != TELEM_SRC_UDP ) return(-1);
+  if ( i == num_telem_subs ) {
+    if ( num_telem_subs == TELEM_MAX_SUBS || (source == TELEM_SRC_UDP && num_udp == TELEM_MAX_UDP_SUBS) ) return(-1);
+    num_telem_subs++;
+    telem_subs[i].sent = 0;
+  }
+  memcpy(telem_subs[i].ip, ip, 4);
+  telem_subs[i].port = port;
+  telem_subs[i].group = group;
+  telem_subs[i].source = source;
+  telem_subs[i].decimation = decimation ? decimation : 1;
+  telem_subs[i].mask = mask;
+  telem_subs[i].expires = expires;
+  return(i);
+}
+
+
+void removeTelemetrySub(int i) {
+  telem_subs[i] = telem_subs[--num_telem_subs];
+}
+
+
+// Parse a channel mask: hex, or * for all channels
+uint64_t parseTelemetryMask(char* str) {
+  if ( str[0] == '*' || str[0] == 0 ) return(TELEM_ALL_CHANNELS);
+  return( strtoull(str, NULL, 16) );
+}
+
+
+// Add a subscriber from a parm string: "<ip>:<port>,<group>,<decimation>,<mask>". Returns true if it was added.
+boolean parseTelemetrySub(char* str) {
+  int a, b, c, d, port, group;
+  unsigned long decimation;
+  char maskstr[20] = "*";
+  if ( str[0] == 0 ) return(false);         // no subscriber
+  if ( sscanf(str, "%d.%d.%d.%d:%d,%d,%lu,%19s", &a, &b, &c, &d, &port, &group, &decimation, maskstr) < 7 ) {
+    Serial << "telemetry: Bad subscription parm \"" << str << "\"\n";
+    return(false);
+  }
+  uint8_t ip[4] = { (uint8_t)a, (uint8_t)b, (uint8_t)c, (uint8_t)d };
+  return( addTelemetrySub(ip, port, group, decimation, parseTelemetryMask(maskstr), TELEM_SRC_PARM, 0) >= 0 );
+}
+
+
+// Rebuild the parm-based subscriptions (Data Server and parm_telem_sub*) if any parm has changed since the last call.
+void updateTelemetrySubs() {
+  static unsigned long last_parms_version = 0;
+  if ( parms_version == last_parms_version ) return;
+  last_parms_version = parms_version;
+
+  for ( int i = num_telem_subs - 1; i >= 0; i-- ) {
+    if ( telem_subs[i].source != TELEM_SRC_UDP ) removeTelemetrySub(i);
+  }
+
+  int a, b, c, d;
+  if ( sscanf(parm_udp_ip.parmVal(), "%d.%d.%d.%d", &a, &b, &c, &d) == 4 ) {
+    uint8_t ip[4] = { (uint8_t)a, (uint8_t)b, (uint8_t)c, (uint8_t)d };
+    addTelemetrySub(ip, udp_remote_port, 0, 1, TELEM_ALL_CHANNELS, TELEM_SRC_DATASERVER, 0);             // controller data
+    addTelemetrySub(ip, udp_remote_port_mod_fast, 1, 1, TELEM_ALL_CHANNELS, TELEM_SRC_DATASERVER, 0);    // Modbus/RTU 'fast' data
+    addTelemetrySub(ip, udp_remote_port_mod_slow, 2, 3600, TELEM_ALL_CHANNELS, TELEM_SRC_DATASERVER, 0); // Modbus/RTU 'slow' data, on-the-hour
+    addTelemetrySub(ip, udp_remote_port_nuvation, 3, 1, TELEM_ALL_CHANNELS, TELEM_SRC_DATASERVER, 0);    // Modbus/TCP Nuvation data
+  } else {
+    Serial << "telemetry: Bad Data Server IP \"" << parm_udp_ip.parmVal() << "\"\n";
+  }
+  parseTelemetrySub(parm_telem_sub1.parmVal());
+  parseTelemetrySub(parm_telem_sub2.parmVal());
+  Serial << "telemetry: " << num_telem_subs << " subscribers\n";
+}
+
+
+// Handle SUB/UNSUB messages, if any have arrived, and drop lapsed UDP subscriptions.
+void checkTelemetrySubscribe() {
+  char msg[80];
+  char key[20];
+  for ( int i = num_telem_subs - 1; i >= 0; i-- ) {
+    if ( telem_subs[i].source == TELEM_SRC_UDP && (long)(myunixtime - telem_subs[i].expires) >= 0 ) {
+      Serial << "telemetry: Subscription lapsed, port " << telem_subs[i].port << ", group " << telem_subs[i].group << "\n";
+      removeTelemetrySub(i);
+    }
+  }
+
+  int pktLen = statusudp.parsePacket();
+  if ( pktLen <= 0 ) return;
+  pktLen = statusudp.read(msg, sizeof(msg) - 1);
+  msg[max(pktLen, 0)] = 0;
+  IPAddress remote = statusudp.remoteIP();
+  uint8_t ip[4] = { remote[0], remote[1], remote[2], remote[3] };
+
+  // No key, no reply: an unauthenticated message must not cause any traffic
+  if ( parm_telem_key.parmVal()[0] == 0 || sscanf(msg, "%*s %19s", key) != 1 || strcmp(key, parm_telem_key.parmVal()) ) {
+    Serial << "telemetry: " << remote << " sent a message without the key, dropped\n";
+    return;
+  }
+
+  int port, group;
+  unsigned long decimation;
+  char maskstr[20] = "*";
+  boolean ok = false;
+  if ( sscanf(msg, "SUB %*s %d %d %lu %19s", &port, &group, &decimation, maskstr) >= 3 ) {
+    ok = addTelemetrySub(ip, port, group, decimation, parseTelemetryMask(maskstr), TELEM_SRC_UDP, myunixtime + TELEM_LEASE_SEC) >= 0;
+  } else if ( sscanf(msg, "UNSUB %*s %d %d", &port, &group) == 2 ) {
+    for ( int i = 0; i < num_telem_subs; i++ ) {
+      if ( telem_subs[i].source == TELEM_SRC_UDP && !memcmp(telem_subs[i].ip, ip, 4) && telem_subs[i].port == port && telem_subs[i].group == group ) {
+        removeTelemetrySub(i);
+        ok = true;
+        break;
+      }
+    }
+  }
+  Serial << "telemetry: " << remote << " " << (ok ? "OK" : "ERR") << "\n";   // not msg: it holds the key
+
+  statusudp.beginPacket(remote, statusudp.remotePort());
+  if ( ok ) {
+    sprintf(msg, "OK %d", TELEM_LEASE_SEC);
+    statusudp.write(msg);
+  } else {
+    statusudp.write("ERR");
+  }
+  statusudp.endPacket();
+}
+
+
+// Send this second's packets to every subscriber that's due. Called once per POST, when Ethernet is OK - see wwe.ino
+void sendTelemetry() {
+  boolean sent[TELEM_MAX_SUBS] = { false };
+
+  updateTelemetrySubs();
+  for ( int group = 0; group < TELEM_NUM_GROUPS; group++ ) {
+    for ( int i = 0; i < num_telem_subs; i++ ) {
+      TelemSub* sub = &telem_subs[i];
+      if ( sent[i] || sub->group != group || (myunixtime % sub->decimation) != 0 ) continue;
+
+      // Encode ONCE for this group and mask...
+      unsigned long starttime = millis();
+      telem_len = 0;
+      telem_overflow = false;
+      printPOSTBody(true, false, group, sub->mask);  // args: do_udp, countonly, do_modbus (0, 1, 2, or 3), mask - see webclient.ino
+      if ( telem_overflow ) {
+        Serial << "telemetry: Group " << group << " packet > " << TELEM_BUF_SIZE << " bytes, NOT sent\n";
+      }
+      unsigned long encode_time = millis() - starttime;
+
+      // ...then send it to everyone who wants it
+      int count = 0;
+      for ( int j = i; j < num_telem_subs; j++ ) {
+        TelemSub* s = &telem_subs[j];
+        if ( sent[j] || s->group != group || s->mask != sub->mask || (myunixtime % s->decimation) != 0 ) continue;
+        sent[j] = true;
+        if ( telem_overflow ) continue;
+        statusudp.beginPacket(s->ip, s->port);
+        statusudp.write((uint8_t*)telem_buf, telem_len);
+        statusudp.endPacket();
+        s->sent++;
+        count++;
+      }
+      Serial << "telemetry: Group " << group << ", " << telem_len << " bytes --> " << count << " subscribers, encode time = "
+             << encode_time << " msec, send time = " << (millis() - starttime - encode_time) << " msec\n";
+    }
+  }
+}
@@ -1,91 +1,274 @@
 // ---------- temperature.h ----------
 //
+// Controller logic board temperature: a DS18B20 on a 1-Wire bus, driven by a TIMER STATE MACHINE.
+//
+// We used to use the OneWire library, which bit-bangs each 1-Wire time slot with interrupts DISABLED (~70 usec per bit).
+//   Reading the 9-byte scratchpad is ~100 slots, so every second the TC0 sampling interrupt (100 usec period) and the
+//   stepper interrupt were held off, over and over, for most of a sample period - jitter that shows up in the RPM period
+//   counting in RPMChannel (see adc.ino).
+// Now each edge of each slot is done by ONE short interrupt from timer TC3 (TC1, channel 0), which reprograms RC for the
+//   time until the next edge. Nothing ever masks interrupts. TC3 runs at priority 0 (like the stepper), so TC0 can't stretch
+//   a 6 usec pulse, and each TC3 interrupt costs TC0 only a microsecond or so.
+// Pin 34 (PC2) is not a UART or TC pin, so the pin itself is driven in software: open drain, i.e., drive LOW or release
+//   (input, the external pull-up pulls it high).
+//
+// The transfers run in the background; loop() never waits:
+//   - init() starts a job that reads the ROM (family code) and starts the first conversion
+//   - convert() starts a job that reads the scratchpad (the result of the LAST conversion), then starts the next conversion
+//   - readTemp() decodes the scratchpad from the last completed job (if its CRC is good) and returns the latest temperature
+//   So, called as before (readTemp() then convert(), once per second), each reading is from a conversion ~1 sec old.
+//   ***There is only ONE DS18B20 on the bus***, so we use SKIP ROM rather than searching for it.
+
+#define OW_TICKS_PER_USEC 42                   // TIMER_CLOCK1 = MCK/2 = 42 MHz
+
+// 1-Wire standard speed timing (usec), see Maxim app note 126
+#define OW_A 6                                 // write 1 / read: low time
+#define OW_B 64                                // write 1: release time
+#define OW_C 60                                // write 0: low time
+#define OW_D 10                                // write 0: release time
+#define OW_E 9                                 // read: release to sample
+#define OW_F 55                                // read: sample to end of slot
+#define OW_H 480                               // reset: low time
+#define OW_I 70                                // reset: release to presence sample
+#define OW_J 410                               // reset: presence sample to end of slot
+
+// Job script tokens: 0x00-0xFF = write that byte
+#define OW_RESET 0x100                         // reset + presence pulse
+#define OW_READ 0x200                          // read a byte into rx[]
+#define OW_END 0x300
+
+// Job types
+#define OW_JOB_ROM 1                           // READ ROM + convert, started by init()
+#define OW_JOB_TEMP 2                          // read scratchpad + convert, started by convert()
+
+// Results of the last job
+#define OW_OK 0
+#define OW_NO_DEVICE 1                         // no presence pulse
+#define OW_CRC_ERROR 2
 
-// We're going to assume that there's a single DS18B20 attached to the pin.
+const uint16_t ow_rom_script[] = { OW_RESET, 0x33, OW_READ, OW_READ, OW_READ, OW_READ, OW_READ, OW_READ, OW_READ, OW_READ,
+                                   OW_RESET, 0xCC, 0x44, OW_END };
+const uint16_t ow_temp_script[] = { OW_RESET, 0xCC, 0xBE, OW_READ, OW_READ, OW_READ, OW_READ, OW_READ, OW_READ, OW_READ, OW_READ, OW_READ,
+                                    OW_RESET, 0xCC, 0x44, OW_END };
 
-class DS18B20: public OneWire {
+class DS18B20 {
   public:
-    DS18B20(int pin): OneWire(pin){
+    DS18B20(int pin){
+      port = g_APinDescription[pin].pPort;
+      mask = g_APinDescription[pin].ulPin;
     }
 
-    // get the addr of the first chip found with a search();
-    int init(int pin) {
-      present = search(addr);
-      // the first ROM byte indicates which chip
-      switch (addr[0]) {
-        case 0x10:
-          //Serial.println("temperature.h: Chip = DS18S20");  // or old DS1820
-          type_s = 1;
-          break;
-        case 0x28:
-          //Serial.println("temperature.h: Chip = DS18B20");
-          type_s = 0;
-          break;
-        case 0x22:
-          //Serial.println("temperature.h: Chip = DS1822");
-          type_s = 0;
-          break;
-        default:
-          Serial.println("temperature.h: Device is NOT a DS18x20 family device.");
-      } 
+    // Set up the bus timer and start reading the ROM. The result is picked up by the first readTemp().
+    void init(int pin) {
+      setPin(pin);
+      busRelease();
+      pmc_set_writeprotect(false);
+      pmc_enable_periph_clk(ID_TC3);
+      TC_Configure(TC1, 0, TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC | TC_CMR_TCCLKS_TIMER_CLOCK1);
+      TC1->TC_CHANNEL[0].TC_IER = TC_IER_CPCS;
+      TC1->TC_CHANNEL[0].TC_IDR = ~TC_IER_CPCS;
+      NVIC_SetPriority(TC3_IRQn, 0);
+      NVIC_EnableIRQ(TC3_IRQn);
+      startJob(OW_JOB_ROM, ow_rom_script);
     }
 
-    // We need to call this and wait about a second for the chip to be done with the 
+    // Read the result of the last conversion and start the next one, in the background.
+    // This needs to be used in such a way that there is a 1-sec delay between this and reading the temperature.
     void convert() {
-      OneWire::reset();
-      OneWire::select(addr);
-      OneWire::write(0x44, 1);
-      // this needs to be used in such a way that there is a 1-sec delay between this and 
-      // reading the temperature.
+      if ( busy ) return;                       // last job not done?! skip this one
+      startJob(OW_JOB_TEMP, ow_temp_script);
     }
 
+    // Returns the latest temperature (degC), decoding the last job's scratchpad if there's a new one. Never waits.
     float readTemp() {
-      OneWire::reset();
-      OneWire::select(addr);
-      OneWire::write(0xBE, 1);     
-      for(i = 0; i < 9; i++){
-        data[i] = OneWire::read();
-      }
-      //Serial.print("temperature: CRC = ");
-      //Serial.print(OneWire::crc8(data, 8), HEX);
-      //Serial.println();
-
-      // Convert the data to actual temperature
-      // because the result is a 16 bit signed integer, it should
-      // be stored to an "int16_t" type, which is always 16 bits
-      // even when compiled on a 32 bit processor.
-      int16_t raw = (data[1] << 8) | data[0];
-      if (type_s) {
-        raw = raw << 3; // 9 bit resolution default
-        if (data[7] == 0x10) {
-          // "count remain" gives full 12 bit resolution
-          raw = (raw & 0xFFF0) + 12 - data[6];
+      if ( busy || !done ) return(celsius);
+      done = false;
+      int status = OW_OK;
+      if ( !present ) {
+        status = OW_NO_DEVICE;
+      } else if ( job == OW_JOB_ROM ) {
+        if ( crc8(rx, 7) != rx[7] ) {
+          status = OW_CRC_ERROR;
+        } else {
+          // the first ROM byte indicates which chip
+          switch (rx[0]) {
+            case 0x10:
+              //Serial.println("temperature.h: Chip = DS18S20");  // or old DS1820
+              type_s = 1;
+              break;
+            case 0x28:
+              //Serial.println("temperature.h: Chip = DS18B20");
+              type_s = 0;
+              break;
+            case 0x22:
+              //Serial.println("temperature.h: Chip = DS1822");
+              type_s = 0;
+              break;
+            default:
+              Serial.println("temperature.h: Device is NOT a DS18x20 family device.");
+          }
         }
+      } else if ( crc8(rx, 8) != rx[8] ) {
+        status = OW_CRC_ERROR;
+        crc_errors++;
       } else {
-        byte cfg = (data[4] & 0x60);
-        // at lower res, the low bits are undefined, so let's zero them
-        if (cfg == 0x00) raw = raw & ~7;  // 9 bit resolution, 93.75 ms
-        else if (cfg == 0x20) raw = raw & ~3; // 10 bit res, 187.5 ms
-        else if (cfg == 0x40) raw = raw & ~1; // 11 bit res, 375 ms
-        //// default is 12 bit resolution, 750 ms conversion time
+        // Convert the data to actual temperature
+        // because the result is a 16 bit signed integer, it should
+        // be stored to an "int16_t" type, which is always 16 bits
+        // even when compiled on a 32 bit processor.
+        int16_t raw = (rx[1] << 8) | rx[0];
+        if (type_s) {
+          raw = raw << 3; // 9 bit resolution default
+          if (rx[7] == 0x10) {
+            // "count remain" gives full 12 bit resolution
+            raw = (raw & 0xFFF0) + 12 - rx[6];
+          }
+        } else {
+          byte cfg = (rx[4] & 0x60);
+          // at lower res, the low bits are undefined, so let's zero them
+          if (cfg == 0x00) raw = raw & ~7;  // 9 bit resolution, 93.75 ms
+          else if (cfg == 0x20) raw = raw & ~3; // 10 bit res, 187.5 ms
+          else if (cfg == 0x40) raw = raw & ~1; // 11 bit res, 375 ms
+          //// default is 12 bit resolution, 750 ms conversion time
+        }
+        celsius = (float)raw / 16.0;
+      }
+      if ( status != last_status ) {
+        Serial << "temperature: 1-Wire status " << last_status << " --> " << status << " (0=OK, 1=no device, 2=CRC error)\n";
+        last_status = status;
       }
-      celsius = (float)raw / 16.0;
-      fahrenheit = celsius * 1.8 + 32.0;
-      //Serial.print("temperature: controller T = ");
-      //Serial.print(celsius);
-      //Serial.print(" C, ");
-      //Serial.print(fahrenheit);
-      //Serial.println(" F");
       return(celsius);
     }
 
+    // Called from the TC3 interrupt ONLY - see TC3_Handler() in wwe.ino
+    // Does the next edge of the current slot, then sets the timer for the edge after that.
+    // When a slot is complete, the next slot is started right away, in the same interrupt.
+    void handleBusInterrupt() {
+      for (;;) {
+        uint16_t token = script[token_idx];
+        switch ( phase ) {
+          case 0:                                 // start of a slot
+            if ( token == OW_END ) {
+              if ( script[token_idx - 1] == 0x44 ) busPowerOn();  // strong pull-up during the conversion (parasite power)
+              TC_Stop(TC1, 0);
+              done = true;
+              busy = false;                       // publish the job AFTER it is complete
+              return;
+            }
+            busLow();
+            phase = 1;
+            if ( setNext(token == OW_RESET ? OW_H : (token == OW_READ || (token & (1 << bit_idx))) ? OW_A : OW_C) ) return;
+            break;
+          case 1:                                 // end of the low pulse
+            busRelease();
+            phase = 2;
+            if ( setNext(token == OW_RESET ? OW_I : token == OW_READ ? OW_E : (token & (1 << bit_idx)) ? OW_B : OW_D) ) return;
+            break;
+          case 2:                                 // sample (reset, read), or end of a write slot
+            if ( token == OW_RESET ) {
+              present = !busRead();               // the DS18B20 pulls the bus low to say it's there
+              phase = 3;
+              if ( setNext(OW_J) ) return;
+              break;
+            }
+            if ( token == OW_READ ) {
+              if ( busRead() ) rx_byte |= (1 << bit_idx);  // LSB first
+              phase = 3;
+              if ( setNext(OW_F) ) return;
+              break;
+            }
+            // fall through: write slot done
+          case 3:                                 // end of slot
+            phase = 0;
+            if ( token == OW_RESET ) {
+              if ( !present ) token_idx = script_len - 1;  // nobody there, skip to OW_END
+              else token_idx++;
+            } else if ( ++bit_idx == 8 ) {
+              bit_idx = 0;
+              if ( token == OW_READ && rx_count < sizeof(rx) ) rx[rx_count++] = rx_byte;
+              rx_byte = 0;
+              token_idx++;
+            }
+            break;
+        }
+      }
+    }
+
+    uint32_t crc_errors = 0;
+
   private:
     int type_s = 0;
-    byte i; 
+    Pio* port;
+    uint32_t mask;
+    const uint16_t* script = ow_temp_script;
+    int script_len = 0;
+    int job = 0;
+    volatile boolean busy = false;             // job running, written by the interrupt when done
+    volatile boolean done = false;             // a job completed and readTemp() hasn't looked at it yet
+    int token_idx = 0;
+    int bit_idx = 0;
+    int phase = 0;
+    byte rx_byte = 0;
     // DS18B20 has been located
-    int present;
-    byte data[12];
-    byte addr[8];
+    boolean present = false;
+    int last_status = OW_OK;
+    unsigned int rx_count = 0;
+    byte rx[9];
     float celsius = 0.0;
-    float fahrenheit = 0.0;
+
+    void setPin(int pin) {
+      port = g_APinDescription[pin].pPort;
+      mask = g_APinDescription[pin].ulPin;
+      port->PIO_PER = mask;                     // PIO controls the pin
+      port->PIO_PUDR = mask;                    // no internal pull-up, the board has one
+    }
+
+    void busLow()      { port->PIO_CODR = mask; port->PIO_OER = mask; }
+    void busRelease()  { port->PIO_ODR = mask; }
+    void busPowerOn()  { port->PIO_SODR = mask; port->PIO_OER = mask; }
+    boolean busRead()  { return( (port->PIO_PDSR & mask) != 0 ); }
+
+    // Time the next edge usec after the last one. The counter restarted at the last RC compare, so our own interrupt latency
+    //   doesn't add up. Returns false if that time has already passed (we were held off), i.e., do the next edge now:
+    //   the counter is restarted so the edges after that are timed from now. (A slot stretched like this may be misread,
+    //   but the CRC catches it.)
+    boolean setNext(uint32_t usec) {
+      uint32_t rc = usec * OW_TICKS_PER_USEC;
+      TC1->TC_CHANNEL[0].TC_RC = rc;
+      if ( TC1->TC_CHANNEL[0].TC_CV < rc ) return(true);
+      TC1->TC_CHANNEL[0].TC_CCR = TC_CCR_SWTRG;
+      return(false);
+    }
+
+    void startJob(int job_type, const uint16_t* job_script) {
+      script = job_script;
+      script_len = 0;
+      while ( script[script_len++] != OW_END );
+      job = job_type;
+      token_idx = 0;
+      bit_idx = 0;
+      phase = 0;
+      rx_byte = 0;
+      rx_count = 0;
+      present = false;
+      done = false;
+      busy = true;
+      TC1->TC_CHANNEL[0].TC_RC = 2 * OW_TICKS_PER_USEC;  // first interrupt starts the first slot
+      TC_Start(TC1, 0);
+    }
+
+    // Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1), as in the OneWire library
+    byte crc8(const byte* addr, int len) {
+      byte crc = 0;
+      while ( len-- ) {
+        byte inbyte = *addr++;
+        for ( int i = 8; i; i-- ) {
+          byte mix = (crc ^ inbyte) & 0x01;
+          crc >>= 1;
+          if ( mix ) crc ^= 0x8C;
+          inbyte >>= 1;
+        }
+      }
+      return(crc);
+    }
 };
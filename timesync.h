@@ -0,0 +1,38 @@
+// ---------- timesync.h ----------
+// Disciplined program time - see timesync.ino
+// This is a .h file (#include'd in wwe.ino) so that adc.ino, capture.ino and journal.ino, which come before timesync.ino, can see it.
+// ntpudp is here, not in web.ino, so that timesync.ino, which comes before web.ino, can see it.
+
+#ifndef TIMESYNC_DEFINED
+#define TIMESYNC_DEFINED
+
+#include <Dns.h>                            // DNSClient, part of the Ethernet library
+
+#define TS_NTP_SERVER "pool.ntp.org"
+#define TS_NTP_PORT 123
+#define TS_NTP_POLL_SEC 256                 // NTP poll interval once synced
+#define TS_NTP_RETRY_SEC 16                 // ...and after a failed or rejected poll
+#define TS_NTP_TIMEOUT_MSEC 2000            // give up on a reply after this long
+#define TS_NTP_MAX_DELAY_USEC 200000        // reject replies with a longer round trip (incl. loop() latency), offset error <= delay/2
+#define TS_NTP_DNS_FAILS 4                  // re-resolve TS_NTP_SERVER after this many failed polls in a row
+#define TS_STEP_USEC 1000000                // step the clock if it's off by this much or more; slew it if less
+#define TS_SLEW_SHIFT 1                     // slew 1 usec every 2^TS_SLEW_SHIFT ticks = 5000 ppm, i.e., 1 sec in 200 sec
+#define TS_MAX_FREQ_PPB 500000              // max frequency correction of the TC0 tick, +/-500 ppm
+#define TS_PPB_PER_USEC 10000000            // 1 usec per 100 usec tick = 1% = 10^7 ppb
+#define TS_HOLDOVER_SEC 3600                // no NTP sync for this long --> fall back on the RTC
+#define TS_RTC_SET_SEC 86400                // while synced, set the RTC from NTP this often
+
+volatile uint64_t sample_index = 0;         // readADCs() ticks since boot, 10 kHz, never wraps - the timestamp for data producers
+volatile int32_t ts_usec = 0;               // usec into the current second of myunixtime, disciplined - see tickTimeSync()
+volatile int32_t ts_slew_usec = 0;          // offset still to be slewed out, usec; + = program time is behind
+volatile int32_t ts_freq_ppb = 0;           // TC0 tick frequency correction, ppb; + = the tick is slow
+volatile uint64_t ts_second_index = 0;      // sample_index at the start of the current second
+
+boolean ts_synced = false;                  // program time has been set from NTP at least once
+uint32_t ts_last_sync = 0;                  // myunixtime of the last good NTP sample
+int32_t ts_last_offset = 0;                 // last NTP offset, usec
+int32_t ts_last_delay = 0;                  // last NTP round trip, usec
+
+EthernetUDP ntpudp;                         // the NTP socket, open only while a request is outstanding
+
+#endif
@@ -0,0 +1,306 @@
+// ---------- timesync.ino ----------
+// DISCIPLINED PROGRAM TIME
+//
+// Program time (myunixtime) used to be a whole-second count of readADCs() ticks, set from NTP once at boot and then
+//   OVERWRITTEN from the RTC (a blocking I2C read) every second in if(do_post){}. The RTC has 1-sec resolution and drifts
+//   on its own, so seconds jumped or repeated, and the turbines' timestamps didn't agree.
+//
+// Now the 10 kHz TC0 tick is the clock, and NTP disciplines it:
+//   - tickTimeSync(), called by readADCs() every tick, advances ts_usec by 100 usec plus corrections, and rolls myunixtime
+//     (and do_post) over at each disciplined second. It also counts sample_index, a 64-bit tick count since boot.
+//   - serviceTimeSync(), called every loop() iteration, NEVER waits: it sends an NTP request every TS_NTP_POLL_SEC, and
+//     picks up the reply on a later iteration. Offset and round trip delay are computed from all 4 NTP timestamps; a
+//     reply with a long delay (e.g., one that sat in the W5500 during a long if(do_post){}) is rejected.
+//   - An offset < TS_STEP_USEC is SLEWED out (1 usec per 2 ticks, 0.5%), so time never jumps or runs backwards.
+//     A larger offset (or the first sync) STEPS the clock. The offset left over after each slew is the tick's
+//     frequency error, which is averaged into ts_freq_ppb over >= TS_FREQ_MIN_SEC and applied every tick.
+//   - The RTC is read at boot (setup()), and hourly in holdover, i.e., when there's been no NTP sync for TS_HOLDOVER_SEC.
+//     It's set from NTP on the first sync and then once a day.
+//
+// Timestamps for data producers (the tick count is the sample index of every ADC sample):
+//   - getTimeMs(): now, msec since 1970-01-01 UTC, 64 bits
+//   - getSampleTimeMs(idx): the time of sample_index idx, e.g., one latched in readADCs()
+//   - in the ISR, myunixtime + subsecond_ticks, as before (journal.ino, capture.ino), now disciplined
+//
+// The NTP server is resolved once (DNS is blocking), when Ethernet comes up - see runBootStages() in boot.ino -
+//   and again only after TS_NTP_DNS_FAILS failed polls in a row.
+
+
+#define TS_FREQ_MIN_SEC 1024                // min interval for a frequency estimate: 25 msec max error / 1024 sec = 24 ppm
+
+#define TS_NTP_IDLE 0
+#define TS_NTP_WAIT 1
+
+
+IPAddress ntp_server_ip(0, 0, 0, 0);
+
+
+// Advance program time by one readADCs() tick. Called from readADCs() ONLY. Returns true at the start of each second.
+boolean tickTimeSync() {
+  static int32_t freq_acc = 0;              // fractional usec of frequency correction, in ppb-ticks
+  int32_t step = SAMPLE_PERIOD_MICROS;
+
+  sample_index++;
+
+  freq_acc += ts_freq_ppb;
+  if ( freq_acc >= TS_PPB_PER_USEC ) {
+    freq_acc -= TS_PPB_PER_USEC;
+    step++;
+  } else if ( freq_acc <= -TS_PPB_PER_USEC ) {
+    freq_acc += TS_PPB_PER_USEC;
+    step--;
+  }
+
+  if ( ts_slew_usec && (sample_index & ((1 << TS_SLEW_SHIFT) - 1)) == 0 ) {
+    if ( ts_slew_usec > 0 ) {
+      ts_slew_usec--;
+      step++;
+    } else {
+      ts_slew_usec++;
+      step--;
+    }
+  }
+
+  ts_usec += step;
+  if ( ts_usec >= 1000000 ) {
+    ts_usec -= 1000000;
+    ts_second_index = sample_index;
+    return(true);
+  }
+  return(false);
+}
+
+
+// Get program time, to the usec. OK to call from anywhere, including the timer interrupts.
+void getTimeUsec(uint32_t* sec, int32_t* usec) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  *sec = myunixtime;
+  *usec = ts_usec;
+  if ( !primask ) __enable_irq();
+}
+
+
+// Program time, msec since 1970-01-01 UTC
+uint64_t getTimeMs() {
+  uint32_t sec;
+  int32_t usec;
+  getTimeUsec(&sec, &usec);
+  return( (uint64_t)sec * 1000 + usec / 1000 );
+}
+
+
+// Program time of readADCs() tick idx, msec since 1970-01-01 UTC. Exact (to the tick) for a tick in the current second,
+//   otherwise off by the slew and frequency corrections since, i.e., <= 0.5%.
+uint64_t getSampleTimeMs(uint64_t idx) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  uint32_t sec = myunixtime;
+  int64_t ticks = (int64_t)(idx - ts_second_index);
+  if ( !primask ) __enable_irq();
+  return( (int64_t)sec * 1000 + ticks / (SAMPLE_RATE_PER_SEC / 1000) );
+}
+
+
+// Format msec since 1970-01-01 UTC for JSON, e.g., 1700000000123
+void formatTimeMs(char* buf, uint64_t ms) {
+  sprintf(buf, "%lu%03u", (unsigned long)(ms / 1000), (unsigned int)(ms % 1000));
+}
+
+
+// Step program time by offset usec.
+void stepTime(int64_t offset) {
+  __disable_irq();
+  int64_t t = (int64_t)myunixtime * 1000000 + ts_usec + offset;
+  myunixtime = t / 1000000;
+  ts_usec = t % 1000000;
+  ts_slew_usec = 0;
+  __enable_irq();
+}
+
+
+// Correct program time by offset usec (+ = program time is behind). from_ntp is false for an RTC correction, which is
+//   too coarse (1 sec) to estimate the tick frequency from.
+void disciplineTime(int64_t offset, boolean from_ntp) {
+  static uint64_t freq_index = 0;           // sample_index when the frequency estimate window opened, 0 = not open
+  static int64_t freq_drift = 0;            // usec of drift seen in the window
+
+  __disable_irq();
+  uint64_t now_index = sample_index;
+  int32_t pending = ts_slew_usec;           // part of the last correction not slewed out yet, so it isn't drift
+  __enable_irq();
+
+  if ( (from_ntp && !ts_synced) || offset >= TS_STEP_USEC || offset <= -TS_STEP_USEC ) {
+    stepTime(offset);
+    freq_index = 0;
+    Serial << "timesync: STEPPED time by " << (long)(offset / 1000) << " msec\n";
+    return;
+  }
+
+  if ( from_ntp ) {
+    if ( freq_index ) {
+      freq_drift += offset - pending;
+      int32_t interval = (now_index - freq_index) / SAMPLE_RATE_PER_SEC;
+      if ( interval >= TS_FREQ_MIN_SEC ) {
+        int32_t ppb = ts_freq_ppb + (int32_t)(freq_drift * 1000 / interval) / 2;  // usec/sec = ppm, x 1000 = ppb; gain 1/2
+        ts_freq_ppb = constrain(ppb, -TS_MAX_FREQ_PPB, TS_MAX_FREQ_PPB);
+        freq_index = now_index;
+        freq_drift = 0;
+      }
+    } else {
+      freq_index = now_index;
+      freq_drift = 0;
+    }
+  }
+
+  __disable_irq();
+  ts_slew_usec = offset;                    // replaces the pending slew: the new offset already includes it
+  __enable_irq();
+}
+
+
+// Write program time (sec, usec) as a 64-bit NTP timestamp
+void writeNTPTimestamp(byte* p, uint32_t sec, int32_t usec) {
+  uint32_t s = sec + 2208988800UL;          // NTP time is seconds since 1900-01-01
+  uint32_t f = ((uint64_t)usec << 32) / 1000000;
+  for ( int i = 0; i < 4; i++ ) {
+    p[i] = s >> (24 - 8 * i);
+    p[4 + i] = f >> (24 - 8 * i);
+  }
+}
+
+
+// Read a 64-bit NTP timestamp as usec since 1970-01-01
+int64_t readNTPTimestamp(byte* p) {
+  uint32_t s = 0, f = 0;
+  for ( int i = 0; i < 4; i++ ) {
+    s = (s << 8) | p[i];
+    f = (f << 8) | p[4 + i];
+  }
+  return( (int64_t)(uint32_t)(s - 2208988800UL) * 1000000 + (((uint64_t)f * 1000000) >> 32) );
+}
+
+
+// Resolve the NTP server. Blocking (DNS), so it's called only when Ethernet comes up and after repeated failures.
+boolean resolveNTPServer() {
+  DNSClient dns;
+  dns.begin(Ethernet.dnsServerIP());
+  if ( dns.getHostByName(TS_NTP_SERVER, ntp_server_ip) != 1 ) {
+    Serial << "timesync: Can't resolve " << TS_NTP_SERVER << "\n";
+    return(false);
+  }
+  Serial << "timesync: NTP server " << TS_NTP_SERVER << " = " << ntp_server_ip << "\n";
+  return(true);
+}
+
+
+// Called ONCE by runBootStages() when Ethernet comes up - see boot.ino
+void initTimeSync() {
+  resolveNTPServer();
+}
+
+
+// Run the NTP client and RTC holdover. Called every loop() iteration. NEVER waits.
+void serviceTimeSync() {
+  static int state = TS_NTP_IDLE;
+  static uint32_t next_poll = 0;            // myunixtime of the next NTP request
+  static unsigned long send_msec = 0;       // millis() when the request was sent
+  static byte sent_ts[8];                   // our transmit timestamp, echoed back by the server
+  static int fails = 0;                     // failed polls in a row
+  static uint32_t rtc_check = 0;            // myunixtime of the last RTC read (setup() reads it at boot)
+  static uint32_t rtc_set = 0;              // myunixtime the RTC was last set from NTP
+  byte pkt[48];
+  uint32_t sec;
+  int32_t usec;
+
+  // Holdover: no NTP for a while, so keep to the RTC
+  if ( !rtc_check ) rtc_check = myunixtime;
+  if ( (!ts_synced || (myunixtime - ts_last_sync) >= TS_HOLDOVER_SEC) && (myunixtime - rtc_check) >= TS_HOLDOVER_SEC ) {
+    rtc_check = myunixtime;
+    if ( rtc_time = realtime_clock.get() ) {
+      int32_t off = rtc_time - myunixtime;
+      Serial << "timesync: HOLDOVER, RTC - program time = " << off << " sec\n";
+      if ( off >= 2 || off <= -2 ) disciplineTime((int64_t)off * 1000000, false);
+    }
+  }
+
+  if ( !ethernet_up ) return;
+
+  if ( state == TS_NTP_IDLE ) {
+    if ( (long)(myunixtime - next_poll) < 0 ) return;
+    next_poll = myunixtime + TS_NTP_RETRY_SEC;  // unless it succeeds
+    if ( fails >= TS_NTP_DNS_FAILS || !ntp_server_ip[0] ) {
+      fails = 0;
+      if ( !resolveNTPServer() ) return;
+    }
+    if ( !ntpudp.begin(TS_NTP_PORT) ) {
+      fails++;
+      return;
+    }
+    memset(pkt, 0, sizeof(pkt));
+    pkt[0] = 0xE3;                          // LI = 3 (unsynchronized), version 4, mode 3 (client)
+    pkt[2] = 6;                             // poll
+    pkt[3] = 0xEC;                          // precision
+    getTimeUsec(&sec, &usec);
+    writeNTPTimestamp(&pkt[40], sec, usec); // T1, transmit timestamp
+    memcpy(sent_ts, &pkt[40], 8);
+    if ( !(ntpudp.beginPacket(ntp_server_ip, TS_NTP_PORT) && ntpudp.write(pkt, 48) == 48 && ntpudp.endPacket()) ) {
+      ntpudp.stop();
+      fails++;
+      return;
+    }
+    send_msec = millis();
+    state = TS_NTP_WAIT;
+    return;
+  }
+
+  // TS_NTP_WAIT
+  if ( ntpudp.parsePacket() != 48 ) {
+    if ( (millis() - send_msec) < TS_NTP_TIMEOUT_MSEC ) return;
+    Serial << "timesync: NTP request timed out\n";
+    ntpudp.stop();
+    state = TS_NTP_IDLE;
+    fails++;
+    return;
+  }
+  getTimeUsec(&sec, &usec);                 // T4, as soon as we see it
+  int64_t t4 = (int64_t)sec * 1000000 + usec;
+  ntpudp.read(pkt, 48);
+  ntpudp.stop();
+  state = TS_NTP_IDLE;
+
+  // A stray or stale reply, or an unsynchronized server
+  if ( memcmp(&pkt[24], sent_ts, 8) || (pkt[0] & 0x07) != 4 || (pkt[0] >> 6) == 3 || pkt[1] == 0 || pkt[1] > 15 ) {
+    Serial << "timesync: NTP reply rejected\n";
+    fails++;
+    return;
+  }
+  int64_t t1 = readNTPTimestamp(&pkt[24]);
+  int64_t t2 = readNTPTimestamp(&pkt[32]);
+  int64_t t3 = readNTPTimestamp(&pkt[40]);
+  int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+  int64_t delay = (t4 - t1) - (t3 - t2);
+  if ( delay < 0 || delay > TS_NTP_MAX_DELAY_USEC ) {
+    Serial << "timesync: NTP reply rejected, delay = " << (long)(delay / 1000) << " msec\n";
+    fails++;
+    return;
+  }
+
+  disciplineTime(offset, true);
+  ts_synced = true;
+  ts_last_sync = myunixtime;
+  ts_last_offset = constrain(offset, -2000000000LL, 2000000000LL);
+  ts_last_delay = delay;
+  fails = 0;
+  next_poll = myunixtime + TS_NTP_POLL_SEC;
+  Serial << "timesync: NTP offset = " << ts_last_offset << " usec, delay = " << ts_last_delay << " usec, freq = "
+         << ts_freq_ppb << " ppb\n";
+
+  // Keep the RTC close for holdover and the next boot
+  if ( !rtc_set || (myunixtime - rtc_set) >= TS_RTC_SET_SEC ) {
+    getTimeUsec(&sec, &usec);
+    realtime_clock.set(sec + (usec >= 500000));
+    rtc_set = myunixtime;
+    Serial << "timesync: RTC set from NTP\n";
+  }
+}
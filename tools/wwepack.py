@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+# ---------- wwepack.py ----------
+# Host tool for the Update Server: makes the compressed (.lz) and delta (.delta) firmware images that updatefw.ino
+#   streams into flash, plus the .crc32 digest file used for plain .bin downloads - see streamHTTP2Flash() in updatefw.ino
+#
+# Usage:
+#   wwepack.py crc32 new.bin                      --> new.bin.crc32
+#   wwepack.py compress new.bin                   --> new.bin.lz
+#   wwepack.py delta old.bin new.bin              --> new.bin.delta  (old.bin = firmware now running on the controllers)
+#   wwepack.py decode image [old.bin] out.bin     --> decode an image the way the controller does, to check it
+#
+# Image format (all integers little-endian):
+#   header, 24 bytes: "WWZ1", block size (uint16), flags (uint16, 0), out_len, out_crc, base_len, base_crc (uint32 each)
+#     base_len = 0 for a compressed image; for a delta, base_crc must match the first base_len bytes of flash Bank 0.
+#   then a stream of tokens, each starting with a control byte c:
+#     0x00-0x7F  literal run: c+1 bytes follow
+#     0x80-0xBF  copy from OUTPUT (already decoded):   len = (c & 0x3F) + 4, then 3-byte distance back from the current position
+#     0xC0-0xFF  copy from BASE (the old image):        len = (c & 0x3F) + 4, then 3-byte offset in the base image
+#     If (c & 0x3F) == 0x3F, extension bytes come before the 3 offset bytes: each is added to len, until one is < 255.
+#
+# The controller decodes IN PLACE: the new image is written over the old one in Bank 0, one block at a time.
+#   So a base copy may only read base bytes in blocks that have not been overwritten yet, i.e., for every byte,
+#   base offset >= start of the output block being built. The encoder below only emits copies that satisfy that.
+#   Output copies can reach anywhere behind the current position; the controller reads them back from flash.
+
+import struct
+import sys
+import zlib
+
+MAGIC = b"WWZ1"
+BLOCK = 4096            # must equal BUFSIZE in updatefw.ino
+MIN_MATCH = 4
+MAX_DIST = (1 << 24) - 1
+HASH_LEN = 4
+MAX_CANDIDATES = 16     # per hash bucket
+
+
+def crc32(data):
+    return zlib.crc32(data) & 0xFFFFFFFF
+
+
+def match_len(a, i, b, j, limit):
+    n = 0
+    while n + 64 <= limit and a[i + n:i + n + 64] == b[j + n:j + n + 64]:
+        n += 64
+    while n < limit and a[i + n] == b[j + n]:
+        n += 1
+    return n
+
+
+def base_limit(p, s, base_len, out_len):
+    # Longest base copy from base offset s to output position p that only reads not-yet-overwritten blocks.
+    d = s - p
+    limit = min(base_len - s, out_len - p)
+    if d < 0:
+        if (p % BLOCK) < -d:
+            return 0
+        limit = min(limit, BLOCK - (p % BLOCK))  # can't cross into the next block
+    return max(limit, 0)
+
+
+def add_key(table, key, pos):
+    bucket = table.setdefault(key, [])
+    bucket.append(pos)
+    if len(bucket) > MAX_CANDIDATES:
+        del bucket[0]
+
+
+def encode(new, old=b""):
+    out = bytearray()
+    lits = bytearray()
+    base_table = {}
+    for i in range(len(old) - HASH_LEN + 1):
+        add_key(base_table, old[i:i + HASH_LEN], i)
+    self_table = {}
+    last_delta = 0      # base offset - output position of the last base copy; code that just moved tends to keep moving
+
+    def flush_lits():
+        for k in range(0, len(lits), 128):
+            run = lits[k:k + 128]
+            out.append(len(run) - 1)
+            out.extend(run)
+        lits.clear()
+
+    def emit_copy(kind, length, arg):
+        flush_lits()
+        n = length - MIN_MATCH
+        if n < 0x3F:
+            out.append(kind | n)
+        else:
+            out.append(kind | 0x3F)
+            n -= 0x3F
+            while n >= 255:
+                out.append(255)
+                n -= 255
+            out.append(n)
+        out.extend(struct.pack("<I", arg)[:3])
+
+    p = 0
+    n_new = len(new)
+    while p < n_new:
+        best_len, best_kind, best_arg = 0, 0, 0
+        key = new[p:p + HASH_LEN]
+        if len(key) == HASH_LEN:
+            cands = list(base_table.get(key, ()))
+            if 0 <= p + last_delta < len(old):
+                cands.append(p + last_delta)
+            for s in cands:
+                limit = base_limit(p, s, len(old), n_new)
+                if limit > best_len:
+                    n = match_len(new, p, old, s, limit)
+                    if n > best_len:
+                        best_len, best_kind, best_arg = n, 0xC0, s
+            for s in self_table.get(key, ()):
+                if p - s <= MAX_DIST:
+                    # overlapping copies are fine: the decoder copies one byte at a time
+                    n = match_len(new, p, new, s, n_new - p)
+                    if n > best_len + 1:    # prefer base copies, they let later copies follow the same shift
+                        best_len, best_kind, best_arg = n, 0x80, p - s
+        if best_len >= MIN_MATCH:
+            emit_copy(best_kind, best_len, best_arg)
+            if best_kind == 0xC0:
+                last_delta = best_arg - p
+            for k in range(p, min(p + best_len, n_new - HASH_LEN + 1)):
+                add_key(self_table, new[k:k + HASH_LEN], k)
+            p += best_len
+        else:
+            lits.append(new[p])
+            if p + HASH_LEN <= n_new:
+                add_key(self_table, key, p)
+            p += 1
+    flush_lits()
+
+    header = MAGIC + struct.pack("<HHIIII", BLOCK, 0, n_new, crc32(new), len(old), crc32(old) if old else 0)
+    return header + bytes(out)
+
+
+def decode(image, old=b""):
+    # Reference decoder. It mimics the controller: output overwrites the base in place, one BLOCK at a time.
+    if image[:4] != MAGIC:
+        raise ValueError("bad magic")
+    block, flags, out_len, out_crc, base_len, base_crc = struct.unpack("<HHIIII", image[4:24])
+    if block != BLOCK:
+        raise ValueError("block size %d != %d" % (block, BLOCK))
+    if base_len and (len(old) < base_len or crc32(old[:base_len]) != base_crc):
+        raise ValueError("base image does not match")
+    flash = bytearray(old[:base_len])
+    out = bytearray()
+    i = 24
+    while len(out) < out_len:
+        c = image[i]; i += 1
+        if c < 0x80:
+            out += image[i:i + c + 1]; i += c + 1
+        else:
+            n = c & 0x3F
+            if n == 0x3F:
+                while True:
+                    e = image[i]; i += 1
+                    n += e
+                    if e != 255:
+                        break
+            n += MIN_MATCH
+            arg = image[i] | (image[i + 1] << 8) | (image[i + 2] << 16); i += 3
+            if c & 0x40:
+                for k in range(n):
+                    flushed = (len(out) // BLOCK) * BLOCK
+                    if arg + k < flushed or arg + k >= base_len:
+                        raise ValueError("base copy reads overwritten flash at output %d" % len(out))
+                    out.append(flash[arg + k])
+            else:
+                src = len(out) - arg
+                if arg == 0 or src < 0:
+                    raise ValueError("bad distance")
+                for k in range(n):
+                    out.append(out[src + k])
+        # blocks that are complete have been written over the base
+        flushed = (len(out) // BLOCK) * BLOCK
+        if flushed > 0:
+            end = min(flushed, len(flash))
+            flash[:end] = out[:end]
+    if len(out) != out_len or crc32(out) != out_crc:
+        raise ValueError("CRC mismatch")
+    return bytes(out)
+
+
+def read(fname):
+    with open(fname, "rb") as f:
+        return f.read()
+
+
+def write(fname, data):
+    with open(fname, "wb") as f:
+        f.write(data)
+    print("wwepack: wrote %s (%d bytes)" % (fname, len(data)))
+
+
+def main(argv):
+    if len(argv) < 3:
+        print("usage: wwepack.py crc32|compress|delta|decode ...  (see comments at the top of wwepack.py)")
+        return 2
+    cmd = argv[1]
+    if cmd == "crc32":
+        data = read(argv[2])
+        with open(argv[2] + ".crc32", "w") as f:
+            f.write("%08x %d\n" % (crc32(data), len(data)))
+        print("wwepack: %s.crc32 = %08x %d" % (argv[2], crc32(data), len(data)))
+    elif cmd == "compress":
+        new = read(argv[2])
+        image = encode(new)
+        decode(image)
+        write(argv[2] + ".lz", image)
+    elif cmd == "delta" and len(argv) == 4:
+        old, new = read(argv[2]), read(argv[3])
+        image = encode(new, old)
+        decode(image, old)
+        write(argv[3] + ".delta", image)
+    elif cmd == "decode":
+        image = read(argv[2])
+        old = read(argv[3]) if len(argv) == 5 else b""
+        write(argv[-1], decode(image, old))
+    else:
+        print("wwepack: unknown command " + cmd)
+        return 2
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -4,6 +4,10 @@
 // This program visits the Update Server and downloads a firmware binary file.
 // The firmware binary file is downloaded via HTTP, written to flash Bank 0 at address 0x80000 (the usual 
 //   location of Arduino code), and started at that location.
+// If the Update Server publishes <binary>.crc32 ("<CRC32 in hex> <length in bytes>"), the file is streamed straight 
+//   into flash and checked against that CRC - see streamHTTP2Flash(). Otherwise it goes through SD as before.
+// Smaller downloads are tried first: <binary>.delta (against the firmware now in Bank 0), then <binary>.lz (compressed).
+//   Both are made on the Update Server with tools/wwepack.py - see streamHTTPImage2Flash().
 //
 // To build this program to execute at 0x80000 with a size not exceeding 0x40000, EDIT:
 //   %USERPROFILE%\AppData\Local\Arduino15\packages\arduino\hardware\sam\1.6.12\variants\arduino_due_x\linker_scripts\gcc\flash.ld
@@ -49,6 +53,7 @@ SdFat SD;
 #define FLASH_START_INTS ((int *)0)         // used only in commented-out code, purpose unclear
 
 // global vars
+boolean SD_ok = false;                     // SD is only needed if the firmware can't be streamed
 uint8_t mac[] = {0,0,0,0,0,0};             // Ethernet adapter MAC address: used in initWeb()
 char mac_chars[] = "00:00:00:00:00:00\0";  // appended to config file name: used in setup(), initWeb()
 byte rcvbuf[BUFSIZE];                      // byte array buffer to hold config file contents: used in several functions
@@ -61,6 +66,7 @@ void setup() {
   char cfg_filename[80];                     // configuration file name
   char binfile[40];                          // firmware binary file name
   char binpath[50];                          // firmware binary file path
+  char imgpath[60];                          // compressed/delta image file path
   int n;                                     // retry counter
   
   Serial.begin(115200);
@@ -71,13 +77,13 @@ void setup() {
 
   // Initialize SD
   n = 3;
-  while ( !(SD.begin(4, SPI_HALF_SPEED)) ) {
+  while ( !(SD_ok = SD.begin(4, SPI_HALF_SPEED)) ) {
     Serial << "updatefw: setup(): SD initialization FAILED.\n";
-    delay(10000);
     n--;
-    if (n == 0) return;  // if we don't have the SD, we have to abort!
+    if (n == 0) break;   // we can still stream the firmware without SD
+    delay(10000);
   }
-  Serial << "updatefw: setup(): SD initialization successful.\n";
+  if ( SD_ok ) Serial << "updatefw: setup(): SD initialization successful.\n";
 
   // Initialize Ethernet
   n = 3;
@@ -98,19 +104,32 @@ void setup() {
   strcpy(binfile, bin_filename);                              // save name of binary file
   sprintf(binpath, "%s%s", FIRMWARE_PATH, binfile);           // save path to binary file (includes file name)
   
-  // Get firmware file from HTTP server
-  if (getHTTP2File(SERVERADDR, SERVERPORT, binpath, binfile)) {
-    Serial << "updatefw: setup(): Firmware downloaded and verified!\n";
-    
-    // *** STOP HERE when uploading this program to usual Arduino flash (0x80000) for testing! ***
-    // *** Meaning... comment out the rest of the code in this if() ***
-    
-    // NOTE: See the change to library file DueFlashStorage.h to allow an ABSOLUTE flash memory address, 
-    // e.g., 0x80000 or 0xC0000. The default was an address RELATIVE to IFLASH1_ADDR = 0xC0000.
-    //showNFlashBytes(40, 0x80000);  // BEFORE flash write, for debug
-    writeFile2Flash(binfile, 0x80000);
-    //showNFlashBytes(40, 0x80000);  // AFTER flash write, for debug
+  // *** When uploading this program to usual Arduino flash (0x80000) for testing, DON'T write to 0x80000! ***
+  // *** Meaning... comment out the stream...2Flash() and writeFile2Flash() calls below ***
+
+  // NOTE: See the change to library file DueFlashStorage.h to allow an ABSOLUTE flash memory address, 
+  // e.g., 0x80000 or 0xC0000. The default was an address RELATIVE to IFLASH1_ADDR = 0xC0000.
+  //showNFlashBytes(40, 0x80000);  // BEFORE flash write, for debug
+
+  // Stream firmware from HTTP server straight into flash Bank 0: delta, compressed, then the plain file
+  sprintf(imgpath, "%s.delta", binpath);
+  boolean loaded = streamHTTPImage2Flash(SERVERADDR, SERVERPORT, imgpath, 0x80000, 0x40000);
+  if ( !loaded ) {
+    sprintf(imgpath, "%s.lz", binpath);
+    loaded = streamHTTPImage2Flash(SERVERADDR, SERVERPORT, imgpath, 0x80000, 0x40000);
+  }
+  if ( !loaded ) loaded = streamHTTP2Flash(SERVERADDR, SERVERPORT, binpath, 0x80000, 0x40000);
+
+  // Otherwise, get firmware file from HTTP server to SD, then copy it to flash
+  if ( !loaded && SD_ok ) {
+    if (getHTTP2File(SERVERADDR, SERVERPORT, binpath, binfile)) {
+      Serial << "updatefw: setup(): Firmware downloaded and verified!\n";
+      loaded = writeFile2Flash(binfile, 0x80000);
+    }
+  }
+  //showNFlashBytes(40, 0x80000);  // AFTER flash write, for debug
 
+  if ( loaded ) {
     Serial << "updatefw: GPNVM Security Bit (bit 0)     : 0 = unset, 1 = set\n";
     Serial << "updatefw: GPNVM Boot Mode (bit 1)        : 0 = boot from ROM, 1 = boot from FLASH\n";
     Serial << "updatefw: GPNVM Flash Boot Region (bit 2): 0 = FLASH0, 1 = FLASH1\n";
@@ -295,6 +314,371 @@ boolean readHTTP2File(char* server, uint16_t port, char* path, char* filename, b
 }
 
 
+// Standard (zlib) CRC32, nibble table. Start with crc = 0; pass the previous result to continue over more data.
+// Same as crc32Update() in parmstore.ino of the wwe sketch.
+uint32_t crc32Update(uint32_t crc, const byte* buf, int len) {
+  static const uint32_t crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  crc = ~crc;
+  while ( len-- > 0 ) {
+    crc ^= *buf++;
+    crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+    crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+  }
+  return(~crc);
+}
+
+
+// Get the published CRC32 and length of the file at path, from <path>.crc32. Returns true if successful.
+boolean getHTTPDigest(char* server, uint16_t port, char* path, uint32_t* crc, long* len) {
+  EthernetClient client;
+  HttpClient http(client);
+  char digestpath[80];
+  char buf[40];
+  boolean returnval = false;
+
+  sprintf(digestpath, "%s.crc32", path);
+  int rc = http.get(server, port, digestpath);
+  http.endRequest();
+  if ( rc == 0 ) rc = http.responseStatusCode();
+  if ( rc == 200 && http.skipResponseHeaders() >= 0 ) {
+    int n = http.readBytes(buf, sizeof(buf) - 1);
+    buf[n] = 0;
+    unsigned long crcval;
+    if ( sscanf(buf, "%lx %ld", &crcval, len) == 2 ) {
+      *crc = crcval;
+      returnval = true;
+    }
+  }
+  http.stop();
+  if ( !returnval ) Serial << "updatefw: getHTTPDigest(): No digest at " << server << ":" << port << digestpath << ", rc = " << rc << "\n";
+  return(returnval);
+}
+
+
+// Stream the file at path into flash at startaddr (at most maxlen bytes), without SD.
+//   Each full BUFSIZE block is CRC'd and written to flash. If the connection drops, we reconnect and request the rest
+//   with an HTTP Range header. At the end, the CRC of the received data AND of flash must match the published one.
+//   Same as streamHttp2Flash() in webclient.ino of the wwe sketch.
+boolean streamHTTP2Flash(char* server, uint16_t port, char* path, uint32_t startaddr, long maxlen) {
+  EthernetClient client;
+  HttpClient http(client);
+  const int kNetworkTimeout = 30000;   // # msec to wait for data before giving up on a connection
+  const int kMaxAttempts = 5;          // # connections (first try + resumes)
+  uint32_t expected_crc;
+  long expected_len;
+  uint32_t crc = 0;                    // CRC of bytes in flash so far
+  long offset = 0;                     // # bytes in flash so far
+  unsigned long starttime = millis();
+
+  if ( !getHTTPDigest(server, port, path, &expected_crc, &expected_len) ) return(false);
+  if ( expected_len <= 0 || expected_len > maxlen ) {
+    Serial << "updatefw: streamHTTP2Flash(): " << path << " length " << expected_len << " won't fit in " << maxlen << " bytes!\n";
+    return(false);
+  }
+  Serial << "updatefw: streamHTTP2Flash(): STREAMING " << server << ":" << port << path << " (" << expected_len 
+         << " bytes) to flash at 0x" << _HEX(startaddr) << "\n";
+
+  for ( int attempt = 1; (attempt <= kMaxAttempts) && (offset < expected_len); attempt++ ) {
+    int bufindx = 0;
+    char range[30];
+
+    int rc = http.get(server, port, path);
+    http.sendHeader("Accept", "application/octet-stream");
+    if ( offset > 0 ) {                                     // resume where we left off
+      sprintf(range, "bytes=%ld-", offset);
+      http.sendHeader("Range", range);
+      Serial << "updatefw: streamHTTP2Flash(): Resuming at byte " << offset << " (attempt " << attempt << ")\n";
+    }
+    http.endRequest();  // REQUIRED!
+    if ( rc == 0 ) rc = http.responseStatusCode();          // 200 = whole file, 206 = partial content
+    if ( rc == 200 && offset > 0 ) {
+      Serial << "updatefw: streamHTTP2Flash(): Server ignored Range, starting over.\n";
+      offset = 0;
+      crc = 0;
+    }
+    if ( (rc == 200 || rc == 206) && (http.skipResponseHeaders() >= 0) ) {
+      unsigned long timeoutStart = millis();
+      while ( (offset + bufindx < expected_len) && (http.connected() || http.available()) && 
+              ((millis() - timeoutStart) < kNetworkTimeout) ) {
+        if ( http.available() ) {
+          bufindx += http.readBytes(&(rcvbuf[bufindx]), min((long)(BUFSIZE - bufindx), expected_len - offset - bufindx));
+          if ( (bufindx == BUFSIZE) || (offset + bufindx == expected_len) ) {  // full block, or the last one
+            crc = crc32Update(crc, rcvbuf, bufindx);
+            dueflashstorage.write(startaddr + offset, rcvbuf, bufindx);
+            offset += bufindx;
+            bufindx = 0;
+          }
+          timeoutStart = millis();
+        } else {
+          delay(10);                                        // pause to allow some data to arrive
+        }
+      }
+    } else {
+      Serial << "updatefw: streamHTTP2Flash(): http.get failed, rc = " << rc << "\n";
+    }
+    http.stop();
+    if ( offset < expected_len ) Serial << "updatefw: streamHTTP2Flash(): Connection lost, " << offset << " bytes in flash\n";
+  }
+
+  if ( offset < expected_len ) {
+    Serial << "updatefw: streamHTTP2Flash(): Download FAILED.\n";
+    return(false);
+  }
+  uint32_t flash_crc = crc32Update(0, dueflashstorage.readAddress(startaddr), expected_len);
+  Serial << "updatefw: streamHTTP2Flash(): CRC32 received = 0x" << _HEX(crc) << ", in flash = 0x" << _HEX(flash_crc) 
+         << ", published = 0x" << _HEX(expected_crc) << "\n";
+  if ( (crc != expected_crc) || (flash_crc != expected_crc) ) {
+    Serial << "updatefw: streamHTTP2Flash(): CRC MISMATCH!\n";
+    return(false);
+  }
+  Serial << "updatefw: streamHTTP2Flash(): Wrote and verified " << expected_len << " bytes in " << (millis() - starttime) << " msec\n";
+  return(true);
+}
+
+
+// COMPRESSED AND DELTA IMAGES
+// The Update Server may also publish <binary>.delta (made against the firmware now in Bank 0) and <binary>.lz
+//   (compressed), both made by tools/wwepack.py - see the format notes there. They are decoded as they stream in, 
+//   with no RAM beyond rcvbuf[] (the output block being built) and a small network buffer:
+//   - copies from earlier OUTPUT are read back from flash once their block has been written
+//   - copies from the BASE (old firmware) are read from Bank 0 blocks that haven't been overwritten yet;
+//     wwepack.py only emits copies for which that is true.
+// Every time a block is written, the decoder state is saved. If the connection drops, we resume from that 
+//   checkpoint with an HTTP Range request. The header carries the CRC32 of the decoded image, which is checked at the end.
+#define IMG_MAGIC 0x315A5757                // "WWZ1"
+#define IMG_HDR_LEN 24
+#define IMG_MIN_MATCH 4
+
+// Decoder states
+#define IMG_CTRL 0                          // expecting a control byte
+#define IMG_LIT 1                           // copying literal bytes
+#define IMG_EXT 2                           // reading copy length extension bytes
+#define IMG_OFF 3                           // reading the 3 copy offset bytes
+#define IMG_COPY 4                          // copying
+
+struct ImageDecoder {
+  uint8_t state;
+  uint8_t ctrl;                             // control byte of the current copy
+  uint8_t nbytes;                           // # offset bytes read so far
+  uint32_t count;                           // literal bytes left, or copy length
+  uint32_t arg;                             // copy offset being read, then the next source offset
+  uint32_t out_total;                       // # bytes decoded
+  uint32_t out_flushed;                     // # bytes written to flash
+  uint32_t crc;                             // CRC of the bytes written to flash
+  long in_off;                              // # image bytes consumed
+};
+
+ImageDecoder img;                           // current state
+ImageDecoder img_checkpoint;                // state when the last block was written
+uint32_t img_startaddr;                     // flash address of the decoded image
+uint32_t img_out_len;                       // from the image header
+uint32_t img_out_crc;
+uint32_t img_base_len;
+boolean img_error;
+
+
+// Write the output block to flash, and save the decoder state
+void imageFlush() {
+  int n = img.out_total - img.out_flushed;
+  img.crc = crc32Update(img.crc, rcvbuf, n);
+  dueflashstorage.write(img_startaddr + img.out_flushed, rcvbuf, n);
+  img.out_flushed = img.out_total;
+  img_checkpoint = img;
+}
+
+
+void imageEmit(byte b) {
+  if ( img.out_total >= img_out_len ) {
+    Serial << "updatefw: imageEmit(): Image decodes past its length!\n";
+    img_error = true;
+    return;
+  }
+  rcvbuf[img.out_total++ - img.out_flushed] = b;
+  if ( (img.out_total - img.out_flushed == BUFSIZE) || (img.out_total == img_out_len) ) imageFlush();
+}
+
+
+// Run the current copy to completion (or an error)
+void imageCopy() {
+  while ( img.state == IMG_COPY && !img_error ) {
+    uint32_t src = img.arg++;
+    byte b;
+    if ( img.ctrl & 0x40 ) {                                   // copy from the BASE
+      if ( src < img.out_flushed || src >= img_base_len ) {    //   that block is already overwritten, or past the end
+        Serial << "updatefw: imageCopy(): Bad base copy from " << src << " at " << img.out_total << "\n";
+        img_error = true;
+        return;
+      }
+      b = dueflashstorage.read(img_startaddr + src);
+    } else {                                                   // copy from OUTPUT
+      b = (src >= img.out_flushed) ? rcvbuf[src - img.out_flushed] : dueflashstorage.read(img_startaddr + src);
+    }
+    if ( --img.count == 0 ) img.state = IMG_CTRL;
+    imageEmit(b);
+  }
+}
+
+
+// Decode one image byte (after the header)
+void imageFeed(byte b) {
+  img.in_off++;
+  switch ( img.state ) {
+    case IMG_CTRL:
+      if ( b < 0x80 ) {                                        // literal run
+        img.count = b + 1;
+        img.state = IMG_LIT;
+      } else {                                                 // copy
+        img.ctrl = b;
+        img.count = b & 0x3F;
+        img.arg = 0;
+        img.nbytes = 0;
+        img.state = (img.count == 0x3F) ? IMG_EXT : IMG_OFF;
+      }
+      break;
+    case IMG_LIT:
+      if ( --img.count == 0 ) img.state = IMG_CTRL;
+      imageEmit(b);
+      break;
+    case IMG_EXT:
+      img.count += b;
+      if ( b != 255 ) img.state = IMG_OFF;
+      break;
+    case IMG_OFF:
+      img.arg |= (uint32_t)b << (8 * img.nbytes++);
+      if ( img.nbytes == 3 ) {
+        img.count += IMG_MIN_MATCH;
+        if ( !(img.ctrl & 0x40) ) {                            // OUTPUT copy: distance --> source offset
+          if ( img.arg == 0 || img.arg > img.out_total ) {
+            Serial << "updatefw: imageFeed(): Bad copy distance " << img.arg << " at " << img.out_total << "\n";
+            img_error = true;
+            return;
+          }
+          img.arg = img.out_total - img.arg;
+        }
+        img.state = IMG_COPY;
+        imageCopy();
+      }
+      break;
+  }
+}
+
+
+// Check the image header. For a delta, the base must match what's in flash now.
+boolean imageHeader(byte* hdr, uint32_t startaddr, long maxlen) {
+  uint32_t magic, base_crc;
+  uint16_t block;
+  memcpy(&magic, hdr, 4);
+  memcpy(&block, hdr + 4, 2);
+  memcpy(&img_out_len, hdr + 8, 4);
+  memcpy(&img_out_crc, hdr + 12, 4);
+  memcpy(&img_base_len, hdr + 16, 4);
+  memcpy(&base_crc, hdr + 20, 4);
+  if ( magic != IMG_MAGIC || block != BUFSIZE || img_out_len == 0 || img_out_len > (uint32_t)maxlen || img_base_len > (uint32_t)maxlen ) {
+    Serial << "updatefw: imageHeader(): Bad image header\n";
+    return(false);
+  }
+  if ( img_base_len && crc32Update(0, dueflashstorage.readAddress(startaddr), img_base_len) != base_crc ) {
+    Serial << "updatefw: imageHeader(): Delta base does not match flash at 0x" << _HEX(startaddr) << "\n";
+    return(false);
+  }
+  Serial << "updatefw: imageHeader(): " << img_out_len << " bytes, " << (img_base_len ? "delta" : "compressed") << "\n";
+  return(true);
+}
+
+
+// Stream a compressed or delta image from path, decoding it into flash at startaddr (at most maxlen bytes).
+// Returns true if flash holds the decoded image and its CRC matches the header.
+boolean streamHTTPImage2Flash(char* server, uint16_t port, char* path, uint32_t startaddr, long maxlen) {
+  EthernetClient client;
+  HttpClient http(client);
+  const int kNetworkTimeout = 30000;   // # msec to wait for data before giving up on a connection
+  const int kMaxAttempts = 5;          // # connections (first try + resumes)
+  byte netbuf[256];
+  byte hdr[IMG_HDR_LEN];
+  long in_len = 0x7FFFFFFF;            // image length, once we know it
+  unsigned long starttime = millis();
+
+  memset(&img, 0, sizeof(img));
+  img_checkpoint = img;
+  img_startaddr = startaddr;
+  img_out_len = 0;
+  img_error = false;
+
+  for ( int attempt = 1; (attempt <= kMaxAttempts) && !img_error; attempt++ ) {
+    char range[30];
+
+    img = img_checkpoint;                                   // back to the last block written
+    if ( img.state == IMG_COPY ) imageCopy();               //   finish a copy that was cut off there
+    if ( img_error || (img_out_len && img.out_flushed == img_out_len) ) break;
+    int rc = http.get(server, port, path);
+    http.sendHeader("Accept", "application/octet-stream");
+    if ( img.in_off > 0 ) {
+      sprintf(range, "bytes=%ld-", img.in_off);
+      http.sendHeader("Range", range);
+      Serial << "updatefw: streamHTTPImage2Flash(): Resuming at image byte " << img.in_off << " (attempt " << attempt << ")\n";
+    }
+    http.endRequest();  // REQUIRED!
+    if ( rc == 0 ) rc = http.responseStatusCode();
+    if ( rc >= 400 ) {                                      // e.g., 404, the server doesn't have this image
+      Serial << "updatefw: streamHTTPImage2Flash(): " << server << ":" << port << path << " not available, rc = " << rc << "\n";
+      http.stop();
+      return(false);
+    }
+    if ( rc == 200 && img.in_off > 0 ) {                    // server ignored Range: decode again from byte 0. That's safe
+                                                            //   only because imageHeader() re-checks the delta base CRC: once
+                                                            //   a block is overwritten, a delta is rejected, not mis-decoded
+      Serial << "updatefw: streamHTTPImage2Flash(): Server ignored Range, starting over.\n";
+      memset(&img, 0, sizeof(img));
+      img_checkpoint = img;
+    }
+    if ( (rc == 200 || rc == 206) && (http.skipResponseHeaders() >= 0) ) {
+      if ( http.contentLength() >= 0 ) in_len = img.in_off + http.contentLength();
+      unsigned long timeoutStart = millis();
+      while ( (img.in_off < in_len) && !img_error && (http.connected() || http.available()) && 
+              ((millis() - timeoutStart) < kNetworkTimeout) ) {
+        if ( http.available() ) {
+          int n = http.readBytes(netbuf, min((long)sizeof(netbuf), in_len - img.in_off));
+          for ( int i = 0; (i < n) && !img_error; i++ ) {
+            if ( img.in_off < IMG_HDR_LEN ) {               // header
+              hdr[img.in_off++] = netbuf[i];
+              if ( img.in_off == IMG_HDR_LEN && !imageHeader(hdr, startaddr, maxlen) ) img_error = true;
+            } else {
+              imageFeed(netbuf[i]);
+            }
+          }
+          timeoutStart = millis();
+        } else {
+          delay(10);                                        // pause to allow some data to arrive
+        }
+      }
+    } else {
+      Serial << "updatefw: streamHTTPImage2Flash(): http.get failed, rc = " << rc << "\n";
+    }
+    http.stop();
+    if ( img_out_len && img.out_flushed == img_out_len ) break;  // done
+    if ( !img_error ) Serial << "updatefw: streamHTTPImage2Flash(): Connection lost, " << img_checkpoint.out_flushed << " bytes in flash\n";
+  }
+
+  if ( img_error || img_out_len == 0 || img.out_flushed != img_out_len ) {
+    Serial << "updatefw: streamHTTPImage2Flash(): Decode FAILED.\n";
+    return(false);
+  }
+  uint32_t flash_crc = crc32Update(0, dueflashstorage.readAddress(startaddr), img_out_len);
+  Serial << "updatefw: streamHTTPImage2Flash(): CRC32 decoded = 0x" << _HEX(img.crc) << ", in flash = 0x" << _HEX(flash_crc) 
+         << ", header = 0x" << _HEX(img_out_crc) << "\n";
+  if ( (img.crc != img_out_crc) || (flash_crc != img_out_crc) ) {
+    Serial << "updatefw: streamHTTPImage2Flash(): CRC MISMATCH!\n";
+    return(false);
+  }
+  Serial << "updatefw: streamHTTPImage2Flash(): Decoded " << img.in_off << " image bytes to " << img_out_len 
+         << " bytes in " << (millis() - starttime) << " msec\n";
+  return(true);
+}
+
+
 // Write an SD file to Arduino flash memory
 boolean writeFile2Flash(char* filename, int startaddr){
   boolean rc = false;
@@ -1,64 +1,6 @@
 // ---------- utils.ino ----------
 // This module is a collection of functions that don't obviously fit elsewhere.
 
-//
-// © Francesco Potortì 2013 - GPLv3 - Revision: 1.13
-// This function sends an NTP packet and wait for the response. It returns the Unix time.
-//
-// To lower the memory footprint, no buffers are allocated for sending and receiving the NTP packets.
-// Four bytes of memory are allocated for transmision, the rest is random garbage collected from the data memory segment,
-// and the received packet is read one byte at a time. The Unix time is returned, that is, seconds from 1970-01-01T00:00.
-
-// This function is called from setup() in web.ino.
-//   ntptime = ntpUnixTime(ntpudp);
-//   ntpudp is an instantiation of class EthernetUDP. In Ethernet.h, a derived class (UDP) inherits the EthernetUDP class.
-//   So below, ntpUnixTime is being passed a parameter which is the address of an object of class UDP.
-unsigned long inline ntpUnixTime(UDP &udp) {
-
-  static int udpInited = udp.begin(123);  // open socket on an arbitrary CLIENT port
-  if ( !udpInited ) return 0;             // FAIL if udp.begin() did not init a socket
-  udp.flush();                            // clear received data of possible stray received packets
- 
-  // Send an NTP request to the NTP port (port 123) on the time server.
-  // Only the first 4 bytes of an outgoing NTP request packet need to be set appropriately, the rest can be whatever.
-  const char timeServer[] = "pool.ntp.org";                     // NTP server name
-  const long ntpFirstFourBytes = 0xEC0600E3;                    // these are the 4 required bytes
-  if ( !( udp.beginPacket(timeServer, 123) &&                   // open the packet
-          udp.write( (byte *)&ntpFirstFourBytes, 48 ) == 48 &&  // write the required bytes to a 48-byte packet
-          udp.endPacket() ) ) return 0;                         // close the packet; if any of that fails, return 0
-
-  // Wait for a response from the time server. Check every pollIntv msec up to maxPoll times.
-  const int pollIntv = 150;		                        // poll interval, msec
-  const byte maxPoll = 15;		                        // max # of poll attempts
-  int pktLen;				                                  // received packet length
-  for ( byte i = 0; i < maxPoll; i++ ) {              // for each poll attempt...
-    if ( (pktLen = udp.parsePacket()) == 48 ) break;  //   if a 48-byte packet is received, break out of for() loop
-    delay( pollIntv );                                //   wait before trying again
-  }
-  if ( pktLen != 48 ) return 0;  // FAIL if no packet of correct length is received
-
-  // Read and discard the first useless bytes, bytes 0-32 or 0-40.
-  const byte useless = 40;  // set to 32 for speed or 40 for accuracy
-  for ( byte i = 0; i < useless; ++i ) udp.read();
-
-  // Read the INTEGER part of NTP time (read bytes 41-44, unsigned long is 4 bytes = 32 bits)
-  unsigned long NTPtime = udp.read();                                  // read first byte
-  for ( byte i = 1; i < 4; i++ ) NTPtime = NTPtime << 8 | udp.read();  // shift last byte left 8 bits, then bitwise OR with next byte
-
-  // For accuracy, round the INTEGER time to the nearest second:
-  //   The FRACTIONAL part of NTP time = next byte (0-255) / 256.
-  //   So, if (next byte / 256) > 0.5 sec, round up if next byte > 128, but...
-  //     assume a network delay = 0.05 sec, so round up if next byte > (0.5 - 0.05) * 256 = 115, but...
-  //     assume a further delay in reading the packet since it arrived = pollIntv/10 = 15 msec --> (0.5 - 0.05 - 0.015) * 256 = 111
-  NTPtime += ( udp.read() > 111 );  // if byte > arg, add 1 sec; otherwise add 0 sec
-
-  udp.flush();                    // discard the rest of the packet
-  udp.stop();                     // disconnect the client
-  // convert NTP time (seconds since 1900-01-01) to unix time (seconds since 1970-01-01)
-  return NTPtime - 2208988800ul;  // subtract 70 years = 2208988800 sec
-}  // END ntpUnixTime
-
-
 
 // This function reads a byte from EEPROM.
 //   The EEPROM has 256 bytes. The first 128 are available to us for storage of whatever we want to save,
@@ -64,13 +64,221 @@ void getWeatherData() {
   strcat(wxpath, sitelat);                  // site latitude from parms
   strcat(wxpath, "%2C");                    // ,
   strcat(wxpath, sitelon);                  // site longitude from parms
-  getNWSAPIData(wxserver, wxpath);          // see webclient.ino
+  getNWSAPIData(wxserver, wxpath);          // see webclient.ino, the response is parsed on-the-fly by feedNWSAlertParser() below
   // if NO ALERTS, ~232 bytes are returned
 
+}
+
+
+
+// ---------- NWS ALERT PARSER ----------
+// The NWS API returns a GeoJSON FeatureCollection, one feature per active alert, e.g.:
+//   {"type":"FeatureCollection", "features":[ {"id":..., "geometry":{...}, "properties":{"event":"High Wind Warning",
+//     "severity":"Severe", "onset":"2023-02-22T09:00:00-06:00", "expires":"2023-02-22T21:00:00-06:00", "description":"...", ...}}, ...]}
+// A response can be tens of KB (long descriptions, polygons), so it is NOT stored. Instead, getNWSAPIData() feeds each block
+//   it reads to feedNWSAlertParser(), a streaming JSON tokenizer that uses the same few bytes of state however long the response is:
+//   it only tracks nesting depth, whether the next string is a key or a value, and the first WXP_VAL_LEN chars of the current string.
+// Only features[].properties.{event, severity, onset, effective, expires} are kept. When a feature's properties object closes,
+//   a wind-related alert (see wx_furl_events[]) that is not "Minor" and not yet expired widens the furl window [onset, expires).
+// The window is only committed when the whole response parsed. Then updateWeatherFurl(), called every post in loop(),
+//   sets weather_furl inside the window and clears it AT the alert's expiry time, not at the next hourly check.
+
+#define WXP_KEY_LEN 12     // longest key we need to match is "properties"
+#define WXP_VAL_LEN 40     // longest value we keep, event names and ISO 8601 times are shorter
+#define WXP_MAX_DEPTH 31   // GeoJSON polygons nest ~7 deep
+
+// Events that trigger a weather furl, matched as UPPERCASE substrings of "event", e.g., "High Wind Warning", "Wind Advisory"
+const char* wx_furl_events[] = { "WIND", "HURRICANE", "TROPICAL STORM", "TORNADO", "SEVERE THUNDERSTORM" };
+#define NUM_WX_FURL_EVENTS (int)(sizeof(wx_furl_events) / sizeof(wx_furl_events[0]))
+
+enum { WXP_STRUCT, WXP_STRING, WXP_ESCAPE };
+
+struct {
+  byte state;                   // WXP_STRUCT, WXP_STRING, or WXP_ESCAPE
+  byte depth;                   // nesting depth, root object = 1
+  uint32_t arrays;              // bit n set if the container at depth n is an array
+  byte features_depth;          // depth of the "features" array, 0 = not in it
+  byte props_depth;             // depth of the current feature's "properties" object, 0 = not in it
+  boolean started;              // root object opened
+  boolean done;                 // root object closed
+  boolean error;                // too deep
+  boolean expect_key;           // next string in this object is a key
+  boolean is_key;               // string being read is a key
+  char key[WXP_KEY_LEN + 1]; int key_len;
+  char val[WXP_VAL_LEN + 1]; int val_len;
+  // current alert
+  char event[WXP_VAL_LEN + 1];
+  char severity[WXP_VAL_LEN + 1];
+  time_t onset, effective, expires;
+  // results
+  int alerts;
+  int furl_alerts;
+  time_t furl_onset, furl_expires;
+} wxp;
+
+// Committed furl window, see updateWeatherFurl()
+time_t wx_furl_onset = 0;
+time_t wx_furl_expires = 0;
+
+
+// Reset the parser before each response
+void startNWSAlertParser() {
+  memset(&wxp, 0, sizeof(wxp));
+  wxp.state = WXP_STRUCT;
+}
+
+
+// Convert an ISO 8601 time, e.g., "2023-02-22T09:00:00-06:00" or "...Z", to unix time. Returns 0 if it can't.
+time_t parseISO8601Time(char* s) {
+  int yr, mo, dy, hr, mn, sc, oh = 0, om = 0;
+  char sign = 'Z';
+  int n = sscanf(s, "%4d-%2d-%2dT%2d:%2d:%2d%c%2d:%2d", &yr, &mo, &dy, &hr, &mn, &sc, &sign, &oh, &om);
+  if ( n < 6 ) return(0);
+  tmElements_t tm;
+  tm.Year = CalendarYrToTm(yr); tm.Month = mo; tm.Day = dy;
+  tm.Hour = hr; tm.Minute = mn; tm.Second = sc;
+  time_t t = makeTime(tm);
+  long offset = (long)oh * 3600 + (long)om * 60;  // local time = UTC + offset
+  if ( sign == '-' ) t += offset;
+  if ( sign == '+' ) t -= offset;
+  return(t);
+}
 
-// *** Process the returned data ***
 
-  
+// Return true if an event name is one of wx_furl_events[]
+boolean isWeatherFurlEvent(char* event) {
+  char ev[WXP_VAL_LEN + 1];
+  int i;
+  for ( i = 0; event[i] && i < WXP_VAL_LEN; i++ ) ev[i] = toupper(event[i]);
+  ev[i] = 0;
+  if ( strstr(ev, "WIND CHILL") ) return(false);  // a cold alert, not a wind alert
+  for ( i = 0; i < NUM_WX_FURL_EVENTS; i++ ) {
+    if ( strstr(ev, wx_furl_events[i]) ) return(true);
+  }
+  return(false);
+}
+
+
+// A string value in a feature's properties has been read
+void storeNWSAlertValue() {
+  if ( wxp.key_len > WXP_KEY_LEN ) return;  // not a key we want
+  if ( strcmp(wxp.key, "event") == 0 ) strcpy(wxp.event, wxp.val);
+  else if ( strcmp(wxp.key, "severity") == 0 ) strcpy(wxp.severity, wxp.val);
+  else if ( strcmp(wxp.key, "onset") == 0 ) wxp.onset = parseISO8601Time(wxp.val);
+  else if ( strcmp(wxp.key, "effective") == 0 ) wxp.effective = parseISO8601Time(wxp.val);
+  else if ( strcmp(wxp.key, "expires") == 0 ) wxp.expires = parseISO8601Time(wxp.val);
+}
+
+
+// A feature's properties object has closed: decide whether this alert furls the turbine
+void endNWSAlert() {
+  wxp.alerts++;
+  time_t onset = wxp.onset ? wxp.onset : wxp.effective;  // onset is null for some alerts
+  time_t expires = wxp.expires ? wxp.expires : myunixtime + 3600 + 60;  // can't tell, hold until the next hourly check
+  boolean furl = isWeatherFurlEvent(wxp.event) && strcmp(wxp.severity, "Minor") && expires > myunixtime;
+  Serial << "weather: alert " << wxp.alerts << " \"" << wxp.event << "\", " << wxp.severity << ", onset " << onset << ", expires " << expires << (furl ? " --> FURL\n" : "\n");
+  if ( furl ) {
+    wxp.furl_alerts++;
+    if ( !wxp.furl_onset || onset < wxp.furl_onset ) wxp.furl_onset = onset;
+    if ( expires > wxp.furl_expires ) wxp.furl_expires = expires;
+  }
+  wxp.event[0] = 0; wxp.severity[0] = 0;
+  wxp.onset = 0; wxp.effective = 0; wxp.expires = 0;
+}
+
+
+// Tokenize the next len bytes of the response. Bytes before the root object (e.g., HTTP headers) are skipped.
+// Returns true once the root object has closed, i.e., the rest of the response can be ignored.
+boolean feedNWSAlertParser(byte* buf, int len) {
+  for ( int i = 0; i < len && !wxp.done && !wxp.error; i++ ) {
+    char c = buf[i];
+    switch ( wxp.state ) {
+
+      case WXP_STRING:
+        if ( c == '"' ) {
+          wxp.state = WXP_STRUCT;
+          if ( wxp.is_key ) {
+            wxp.key[min(wxp.key_len, WXP_KEY_LEN)] = 0;
+          } else {
+            wxp.val[min(wxp.val_len, WXP_VAL_LEN)] = 0;
+            if ( wxp.props_depth && wxp.depth == wxp.props_depth ) storeNWSAlertValue();
+          }
+          break;
+        }
+        if ( c == '\\' ) { wxp.state = WXP_ESCAPE; break; }
+        // fall through: ordinary string char
+      case WXP_ESCAPE:                            // keep the escaped char itself, e.g., \" --> "
+        if ( wxp.state == WXP_ESCAPE ) wxp.state = WXP_STRING;
+        if ( wxp.is_key ) {
+          if ( wxp.key_len < WXP_KEY_LEN ) wxp.key[wxp.key_len] = c;
+          wxp.key_len++;                          // keep counting, so a truncated key never matches
+        } else if ( wxp.val_len < WXP_VAL_LEN ) {
+          wxp.val[wxp.val_len++] = c;
+        }
+        break;
+
+      case WXP_STRUCT:
+        if ( !wxp.started && c != '{' ) break;    // skip anything before the root object
+        switch ( c ) {
+          case '"':
+            wxp.state = WXP_STRING;
+            wxp.is_key = wxp.expect_key;
+            if ( wxp.is_key ) wxp.key_len = 0; else wxp.val_len = 0;
+            break;
+          case ':':
+            wxp.expect_key = false;
+            break;
+          case ',':
+            wxp.expect_key = !(wxp.arrays & (1UL << wxp.depth));
+            break;
+          case '{':
+          case '[':
+            if ( wxp.depth >= WXP_MAX_DEPTH ) { wxp.error = true; break; }
+            wxp.started = true;
+            wxp.depth++;
+            if ( c == '[' ) wxp.arrays |= (1UL << wxp.depth); else wxp.arrays &= ~(1UL << wxp.depth);
+            // wxp.key is still the key of this container's value, e.g., "features"
+            if ( c == '[' && wxp.depth == 2 && strcmp(wxp.key, "features") == 0 ) wxp.features_depth = wxp.depth;
+            if ( c == '{' && wxp.features_depth && wxp.depth == wxp.features_depth + 2 && strcmp(wxp.key, "properties") == 0 ) wxp.props_depth = wxp.depth;
+            wxp.expect_key = (c == '{');
+            wxp.key[0] = 0; wxp.key_len = 0;
+            break;
+          case '}':
+          case ']':
+            if ( wxp.depth == wxp.props_depth ) { endNWSAlert(); wxp.props_depth = 0; }
+            if ( wxp.depth == wxp.features_depth ) wxp.features_depth = 0;
+            if ( wxp.depth > 0 ) wxp.depth--;
+            if ( wxp.depth == 0 ) wxp.done = true;
+            wxp.expect_key = false;
+            break;
+          default:                                // whitespace, numbers, true/false/null: nothing to keep
+            break;
+        }
+        break;
+    }
+  }
+  return(wxp.done || wxp.error);
+}
+
+
+// Called by getNWSAPIData() after the response has been read. Commits the new furl window only if the whole response parsed,
+//   otherwise the previous window stays in effect (and still expires on time).
+boolean endNWSAlertParser() {
+  if ( !wxp.done || wxp.error ) {
+    Serial << "weather: NWS alert parse FAILED (depth = " << wxp.depth << ", error = " << wxp.error << "), keeping previous alert window\n";
+    return(false);
+  }
+  wx_furl_onset = wxp.furl_onset;
+  wx_furl_expires = wxp.furl_expires;
+  Serial << "weather: " << wxp.alerts << " NWS alerts, " << wxp.furl_alerts << " furl, window " << wx_furl_onset << " - " << wx_furl_expires << "\n";
+  updateWeatherFurl();
+  return(true);
+}
 
 
+// Set/clear weather_furl (global, used in furlctl.ino) from the furl window. Called every post in loop().
+void updateWeatherFurl() {
+  boolean furl = wx_furl_expires && myunixtime >= wx_furl_onset && myunixtime < wx_furl_expires;
+  if ( furl != weather_furl ) Serial << "weather: weather_furl " << weather_furl << " --> " << furl << "\n";
+  weather_furl = furl;
 }
@@ -6,8 +6,6 @@
 #define HTTP_RESPONSE_TIMEOUT 5000
 #define HTTPS_RESPONSE_TIMEOUT 10000
 
-DueFlashStorage dueflashstorage;  // instantiate a DUE flash storage object
-
 unsigned long starttime;
 char* getChannelName();
 const float MAIN_SAMPLE_PERIOD_MILLIS = SAMPLE_PERIOD_MICROS / 100.0;  // = 100/100.0 = 1, period (in msec) on which all analog inputs are sampled.
@@ -15,9 +13,7 @@ const int NUM_GRAPH_CHANNELS = 11;                                     // # item
 const int graph_channels[] = {0,1,2,3,9,10,11,5,6,7,8};                // 0=V1, 1=V2, 2=V3, 3=VDC, 9=V12, 10=V23, 11=V31, 5=I1, 6=I2, 7=I3, 8=IDC
 const int axis_nums[] = {1,1,1,1,1,1,1,2,2,2,2};                       // y-axis numbers, used by flot
 
-EthernetUDP statusudp;  // instantiate some Ethernet UDP client objects
-EthernetUDP ntpudp;
-EthernetUDP tstudp;
+EthernetUDP tstudp;     // instantiate some Ethernet UDP client objects; statusudp is in telemetry.h, ntpudp in timesync.h
 
 
 
@@ -55,37 +51,7 @@ int initWeb() {
   if ( ethernet_rc ) { 
     Serial << "web: initWeb Ethernet initialization successful.\n";
 
-    Serial << "web: initWeb Getting NTP time...\n";
-    //sendUDPWorkaround();                          // this may be necessary even with Ethernet 2 shield - see function below
-    unsigned long ntptime = ntpUnixTime(ntpudp);  // get NTP time (unix time format), returns 0 if it fails
-
-    // Set the PROGRAM time (myunixtime)
-    Serial << "web: initWeb Getting RTC time...\n";
-    rtc_time = realtime_clock.get();                                                   // get RTC time (unix time format)
-    if ( rtc_time ) {                                                                  // if we have RTC time...
-      Serial << "web: initWeb RTC time = " << rtc_time << "\n";                        //   print RTC time
-      if ( ntptime ) {                                                                 //   if we have NTP time...
-        myunixtime = ntptime;                                                          //     ***set PROGRAM time to NTP***
-        Serial << "web: initWeb NTP time = " << ntptime << "\n";                       //     print NTP time
-        Serial << "web: initWeb Adjusting RTC by " << ntptime - rtc_time << " sec\n";  //     print NTP-RTC time diff
-        realtime_clock.set(ntptime);                                                   //     adjust RTC to NTP time
-        Serial << "web: initWeb RTC time = " << rtc_time << "\n";                      //     print adjusted RTC time
-      } else {                                                                         //   if we DON'T have NTP time...
-        myunixtime = rtc_time;                                                         //     ***set PROGRAM time to RTC***
-      }
-    } else {                                                                           // if we DON'T have RTC time...
-      Serial << "web: initWeb get RTC time FAILED.\n";                                 //   print FAIL message
-      if ( ntptime ) {                                                                 //   if we have NTP time...
-        myunixtime = ntptime;                                                          //     ***set PROGRAM time to NTP***
-        Serial << "web: initWeb NTP time = " << ntptime << "\n";                       //     print NTP time
-      } else {                                                                         //   if we DON'T have NTP time...
-        Serial << "web: initWeb get NTP time FAILED.\n";                               //     print FAIL message
-        while(1) {                                                                     //     DEAD END
-          Serial << "web: initWeb NO RTC or NTP available. PROGRAM STOPPED.\n";
-          delay(3600000);  // 1 hour
-        }
-      }
-    }
+    // Program time is set and kept by NTP from loop() from now on - see initTimeSync(), serviceTimeSync() in timesync.ino
 
     // Start a webserver - see webserver.ino
     initServer();
@@ -112,105 +78,116 @@ int initWeb() {
 //   the local network. Transmission to this address is limited by definition, in that it is never 
 //   forwarded by the routers connecting the local network to other networks."
 void sendUDPWorkaround() {
-  statusudp.begin(555);                         // start a UDP client, listening on an arbitrary port
+  tstudp.begin(555);                            // start a UDP client, listening on an arbitrary port (NOT statusudp, which stays open)
   static uint8_t udp_ip[] = {255,255,255,255};  // broadcast to the local network
-  statusudp.beginPacket(udp_ip, 55555);         // open packet for sending to (server or broadcast, port)
-  statusudp.write("wwe");                       // write some random chars
-  statusudp.endPacket();                        // close the packet
-  statusudp.stop();                             // stop UDP client
+  tstudp.beginPacket(udp_ip, 55555);            // open packet for sending to (server or broadcast, port)
+  tstudp.write("wwe");                          // write some random chars
+  tstudp.endPacket();                           // close the packet
+  tstudp.stop();                                // stop UDP client
 }
 
 
 
 
-// Send a UDP packet with current parms to the UDP server.
-int sendConfigUDP(char* ip_str) {
-  int rc = 0;                          // return code
-  statusudp.begin(456);                // start a UDP client, listening on an arbitrary port
-  unsigned long starttime = millis();  // measure how long this takes
+// CONFIG SYNC with the Data Server (cfgudp.py), on udp_remote_port_config
+//   Every parm_cfg_minutes the controller sends only a 32-bit DIGEST of its parms:  {"id":"<MAC>","digest":"1a2b3c4d"}
+//   The digest is the sum (mod 2^32) over all parms of CRC32("<parmname>=<parmval>"), so it doesn't depend on parm order.
+//   The server replies with one of:
+//     {"status":"unchanged"}                  nothing to do
+//     {"status":"full"}                       server doesn't recognize the digest; we send the FULL parm set on the next pass
+//     {"status":"delta","config":{...}}       only the changed keys, applied by writeBuff2Parms() - see parms.ino
+//   A full parm set is sent instead of the digest after a restart and after a reply timeout (which is also how an older
+//   server, that doesn't know about digests, keeps working). After {"status":"full"} it is sent right away, without
+//   waiting for the next parm_cfg_minutes.
+//   The reply is NOT waited for. checkConfigUDP() picks it up on a later pass through if(do_post) - see wwe.ino
+#define CONFIG_REPLY_TIMEOUT 3000          // msec
 
-  Serial << "web: sendConfigUDP() Sending current parms to UDP server: " << ip_str << ":" << udp_remote_port_config << "\n";
-  statusudp.beginPacket(ip_str, udp_remote_port_config);  //
-  statusudp.write(jsonbuf);
-  statusudp.endPacket();
+EthernetUDP configudp;                     // kept open while a reply is pending, so it's separate from statusudp
+boolean config_pending = false;            // a request is out, waiting for the reply
+boolean config_send_full = true;           // next request sends the full parm set
+boolean config_send_now = false;           // server asked for the full parm set; don't wait for parm_cfg_minutes
+unsigned long config_sent_time = 0;        // millis() when the request went out
 
-  // Wait for a response from the UDP server.
-  const int pollIntv = 100;                                // check every 100 msec
-  const byte maxPoll = 10;                                 // up to 10 times
-  int pktLen;                                              // received packet length
-  for (byte i=0; i < maxPoll; i++) {                       // start polling loop...
-    if ( (pktLen = statusudp.parsePacket()) != 0 ) break;  //   if we get a response, break out of for() loop
-    delay(pollIntv);                                       //   wait
-  }
-  // Handle response from UDP server (if any).
-  if (pktLen > 0) {                                        // if we get a response from the UDP server...
-    Serial << "web: sendConfigUDP() Received " << pktLen << " bytes from UDP server:\n";
-    statusudp.read(jsonbuf, pktLen);                       //   read response into jsonbuf
-    jsonbuf[pktLen] = 0;                                   //   null terminate jsonbuf string
-    printJSONBuf();                                        //   print jsonbuf to Serial
-    rc = writeBuff2Parms();                                //   put changes (if any) into the controller parms, see parms.ino
-  } else {                                                 // otherwise, we have no response...
-    rc = 0;                                                //   set return code = 0
-    Serial << "web: sendConfigUDP() NO RESPONSE from UDP server.\n";
-  }  
-  statusudp.stop();                   // stop
-  Serial << "web: sendConfigUDP() cycle time = " << (millis()-starttime) << " msec\n";
 
-  return(rc);
+// Digest of the current parms - see above
+uint32_t getParmsDigest() {
+  uint32_t digest = 0;
+  for (int i = 0; i < num_parms; i++) {
+    uint32_t crc = crc32Update(0, (byte*)parmary[i]->parmName(), strlen(parmary[i]->parmName()));  // see parmstore.ino
+    crc = crc32Update(crc, (byte*)"=", 1);
+    digest += crc32Update(crc, (byte*)parmary[i]->parmVal(), strlen(parmary[i]->parmVal()));
+  }
+  return(digest);
 }
 
 
+// Return true if the server is waiting for our full parm set - see wwe.ino
+boolean configRequestDue() {
+  return(config_send_now && !config_pending);
+}
 
-// This function calls the next one, of the same name, after converting the UDP IP string to an array.
-void sendDataUDP(char* ip_str, int udp_remote_port, int do_modbus) {
-  static uint8_t udp_ip[] = {255, 255, 255, 255};   // int array
-  static char last_ip_str[20] = "255.255.255.255";  // string (char array)
 
-  // Convert destination UDP IP string to an array
-  //   strtok() usage - see https://www.tutorialspoint.com/c_standard_library/c_function_strtok.htm
-  if (strcmp(ip_str, last_ip_str) != 0) {  // if the incoming IP string and last_ip_str don't match...
-    int i = 0;                             //   token counter
-    char* token;                           //   string pointer returned by strtok()
-    strcpy(last_ip_str, ip_str);           //   copy ip_str --> last_ip_str
-    token = strtok(last_ip_str, ".");      //   break last_ip_str into tokens separated by delimiter "."
-    while (token != NULL) {                //   loop through the tokens...
-      udp_ip[i++] = atoi(token);           //     each (char*) token becomes an (int) element of udp_ip[]
-      token = strtok(NULL, ".");           //     advance pointer to next token
-    }
-    strcpy(last_ip_str, ip_str);           //   copy ip_str --> last_ip_str, because last_ip_str was destroyed by strtok()
+// Send a config request (digest or full parm set) to the UDP server. Does NOT wait for the reply.
+void sendConfigUDP(char* ip_str) {
+  if ( config_pending ) configudp.stop();  // a reply that never came
+  config_send_now = false;
+  configudp.begin(457);                    // start a UDP client, listening on an arbitrary port
+
+  if ( config_send_full ) {
+    writeParms2Buff(true);                 // current parms --> jsonbuf; true --> include controller MAC - see parms.ino
+    config_send_full = false;
+    Serial << "web: sendConfigUDP() Sending current parms to UDP server: " << ip_str << ":" << udp_remote_port_config << "\n";
+  } else {
+    sprintf(jsonbuf, "{\"id\":\"%s\",\"digest\":\"%08lx\"}", mac_chars, (unsigned long)getParmsDigest());
+    Serial << "web: sendConfigUDP() Sending parm digest to UDP server: " << ip_str << ":" << udp_remote_port_config << " " << jsonbuf << "\n";
   }
-  //Serial << "web: sendDataUDP " << ip_str << "--> " << udp_ip[0] << "." << udp_ip[1] << "." << udp_ip[2] << "." <<  udp_ip[3] << "\n";
-  sendDataUDP(udp_ip, udp_remote_port, do_modbus);  // call same-named function (below) with IP array arg
+  configudp.beginPacket(ip_str, udp_remote_port_config);
+  configudp.write(jsonbuf);
+  configudp.endPacket();
+  config_pending = true;
+  config_sent_time = millis();
 }
 
 
+// Handle the reply to sendConfigUDP(), if it has arrived. Returns writeBuff2Parms() bits, or 0 if there's nothing to do.
+int checkConfigUDP() {
+  int rc = 0;
+  if ( !config_pending ) return(0);
 
-// Send out a JSON string as a UDP packet.
-// This function calls printPOSTBody() in webclient.ino to construct the actual UDP packet.
-//   uint8_t* is a pointer to an array 8-bit ints holding the UDP IP address
-void sendDataUDP (uint8_t* udp_ip, int udp_remote_port, int do_modbus) {
-  unsigned long starttime = millis();
-  
-  //Serial << "web: calling statusudp.begin()...\n";
-  statusudp.begin(456);  // start a UDP client, listening on an arbitrary port
+  int pktLen = configudp.parsePacket();
+  if ( pktLen <= 0 ) {                                                 // nothing yet...
+    if ( millis() - config_sent_time > CONFIG_REPLY_TIMEOUT ) {        //   if we've waited long enough...
+      Serial << "web: checkConfigUDP() NO RESPONSE from UDP server.\n";
+      configudp.stop();
+      config_pending = false;
+      config_send_full = true;                                         //     send everything next time
+    }
+    return(0);
+  }
 
-  //Serial << "web: calling statusudp.beginPacket()...\n";
-  statusudp.beginPacket(udp_ip, udp_remote_port);
+  Serial << "web: checkConfigUDP() Received " << pktLen << " bytes from UDP server after " << (millis() - config_sent_time) << " msec:\n";
+  pktLen = configudp.read(jsonbuf, min(pktLen, (int)sizeof(jsonbuf) - 1));  // read response into jsonbuf
+  jsonbuf[max(pktLen, 0)] = 0;                                       // null terminate jsonbuf string
+  configudp.stop();
+  config_pending = false;
+  printJSONBuf();                                                      // print jsonbuf to Serial
+
+  if ( strstr(jsonbuf, "\"status\":\"unchanged\"") ) {
+    Serial << "web: checkConfigUDP() Parms unchanged.\n";
+  } else if ( strstr(jsonbuf, "\"status\":\"full\"") ) {
+    Serial << "web: checkConfigUDP() Server requested full parm set.\n";
+    config_send_full = true;
+    config_send_now = true;
+  } else {
+    rc = writeBuff2Parms();                                            // put changes (if any) into the controller parms, see parms.ino
+  }
+  return(rc);
+}
 
-  //Serial << "web: calling printPOSTBody()...\n";
-  printPOSTBody(true, false, do_modbus);  // args: do_udp, countonly, do_modbus (0, 1, 2, or 3)
 
-  //Serial << "web: calling statusudp.endPacket()...\n";
-  statusudp.endPacket();
-  
-  //Serial << "web: calling statusudp.stop()...\n";
-  statusudp.stop();
-  
-  unsigned long udp_duration = millis() - starttime;
 
-  Serial << "web: sendDataUDP --> " << udp_ip[0] << "." << udp_ip[1] << "." << udp_ip[2] << "." << udp_ip[3] << ":" 
-                                   << udp_remote_port << ", send time = " << udp_duration << " msec\n";
-}
+// UDP DATA to the Data Server and other subscribers: see sendTelemetry() in telemetry.ino
+
 
 
 // Left over from early testing...
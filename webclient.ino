@@ -37,20 +37,24 @@ SSLClient https(base_client, TAs, (size_t)TAs_NUM, A6, 1, SSLClient::SSL_ERROR);
 // This function does a GET request *and* parses data received from the NWS API ***HTTPS*** server.
 //   It is called by getWeatherData - see weather.ino.
 // We parse data on-the-fly to avoid storing a large amount of unneeded data in a long JSON string
-//   before processing it. Why? Arduino memory is limited!
+//   before processing it. Why? Arduino memory is limited! Each block read is handed to feedNWSAlertParser() in weather.ino,
+//   and we stop reading as soon as the JSON root object closes, rather than waiting for the server to disconnect.
+// We ask for HTTP/1.0 so the server does NOT use chunked transfer encoding, i.e., the body is plain JSON.
+// TLS SESSION REUSE: we connect by host *name*, so SSLClient caches the TLS session for api.weather.gov (1 session, see https above)
+//   and the next hourly call resumes it with an abbreviated handshake instead of a full key exchange (~4 sec). If the server
+//   has dropped the session, SSLClient falls back to a full handshake by itself. If DNS fails we connect by IP, without caching.
 // An SSL certificate MUST be generated that includes the host domain: api.weather.gov
 //   see https://openslab-osu.github.io/bearssl-certificate-utility/
 //   and put the generated certificate into the #include'd file "trust_anchors.h"
 void getNWSAPIData(char* theserver, char* thepath) {
-  int bytecount = 0;
-  boolean wxalert0 = false;  // weather alert flags, NOT static!
-  boolean wxalert1 = false;
+  long bytecount = 0;
+  byte buf[256];             // read buffer
 
   Serial << "webclient: getNWSAPIData server = " << theserver << "\n";
   Serial << "webclient: getNWSAPIData path = " << thepath << "\n";
 
   // SSLClient says initial .connect() SSL negotiation can take 4-10 seconds!
-  // We see ~4 seconds on the FIRST API call, then ~400 msec on subsequent calls.
+  // We see ~4 seconds on a full handshake, ~400 msec when the cached session is resumed.
   https.setTimeout(20000);  // default is 30000 ms
 
   // For SSLClient class, see SSLClient.cpp
@@ -60,14 +64,19 @@ void getNWSAPIData(char* theserver, char* thepath) {
   //   SSLClient::m_start_ssl --> SSLClient::m_run_until --> (back to) SSLClient::m_start_ssl --> https.connect() returns 1
   //
   auto connecttime = millis();
-  //if ( https.connect(theserver, 443) ) { 
-  IPAddress ipaddr = {23,33,56,21};         // <-- nslookup api.weather.gov, avoids DNS
-  if ( https.connect(ipaddr, 443) ) {       // port 443 = HTTPS
-    Serial << "webclient: getNWSAPIData connect time = " << (millis() - connecttime) << " msec\n";
+  boolean connected = https.connect(theserver, 443);  // port 443 = HTTPS, resumes a cached session if we have one
+  if ( !connected ) {
+    https.stop();                                     // we MUST stop the client or subsequent Ethernet access is blocked!
+    Serial << "webclient: getNWSAPIData connect by name failed, trying IP\n";
+    IPAddress ipaddr = {23,33,56,21};                 // <-- nslookup api.weather.gov, avoids DNS
+    connected = https.connect(ipaddr, 443);
+  }
+  if ( connected ) {
+    Serial << "webclient: getNWSAPIData connect time = " << (millis() - connecttime) << " msec, cached sessions = " << https.getSessionCount() << "\n";
     Serial.flush();
     https.print("GET ");
     https.print(thepath);      // path name MUST begin with "/"
-    https.println(" HTTP/1.1");
+    https.println(" HTTP/1.0");
     https.println("User-Agent: SSLClientOverEthernet");
     https.print("Host: ");
     https.println(theserver);  // server name MUST match a domain *name* listed in trust_anchors.h
@@ -79,61 +88,30 @@ void getNWSAPIData(char* theserver, char* thepath) {
     return;
   }
 
-  // Skip over headers and anything else until we get to the first "{" char of the JSON data,
-  //   then break out of the while() and move on. (There are no methods in SSLClient to do this.)
+  // Read the response in blocks. The parser skips the headers and anything else before the first "{" of the JSON data.
+  startNWSAlertParser();
   auto waittime = millis();
   while ( true ) {
-    if ( https.available() ) {
-      char c = https.read();
-      if ( c == '{' ) break;  // '{' is a char, "{" would be a (null-terminated) string which would fail test
-    }
-    if ( (millis() - waittime) > 10000 ) {
-      https.stop();  // MUST stop the client or subsequent Ethernet access is blocked!
-      Serial << "webclient: getNWSAPIData timed out.\n";
-      return;
-    }
-  }
-
-  // Read through JSON data one char at a time
-  // Look for any occurances of "wind" or "Wind" or "WIND" in the Alert/Warning/Advisory
-  while ( true ) {
-    if ( https.available() ) {
-      char cbuf[] = "abcd";                                             // initialize a 4-char string, includes \0 at end --> necessary for printing it!
-      int len = https.read((byte*)&cbuf[0], 1);                         // read one byte, char ptr --> byte ptr
-      if ( len == 1 ) bytecount++;                                      // increment byte counter
-      cbuf[0] = toupper( cbuf[0] );                                     // convert char to uppercase
-      
-      // Look for 'WIND' in weather alert
-      if ( cbuf[0] == 'W' ) {                                           // if we've found a 'w' or 'W'...
-        len = https.read((byte*)&cbuf[1], 3);                           //   read next 3 bytes, char ptr --> byte ptr
-        bytecount += len;                                               //   increment byte counter by #bytes read
-        if ( len == 3 ) {                                               //     if we have 3 more bytes (chars)...
-          for (int i = 1; i < 4; i++) cbuf[i] = toupper( cbuf[i] );     //       convert them to uppercase
-          Serial << "webclient: getNWSAPIData buf = " << cbuf[0] << cbuf[1] << cbuf[2] << cbuf[3] << "\n";  // print 4 cbuf chars
-          if ( strncmp(cbuf,"WIND",4) == 0 ) wxalert0 = true;           //       if we find the string we're looking for, set weather alert flag
-        }
-      }
-      // Look for 'MPH' in weather alert. We add this to avoid furling during 'wind chill' alerts where no wind speed is given.
-      if ( cbuf[0] == 'M' ) {                                           // if we've found a 'm' or 'M'...
-        len = https.read((byte*)&cbuf[1], 2);                           //   read next 2 bytes, char ptr --> byte ptr
-        bytecount += len;                                               //   increment byte counter by #bytes read
-        if ( len == 2 ) {                                               //     if we have 2 more bytes (chars)...
-          for (int i = 1; i < 3; i++) cbuf[i] = toupper( cbuf[i] );     //       convert them to uppercase
-          Serial << "webclient: getNWSAPIData buf = " << cbuf[0] << cbuf[1] << cbuf[2] << "\n";  // print 3 cbuf chars
-          if ( strncmp(cbuf,"MPH",3) == 0 ) wxalert1 = true;            //       if we find the string we're looking for, set weather alert flag
-        }
+    int len = https.available();
+    if ( len > 0 ) {
+      len = https.read(buf, min(len, (int)sizeof(buf)));
+      if ( len > 0 ) {
+        bytecount += len;
+        waittime = millis();
+        if ( feedNWSAlertParser(buf, len) ) break;  // root object closed, we have everything we need
       }
-    }
-    
-    if ( !https.connected() ) {   // when we're disconnected (by the host)...
-      https.stop();               //   stop client
-      break;                      //   escape while()
+    } else if ( !https.connected() ) {              // when we're disconnected (by the host)...
+      break;
+    } else if ( (millis() - waittime) > 10000 ) {
+      Serial << "webclient: getNWSAPIData timed out.\n";
+      break;
     }
   }
+  https.stop();  // MUST stop the client or subsequent Ethernet access is blocked!
 
-  (wxalert0 && wxalert1) ? weather_furl = true : weather_furl = false;  // set weather FURL flag (global), used in furlctl.ino
+  endNWSAlertParser();  // sets weather_furl (global, used in furlctl.ino) - see weather.ino
   Serial << "webclient: getNWSAPIData data length = " << bytecount << " bytes\n";
-  return;           // return the data
+  return;
   
 }  // END getNWSAPIData
 
@@ -241,9 +219,9 @@ char* doHttpPost(char* server_addr, int server_port, char* filename) {
     client.println("Content-Type: application/json");
     
     client.print("Content-Length: ");
-    client.println( printPOSTBody(false, true, 0) );  // do_udp==false, countonly==true, 0==controller data, returns content length
+    client.println( printPOSTBody(false, true, 0, TELEM_ALL_CHANNELS) );  // do_udp==false, countonly==true, 0==controller data, returns content length
     client.println("");
-    printPOSTBody(false, false, 0);  // do_udp==false, countonly==false, 0==controller data, sends JSON-formatted data to server
+    printPOSTBody(false, false, 0, TELEM_ALL_CHANNELS);  // do_udp==false, countonly==false, 0==controller data, sends JSON-formatted data to server
 
     return( getHttpResponse() );
   } else {
@@ -254,13 +232,46 @@ char* doHttpPost(char* server_addr, int server_port, char* filename) {
 
 
 
-// This function returns a controller or Modbus channel name. Used by printPOSTBody() immediately below.
+// The channel functions below are used by printPOSTBody() immediately below, and by the SD and web page outputs.
+// They look up the channel tables (ctl_chans[] in channels.h, mod_*_chans[] in modbus.h), do_modbus = channel group.
+
+// Returns the # channels in a group (including any that are merged into another channel)
+int getNumChans(int do_modbus) {
+  int n = NUM_ADC_CHANNELS;
+  if (do_modbus != CH_GROUP_CONTROLLER) getModChannels(do_modbus, &n);
+  return(n);
+}
+
+
+// Returns a controller or Modbus channel name, or NULL if channel i is output as part of another channel (CH_MERGE_LO).
 // There is a method of the same name in class ModbusReg{} - see modbus.h
 char* getChanName(int i, int do_modbus) {
-  if ( do_modbus == 0 ) {
-    return( getChannelName(i) );  // see adc.ino
-  } else {
-    return( getModchannelName(do_modbus, i) );  // see modbus.h
+  if (do_modbus == CH_GROUP_CONTROLLER) return( (char*)ctl_chans[i].name );
+  int n;
+  const ModChannel* ch = &getModChannels(do_modbus, &n)[i];
+  if (ch->flags & CH_MERGE_LO) return(NULL);
+  if (ch->flags & CH_MERGE_HI) return( (char*)ch->merged_name );
+  return( ch->reg->getChanLabel() );
+}
+
+
+// Formats the val of channel i into buf (40 chars), as output to SD, UDP and HTTP.
+//   Controller vals are scaled and rounded as given in ctl_chans[]. Modbus vals are formatted by readReg() - see modbus.h
+void formatChanVal(char* buf, int i, int do_modbus) {
+  if (do_modbus == CH_GROUP_CONTROLLER) {
+    const ChannelDesc* ch = &ctl_chans[i];
+    if (ch->decimals == CH_INT) {
+      sprintf(buf, "%d", getChannelRMSInt(i));
+    } else {
+      sprintf(buf, "%.*f", ch->decimals, (float)getChannelRMSInt(i) * ch->scale);
+    }
+    return;
+  }
+  int n;
+  const ModChannel* ch = &getModChannels(do_modbus, &n)[i];
+  strcpy(buf, ch->reg->valStrg());
+  if ( (ch->flags & CH_MERGE_HI) && strcmp(buf, "\"NaN\"") != 0 ) {  // (HI << 16) + LO, unless the HI read failed
+    sprintf(buf, "%d", (ch->reg->valInt() << 16) + (ch - 1)->reg->valInt());
   }
 }
 
@@ -268,16 +279,14 @@ char* getChanName(int i, int do_modbus) {
 
 // This function generates (in short chunks) a JSON string for posting.
 // This function calls printOrCount() immediately below.
-int printPOSTBody(boolean do_udp, boolean countonly, int do_modbus) {
-  int num_channels;  // # channels (or data vals)
-  char buf[40];      // string buffer
+// Only channels whose bit is set in mask are included (bit i = channel i) - see telemetry.ino
+int printPOSTBody(boolean do_udp, boolean countonly, int do_modbus, uint64_t mask) {
+  int num_channels = getNumChans(do_modbus);  // # channels (or data vals)
+  char* name;        // channel name
+  char buf[64];      // string buffer
   char ipstr[16];    // IP address string
   int len = 0;       // string length
-  
-  if (do_modbus == 0) num_channels = NUM_ADC_CHANNELS;       // 0 --> Controller data, NUM_ADC_CHANNELS is defined in adc.ino
-  if (do_modbus == 1) num_channels = NUM_MOD_FAST_CHANNELS;  // 1 --> Morningstar Modbus 'fast' regs, NUM_MOD_FAST_CHANNELS is defined in modbus.h
-  if (do_modbus == 2) num_channels = NUM_MOD_SLOW_CHANNELS;  // 2 --> Morningstar Modbus 'slow' regs, NUM_MOD_SLOW_CHANNELS is defined in modbus.h
-  if (do_modbus == 3) num_channels = NUM_MOD_NUV_CHANNELS;   // 3 --> Nuvation Modbus/TCP regs, NUM_MOD_NUV_CHANNELS is defined in modbus.h
+  boolean first = true;  // no "," before the first name or val
 
   // Begin JSON with "id" and "ip" key:vals
   len += printOrCount(do_udp, countonly, "{\"id\":\"");                         // print {"id":"
@@ -291,67 +300,31 @@ int printPOSTBody(boolean do_udp, boolean countonly, int do_modbus) {
   // CHANNELS
   len += printOrCount(do_udp, countonly, "\",\"channels\":[\"");                // print ","channels":["
   for (int i = 0; i < num_channels; i++) {                                      // loop over channel names...
-    if (getChanName(i, do_modbus) == "ABloD60") continue;                       //   skip to next channel name
-    if (getChanName(i, do_modbus) == "ABloD2") continue;                        //   skip to next channel name
-    if (getChanName(i, do_modbus) == "ABhiD60") {                               //   if channel name is ABhiD60...
-      printOrCount(do_udp, countonly, "ABD60\",\"");                            //     rename it (with trailing quote followed by comma)
-      continue;                                                                 //     skip to next channel name
-    }
-    if (getChanName(i, do_modbus) == "ABhiD2") {                                //   if channel name is ABhiD60...
-      printOrCount(do_udp, countonly, "ABD2\",\"");                             //     rename it (with trailing quote followed by comma)
-      continue;                                                                 //     skip to next channel name
-    }
-    len += printOrCount(do_udp, countonly, getChanName(i, do_modbus));          //   print channel name
-    if (i < num_channels - 1) len += printOrCount(do_udp, countonly, "\",\"");  //   print "," between channel names
+    if (!((mask >> i) & 1)) continue;                                           //   not subscribed, skip to next channel name
+    if ((name = getChanName(i, do_modbus)) == NULL) continue;                   //   merged into the next channel, skip it
+    if (!first) len += printOrCount(do_udp, countonly, "\",\"");                //   print "," between channel names
+    first = false;
+    len += printOrCount(do_udp, countonly, name);                               //   print channel name
   }                                                                             // END loop over channel names
 
   // DATA
   len += printOrCount(do_udp, countonly, "\"],\"data\":[");               // print "],"data":[
-  sprintf(buf, "{\"time\":%d,\"vals\":[", myunixtime);                    // put timestamp into buf
-  len += printOrCount(do_udp, countonly, buf);                            // print buf {"time":<timestamp>,"vals":[
+  sprintf(buf, "{\"time\":%d,\"ms\":", myunixtime);                       // put timestamp into buf
+  formatTimeMs(buf + strlen(buf), getTimeMs());                           //   and the msec time the vals are read - see timesync.ino
+  strcat(buf, ",\"vals\":[");
+  len += printOrCount(do_udp, countonly, buf);                            // print buf {"time":<timestamp>,"ms":<msec>,"vals":[
 
-  int ABD60 = 0, ABD2 = 0;                                                // Alarm vals (low word + high word)
+  first = true;
   for ( int i = 0; i < num_channels; i++ ) {                              // loop over channel vals...
-    if (do_modbus) {                                                      //   if MODBUS data...
-      sprintf(buf, "%s", getModchannelValue(do_modbus, i));               //     put val into string buf
- 
-      if (getChanName(i, do_modbus) == "ABloD60") {                       //     if the channel name is a low word...
-        ABD60 = mod_fast_regs[i]->valInt();                               //       save its val (as int!)
-        continue;                                                         //       skip to next channel
-      }
-      if (getChanName(i, do_modbus) == "ABhiD60") {                       //     if the channel name is a high word...
-        ABD60 += (mod_fast_regs[i]->valInt() << 16);                      //       add high word to low word 
-        if ( strcmp(buf, "\"NaN\"") != 0 ) sprintf(buf, "%d", ABD60);     //       save combined val in buf (if not "NaN")
-      }
-      if (getChanName(i, do_modbus) == "ABloD2") {                        //     if channel name is a low word...
-        ABD2 = mod_fast_regs[i]->valInt();                                //       save its val (as int!)
-        continue;                                                         //       skip to next channel
-      }
-      if (getChanName(i, do_modbus) == "ABhiD2") {                        //     if the channel name is a high word...
-        ABD2 += (mod_fast_regs[i]->valInt() << 16);                       //       add hi word to low word 
-        if ( strcmp(buf, "\"NaN\"") != 0 ) sprintf(buf, "%d", ABD2);      //       save combined val in buf (if not "NaN")
-      }
-    } else {                                                              //   otherwise, CONTROLLER data...
-      float multiplier = 1.0;
-      if (i == TAIL_POSITION) {                                                       // TAIL_POSITION
-        multiplier = 0.002903226;                                                     //   units are usteps, with 360/(2000*62) deg/ustep --> multiplier = 0.002903226
-        sprintf(buf, "%.2f", (float)getChannelRMSInt(TAIL_POSITION) * multiplier);    //   get val and format (as float)
-      } else if (i == HVDL_DUTY_CYCLE) {                                              // HVDL_DUTY_CYCLE
-        multiplier = 0.01;                                                            //   units are % --> multiplier = 0.01
-        sprintf(buf, "%.2f", (float)getChannelRMSInt(HVDL_DUTY_CYCLE) * multiplier);  //   get val and format (as float)
-      } else if (i == STATE) {                                                        // STATE, no units (bitfield) --> no multiplier
-        sprintf(buf, "%d", getChannelRMSInt(STATE));                                  //   get val and format (as int)
-      } else {                                                                        // ALL OTHER CHANNELS...
-        multiplier = 0.0009765625;                                                    //   vals are 1024x actual --> multiplier = 1/1024
-        sprintf(buf, "%.2f", (float)getChannelRMSInt(i) * multiplier);                //   get val and format (as float)
-      }
-      if (strncmp(buf, "inf", 3) == 0) strcpy(buf, "\"inf\"");      // if val == "inf", insert "inf" into buf
-    }
+    if (!((mask >> i) & 1)) continue;                                     //   not subscribed, skip to next channel
+    if (getChanName(i, do_modbus) == NULL) continue;                      //   merged into the next channel, skip it
+    formatChanVal(buf, i, do_modbus);                                     //   put val into string buf
+    if (!first) len += printOrCount(do_udp, countonly, ",");        // print , between vals
+    first = false;
     len += printOrCount(do_udp, countonly, buf);                    // print buf (contains channel val)
-    i < num_channels - 1 ? sprintf(buf, ",") : sprintf(buf, "]}");  // print , (between vals) or ]} (after last val) to buf
-    len += printOrCount(do_udp, countonly, buf);                    // print buf
   }  // END loop over channel vals
 
+  len += printOrCount(do_udp, countonly, "]}");  // end "vals" array with ], end "data" object with }
   len += printOrCount(do_udp, countonly, "]}");  // end "data" array with ], end JSON string with }
   //Serial << "webclient: printPOSTBody string length = " << len << "\n";
   return(len);  
@@ -361,16 +334,22 @@ int printPOSTBody(boolean do_udp, boolean countonly, int do_modbus) {
 
 // This function is called by printPOSTBody().
 //   If countonly==true, just calculate the length of strg and return it.
-//   If countonly==false AND do_udp==true, write a UDP packet containing strg to a UDP client (statusudp).
+//   If countonly==false AND do_udp==true, add strg to the telemetry packet in telem_buf, to be sent by sendTelemetry() - see telemetry.ino
 //   If countonly==false AND do_udp==false, write strg to an HTTP client.
 int printOrCount(boolean do_udp, boolean countonly, char* strg) {
   
   if (countonly) {          // if countonly==true...
     return(strlen(strg));   //   return string length
   } else if (do_udp) {      // otherwise, countonly==false, do_udp==true
+    int n = strlen(strg);
     //Serial << strg;         //   display string on serial monitor, and
-    statusudp.write(strg);  //   ***write string to UDP client***
-    return(strlen(strg));   //   return string length
+    if (telem_len + n > TELEM_BUF_SIZE) {                                     //   ***add string to the telemetry packet***
+      telem_overflow = true;
+    } else {
+      memcpy(telem_buf + telem_len, strg, n);
+      telem_len += n;
+    }
+    return(n);              //   return string length
   } else {                  // otherwise, countonly==false and do_udp==false
     client.write(strg);     //   ***write string to HTTP client***
     return(0);              //   return 0
@@ -661,6 +640,119 @@ boolean readHttp2File(char* server, uint16_t port, char* path, char* filename, b
 
 
 
+// STREAMING FIRMWARE DOWNLOAD
+// These functions download a binary STRAIGHT INTO FLASH, without the SD download + verify + copy of 
+//   getHttp2File() and writeFile2Flash() above and below:
+//   - The Update Server publishes <path>.crc32 next to each binary: "<CRC32 in hex> <length in bytes>", e.g., "1a2b3c4d 98304"
+//   - The body is read into rcvbuf[]. Each full BUFSIZE block (16 flash pages) is CRC'd and written to flash.
+//   - If the connection drops, we reconnect and request the rest with an HTTP Range header, starting at the
+//     first byte not yet in flash. A server that ignores Range (200 instead of 206) just restarts the download.
+//   - At the end, BOTH the CRC of the received data and a CRC re-read from flash must match the published one.
+// The same code is in updatefw.ino, which streams the new firmware into Bank 0.
+
+// Get the published CRC32 and length of the file at path. Returns true if successful.
+boolean getHttpDigest(char* server, uint16_t port, char* path, uint32_t* crc, long* len) {
+  char digestpath[80];
+  char buf[40];
+  boolean returnval = false;
+
+  sprintf(digestpath, "%s.crc32", path);
+  int rc = http.get(server, port, digestpath);
+  http.endRequest();
+  if ( rc == 0 ) rc = http.responseStatusCode();
+  if ( rc == 200 && http.skipResponseHeaders() >= 0 ) {
+    int n = http.readBytes(buf, sizeof(buf) - 1);
+    buf[n] = 0;
+    unsigned long crcval;
+    if ( sscanf(buf, "%lx %ld", &crcval, len) == 2 ) {
+      *crc = crcval;
+      returnval = true;
+    }
+  }
+  http.stop();
+  if ( !returnval ) Serial << "webclient: getHttpDigest No digest at " << server << ":" << port << digestpath << ", rc = " << rc << "\n";
+  return(returnval);
+}
+
+
+// Stream the file at path into flash at startaddr (at most maxlen bytes), resuming after a dropped connection.
+// Returns true if flash holds a verified copy.
+boolean streamHttp2Flash(char* server, uint16_t port, char* path, uint32_t startaddr, long maxlen) {
+  const int kNetworkTimeout = 5*1000;  // msec to wait w/o receiving data before giving up on a connection
+  const int kMaxAttempts = 5;          // connections (first try + resumes)
+  uint32_t expected_crc;
+  long expected_len;
+  uint32_t crc = 0;                    // CRC of bytes in flash so far
+  long offset = 0;                     // # bytes in flash so far
+  auto starttime = millis();
+
+  if ( !getHttpDigest(server, port, path, &expected_crc, &expected_len) ) return(false);
+  if ( expected_len <= 0 || expected_len > maxlen ) {
+    Serial << "webclient: streamHttp2Flash " << path << " length " << expected_len << " won't fit in " << maxlen << " bytes!\n";
+    return(false);
+  }
+  Serial << "webclient: streamHttp2Flash STREAMING " << server << ":" << port << path << " (" << expected_len 
+         << " bytes) to flash at 0x" << _HEX(startaddr) << "\n";
+
+  for ( int attempt = 1; (attempt <= kMaxAttempts) && (offset < expected_len); attempt++ ) {
+    int bufindx = 0;
+    char range[30];
+
+    int rc = http.get(server, port, path);
+    http.sendHeader("Accept", "application/octet-stream");
+    if ( offset > 0 ) {                                     // resume where we left off
+      sprintf(range, "bytes=%ld-", offset);
+      http.sendHeader("Range", range);
+      Serial << "webclient: streamHttp2Flash Resuming at byte " << offset << " (attempt " << attempt << ")\n";
+    }
+    http.endRequest();
+    if ( rc == 0 ) rc = http.responseStatusCode();          // 200 = whole file, 206 = partial content
+    if ( rc == 200 && offset > 0 ) {
+      Serial << "webclient: streamHttp2Flash Server ignored Range, starting over.\n";
+      offset = 0;
+      crc = 0;
+    }
+    if ( (rc == 200 || rc == 206) && (http.skipResponseHeaders() >= 0) ) {
+      unsigned long timeoutStart = millis();
+      while ( (offset + bufindx < expected_len) && (http.connected() || http.available()) && 
+              ((millis() - timeoutStart) < kNetworkTimeout) ) {
+        if ( http.available() ) {
+          bufindx += http.readBytes( &rcvbuf[bufindx], min((long)(BUFSIZE - bufindx), expected_len - offset - bufindx) );
+          if ( (bufindx == BUFSIZE) || (offset + bufindx == expected_len) ) {  // full block, or the last one
+            crc = crc32Update(crc, rcvbuf, bufindx);                           //   see parmstore.ino
+            dueflashstorage.write( startaddr + offset, rcvbuf, bufindx );      //   ABSOLUTE address, see wwe.ino
+            offset += bufindx;
+            bufindx = 0;
+          }
+          timeoutStart = millis();
+        } else {
+          delay(10);                                        // pause to allow some data to arrive
+        }
+      }
+    } else {
+      Serial << "webclient: streamHttp2Flash Get failed, rc = " << rc << "\n";
+    }
+    http.stop();
+    if ( offset < expected_len ) Serial << "webclient: streamHttp2Flash Connection lost, " << offset << " bytes in flash\n";
+  }
+
+  if ( offset < expected_len ) {
+    Serial << "webclient: streamHttp2Flash Download FAILED.\n";
+    return(false);
+  }
+  uint32_t flash_crc = crc32Update(0, dueflashstorage.readAddress(startaddr), expected_len);
+  Serial << "webclient: streamHttp2Flash CRC32 received = 0x" << _HEX(crc) << ", in flash = 0x" << _HEX(flash_crc) 
+         << ", published = 0x" << _HEX(expected_crc) << "\n";
+  if ( (crc != expected_crc) || (flash_crc != expected_crc) ) {
+    Serial << "webclient: streamHttp2Flash CRC MISMATCH!\n";
+    return(false);
+  }
+  Serial << "webclient: streamHttp2Flash Wrote and verified " << expected_len << " bytes in " << (millis() - starttime) << " msec\n";
+  return(true);
+}
+
+
+
 // This function writes contents of an SD file to the SAM DUE's on-chip Flash memory.
 boolean writeFile2Flash(char* filename, int startaddr) {
   boolean rc = false;
@@ -682,6 +774,11 @@ boolean writeFile2Flash(char* filename, int startaddr) {
   if (thefile = SD.open(filename, FILE_READ)) {
     int bytes_remaining = thefile.size();  // compiler allows this, but .size() method used elsewhere caused compiler errors with SdFat
     Serial << "webclient: writeFile2Flash " << filename << " opened for read.\n";
+    if ( (startaddr < CKPT_ADDR) && (startaddr + bytes_remaining > CKPT_ADDR) ) {  // don't overwrite the checkpoint ring or the parm store above it - see checkpoint.h
+      Serial << "webclient: writeFile2Flash " << filename << " is too large! It would overwrite the checkpoint ring at 0x" << _HEX(CKPT_ADDR) << "\n";
+      thefile.close();
+      return(false);
+    }
     while ( thefile.available() ) {
       rcvbuf[bufaddr++] = thefile.read();
       bytes_remaining--;
@@ -743,6 +840,9 @@ boolean ethernetOK() {
   static boolean ethernet_status = false;  // status flag, static!
   static int fail_count = 0;
 
+  // Until runBootStages() has initialized the W5500, there is nothing to test - see boot.ino
+  if ( !ethernet_up ) return(false);
+
   // If Ethernet has failed, force socket disconnection - see socket.cpp
   //   This is a WORKAROUND.
   //   Rarely, the webserver (port 80) gets tied up by mysterious requests coming from 
@@ -18,6 +18,8 @@ void windCfgCmd(WebServer&, WebServer::ConnectionType, char*, bool);
 void parmCmd(WebServer&, WebServer::ConnectionType, char*, bool);
 void statusCmd(WebServer&, WebServer::ConnectionType, char*, bool);
 void modbus1Cmd(WebServer&, WebServer::ConnectionType, char*, bool);
+void eventsCmd(WebServer&, WebServer::ConnectionType, char*, bool);
+void bootCmd(WebServer&, WebServer::ConnectionType, char*, bool);
 
 
 void initServer(){
@@ -28,6 +30,11 @@ void initServer(){
   webserver.setDefaultCommand(&failCmd);               // Default response from webserver if no specific command is given: server:port/<command>
   webserver.setFailureCommand(&failCmd);
   webserver.addCommand("parms.html", &parmCmd);        // Show a web form with controller operating parms
+  webserver.addCommand("events.json", &eventsCmd);     // Return the most recent control events from the journal - see journal.ino
+  webserver.addCommand("boot.json", &bootCmd);         // Return the boot timeline - see boot.ino
+  webserver.addCommand("agg.json", &aggCmd);           // Return the rolling aggregates - see aggregate.ino
+  webserver.addCommand("cap.json", &capCmd);           // List waveform captures, ?trigger = take one - see capture.ino
+  webserver.addCommand("cap.csv", &capFileCmd);        // Download a waveform capture from SD
   // Disable everything else:
   //webserver.addCommand("wave.json", &waveCmd);         // Return waveforms
   //webserver.addCommand("measure.json", &measureCmd);   // Return collected RMS values
@@ -114,6 +121,7 @@ void measureCmd(WebServer &server, WebServer::ConnectionType type, char *url_tai
 void windCfgCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete){
   dbgPrintln(1, "web: doing windConfigCmd");
   server.httpSuccess("Content-Type: text/plain");
+  wind_paused = true;   // keep the stream parser off Serial2 while we read it here - see wind.ino
   Serial2.write(0x1b);  // send escape to knock out of stream mode
   Serial2.println("config");
   while(Serial2.available()){
@@ -122,6 +130,7 @@ void windCfgCmd(WebServer &server, WebServer::ConnectionType type, char *url_tai
     server.write((char)inByte);
   }
   Serial2.println("stream");
+  wind_paused = false;
 }
 
 
@@ -201,18 +210,18 @@ void setvalsCmd(WebServer &server, WebServer::ConnectionType type, char *url_tai
 // This function creates an HTML *form* containing Controller Operating Parameters and handles user-submitted updates to parm vals.
 // Clicking the form's "Submit" button initiates a POST that sends updated parms back to this code which saves parm vals and writes them to SD.
 void parmCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete) {
-  char parmval[40];
+  char parmval[PARM_VAL_LEN];
   int write_col = 0;
 
   // Handle user-updated parms from the Controller Operating Parameters web form.
   if ( type == WebServer::POST ) {
     boolean repeat;         // data available flag
     Parm* theparm;          // pointer to a parm object
-    char key[30], val[32];  // char arrays for parm key (parm name) and val (parm val) pairs
+    char key[30], val[PARM_VAL_LEN];  // char arrays for parm key (parm name) and val (parm val) pairs - see parms.h
     
     Serial << "webserver: parmCmd POST Controller Operating Parameters from submitted form...\n";
     do {
-      repeat = server.readPOSTparam(key, 30, val, 32);    // read a parm into key[30] and val[32] char arrays
+      repeat = server.readPOSTparam(key, 30, val, PARM_VAL_LEN);  // read a parm into key[30] and val[PARM_VAL_LEN] char arrays
       if ( repeat ) {                                     // if we've read a parm...
         if ( theparm = findParm(key) ) {                  //   get pointer to a parm object - see parms.h
           if ( (!strcmp(key, "furl_init_windspeed")) || 
@@ -229,7 +238,7 @@ void parmCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail,
     } while (repeat);
     
     server.httpSeeOther(PREFIX "/parms.html");  // display the updated page
-    writeParms2SD(PARMFILENAME);                // save updated parms to SD
+    writeParms2Flash();                         // save updated parms to flash - see parmstore.ino
     
   } else {  // this is not a POST, so... it's a GET
     
@@ -267,14 +276,17 @@ void parmCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail,
       }
 
       // partition table into parameter groups - see parmdefs.h
-      if ( i==0 ) server << "<tr><td colspan=7 style='text-align:center; background-color:#f0f0f0; font-style:italic'>Turbine control</td></tr><tr>";  // 14 parms, 0-13
-      if ( i==14 ) server << "<tr><td colspan=7 style='text-align:center; background-color:#f0f0f0; font-style:italic'>Network</td></tr><tr>";         // 10 parms, 14-23
-      if ( i==24 ) server << "<tr><td colspan=7 style='text-align:center; background-color:#f0f0f0; font-style:italic'>Diversion load</td></tr><tr>";  // 5 parms, 24-28
-      if ( i==29 ) {
+      // Groups start at these parms, not at fixed indices, so adding a parm doesn't shift the headings
+      char* group = NULL;
+      if ( !strcmp(parmname, "shutdown_state") ) group = "Turbine control";
+      if ( !strcmp(parmname, "ovrd") ) group = "Network";
+      if ( !strcmp(parmname, "hvdl_active") ) group = "Diversion load";
+      if ( !strcmp(parmname, "pv1_disc") ) group = "Local site";
+      if ( group ) {
+        if ( write_col == 1 ) server << "</tr>";  // finish a half-filled row
         write_col = 0;
-        server << "</tr>"; // add </tr> because i is odd
-        server << "<tr><td colspan=7 style='text-align:center; background-color:#f0f0f0; font-style:italic'>Local site</td></tr><tr>";  // 7 parms, 29-35
-      } 
+        server << "<tr><td colspan=7 style='text-align:center; background-color:#f0f0f0; font-style:italic'>" << group << "</td></tr><tr>";
+      }
       
       server << "<td>" << theparmptr->parmEngName() << "</td>";                  // print parm display name
       if ( !strcmp(parmname, "shutdown_state") ) {                               // this parm gets a drop-down selection with *3* options
@@ -294,7 +306,7 @@ void parmCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail,
         server << "</td><td></td>";
      } else {                                                                   // all other parms get a text field then parm units
         server << "<td><input type='text' name='" << theparmptr->parmName()
-               << "' value='" << parmval << "'></td><td>" << theparmptr->parmUnits() << "</td>";
+               << "' value='" << parmval << "' maxlength='" << (PARM_VAL_LEN - 1) << "'></td><td>" << theparmptr->parmUnits() << "</td>";
       }
 
       write_col==0 ? server << "<td>&nbsp&nbsp</td>" : server << "</tr>\n";  // if we're writing to column 0, add empty <td>, otherwise end the row
@@ -385,8 +397,95 @@ void modbus1Cmd(WebServer &server, WebServer::ConnectionType type, char *url_tai
     server << "<H1>Modbus real-time data<\H1>\n";
     server << "<p><ul>\n";
     for (int i = 0; i< NUM_MOD_FAST_CHANNELS; i++) {
-      server << "<li>" << mod_fast_regs[i]->getChanName() << " = " << mod_fast_regs[i]->valStrg() << " " << mod_fast_regs[i]->getUnits() << "\n";
+      ModbusReg* reg = mod_fast_chans[i].reg;
+      server << "<li>" << reg->getChanName() << " = " << reg->valStrg() << " " << reg->getUnits() << "\n";
     }
     server << "</ul></p></body></html>\n";
   }
 }
+
+
+// Return the most recent control events (up to JOURNAL_SIZE), oldest first: [{"time":..., "event":"FURL", ...}, ...]
+// These come from the RAM journal, so they include events that haven't been flushed to SD yet - see journal.ino
+void eventsCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete) {
+  char line[128];
+  server.httpSuccess("Content-Type: application/json");
+  uint32_t head = journal_head;                                      // snapshot
+  uint32_t first = (head > JOURNAL_SIZE) ? head - JOURNAL_SIZE : 0;  // oldest record still in RAM
+  server.printP("[");
+  for (uint32_t i = first; i < head; i++) {
+    if (i > first) server.printP(",\n");
+    formatJournalRecord(line, &journal[i & JOURNAL_MASK]);
+    server << line;
+  }
+  server.printP("]");
+}
+
+
+
+// Respond with the boot timeline as a JSON array, e.g.: [{"stage":"RESET","msec":0,"tries":1},{"stage":"PARMS","msec":103,"tries":1},...]
+void bootCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete) {
+  char line[64];
+  server.httpSuccess("Content-Type: application/json");
+  server.printP("[");
+  for (int i = 0; i < NUM_BOOT_STAGES; i++) {
+    if (i > 0) server.printP(",\n");
+    formatBootStage(line, i);
+    server << line;
+  }
+  server.printP("]");
+}
+
+
+
+// Respond with the rolling aggregates as a JSON object: {"current":[<1m>,<1h>,<1d>],"last":[<1m>,<1h>,<1d>]}
+//   Each is a summary record (see aggregate.ino), or null if there isn't one yet.
+void aggCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete) {
+  server.httpSuccess("Content-Type: application/json");
+  for (int last = 0; last < 2; last++) {
+    server.printP(last ? "],\n\"last\":[" : "{\"current\":[");
+    for (int w = 0; w < AGG_NUM_WINDOWS; w++) {
+      if (w > 0) server.printP(",\n");
+      if (formatAggWindow(w, last)) server << agg_buf;
+      else server.printP("null");
+    }
+  }
+  server.printP("]}");
+}
+
+
+
+// Respond with the waveform capture state and the most recent captures (oldest first) as a JSON object, e.g.:
+//   {"triggers":"FURL,SC","taken":3,"dropped":0,"captures":[{"file":"20220818/12000012","time":1660838400.125,...},...]}
+// With ?trigger, take a capture now (it's listed once it has been saved). Files are downloaded with cap.csv, below.
+void capCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete) {
+  char line[128];
+  if ( !strcmp(url_tail, "trigger") ) triggerCapture(CAP_SRC_MANUAL, 0);
+  server.httpSuccess("Content-Type: application/json");
+  server << "{\"triggers\":\"" << parm_cap_trig.parmVal() << "\",\"taken\":" << cap_count << ",\"dropped\":" << cap_dropped;
+  server.printP(",\"captures\":[");
+  uint32_t first = (cap_index_n > CAP_INDEX_SIZE) ? cap_index_n - CAP_INDEX_SIZE : 0;
+  for (uint32_t i = first; i < cap_index_n; i++) {
+    if (i > first) server.printP(",\n");
+    formatCaptureRecord(line, i);
+    server << line;
+  }
+  server.printP("]}");
+}
+
+
+
+// Respond with a waveform capture file from SD, e.g., <controllerIP>/cap.csv?20220818/12000012
+void capFileCmd(WebServer &server, WebServer::ConnectionType type, char *url_tail, bool tail_complete) {
+  char fname[28];
+  File sdfile;
+  if ( !SD_ok || !getCaptureFileName(fname, url_tail) || !(sdfile = SD.open(fname)) ) {
+    server.httpFail();
+    return;
+  }
+  server.httpSuccess("Content-Type: text/csv");
+  uint8_t buf[256];
+  int n;
+  while ( (n = sdfile.read(buf, sizeof(buf))) > 0 ) server.write(buf, n);
+  sdfile.close();
+}
@@ -1,24 +1,39 @@
 //---------- wind.ino ----------
 // This module is the interface to the wireless Etesian anemometer. 
-// In addition to the processSerialWind() method, it provides methods 
+// In addition to the stream parser (pollSerialWind(), below), it provides methods 
 // that are used to set the calibration of the device.
 
-void initWind(){
-  Serial2.begin(9600);  // Serial2 is the Etesian interface
-  delay(2000);
-  
-  Serial.println("wind: Initializing Etesian");
-  Serial2.write(0x1b);  // ESC
-  Serial2.flush();
-  delay(500);
-  Serial2.write(0x1b);  // ESC
-  Serial2.flush();
-  delay(500);
+// The Etesian needs 2 sec after Serial2 starts, then two ESC's 500 msec apart. Rather than delay() for 3 sec,
+//   initWind() is called repeatedly from loop() and does the next step when its time comes - see runBootStages() in boot.ino
+// Returns true when initialization is complete.
+boolean initWind(){
+  static int step = 0;
+  static unsigned long step_time = 0;  // millis() when the current step started
+
+  if ( step > 0 && (millis() - step_time) < (step == 1 ? 2000UL : 500UL) ) return(false);  // not yet
+  step_time = millis();
+  switch ( step++ ) {
+    case 0:
+      Serial2.begin(9600);  // Serial2 is the Etesian interface
+      return(false);
+    case 1:
+      Serial.println("wind: Initializing Etesian");
+      // fall through
+    case 2:
+      Serial2.write(0x1b);  // ESC
+      Serial2.flush();
+      return(false);
+  }
 
   // Set the Etesian anemometer data format.
   // We tried NMEA first, but for some reason that didn't work or stopped working with new Etesian firmware.
   // Now we just use the default, so we don't have to set it.
   //Serial2.print("NMEA\r\n");
+
+  // Put the Etesian into STREAM mode (as windStreamCmd() in webserver.ino does). From now on the timer interrupt
+  //   reads and parses its data - see pollSerialWind() below.
+  Serial2.println("stream");
+  return(true);
 }
 
 
@@ -56,87 +71,133 @@ void setWindCalScaleOffset(float offset) {
 }
 
 
-// This function is called every iteration of loop() - see wwe.ino.
-// loop() runs at whatever rate it can depending on how much time each timer interrupt cycle requires - see wwe.ino and adc.ino.
+// ETESIAN STREAM PARSER
 //
-// The Etesian is initialized into STREAM mode, sending out data at its own rate, somewhere around 1 per second, if the wind is blowing. 
-// We want to capture data whenever available, setting windspeed_ms and Ta as global vars. 
-// Each time we set these vars, we also save the time... in order to reject non-current data (see below).
-void processSerialWind() {
-  static char linebuf[200];  // do all these need to be static?
-  static char buf[10];
-  static char buf1[10];
-  static int bufptr = 0;
-  static int buf1ptr = 0;
-  static int commacount = 0;
-  static int bytes_read = 0;
+// The Etesian used to be polled from loop(): "T\r\n" once per second, then processSerialWind() parsed whatever had arrived.
+//   Wind speed reached furlctl1() at 1 Hz at best, and a second late.
+// Now the Etesian is left in STREAM mode (see initWind() above), sending a line whenever it has a new reading, and the
+//   lines are assembled and parsed IN THE TIMER INTERRUPT: readADCs() calls pollSerialWind() at 1000 Hz - see adc.ino.
+//   At 9600 baud that's about one char per call. The USART1 interrupt belongs to the Arduino core (it fills Serial2's
+//   receive buffer), so we drain that buffer rather than hooking the UART itself. Either way a reading is published
+//   within ~1 msec of its last char arriving, and gust response is limited by the sensor, not by loop().
+// ***While the parser runs, nothing else may read Serial2*** - see wind_paused and windCfgCmd() in webserver.ino
+//
+// Each line is checked before it's published:
+//   - format: exactly 4 commas, a numeric WS field ending in " mph" and a numeric Ta field
+//     Default string looks like this: 0/0/0,05:01:57,29,6.6 mph,19.3
+//   - plausibility: WS within 0 to WIND_MAX_MPH, Ta within WIND_MIN_TA to WIND_MAX_TA (after the sub-zero fix below)
+//   - REJECT any WS that changes by more than +15 mph from the last WS value (see below)
+// A good line updates windspeed_ms and Ta, and is stamped with its arrival time (wind_reading_msec, wind_reading_time).
+// The result of the last line is in wind_status, and good/bad lines are counted in wind_readings and wind_rejects.
+// Everything here runs in the interrupt, so loop() only READS these vars - see wwe.ino
+
+#define WIND_LINE_LEN 64                  // longest line we'll accept; a normal line is ~30 chars
+#define WIND_MAX_MPH 150                  // anything faster is a bad reading
+#define WIND_MIN_TA (-60*10)              // degF, 10x actual
+#define WIND_MAX_TA (160*10)              // degF, 10x actual
+#define WIND_MAX_JUMP 6867                // +15 mph * 0.44704 (ms/mph) * 1024
+
+// wind_status vals
+#define WIND_OK 0                         // good reading, published
+#define WIND_BAD_FORMAT 1                 // wrong # fields, or a field isn't a number
+#define WIND_IMPLAUSIBLE 2                // WS or Ta out of range
+#define WIND_JUMP 3                       // WS jumped up by more than 15 mph
+
+
+// Parse a decimal number with (at most) one significant decimal place, e.g., "-6.6" --> -66.
+// Returns a pointer to the first char after the number, or NULL if there's no number.
+char* parseTenths(char* p, int* val) {
+  boolean neg = false;
+  int v = 0;
+  boolean digits = false;
+  if ( *p == '-' ) { neg = true; p++; }
+  while ( *p >= '0' && *p <= '9' ) { v = v*10 + (*p++ - '0'); digits = true; }
+  v *= 10;
+  if ( *p == '.' ) {
+    p++;
+    if ( *p >= '0' && *p <= '9' ) { v += *p++ - '0'; digits = true; }
+    while ( *p >= '0' && *p <= '9' ) p++;  // ignore any more decimal places
+  }
+  if ( !digits ) return(NULL);
+  *val = neg ? -v : v;
+  return(p);
+}
+
 
-  //Serial << "wind: processSerialWind() called\n");
-
-  // Read from Serial2 as many characters as there are, and grab the ones that represent WS and Ta
-  // Default string looks like this: 0/0/0,05:01:57,29,6.6 mph,19.3
-  int num_available = Serial2.available(); // find how many chars are available...
-  while (num_available-- > 0) {            // while there are chars available...
-    int inByte = Serial2.read();           //   read one char
-    linebuf[bytes_read++] = inByte;        //   put it in the linebuf[] array
-    
-    if (inByte == 0x2c) {                  //   is char a COMMA?
-      commacount++;                        //     # commas = # fields
-      buf[bufptr] = 0;                     //     null terminate buf (WS) array
-      buf1[buf1ptr] = 0;                   //     null terminate buf1 (Ta) array
-    } else if (commacount == 3) {          //   if we have 3 commas, we've reached the WS field, so...
-      buf[bufptr++] = (char)inByte;        //     copy this char to buf, then increment pointer
-    } else if (commacount == 4) {          //   if we have 4 commas, we've reached the Ta field, so...
-      buf1[buf1ptr++] = (char)inByte;      //     copy this char to buf1, then increment pointer
+// Check a complete line and publish it if it's good. Called from pollSerialWind() ONLY (i.e., in the timer interrupt).
+int parseWindLine(char* line) {
+  char* field[5];
+  int nfields = 1;
+  field[0] = line;
+  for ( char* p = line; *p; p++ ) {
+    if ( *p == ',' ) {
+      if ( nfields == 5 ) return(WIND_BAD_FORMAT);  // too many fields
+      *p = 0;
+      field[nfields++] = p + 1;
+    }
+  }
+  if ( nfields != 5 ) return(WIND_BAD_FORMAT);
+
+  int mph10, Ta10;
+  char* p = parseTenths(field[3], &mph10);         // WS field, e.g., "6.6 mph"
+  if ( p == NULL || strcmp(p, " mph") ) return(WIND_BAD_FORMAT);
+  p = parseTenths(field[4], &Ta10);                // Ta field, e.g., "19.3"
+  if ( p == NULL || *p ) return(WIND_BAD_FORMAT);
+
+  // In sub-zero weather, Ta is displayed (and sent out) as Ta(out) = Ta(sub-zero) + 360. This is fixed here.
+  if ( Ta10 > 200*10 ) Ta10 -= 360*10;             // if Ta > 200F, subtract 360F from raw val
+  if ( mph10 < 0 || mph10 > WIND_MAX_MPH*10 || Ta10 < WIND_MIN_TA || Ta10 > WIND_MAX_TA ) return(WIND_IMPLAUSIBLE);
+
+  int ws = (mph10 * 45777 + 500) / 1000;           // mph (10x actual) --> m/s (1024x actual): 1024 * 0.44704 / 10 = 45.777
+  unsigned long now = millis();
+
+  // REJECT any WS that changes by more than +15 mph from last WS value.
+  // We don't reject a sudden WS decrease (probably to zero) because this may be due to anemometer freezing!
+  // We don't use a median filter because that delays WS (even more than it is already).
+  if ( (ws - windspeed_ms) > WIND_MAX_JUMP ) return(WIND_JUMP);
+
+  // If WS is reported as zero, do exponential decay with time constant = 300s instead.
+  //   exp(-dt/300) ~= 1 - dt/300 for the short dt between readings; integer math, we're in an interrupt.
+  if ( ws == 0 ) {
+    unsigned long dt = now - wind_reading_msec;
+    if ( dt > 300000UL ) dt = 300000UL;
+    ws = windspeed_ms - (int)(((int64_t)windspeed_ms * dt) / 300000);
+  }
+
+  last_windspeed_ms = windspeed_ms;                // save last WS
+  windspeed_ms = ws;
+  Ta = (Ta10 * 1024) / 10;                         // degF, 1024x actual
+  wind_reading_msec = now;
+  wind_reading_time = myunixtime;
+  return(WIND_OK);
+}
+
+
+// Assemble lines from whatever Serial2 chars have arrived. Called from readADCs() at 1000 Hz - see adc.ino
+void pollSerialWind() {
+  static char linebuf[WIND_LINE_LEN + 1];
+  static int bytes_read = 0;
+  static boolean overrun = false;                  // line too long, discard it
+
+  if ( !wind_ok || wind_paused ) return;           // Serial2 is started by runBootStages() - see boot.ino
+
+  int num_available = Serial2.available();
+  while ( num_available-- > 0 ) {
+    int inByte = Serial2.read();
+    if ( inByte == '\r' ) continue;                // lines end in CR/LF
+    if ( inByte != '\n' ) {
+      if ( bytes_read < WIND_LINE_LEN ) linebuf[bytes_read++] = inByte;
+      else overrun = true;
+      continue;
+    }
+    // NEWLINE. There's a second new line char between data lines, i.e., an empty line: ignore it.
+    if ( bytes_read > 0 ) {
+      linebuf[bytes_read] = 0;
+      wind_status = overrun ? WIND_BAD_FORMAT : parseWindLine(linebuf);
+      if ( wind_status == WIND_OK ) wind_readings++;
+      else wind_rejects++;
     }
-    
-    if (inByte == 0x0a) {                  //   is char a NEWLINE?
-      //Serial << "wind: detected newline char\n";
-      buf1[buf1ptr] = 0;                   //     null terminate buf1 (Ta) array
-      if (commacount == 4) {               //     if we've seen 4 commas (there should only be 4!), process the WS chars
-        if (buf[3] == 0x20) {              //       0x20=space between WS # and "mph" could occur after 3 or 4 chars, e.g., 6.7 or 16.7
-          buf[3] = 0;                      //         null terminate a 3-char WS string
-        } else {                           //       otherwise...
-          buf[4] = 0;                      //         null terminate a 4-char WS string
-        }
-        //Serial "wind: " << buf <<" \n";
-
-        // Now we can process the WS and Ta vals...
-        last_windspeed_ms = windspeed_ms;                   // save last WS
-        windspeed_ms = int( atof(buf) * 1024.0 * MPH2MS );  // get new WS, WS in buf --> float --> int (1024x actual), mph --> m/s
-                
-
-        // REJECT any WS that changes by more than +15 mph from last WS value: 15 mph * 0.44704 (ms/mph) * 1024 = 6867
-        // We don't reject a sudden WS decrease (probably to zero) because this may be due to anemometer freezing!
-        // We don't use a median filter because that delays WS (even more than it is already).
-        if ( (windspeed_ms - last_windspeed_ms) > 6867 ) windspeed_ms = last_windspeed_ms;
-
-        // In sub-zero weather, Ta is displayed (and sent out) as Ta(out) = Ta(sub-zero) + 360. This is fixed below.
-        int raw_Ta = 1024 * (int)atof(buf1);                    // Ta string --> float --> int (1024x actual)
-        if (raw_Ta > (1024*200)) raw_Ta = raw_Ta - (1024*360);  // if Ta > 200F, subtract 360F from raw val 
-        Ta = raw_Ta;                                            // save new Ta
-                
-      } // END if commacount == 4
-      
-      linebuf[bytes_read] = 0;  // null terminate linebuf array
-      // Seems there's a second new line char between data lines, causing this Serial statement to repeat with no data
-      //Serial << "wind: linebuf[] = " << linebuf; // linebuf will have CR/LF, so no "\n" needed here
-      
-      bytes_read = 0;          // reset char counter
-      commacount = 0;          // reset comma counter
-      bufptr = 0;              // reset WS (buf) array pointer
-      buf1ptr = 0;             // reset Ta (buf1) array pointer
-    } // END if new line
-    
-  } // END while()
-
-  if ( windspeed_ms == 0 ) {                                  // if WS is reported as zero...
-    windspeed_ms = int( last_windspeed_ms * exp(-1/300.0) );  //   do exponential decay with time constant = 300s
-                                                              //   ***floating point math requires #.0 notation! otherwise (-1/#) = 0 ***
-    last_windspeed_ms = windspeed_ms;                         //   save last WS
+    bytes_read = 0;
+    overrun = false;
   }
-  
-  //Serial << "wind: " << bytes_read << " bytes read\n"; // safety for line buffer overrun
-  if (bytes_read > 200) bytes_read = 0;
 }
-
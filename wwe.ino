@@ -108,7 +108,7 @@
 #include <DueFlashStorage.h>  // ~/Documents/Arduino/libraries/DueFlashStorage-master
 #include <Wire.h>             // C:\Program Files (x86)\Arduino\hardware\arduino\avr\libraries\Wire\src (CORE lib)
 #include <JsonParser.h>       // ~/Documents/Arduino/libraries/ArduinoJson
-#include <OneWire.h>          // ~/Documents/Arduino/libraries/OneWire
+//#include <OneWire.h>        // ~/Documents/Arduino/libraries/OneWire - no longer used, see temperature.h
 
 // The following libs include Ethernet.h:
 // For testing, in this sketch or in the following .h files...
@@ -159,6 +159,7 @@ SdFat SD;            // replace SD functions with SdFat functions
 //#define NOTIMER                                              // turn off main timer
 //#define USE_TEST_VALS                                        // used in various modules for testing
 //#define SHOW_MOTOR_STATUS                                    // used in stepper.h to monitor stepper motor
+//#define ENABLE_BENCH                                         // bench build: time the hot kernels at boot - see bench.ino
 
 #define MSGLVL 2                                             // ***threshold for debug printing*** - see utils.ino
 #define FAST_AD                                              // used below
@@ -185,14 +186,24 @@ SdFat SD;            // replace SD functions with SdFat functions
 #include "parms.h"
 #include "parmdefs.h"  // references MPH2MS and code in parms.h
 #include "pindefs.h"   // references ENABLE_STEPPER
-#include "modbus.h"
+#include "channels.h"  // channel descriptor tables, references ModbusReg (declared) in modbus.h
+#include "modbus.h"    // references channels.h
 #include "temperature.h"
+#include "journal.h"   // control event journal - see journal.ino
+#include "parmstore.h" // flash parm store - see parmstore.ino
+#include "boot.h"      // staged boot - see boot.ino
+#include "supervisor.h"  // ISR heartbeats - see supervisor.ino
+#include "telemetry.h"   // telemetry subscribers - see telemetry.ino
+#include "checkpoint.h"  // runtime state checkpoints - see checkpoint.ino
+#include "timesync.h"    // disciplined program time - see timesync.ino
+#include "filter.h"      // per-channel ADC filter chains - see filter.ino
+#include "phasefault.h"  // fast phase-loss and winding-fault detection - see phasefault.ino
 
 #ifdef ENABLE_STEPPER
 #include "stepper.h"  // local sketch file
 // Instantiate a stepper motor controller:
 StepperMotor motor(TC2,
-              2,
+              MOTOR_TIMER_CH,  // see stepper.h
               MOTOR_STEP_PIN,
               MOTOR_DIR_PIN,
               MOTOR_ENBL_PIN,
@@ -207,15 +218,22 @@ DS18B20 cardtemp(ONE_WIRE_TEMP_PIN);     // create a controller logic board temp
 DS3231RTC realtime_clock = DS3231RTC();  // create a real time clock object
 
 boolean debounced_rs_state = HIGH;       // see debounceRS() in adc.ino
-int dump_load_duty_cycle = 0;            // used in adc.ino and furlctl.ino
+int dump_load_duty_cycle = 0;            // used in adc.ino and furlctl.ino, integer %; see also dump_load_duty_pm in dumpload.ino
 boolean do_post = false;                 // flag set by readADCs in adc.ino
 
-unsigned long rtc_time = 0;              // used in loop() and web.ino
+unsigned long rtc_time = 0;              // used in setup() and timesync.ino
 unsigned long myunixtime;                // ***PROGRAM TIME***
-
-int windspeed_ms = 0;                    // wind speed (m/s, 1024x actual)
-int last_windspeed_ms = 0;               // saved wind speed (m/s, 1024x actual)
-int Ta = 0;                              // anemometer temp (degF, 1024x actual)
+volatile int subsecond_ticks = 0;        // readADCs() ticks into the current (disciplined) second, 0 to SAMPLE_RATE_PER_SEC-1 - see adc.ino, timesync.ino
+
+volatile int windspeed_ms = 0;           // wind speed (m/s, 1024x actual) - set by the Etesian stream parser in the timer interrupt, see wind.ino
+volatile int last_windspeed_ms = 0;      // saved wind speed (m/s, 1024x actual)
+volatile int Ta = 0;                     // anemometer temp (degF, 1024x actual)
+volatile unsigned long wind_reading_msec = 0;  // millis() when the last good Etesian reading arrived
+volatile unsigned long wind_reading_time = 0;  // myunixtime when the last good Etesian reading arrived
+volatile int wind_status = 0;            // result of the last Etesian line, WIND_OK etc. - see wind.ino
+volatile uint32_t wind_readings = 0;     // # good Etesian lines
+volatile uint32_t wind_rejects = 0;      // # Etesian lines rejected
+volatile boolean wind_paused = false;    // set while loop() code talks to the Etesian directly - see windCfgCmd() in webserver.ino
 int Tctl = 0;                            // controller logic board temperature
 int a7_val = 0;                          // VUB72 rectifier thermistor channel - see adc.ino, utils.ino
 int rectifier_temp_int;                  // VUB72 rectifer temperature (1024x actual)
@@ -226,7 +244,9 @@ boolean ledOn = false;                   // used in myHandler() and adc.ino
 int furl_reason_saved = 0;               // saved furl_reason (used for saving a non-zero furl condition)
 int sc_reason_saved = 0;                 // saved sc_reason (used for saving a non-zero SC condition)
 int quiet_time = 0;                      // timer for tail exercise
-boolean weather_furl = false;            // weather furl flag - see webclient.ino, furlctl.ino
+int wind_Wh = 0;                         // cumulative daily wind energy, Wh 1024x actual - see adc.ino
+int total_tail_motion = 0;               // cumulative angular motion of tail, usteps - see furlctl.ino
+boolean weather_furl = false;            // weather furl flag - see weather.ino, furlctl.ino
 
 int shutdown_state = 1; // 0 = normal operation
                         // 1 = 'soft' shutdown (for SYSTEM STARTUP, firmware updates) 
@@ -244,6 +264,8 @@ const unsigned int udp_remote_port_mod_fast = 58329;  // Modbus/RTU "fast" data
 const unsigned int udp_remote_port_mod_slow = 58330;  // Modbus/RTU "slow" data port
 const unsigned int udp_remote_port_config   = 58331;  // Controller configuration data port
 const unsigned int udp_remote_port_nuvation = 58332;  // Modbus/TCP Nuvation data port
+const unsigned int udp_local_port_telemetry = 58333;  // Telemetry SUB/UNSUB messages - see telemetry.ino
+const unsigned int udp_remote_port_aggregate = 58334; // 1-min/1-hour/1-day summary records - see aggregate.ino
 
 // These vars have been used at various times to extract data from fast-running routines like 
 //   furlctl1() - which is being called at 10000 Hz and so CANNOT have Serial print statements!
@@ -293,12 +315,15 @@ float print_predTP;  // float because we want to show 2-digit precision
 // ********** SETUP **********
 // setup() is run ONCE when the controller is powered up or restarted.
 // setup() is followed by loop() which iterates forever.
+// setup() only does what control needs, then starts the timer interrupts. Ethernet, SD, Modbus identity reads, the
+//   Etesian and the first weather check are brought up from loop() by runBootStages() - see boot.ino
 
 void setup() {
 
   // Initialize Serial monitor
+  //   We don't wait for it: the Due's programming port is always ready, and nothing should delay starting control.
   Serial.begin(115200);
-  while (!Serial) {}  // wait for serial monitor to start
+  markBootStage(BOOT_RESET);
 
   Serial << "\n\n\n";
   Serial << "********************\n";
@@ -341,57 +366,35 @@ void setup() {
   // Initialize shorting contactor - see furlctl.ino
   // We startup with the alternator shorted!
   initSC();
-  
-  // Initialize Etesian anemometer - see wind.ino
-  initWind();
-
-  // Initialize Ethernet and timekeeping - see web.ino
-  //   Problems initializing Ethernet + SD went away after replacing the original Ethernet shield with the Ethernet 2 shield.
-  // SETUP NOTE: It may be possible to continue WITHOUT Ethernet, but further testing is required before we allow that.
-  while ( !initWeb() ) {
-    Serial << "wwe: ETHERNET DOWN!\n";
-    delay(15000);
-    Serial << "wwe: Retrying Ethernet...\n";
-  }
 
-  // Initialize SD card - see sdcard.ino
-  //   With the original Ethernet shield, the SD card would NOT initialize following a code update.
-  //   A workaround was implemented with this while() loop, where ejecting then reinserting the SD card works.
-  //   This problem does NOT occur with the Ethernet 2 shield.
-  while ( !(SD_ok = initializeSDCard()) ) {
-    Serial << "wwe: Eject and reinsert SD card.\n";
-    delay(15000);
-  }
-  // If the SD parm file doesn't exist, create it and write current parms to it - see parms.ino
-  if ( SD_ok ) if ( !readSD2Parms(PARMFILENAME) ) writeParms2SD(PARMFILENAME);
+  // Set PROGRAM time from the RTC (I2C, fast), so events are timestamped from the start. NTP adjusts it later - see timesync.ino
+  if ( rtc_time = realtime_clock.get() ) myunixtime = rtc_time;
 
-  // Initialize Modbus/RTU and Modbus/TCP - see modbus.ino
-#ifdef DOMODBUS
-  initModbus();
-#endif
+  // Load parms from the flash parm store - see parmstore.ino
+  //   If there is no valid parm image in flash (e.g., first boot of this firmware), we run on the default parms
+  //   until runBootStages() has read the SD parm file - see boot.ino
+  readFlash2Parms();
+  markBootStage(BOOT_PARMS);
 
-  // Initialize controller board temperature sensor.
-  cardtemp.init(34);
-
-  // Initialize Shutdown State.
-  // Unless we're in SS=2, we initialize into SS=1.
-  // This forces the system operator to deal with SS=2 situations, but it also means that 
-  // setting SS=0 is required to start the turbine. And doing THAT requires that the controller 
-  // web server (Ethernet!) be functional to provide a Controller Operating Parameters web page.
-  if ( parm_shutdown_state.intVal() != 2 ) {
-    parm_shutdown_state.setParmVal("1");
-    shutdown_state = 1;
-  }
-  
-  // Increment controller Restart Count parm.
-  int num_resets = 1 + parm_num_resets.intVal();
-  parm_num_resets.setParmVal(num_resets);
-  Serial << "wwe: Controller restarts = " << num_resets << "\n";
+  // Restore runtime state (daily Wh, tail exercise timer, TP) from the last checkpoint - see checkpoint.ino
+  restoreCheckpoint();
 
-  // Save updated parms to SD.
-  // During setup(), we've possibly changed parm_shutdown_state and DEFINITELY changed parm_num_resets. 
-  if ( SD_ok ) writeParms2SD(PARMFILENAME);
-  printParms();  // see parms.ino
+  // Initialize controller board temperature sensor. Starts the TC3 1-Wire bus timer - see temperature.h
+  cardtemp.init(ONE_WIRE_TEMP_PIN);
+
+  // Initialize Shutdown State: SS=1 unless SS=2 - see boot.ino
+  initShutdownState();
+
+  // Dump load OFF, and set up its PWM (parms are loaded) - see dumpload.ino. MUST be before the timers start.
+  initDumpLoad();
+
+  // Report why we reset and what the ISR supervisor saw last - see supervisor.ino. MUST be before the timers start.
+  checkResetCause();
+
+#ifdef ENABLE_BENCH
+  // Time the hot kernels (DWT cycle counts, to Serial) - see bench.ino. MUST be before the timers start.
+  runBenchmarks();
+#endif
 
   // Start the MAIN TIMER-driven process which calls readADCs() in adc.ino at SAMPLE_RATE_PER_SEC = 10000 Hz (100 usec/sample)
   // Among other tasks, readADCs() runs the stepper motor and manages the dump load.
@@ -417,13 +420,19 @@ void setup() {
   // Initialize a timer-driven interrupt for motor stepping.
   // Timer interrupts run at 2x the rate of the stepper motor clock, so we initialize to 2x the initial stepper clock frequency.
 #ifdef ENABLE_STEPPER
+#ifdef STEPPER_HW_STEP
+  // In hardware step mode the timer generates the STEP pulse on TIOA6 and interrupts once per step, so run it at 1x - see stepper.h
+  startTimer(ID_TC6, TC2, 0, TC6_IRQn, 0, MIN_VELOCITY_INIT);
+  motor.startHWStep();
+#else
   startTimer(ID_TC8, TC2, 2, TC8_IRQn, 0, MIN_VELOCITY_INIT * 2);
 #endif
+#endif
+  markBootStage(BOOT_CONTROL);
 
-
-  // check weather data as we startup, then at intervals in loop()
-  getWeatherData();  // in weather.ino --> calls weather API(s) in webclient.ino
-  Serial << "wwe: weather_furl = " << weather_furl << "\n";
+  // With control running, increment the restart count and commit the parms - see boot.ino
+  //   Without flash parms, this waits until runBootStages() has read the SD parm file.
+  if ( parmstore_ok ) applyBootParms();
 
   
   //while(1);  // DEAD END. Run setup() code above this only.
@@ -448,9 +457,9 @@ void setup() {
 //   Or, at least carve out that code which should be executed precisely on the second... perhaps the Modbus read code?
 
 void loop() {
-  // First things first... reset watchdog every loop() iteration!
+  // First things first... reset watchdog every loop() iteration, but ONLY if the timer interrupts are still running!
   //   ***watchdogSetup() must be UNCOMMENTED ABOVE for watchdog to work***
-  watchdogReset();
+  superviseISRs();  // see supervisor.ino
 
   static int first_loop = true;           // first iteration of loop() flag
   static unsigned int post_counter = 0;   // post iteration counter, 2^32-1 = 4,294,967,295 seconds ~ 136.19 years!
@@ -465,6 +474,21 @@ void loop() {
     Serial << "wwe: Start loop()...\n";
   }
 
+  // Bring up Modbus, Ethernet, SD, Etesian and weather in the background, one step per loop() - see boot.ino
+  runBootStages();
+
+  // Answer Modbus/TCP clients (SCADA) from the last if(do_post) snapshot. Never waits, so it runs every iteration - see modbusserver.ino
+  if ( ethernet_up ) pollModbusServer();
+
+  // Save any triggered waveform capture to SD, a few lines per iteration - see capture.ino
+  serviceCaptures();
+
+  // Recompute the ADC filter chains if parm_adc_filt has changed - see filter.ino
+  updateFilterChains();
+
+  // Poll NTP and discipline program time. Never waits - see timesync.ino
+  serviceTimeSync();
+
 // This is left over from early testing...
 #ifdef USE_TEST_VALS
   getTestInputs();  // see web.ino
@@ -504,19 +528,24 @@ void loop() {
     if (shutdown_state == 1) Serial << "wwe: SHUTDOWN STATE = 1\n";
     if (shutdown_state == 2) Serial << "wwe: SHUTDOWN STATE = 2\n";
 
-    // ***CHECK TIME***
-    // Update myunixtime every SECOND from the RTC (if available)
-    // Although myunixtime is incremented EVERY SECOND by readADCs() - see adc.ino, it may not 'keep up' with real time
-    // due to possible delays in if(do_post){..}, e.g., weather API calls, webserver requests, Modbus timeouts, config requests.
-    if ( rtc_time = realtime_clock.get() ) myunixtime = rtc_time;
+    // ***SAVE PARMS***
+    // Commit any parm change to the flash parm store, e.g., SS2 set by furlctl1() - see parmstore.ino
+    // After a failed commit, wait until parmstore_retry_time, so a bad slot isn't rewritten every second
+    // The SD parm file is a readable copy, refreshed once per hour if anything changed - see parms.ino
+    if ( parms_version != parmstore_version && (long)(myunixtime - parmstore_retry_time) >= 0 ) writeParms2Flash();
+    if ( parms_dirty && SD_ok && ((myunixtime % 3600) == 8) ) writeParms2SD(PARMFILENAME);
+
+    // ***CHECKPOINT RUNTIME STATE*** - see checkpoint.ino
+    if ( (myunixtime % CKPT_INTERVAL_SEC) == 23 ) writeCheckpoint();
 
     // Display UTC and LOCAL time for this post
-    // ***myunixtime is incremented EVERY SECOND by readADCs() - see adc.ino***
+    // ***myunixtime is incremented EVERY SECOND by readADCs(), and kept to NTP by serviceTimeSync() - see timesync.ino***
+    // It is no longer overwritten from the RTC here: that made seconds jump or repeat. The RTC is read only at boot and in holdover.
     time_t t = myunixtime;
     char theyear[] = "yyyy", themonth[] = "mm", theday[] = "dd", thehour[] = "hh", theminute[] = "mm", thesecond[] = "ss";
     sprintf(theyear, "%d", year(t)); sprintf(themonth, "%02d", month(t)); sprintf(theday, "%02d", day(t));
     sprintf(thehour, "%02d", hour(t)); sprintf(theminute, "%02d", minute(t)); sprintf(thesecond, "%02d", second(t));
-    Serial << "wwe: RTC time   = " << theyear << "-" << themonth << "-" << theday << " " << thehour << ":" << theminute << ":" << thesecond << "\n"; 
+    Serial << "wwe: UTC time   = " << theyear << "-" << themonth << "-" << theday << " " << thehour << ":" << theminute << ":" << thesecond << "\n"; 
     
     t += parm_TZ_offset.intVal()*3600;  // add timezone offset
     sprintf(theyear, "%d", year(t)); sprintf(themonth, "%02d", month(t)); sprintf(theday, "%02d", day(t));
@@ -536,7 +565,7 @@ void loop() {
     //   These resettable Ah and kWh counters are reset 00:00 UTC time --> ***does NOT require Ethernet***
     //   We do this here because putting it outside of if(do_post) in free-running loop() could result in multiple executions.
     //   ***The 5 msec delays appear to be necessary.*** One could experiment with shorter delays.
-    if ( (myunixtime % 86400) == 0 ) {
+    if ( modbus_ok && (myunixtime % 86400) == 0 ) {
       Serial << "wwe: RESETTING MORNINGSTAR Ah COUNTERS...\n";
       int result = mppt600.writeSingleCoil(0x0010, 1); delay(5);  // WIND
       Serial << "wwe: mppt600 Ah reset = " << result << "\n";
@@ -570,79 +599,74 @@ void loop() {
         Serial << "wwe: getWeatherData read time = " << (millis() - starttime) << " msec\n";
       }
     }
+    updateWeatherFurl();  // every post, so weather_furl starts at alert onset and clears AT alert expiry - see weather.ino
  
     
+    // ***THRESHOLD RULE STATS***
+    //   Once per hour, print how many times each furl/SC threshold has tripped - see furlctl.ino
+    if ( (myunixtime % 3600) == 7 ) printThresholdStats(2);
+    
     // ***READ DATA***
     Serial << "wwe: READING DATA...\n";
     
-    // READ Modbus/RTU 'fast' data into cache --> ***does NOT require Ethernet***
-    //   Total read time must be < 1 sec! To minimize read time, we do "long reads" to fill 'cache' buffers. 
-    //   The <device>_cache objects are defined in modbus.h and can be accessed much faster than serial single register reads.
-    //   See also code in modbus.ino that sets # regs to be read into the cache, using setNumRegs().
-    //   The delay(5) after each readReg() is REQUIRED to avoid a "Response Timeout" error - see modbus.h
-    //     One could experiment with shorter delays.
-    auto modbustime = millis(); mppt600_cache.readReg(false); delay(5);  // WIND
-    Serial << "wwe: MPPT-600V Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
-
-    modbustime = millis(); mppt30_cache.readReg(false); delay(5);        // PV1
-    Serial << "wwe: MPPT-30 Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
-
-    modbustime = millis(); mppt60_cache.readReg(false); delay(5);        // PV2
-    Serial << "wwe: MPPT-60 Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
-
-    modbustime = millis(); div60_cache.readReg(false); delay(5);         // DIV1
-    Serial << "wwe: TS-60(1) Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
-
-    modbustime = millis(); div2_cache.readReg(false); delay(5);          // DIV2
-    Serial << "wwe: TS-60(2) Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
-
-    /*
-    // Read Modbus/RTU 'slow' data. 
-    //   Will this take too long?
-    if ( (myunixtime % 3600) == 0 ) {  // read Modbus/RTU 'slow' data every hour, on-the-hour
-      mod_starttime = millis();
-      for (int i = 0; i < NUM_MOD_SLOW_CHANNELS; i++) {
-        mod_slow_regs[i]->readReg(false);  // readReg(false) means read directly from the device
+    if ( modbus_ok ) {  // Modbus/RTU is brought up by runBootStages() - see boot.ino
+      // READ Modbus/RTU 'fast' data into cache --> ***does NOT require Ethernet***
+      //   Total read time must be < 1 sec! To minimize read time, we do "long reads" to fill 'cache' buffers. 
+      //   The <device>_cache objects are defined in modbus.h and can be accessed much faster than serial single register reads.
+      //   See also code in modbus.ino that sets # regs to be read into the cache, using setNumRegs().
+      //   The delay(5) after each readReg() is REQUIRED to avoid a "Response Timeout" error - see modbus.h
+      //     One could experiment with shorter delays.
+      auto modbustime = millis(); mppt600_cache.readReg(false); delay(5);  // WIND
+      Serial << "wwe: MPPT-600V Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
+
+      modbustime = millis(); mppt30_cache.readReg(false); delay(5);        // PV1
+      Serial << "wwe: MPPT-30 Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
+
+      modbustime = millis(); mppt60_cache.readReg(false); delay(5);        // PV2
+      Serial << "wwe: MPPT-60 Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
+
+      modbustime = millis(); div60_cache.readReg(false); delay(5);         // DIV1
+      Serial << "wwe: TS-60(1) Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
+
+      modbustime = millis(); div2_cache.readReg(false); delay(5);          // DIV2
+      Serial << "wwe: TS-60(2) Modbus/RTU read time = " << (millis() - modbustime) << " msec\n";
+
+      /*
+      // Read Modbus/RTU 'slow' data. 
+      //   Will this take too long?
+      if ( (myunixtime % 3600) == 0 ) {  // read Modbus/RTU 'slow' data every hour, on-the-hour
+        mod_starttime = millis();
+        for (int i = 0; i < NUM_MOD_SLOW_CHANNELS; i++) {
+          mod_slow_chans[i].reg->readReg(false);  // readReg(false) means read directly from the device
+        }
+        Serial << "wwe: Modbus/RTU 'slow' read time = " << (millis() - mod_starttime) << " msec\n";
       }
-      Serial << "wwe: Modbus/RTU 'slow' read time = " << (millis() - mod_starttime) << " msec\n";
-    }
-    */
-
-    // READ Modbus data from cache --> ***does NOT require Ethernet***
-    for (int i = 0; i < NUM_MOD_FAST_CHANNELS; i++) {
-      //
-      // This if() is a HACK to skip over a few 'slow' regs that we've put (for now) in the mod_fast_regs[] array for convenience.
-      // Specifically, the HVD and HVR regs of the PV controllers. We have to do this because they're NOT in the long read (cache) buffers!
-      char* fast_chan_ptr = mod_fast_regs[i]->getChanName();
-      if ( !strcmp(fast_chan_ptr, mppt60_EV_hvd.getChanName()) ||  // strcmp() returns 0 if strings match, so !strcmp() will ==1 if there's a match
-           !strcmp(fast_chan_ptr, mppt60_EV_hvr.getChanName()) ||
-           !strcmp(fast_chan_ptr, mppt30_EV_hvd.getChanName()) ||
-           !strcmp(fast_chan_ptr, mppt30_EV_hvr.getChanName()) ) {
-        //Serial << "wwe: STRING MATCH FOUND\n";  // for debug
-        continue;  // continue loop at the next value of i, skipping over the line below which reads from cache
+      */
+
+      // READ Modbus data from cache --> ***does NOT require Ethernet***
+      for (int i = 0; i < NUM_MOD_FAST_CHANNELS; i++) {
+        // Skip over a few 'slow' regs that we've put (for now) in mod_fast_chans[] for convenience.
+        // Specifically, the HVD and HVR regs of the PV controllers. We have to do this because they're NOT in the long read (cache) buffers!
+        if ( mod_fast_chans[i].flags & CH_NOT_CACHED ) continue;
+        // mod_fast_chans[] is a table of POINTERS to regs that we're reading every second - see modbus.h
+        mod_fast_chans[i].reg->readReg(true);  // true --> read cached regs found at getResponseBuffer(response_buffer_offset)
+                                               // associated with a particular mod_dev_ptr or mod_dev_ptr_tcp (see modbus.h).
       }
-      // mod_fast_regs[] is an array of POINTERS to regs that we're reading every second - see modbus.h
-      mod_fast_regs[i]->readReg(true);  // true --> read cached regs found at getResponseBuffer(response_buffer_offset)
-                                        // associated with a particular mod_dev_ptr or mod_dev_ptr_tcp (see modbus.h).
-      //Serial << getModchannelName(1, i) << ": " << getModchannelValue(1, i) << "\n";
     }
 
-    // READ Etesian anemometer data --> ***does NOT require Ethernet***
-    // If Serial2.print("T\r\n"); is put into processSerialWind(), if (do_post) slows down dramatically! (about 4 sec/iteration). WHY???
-    //   Regardless, putting the Serial2 data request here fixes the problem.
-    //   TEST: If we move the data request and processSerialWind() out of if(do_post), but within loop(), we seem to get
-    //         finer-grained data (artifactual?), but we also get watchdog resets varying from seconds to minutes! WHY???
-    auto wind_starttime = micros();
-    Serial2.print("T\r\n");             // request a single line of anemometer data
-    processSerialWind();                // process new anemometer data (if any) - see wind.ino
-    Serial.print("wwe: Etesian wind data read time = ");
-    Serial.print( ((float)(micros() - wind_starttime)/1000.), 3);
-    Serial.println(" msec");
+    // Etesian anemometer data --> ***does NOT require Ethernet***
+    // The Etesian runs in STREAM mode, and its lines are parsed in the timer interrupt as they arrive - see pollSerialWind() in wind.ino
+    //   We no longer poll it with "T\r\n" here. Just report how it's doing.
+    if ( wind_ok ) {                      // Serial2 is started by runBootStages() - see boot.ino
+      Serial << "wwe: Etesian readings = " << wind_readings << ", rejects = " << wind_rejects
+             << ", last status = " << wind_status << ", age = " << (millis() - wind_reading_msec) << " msec\n";
+    }
 
     // READ controller board temperature --> ***does NOT require Ethernet***
-    Tctl = cardtemp.readTemp()*1024;    // controller board temp
+    Tctl = cardtemp.readTemp()*1024;    // controller board temp, from the last background 1-Wire read - never waits
     cardtemp.convert();                 // convert() is AFTER readTemp() because a 1-sec-ish delay is required BEFORE readTemp()
                                         // - see temperature.h. Because if(do_post){...} runs at 1 Hz, it provides this delay.
+                                        // The 1-Wire transfers run in the TC3 interrupt - see TC3_Handler() below.
     //Serial << "wwe: Tc = " << Tctl << " degC (1024x actual)\n";
 
     // READ rectifier board temperature --> ***does NOT require Ethernet***
@@ -654,8 +678,7 @@ void loop() {
     if ( ethernetOK() ) {
       auto tcp_starttime = millis();
       for (int i = 0; i < NUM_MOD_NUV_CHANNELS; i++) {
-        mod_nuv_regs[i]->readReg(false);  // false --> read directly from the device (Nuvation is quite fast)
-        //Serial << getModchannelName(3, i) << ": " << getModchannelValue(3, i) << "\n";
+        mod_nuv_chans[i].reg->readReg(false);  // false --> read directly from the device (Nuvation is quite fast)
       }
       // If this times out, the total read time will be ~24 sec = 8 * 3000 ms.
       // 3000 ms is hard-coded in ModbusTCP.cpp. Change this?
@@ -663,6 +686,13 @@ void loop() {
     }
 
 
+    // ***UPDATE MODBUS/TCP SERVER SNAPSHOT*** --> all reads are done, so this is this second's data - see modbusserver.ino
+    updateModbusServerSnapshot();
+
+    // ***ROLLING AGGREGATES*** --> summary records to SD and the Data Server when a 1-min/1-hour/1-day window ends - see aggregate.ino
+    updateAggregates();
+
+
     // ***WRITE DATA TO SD***
     Serial << "wwe: WRITING DATA...\n";
     
@@ -673,6 +703,11 @@ void loop() {
     writeDataToSD(control_fname, 0);  // 0 = controller data, see sdcard.ino
     Serial << "wwe: SD write time (Controller data) = " << millis() - sd_starttime << " msec\n";
 
+    // WRITE control event journal to SD. ***does NOT require Ethernet***
+    char journal_fname[] = "yyyymmdd.evt";
+    sprintf( journal_fname, "%s%s%s.evt", theyear, themonth, theday );
+    flushJournal2SD(journal_fname);   // see journal.ino
+
     // COMMENTED OUT these SD writes because they may cause if (do_post) to exceed 1 second (2022-02-25)
     //   We'll monitor if(do_post) timing to see if we can allow one or more of them.
     //   The controller data are most important, so having it saved on SD is useful if Ethernet fails.
@@ -710,38 +745,30 @@ void loop() {
         
       //sendUDPWorkaround();  // Is this necessary with Ethernet Shield 2? - see web.ino
 
-      // Send UDP data to the Data Server.
-      //   Program flow: sendDataUDP() --> printPOSTBody() --> printOrCount(). See web.ino and webclient.ino
-      sendDataUDP(parm_udp_ip.parmVal(), udp_remote_port, 0);             // port = 58328, 0 = Controller data
- 
-      sendDataUDP(parm_udp_ip.parmVal(), udp_remote_port_mod_fast, 1);    // port = 58329, 1 = Modbus/RTU 'fast' data
-
-      if ( (myunixtime % 3600) == 0 ) {                                   // Every hour, on-the-hour...
-        sendDataUDP(parm_udp_ip.parmVal(), udp_remote_port_mod_slow, 2);  // port = 58330, 2 = Modbus/RTU 'slow' data
-      }
-
-      sendDataUDP(parm_udp_ip.parmVal(), udp_remote_port_nuvation, 3);    // port = 58332, 3 = Modbus/TCP nuvation data
+      // Send UDP data to the Data Server and any other subscribers.
+      //   The Data Server (parm_udp_ip) gets, as always: port 58328 = Controller data, 58329 = Modbus/RTU 'fast' data,
+      //   58330 = Modbus/RTU 'slow' data (every hour, on-the-hour), 58332 = Modbus/TCP nuvation data
+      //   Program flow: sendTelemetry() --> printPOSTBody() --> printOrCount(). See telemetry.ino and webclient.ino
+      checkTelemetrySubscribe();  // SUB/UNSUB messages - see telemetry.ino
+      sendTelemetry();
 
       // Send a CONFIG REQUEST to the Data Server.
       //   A python script, cfgudp.py, on the Data Server compares the controller config (aka controller operating parameters) 
       //   to the server's version of the same. The script EXCLUDES some parms from comparison, e.g., Shutdown State and HVDL Active.
-      if ( (myunixtime % (60*parm_cfg_minutes.intVal())) == 0 ) {  // every parm_cfg_minutes...
-
+      //   Normally only a digest of the parms is sent; the server asks for the full set if it needs it - see web.ino
+      //   The MAC is needed to access the controller's unique MAC-coded config file on the Data Server
+      if ( ((myunixtime % (60*parm_cfg_minutes.intVal())) == 0) || configRequestDue() ) {  // every parm_cfg_minutes...
         Serial << "wwe: Checking for update to controller operating parameters...\n";
-        writeParms2Buff(true);  // write current controller parms to jsonbuf; true --> include controller MAC
-                                // The MAC is needed to access the controller's unique MAC-coded config file on the Data Server
-        //printJSONBuf();  // print contents of jsonbuf, see parms.ino
-          
-        int config_rc = sendConfigUDP( parm_udp_ip.parmVal() );  // send config request - see web.ino
+        sendConfigUDP( parm_udp_ip.parmVal() );  // send config request - see web.ino
+      }
 
+      // Handle the reply to a config request, if one has arrived since the last POST - see web.ino
+      int config_rc = checkConfigUDP();
+      if ( config_rc ) {
         // If return code bit 0 == 1 ... update parms
         if ( config_rc & 1 ) {
-          Serial << "wwe: Updated parms found on Data Server. Writing new parms to SD.\n";  
-          if ( SD_ok ) {                  //   if SD card is OK...
-            writeParms2SD(PARMFILENAME);  //     write updated parms to SD
-          } else {
-            Serial << "wwe: SD is not OK! Unable to write updated parms to SD.\n";
-          }
+          Serial << "wwe: Updated parms found on Data Server. Writing new parms to flash.\n";  
+          writeParms2Flash();  // see parmstore.ino; the SD copy is refreshed hourly
         }
         // If return code bit 1 == 1 ... ***UPDATE FIRMWARE***
         //   PROGRAM FLOW:
@@ -749,27 +776,23 @@ void loop() {
         //     2. updatefw.bin runs, loads new firmware (from Update Server) into flash and reboots --> 
         //     3. new firmware runs
         if ( config_rc & 2 ) {
-          if ( SD_ok ) {
-            Serial << "\n\n\n";
-            Serial << "wwe: ---------------\n";
-            Serial << "wwe: FIRMWARE UPDATE\n";
-            Serial << "wwe: ---------------\n";
-            Serial << "wwe: Setting Shutdown State = 1...\n";
-            parm_shutdown_state.setParmVal("1");
-            shutdown_state = 1;
-            Serial << "wwe: Waiting 30 seconds for shutdown to complete...\n";
-            delay(30000);
-            Serial << "wwe: Disabling controller ADC...\n";  // ???necessary???
-            disable_adc = true;
-            doFWUpdate();
-            // ***DEAD END***
-          } else {
-            Serial << "wwe: SD is not OK! Unable to update firmware.\n";
-            Serial << "wwe: SD is *required* for remote firmware update.\n";
-            Serial << "wwe: Manually upload and run SdInfo to check SD.\n";
-          }
+          Serial << "\n\n\n";
+          Serial << "wwe: ---------------\n";
+          Serial << "wwe: FIRMWARE UPDATE\n";
+          Serial << "wwe: ---------------\n";
+          Serial << "wwe: Setting Shutdown State = 1...\n";
+          parm_shutdown_state.setParmVal("1");
+          shutdown_state = 1;
+          Serial << "wwe: Waiting 30 seconds for shutdown to complete...\n";
+          delay(30000);
+          Serial << "wwe: Disabling controller ADC...\n";  // ???necessary???
+          disable_adc = true;
+          doFWUpdate();
+          // ***DEAD END*** unless updatefw.bin could not be loaded, in which case we carry on (in SS1)
+          Serial << "wwe: Re-enabling controller ADC...\n";
+          disable_adc = false;
         }  // END do firmware update
-      }  // END send config request
+      }  // END handle config reply
     } // END if ( ethernetOK() ) { <post data> }
 
     // loop() will typically execute several 1000 iterations while if(do_post){...} is false.
@@ -846,23 +869,32 @@ void startTimer(uint32_t id, Tc *tc, uint32_t channel, IRQn_Type irq,
 //   contains a parameter "binary_filename" that specifies the name of a new firmware binary file.
 //   This file is downloaded, verified, put it into flash memory ***Bank 0*** at address 0x80000 
 //   (the usual location for Arduino code), and executed.
+// Returns false (rather than rebooting) if updatefw.bin could not be loaded.
 boolean doFWUpdate() {
   char cfg_addr[20];  // Update Server IP address string, e.g., "192.168.1.4"
   uint16_t cfg_port;  // Update Server port, e.g., 80 or 49152
+  boolean loaded;     // updatefw.bin is in flash and verified
   
   strcpy(cfg_addr, parm_cfg_ip.parmVal());  // get Update Server IP address from its parm
   cfg_port = parm_cfg_port.intVal();        // get Update Server port from its parm
 
-  // get file at BOOTLOADER_PATH and write to SD file SD_FILENAME - see webclient.ino
-  if ( getHttp2File(cfg_addr, cfg_port, BOOTLOADER_PATH, SD_FILENAME) ) {
-
-    // NOTE: See the change to library file DueFlashStorage.h to allow an ABSOLUTE flash memory address, 
-    // e.g., 0x80000 or 0xC0000. The default was an address RELATIVE to IFLASH1_ADDR = 0xC0000.
-    //showNFlashBytes(40, 0xC0000);  // for DEBUG, before write to flash
-    Serial << "wwe: Writing " << SD_FILENAME << " to Arduino flash at 0xC0000...\n";
-    writeFile2Flash(SD_FILENAME, 0xC0000);  // write "updatefw.bin" from SD to Arduino flash at 0xC0000.
-    //showNFlashBytes(40, 0xC0000);  // for DEBUG, after write to flash
+  // Stream the file at BOOTLOADER_PATH straight into flash at 0xC0000, up to the checkpoint ring - see checkpoint.h, webclient.ino
+  // NOTE: See the change to library file DueFlashStorage.h to allow an ABSOLUTE flash memory address, 
+  // e.g., 0x80000 or 0xC0000. The default was an address RELATIVE to IFLASH1_ADDR = 0xC0000.
+  //showNFlashBytes(40, 0xC0000);  // for DEBUG, before write to flash
+  loaded = streamHttp2Flash(cfg_addr, cfg_port, BOOTLOADER_PATH, 0xC0000, CKPT_ADDR - 0xC0000);
+
+  // If that fails (e.g., the server doesn't publish a .crc32 for it), fall back to the SD path:
+  //   get file at BOOTLOADER_PATH and write to SD file SD_FILENAME, then copy it to flash - see webclient.ino
+  if ( !loaded && SD_ok ) {
+    if ( getHttp2File(cfg_addr, cfg_port, BOOTLOADER_PATH, SD_FILENAME) ) {
+      Serial << "wwe: Writing " << SD_FILENAME << " to Arduino flash at 0xC0000...\n";
+      loaded = writeFile2Flash(SD_FILENAME, 0xC0000);  // write "updatefw.bin" from SD to Arduino flash at 0xC0000.
+    }
+  }
+  //showNFlashBytes(40, 0xC0000);  // for DEBUG, after write to flash
 
+  if ( loaded ) {
     Serial << "wwe: GPNVM Security Bit (bit 0):      0 = unset, 1 = set\n";
     Serial << "wwe: GPNVM Boot Mode (bit 1):         0 = boot from ROM, 1 = boot from FLASH\n";
     Serial << "wwe: GPNVM Flash Boot Region (bit 2): 0 = FLASH0, 1 = FLASH1\n";
@@ -873,6 +905,7 @@ boolean doFWUpdate() {
     __enable_irq();
     Serial << "wwe: GPNVM bits = 0b" << _BIN(getGPNVMBits(EFC0)) << "\n";
     
+    writeCheckpoint();  // so the daily Wh etc. carry over into the new firmware - see checkpoint.ino
     Serial << "wwe: REBOOTING...\n";
     Serial.flush();
 
@@ -897,6 +930,8 @@ boolean doFWUpdate() {
     //digitalWrite(51, LOW);
     //binary_exec((void*)0);
   }
+  Serial << "wwe: Unable to load " << SD_FILENAME << ". Firmware NOT updated.\n";
+  return(false);
 }
 
 
@@ -912,7 +947,21 @@ void TC0_Handler() {
 #endif
 
 
+// This is an interrupt service routine called by the 1-Wire bus timer, once per edge of each 1-Wire slot - see temperature.h
+void TC3_Handler() {
+  TC_GetStatus(TC1, 0);  // reading status clears the interrupt
+  cardtemp.handleBusInterrupt();
+}
+
+
 #ifdef ENABLE_STEPPER
+#ifdef STEPPER_HW_STEP
+// This is an interrupt service routine called by motor timer, once per step, in hardware step mode.
+void TC6_Handler() {
+  TC_GetStatus(TC2, 0);  // reading status clears the interrupt
+  motor.handleMotorInterrupt();
+}
+#else
 // This is an interrupt service routine called by motor timer.
 void TC8_Handler() {
   // Don't know why following is necessary, but it doesn't work without it!
@@ -920,3 +969,4 @@ void TC8_Handler() {
   motor.handleMotorInterrupt();
 }
 #endif
+#endif